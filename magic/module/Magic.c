@@ -7,6 +7,13 @@
 
 #include <magic.h>
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define MAGIC_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <ruby.h>
 #include "ruby_compat.h"
 
@@ -22,11 +29,51 @@ static VALUE str_to_sym( const char * str ) {
 /* ---------------------------------------------------------------------- */
 /* Magic Module */
 
+#ifdef MAGIC_USE_MMAP
+/* File : map file read-only from the current IO position and pass the
+ * mapping to magic. Returns 0 if the IO cannot be mapped. */
+static int magic_for_mapped_io( magic_t magic, VALUE target, int fd,
+				const char ** result ) {
+	struct stat st;
+	off_t pos, map_off;
+	long page_sz = sysconf(_SC_PAGESIZE);
+	size_t map_len;
+	void * base;
+
+	pos = (off_t) NUM2OFFT(rb_funcall(target, rb_intern("pos"), 0));
+	if ( fstat(fd, &st) || ! S_ISREG(st.st_mode) || st.st_size <= pos ) {
+		return 0;
+	}
+
+	map_off = pos - (pos % (page_sz > 0 ? page_sz : 4096));
+	map_len = (size_t) (st.st_size - map_off);
+	base = mmap( NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_off );
+	if ( base == MAP_FAILED ) {
+		return 0;
+	}
+
+	rb_thread_schedule();
+	*result = magic_buffer( magic, (char *) base + (pos - map_off),
+				(size_t) (st.st_size - pos) );
+
+	munmap( base, map_len );
+	return 1;
+}
+#endif
+
 static const char * magic_for_io( magic_t magic, VALUE target ) {
-	/* File : pass file descr to magic */
-	/* NOTE: this closes the file descriptor! very bad! */
 	int fd = NUM2INT(rb_funcall(target, idFileNo, 0));
+#ifdef MAGIC_USE_MMAP
+	const char * result = NULL;
 
+	/* regular files are examined in place, leaving the descriptor open */
+	if ( magic_for_mapped_io( magic, target, fd, &result ) ) {
+		return result;
+	}
+#endif
+
+	/* File : pass file descr to magic */
+	/* NOTE: this closes the file descriptor! very bad! */
 	rb_thread_schedule();
 	return magic_descriptor( magic, fd );
 }
@@ -12,5 +12,8 @@ elsif RUBY_VERSION =~ /1.9/ then
         $CPPFLAGS += " -DRUBY_19"
 end
 
+# Memory-mapped File targets
+have_header('sys/mman.h') and have_func('mmap', 'sys/mman.h')
+
 create_makefile('MagicExt')
 
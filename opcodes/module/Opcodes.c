@@ -8,6 +8,13 @@
 #include <dis-asm.h>
 #include <ruby.h>
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define OPCODES_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "ruby_compat.h"
 
 #include "Opcodes.h"
@@ -197,8 +204,60 @@ struct disasm_target {
 	asymbol * sym;
 	bfd * abfd;
 	unsigned int ruby_manages_buf;
+	void * map_base;	/* mmap()ed file, if any */
+	size_t map_len;
 };
 
+#ifdef OPCODES_USE_MMAP
+/* map a File read-only from its current position to the end, and position
+ * the IO at EOF as IO#read would. Returns 0 if the IO cannot be mapped. */
+static int map_io_target( VALUE io, struct disasm_target * dest ) {
+	struct stat st;
+	off_t pos, map_off, len;
+	long page_sz = sysconf(_SC_PAGESIZE);
+	void * base;
+	int fd;
+
+	if (! rb_respond_to(io, rb_intern("fileno")) ) {
+		return 0;
+	}
+
+	fd = NUM2INT(rb_funcall(io, rb_intern("fileno"), 0));
+	pos = (off_t) NUM2OFFT(rb_funcall(io, rb_intern("pos"), 0));
+
+	if ( fstat(fd, &st) || ! S_ISREG(st.st_mode) || st.st_size <= pos ) {
+		return 0;
+	}
+
+	map_off = pos - (pos % (page_sz > 0 ? page_sz : 4096));
+	base = mmap( NULL, (size_t) (st.st_size - map_off), PROT_READ, 
+		     MAP_PRIVATE, fd, map_off );
+	if ( base == MAP_FAILED ) {
+		return 0;
+	}
+
+#ifdef MADV_SEQUENTIAL
+	madvise( base, (size_t) (st.st_size - map_off), MADV_SEQUENTIAL );
+#endif
+
+	/* buf_len is an unsigned int: larger files are truncated */
+	len = st.st_size - pos;
+	if ( len > (off_t) 0xFFFFFFFFU ) {
+		len = (off_t) 0xFFFFFFFFU;
+	}
+
+	dest->map_base = base;
+	dest->map_len = (size_t) (st.st_size - map_off);
+	dest->buf = (unsigned char *) base + (pos - map_off);
+	dest->buf_len = (unsigned int) len;
+	dest->ruby_manages_buf = 1;
+
+	rb_funcall(io, rb_intern("pos="), 1, OFFT2NUM(st.st_size));
+
+	return 1;
+}
+#endif
+
 /* fill disassemble_info struct based on contents of target struct */
 static void config_libopcodes_for_target( struct disassemble_info * info, 
 					  struct disasm_target * tgt ) {
@@ -267,7 +326,13 @@ static void load_target( VALUE tgt, struct disasm_target * dest ) {
 
 	} else if ( Qtrue == rb_obj_is_kind_of( tgt, rb_cIO) ) {
 		/* IO (file) object */
-		VALUE str = rb_funcall( tgt, rb_intern("read"), 0 );
+		VALUE str;
+#ifdef OPCODES_USE_MMAP
+		if ( map_io_target( tgt, dest ) ) {
+			return;
+		}
+#endif
+		str = rb_funcall( tgt, rb_intern("read"), 0 );
 		dest->buf = (unsigned char*) RSTRING_PTR(str);
 		dest->buf_len = RSTRING_LEN(str);
 		dest->ruby_manages_buf = 1;
@@ -306,6 +371,13 @@ static void unload_target( struct disasm_target * tgt ) {
 	if ( tgt->buf && ! tgt->ruby_manages_buf ) {
 		free(tgt->buf);
 	}
+
+#ifdef OPCODES_USE_MMAP
+	if ( tgt->map_base ) {
+		munmap( tgt->map_base, tgt->map_len );
+		tgt->map_base = NULL;
+	}
+#endif
 }
 
 /* shared code for loading a target, configuring libopcodes, and getting
@@ -337,45 +409,58 @@ static void disasm_init( struct disassemble_info * info,
 	}
 }
 
-/* disassemble a single instruction */
-static VALUE cls_disasm_single(VALUE class, VALUE tgt, VALUE hash) {
+/* arguments of a disassembly call. The target is unloaded by an ensure
+ * handler, as the options or the output may raise. */
+struct DISASM_CALL {
 	struct disassemble_info * info;
 	struct disasm_target target;
-	bfd_vma vma;
-	VALUE result;
+	VALUE class;
+	VALUE tgt;
+	VALUE hash;
+};
 
-	Data_Get_Struct(class, struct disassemble_info, info);
-	if (! info ) {
+static void disasm_call_init( struct DISASM_CALL * call, VALUE class, 
+			      VALUE tgt, VALUE hash ) {
+	Data_Get_Struct(class, struct disassemble_info, call->info);
+	if (! call->info ) {
 		rb_raise( rb_eRuntimeError, "Invalid disassemble_info" );
 	}
 
-	disasm_init( info, &target, &vma, class, tgt, hash );
+	memset( &call->target, 0, sizeof(call->target) );
+	call->class = class;
+	call->tgt = tgt;
+	call->hash = hash;
+}
 
-	result = disasm_insn( info, vma, NULL );
+static VALUE disasm_call_done( VALUE arg ) {
+	struct DISASM_CALL * call = (struct DISASM_CALL *) arg;
+	unload_target( &call->target );
+	return Qnil;
+}
 
-	unload_target(&target);
+static VALUE disasm_single( VALUE arg ) {
+	struct DISASM_CALL * call = (struct DISASM_CALL *) arg;
+	bfd_vma vma;
 
-	return result;
+	disasm_init( call->info, &call->target, &vma, call->class, call->tgt,
+		     call->hash );
+
+	return disasm_insn( call->info, vma, NULL );
 }
 
-/* disassemble a buffer */
-static VALUE cls_disasm_dis(VALUE class, VALUE tgt, VALUE hash) {
-	struct disassemble_info * info;
-	struct disasm_target target;
+static VALUE disasm_dis( VALUE arg ) {
+	struct DISASM_CALL * call = (struct DISASM_CALL *) arg;
+	struct disassemble_info * info = call->info;
 	unsigned int pos, length; 
 	bfd_vma vma;
-	VALUE ary;
-
-	Data_Get_Struct(class, struct disassemble_info, info);
-	if (! info ) {
-		rb_raise( rb_eRuntimeError, "Invalid disassemble_info" );
-	}
+	VALUE ary, var;
 
-	disasm_init( info, &target, &vma, class, tgt, hash );
+	disasm_init( info, &call->target, &vma, call->class, call->tgt,
+		     call->hash );
 
 	/* length to disassemble to */
-	length = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_LENGTH), Qnil);
-	length = (length == Qnil) ? info->buffer_length : NUM2UINT(length);
+	var = rb_hash_lookup2(call->hash, str_to_sym(DIS_ARG_LENGTH), Qnil);
+	length = (var == Qnil) ? info->buffer_length : NUM2UINT(var);
 
 	/* number of bytes disassembled */
 	ary = rb_ary_new();
@@ -384,11 +469,27 @@ static VALUE cls_disasm_dis(VALUE class, VALUE tgt, VALUE hash) {
 		rb_ary_push(ary, disasm_insn( info, vma + pos, &pos ));
 	}
 
-	unload_target(&target);
-
 	return ary;
 }
 
+/* disassemble a single instruction */
+static VALUE cls_disasm_single(VALUE class, VALUE tgt, VALUE hash) {
+	struct DISASM_CALL call;
+
+	disasm_call_init( &call, class, tgt, hash );
+	return rb_ensure( disasm_single, (VALUE) &call, disasm_call_done, 
+			  (VALUE) &call );
+}
+
+/* disassemble a buffer */
+static VALUE cls_disasm_dis(VALUE class, VALUE tgt, VALUE hash) {
+	struct DISASM_CALL call;
+
+	disasm_call_init( &call, class, tgt, hash );
+	return rb_ensure( disasm_dis, (VALUE) &call, disasm_call_done, 
+			  (VALUE) &call );
+}
+
 /* return an array of supported architectures */
 static VALUE cls_disasm_arch(VALUE class) {
 	VALUE ary = rb_ary_new();
@@ -32,6 +32,9 @@ The args parameter is a Hash which can contain any of the following members:
 
   arch:: The architecture to disassemble for. Use <i>arhcitectures</i> to
          determine supported architectures.
+
+  cache_dir:: Directory in which to cache disassembly results. See
+              <i>cache_dir</i>.
 =end
 
   def self.new(args={})
@@ -50,6 +53,68 @@ See ext_disasm.
       ext_disassemble(target, args, &block)
     end
 
+=begin rdoc
+Disassemble a target, yielding each instruction without storing it. Memory
+use does not grow with the size of the target. Returns an Enumerator if no
+block is given. See ext_each_instruction.
+=end
+    def each_instruction( target, args={}, &block ) # :yields: instruction
+      return enum_for(:each_instruction, target, args) if not block_given?
+      ext_each_instruction(target, args, &block)
+    end
+
+=begin rdoc
+Disassemble each item in <i>items</i> in a single call. Returns an Array
+containing a Disassembly for each item, or one Disassembly for all items
+if args[:combined] is true. See ext_disassemble_batch.
+=end
+    def disassemble_batch( items, args={}, &block ) # :yields: instruction
+      ext_disassemble_batch(items, args, &block)
+    end
+
+=begin rdoc
+Update <i>output</i>, produced by disassemble(<i>target</i>, <i>args</i>),
+after the bytes in <i>changes</i> have been modified. Returns
+<i>output</i>. See ext_redisassemble.
+=end
+    def redisassemble( target, output, changes, args={}, &block )
+      ext_redisassemble(target, output, changes, args, &block)
+    end
+
+=begin rdoc
+Count the instructions in a target by mnemonic, category and ISA subset,
+without creating Instruction objects. See ext_statistics.
+=end
+    def statistics( target, args={} )
+      ext_statistics(target, args)
+    end
+
+=begin rdoc
+Find the ROP/JOP gadgets in the code of a target. Returns an Array of
+Gadget objects. See ext_gadgets.
+=end
+    def gadgets( target, args={} )
+      ext_gadgets(target, args)
+    end
+
+=begin rdoc
+Prepare a Session which disassembles <i>target</i> with <i>args</i>. The
+arguments are parsed and the target loaded once, so repeated runs of the
+Session avoid the setup done by each call to disassemble(). If a block is
+given, the Session is yielded to it and closed afterwards.
+See ext_prepare.
+=end
+    def prepare( target, args={} ) # :yields: session
+      sess = ext_prepare(target, args)
+      return sess if not block_given?
+
+      begin
+        yield sess
+      ensure
+        sess.close
+      end
+    end
+
 =begin rdoc
 Convenience method for invoking disassemble() with STRATEGY_SINGLE.
 =end
@@ -98,6 +163,21 @@ Convenience method for invoking disassemble() with STRATEGY_ENTRY.
       disassemble(target, args, &block)
     end
 
+=begin rdoc
+Convenience method for invoking disassemble() with STRATEGY_FUNCTIONS.
+=end
+    def disasm_functions( target, args={}, &block )
+      args[:strategy] = STRATEGY_FUNCTIONS
+      disassemble(target, args, &block)
+    end
+
+=begin rdoc
+Return the FunctionTable of the target. See STRATEGY_FUNCTIONS.
+=end
+    def functions( target, args={} )
+      disasm_functions(target, args).functions
+    end
+
 =begin rdoc
 Convenience alias for disassemble().
 =end
@@ -120,4 +200,31 @@ Return array of available disassembler options, as printed by libopcodes.
 
   end
 
+  class Session
+
+=begin rdoc
+Disassemble the prepared target at <i>vma</i>. A nil vma or length uses the
+value given to Disassembler#prepare. See ext_disassemble.
+=end
+    def disassemble( vma=nil, length=nil, &block ) # :yields: instruction
+      ext_disassemble(vma, length, &block)
+    end
+
+=begin rdoc
+Disassemble the prepared target at <i>vma</i>, yielding each instruction
+without storing it. Returns an Enumerator if no block is given. 
+See ext_each_instruction.
+=end
+    def each_instruction( vma=nil, length=nil, &block ) # :yields: instruction
+      return enum_for(:each_instruction, vma, length) if not block_given?
+      ext_each_instruction(vma, length, &block)
+    end
+
+=begin rdoc
+Convenience alias for disassemble().
+=end
+    alias :disasm :disassemble
+
+  end
+
 end
@@ -0,0 +1,62 @@
+/* Arena.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <opdis/opdis.h>
+#include <opdis/model.h>
+
+#include "Arena.h"
+
+/* sizes used for architectures without their own entry */
+static const Opdis_insn_sizes default_sizes = { 128, 32, 16, 32 };
+
+/* x86 instructions have at most 4 operands; leave room for the implicit
+ * operands added by the decoder */
+static const Opdis_insn_sizes x86_sizes = { 128, 24, 8, 32 };
+
+void Opdis_arenaInit( Opdis_insn_arena * arena, enum bfd_architecture arch ) {
+	switch ( arch ) {
+		case bfd_arch_i386:
+			arena->sizes = x86_sizes; break;
+		default:
+			arena->sizes = default_sizes; break;
+	}
+
+	arena->num_free = 0;
+}
+
+opdis_insn_t * Opdis_arenaAlloc( Opdis_insn_arena * arena ) {
+	opdis_insn_t * insn;
+
+	if ( arena->num_free ) {
+		insn = arena->free[--arena->num_free];
+		opdis_insn_clear( insn );
+		return insn;
+	}
+
+	return opdis_insn_alloc_fixed( arena->sizes.ascii_sz, 
+				       arena->sizes.mnem_sz,
+				       arena->sizes.num_ops, 
+				       arena->sizes.op_ascii_sz );
+}
+
+void Opdis_arenaRelease( Opdis_insn_arena * arena, opdis_insn_t * insn ) {
+	if (! insn ) {
+		return;
+	}
+
+	if ( arena->num_free < OPDIS_ARENA_MAX_FREE ) {
+		arena->free[arena->num_free++] = insn;
+	} else {
+		opdis_insn_free( insn );
+	}
+}
+
+void Opdis_arenaFree( Opdis_insn_arena * arena ) {
+	while ( arena->num_free ) {
+		opdis_insn_free( arena->free[--arena->num_free] );
+	}
+}
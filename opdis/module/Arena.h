@@ -0,0 +1,46 @@
+/* Arena.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_ARENA_H
+#define OPDIS_RB_ARENA_H
+
+#include <bfd.h>
+#include <opdis/opdis.h>
+
+/* Number of released instructions an arena keeps for reuse */
+#define OPDIS_ARENA_MAX_FREE 16
+
+/* Sizes of the buffers in a fixed-size opdis_insn_t */
+typedef struct {
+	unsigned int ascii_sz;
+	unsigned int mnem_sz;
+	unsigned int num_ops;
+	unsigned int op_ascii_sz;
+} Opdis_insn_sizes;
+
+/* A pool of scratch instructions. Instructions are allocated with
+ * opdis_insn_alloc_fixed(), sized for the architecture, and are recycled
+ * when released instead of being freed. An arena is not thread-safe. */
+typedef struct {
+	Opdis_insn_sizes sizes;
+	opdis_insn_t * free[OPDIS_ARENA_MAX_FREE];
+	unsigned int num_free;
+} Opdis_insn_arena;
+
+/* Initialize an empty arena for instructions of architecture 'arch' */
+void Opdis_arenaInit( Opdis_insn_arena * arena, enum bfd_architecture arch );
+
+/* Return a cleared scratch instruction, or NULL if allocation fails */
+opdis_insn_t * Opdis_arenaAlloc( Opdis_insn_arena * arena );
+
+/* Return an instruction obtained from Opdis_arenaAlloc to the arena */
+void Opdis_arenaRelease( Opdis_insn_arena * arena, opdis_insn_t * insn );
+
+/* Free all instructions held by the arena */
+void Opdis_arenaFree( Opdis_insn_arena * arena );
+
+#endif
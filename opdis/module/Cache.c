@@ -0,0 +1,752 @@
+/* Cache.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define OPDIS_USE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Cache.h"
+#include "Disassembly.h"
+
+/* string table offset for NULL strings */
+#define NO_STR ((uint64_t) -1)
+
+/* ---------------------------------------------------------------------- */
+/* File layout */
+
+/* All offsets are from the start of the file. The header is followed by
+ * the key (padded to 8 bytes), the instruction records, the operand
+ * records, the error list (string offsets) and the string table. */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t abi;			/* sizes of the record types */
+	uint64_t key_len;
+	uint64_t num_insns;
+	uint64_t num_ops;
+	uint64_t num_errors;
+	uint64_t insn_off;
+	uint64_t op_off;
+	uint64_t err_off;
+	uint64_t str_off;
+	uint64_t str_len;
+} cache_header;
+
+typedef struct {
+	uint64_t self;			/* offset of this record */
+	uint64_t vma;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t bytes;			/* string table offsets */
+	uint64_t ascii;
+	uint64_t mnemonic;
+	uint64_t prefixes;
+	uint64_t comment;
+	uint32_t status;
+	uint32_t category;
+	uint32_t isa;
+	uint32_t flags;
+	uint32_t first_op;
+	uint32_t num_ops;
+	int32_t target;			/* operand indexes, or -1 */
+	int32_t dest;
+	int32_t src;
+	uint32_t pad;
+} cache_insn;
+
+#define OP_VALUE_SZ sizeof(((opdis_op_t *) 0)->value)
+
+/* the operand value contains no pointers, so it is stored as-is */
+typedef struct {
+	uint32_t category;
+	uint32_t flags;
+	uint32_t data_size;
+	uint32_t pad;
+	uint64_t ascii;
+	union {
+		unsigned char bytes[OP_VALUE_SZ];
+		uint64_t align;
+	} value;
+} cache_op;
+
+#define CACHE_ABI ((uint32_t) (sizeof(cache_insn) | \
+				(sizeof(cache_op) << 16)))
+
+#define PAD8(x) (((x) + 7) & ~((uint64_t) 7))
+
+/* ---------------------------------------------------------------------- */
+/* Hashing */
+
+static uint64_t hash_mix( uint64_t h ) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t Opdis_cacheHash( uint64_t seed, const void * data, size_t len ) {
+	const unsigned char * p = (const unsigned char *) data;
+	uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+	uint64_t w;
+
+	for ( ; len >= 8; p += 8, len -= 8 ) {
+		memcpy( &w, p, 8 );
+		h = (h ^ hash_mix(w)) * 0x9E3779B97F4A7C15ULL +
+		    0x632BE59BD9B4E019ULL;
+	}
+
+	if ( len ) {
+		w = 0;
+		memcpy( &w, p, len );
+		h = (h ^ hash_mix(w ^ len)) * 0x9E3779B97F4A7C15ULL;
+	}
+
+	return hash_mix(h);
+}
+
+/* Recently hashed files. A file is identified by its device, inode, size
+ * and modification and change times, so that a cache hit does not read the
+ * whole file again. This is only used with the GVL held. */
+#define HASH_MEMO_SIZE 16
+
+/* Files modified this recently (in seconds) are not memoized, as a second
+ * write may not change their timestamps */
+#define HASH_MEMO_MIN_AGE 2
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define STAT_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define STAT_CTIME_NSEC(st) ((st)->st_ctim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(st) 0
+#define STAT_CTIME_NSEC(st) 0
+#endif
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	long mtime_nsec;
+	long ctime_nsec;
+	uint64_t hash;
+	int valid;
+} hash_memo;
+
+static hash_memo file_hashes[HASH_MEMO_SIZE];
+static unsigned int next_file_hash;
+
+static hash_memo * memo_lookup( const struct stat * st ) {
+	unsigned int i;
+
+	for ( i = 0; i < HASH_MEMO_SIZE; i++ ) {
+		hash_memo * m = &file_hashes[i];
+		if ( m->valid && m->dev == st->st_dev && 
+		     m->ino == st->st_ino && m->size == st->st_size && 
+		     m->mtime == st->st_mtime && m->ctime == st->st_ctime &&
+		     m->mtime_nsec == (long) STAT_MTIME_NSEC(st) &&
+		     m->ctime_nsec == (long) STAT_CTIME_NSEC(st) ) {
+			return m;
+		}
+	}
+
+	return NULL;
+}
+
+static void memo_store( const struct stat * st, uint64_t hash ) {
+	hash_memo * m;
+	time_t now = time(NULL);
+
+	if ( st->st_mtime > now - HASH_MEMO_MIN_AGE ||
+	     st->st_ctime > now - HASH_MEMO_MIN_AGE ) {
+		return;
+	}
+
+	m = &file_hashes[next_file_hash];
+	next_file_hash = (next_file_hash + 1) % HASH_MEMO_SIZE;
+	m->dev = st->st_dev;
+	m->ino = st->st_ino;
+	m->size = st->st_size;
+	m->mtime = st->st_mtime;
+	m->ctime = st->st_ctime;
+	m->mtime_nsec = (long) STAT_MTIME_NSEC(st);
+	m->ctime_nsec = (long) STAT_CTIME_NSEC(st);
+	m->hash = hash;
+	m->valid = 1;
+}
+
+int Opdis_cacheHashFile( const char * path, uint64_t * hash ) {
+	unsigned char buf[65536];
+	uint64_t h = 0;
+	ssize_t len;
+	struct stat st;
+	hash_memo * memo;
+	int fd = open( path, O_RDONLY );
+
+	if ( fd < 0 ) {
+		return 0;
+	}
+
+	if ( fstat(fd, &st) ) {
+		close(fd);
+		return 0;
+	}
+
+	memo = memo_lookup( &st );
+	if ( memo ) {
+		close(fd);
+		*hash = memo->hash;
+		return 1;
+	}
+
+	while ( (len = read(fd, buf, sizeof(buf))) > 0 ) {
+		h = Opdis_cacheHash( h, buf, (size_t) len );
+	}
+
+	close(fd);
+	if ( len < 0 ) {
+		return 0;
+	}
+
+	memo_store( &st, h );
+	*hash = h;
+	return 1;
+}
+
+VALUE Opdis_cachePath( VALUE dir, VALUE key ) {
+	char name[32];
+	VALUE path = rb_str_dup( rb_obj_as_string(dir) );
+
+	StringValue(key);
+	snprintf( name, sizeof(name), "/%016llx" OPDIS_CACHE_EXT,
+		  (unsigned long long) Opdis_cacheHash( 0, RSTRING_PTR(key),
+						RSTRING_LEN(key) ) );
+	rb_str_cat2( path, name );
+
+	return path;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Mapped files */
+
+typedef struct {
+	void * base;
+	size_t len;
+	int mapped;
+} cache_map;
+
+static void map_free( void * ptr ) {
+	cache_map * map = (cache_map *) ptr;
+
+	if ( map->base ) {
+#ifdef OPDIS_USE_MMAP
+		if ( map->mapped ) {
+			munmap( map->base, map->len );
+		} else
+#endif
+		free( map->base );
+	}
+	xfree( map );
+}
+
+static size_t map_memsize( const void * ptr ) {
+	const cache_map * map = (const cache_map *) ptr;
+	return sizeof(cache_map) + (map->mapped ? 0 : map->len);
+}
+
+static const rb_data_type_t map_data_type = {
+	"Opdis::CacheMap",
+	{ NULL, map_free, map_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+/* map (or read) a file into 'map'. Returns 0 on failure. */
+static int map_file( const char * path, cache_map * map ) {
+	struct stat st;
+	int fd = open( path, O_RDONLY );
+
+	if ( fd < 0 ) {
+		return 0;
+	}
+
+	if ( fstat(fd, &st) || ! S_ISREG(st.st_mode) ||
+	     (size_t) st.st_size < sizeof(cache_header) ) {
+		close(fd);
+		return 0;
+	}
+	map->len = (size_t) st.st_size;
+
+#ifdef OPDIS_USE_MMAP
+	map->base = mmap( NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( map->base != MAP_FAILED ) {
+		map->mapped = 1;
+		close(fd);
+		return 1;
+	}
+#endif
+
+	map->base = malloc( map->len );
+	if ( map->base &&
+	     read(fd, map->base, map->len) != (ssize_t) map->len ) {
+		free( map->base );
+		map->base = NULL;
+	}
+
+	close(fd);
+	return map->base ? 1 : 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Loading */
+
+static int valid_str( const cache_header * hdr, uint64_t off ) {
+	return off == NO_STR || off < hdr->str_len;
+}
+
+static int valid_op_idx( const cache_insn * rec, int32_t idx ) {
+	return idx == -1 || (idx >= 0 && (uint32_t) idx < rec->num_ops);
+}
+
+/* check that every offset in the file is in bounds, so that records can
+ * be used without further checks */
+static int valid_cache( const cache_map * map, VALUE key ) {
+	const char * base = (const char *) map->base;
+	const cache_header * hdr = (const cache_header *) base;
+	const cache_insn * insns;
+	const cache_op * ops;
+	const uint64_t * errs;
+	uint64_t i;
+
+	if ( memcmp(hdr->magic, OPDIS_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	     hdr->version != OPDIS_CACHE_VERSION || hdr->abi != CACHE_ABI ) {
+		return 0;
+	}
+
+	/* sections must be in order and inside the file */
+	if ( hdr->key_len != (uint64_t) RSTRING_LEN(key) ||
+	     hdr->insn_off != PAD8(sizeof(cache_header) + hdr->key_len) ||
+	     hdr->num_insns > (map->len / sizeof(cache_insn)) ||
+	     hdr->num_ops > (map->len / sizeof(cache_op)) ||
+	     hdr->num_errors > (map->len / sizeof(uint64_t)) ||
+	     hdr->op_off != hdr->insn_off + hdr->num_insns *
+	     		    sizeof(cache_insn) ||
+	     hdr->err_off != hdr->op_off + hdr->num_ops * sizeof(cache_op) ||
+	     hdr->str_off != hdr->err_off + hdr->num_errors *
+	     		     sizeof(uint64_t) ||
+	     hdr->str_len == 0 || hdr->str_off > map->len ||
+	     hdr->str_len != map->len - hdr->str_off ||
+	     base[map->len - 1] != '\0' ) {
+		return 0;
+	}
+
+	if ( memcmp(base + sizeof(cache_header), RSTRING_PTR(key),
+		    hdr->key_len) ) {
+		return 0;
+	}
+
+	insns = (const cache_insn *) (base + hdr->insn_off);
+	for ( i = 0; i < hdr->num_insns; i++ ) {
+		const cache_insn * rec = &insns[i];
+		if ( rec->self != hdr->insn_off + i * sizeof(cache_insn) ||
+		     (uint64_t) rec->first_op + rec->num_ops > hdr->num_ops ||
+		     ! valid_op_idx(rec, rec->target) ||
+		     ! valid_op_idx(rec, rec->dest) ||
+		     ! valid_op_idx(rec, rec->src) ||
+		     ! valid_str(hdr, rec->ascii) ||
+		     ! valid_str(hdr, rec->mnemonic) ||
+		     ! valid_str(hdr, rec->prefixes) ||
+		     ! valid_str(hdr, rec->comment) ||
+		     (rec->bytes != NO_STR && (rec->bytes > hdr->str_len ||
+			rec->size > hdr->str_len - rec->bytes)) ) {
+			return 0;
+		}
+	}
+
+	ops = (const cache_op *) (base + hdr->op_off);
+	for ( i = 0; i < hdr->num_ops; i++ ) {
+		if (! valid_str(hdr, ops[i].ascii) ) {
+			return 0;
+		}
+	}
+
+	errs = (const uint64_t *) (base + hdr->err_off);
+	for ( i = 0; i < hdr->num_errors; i++ ) {
+		if ( errs[i] == NO_STR || ! valid_str(hdr, errs[i]) ) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void load_prefixes( opdis_insn_t * insn, const char * str ) {
+	char * buf = strdup( str );
+	char * tok, * save = NULL;
+
+	if (! buf ) {
+		return;
+	}
+
+	for ( tok = strtok_r(buf, " ", &save); tok;
+	      tok = strtok_r(NULL, " ", &save) ) {
+		opdis_insn_add_prefix( insn, tok );
+	}
+
+	free( buf );
+}
+
+/* Opdis_rec_loader for cache records; called without touching Ruby */
+static opdis_insn_t * load_insn( const void * image ) {
+	const cache_insn * rec = (const cache_insn *) image;
+	const char * base = (const char *) image - rec->self;
+	const cache_header * hdr = (const cache_header *) base;
+	const cache_op * ops = (const cache_op *) (base + hdr->op_off);
+	const char * strs = base + hdr->str_off;
+	opdis_insn_t * insn = opdis_insn_alloc( rec->num_ops );
+	uint32_t i;
+
+	if (! insn ) {
+		return NULL;
+	}
+
+	insn->status = (enum opdis_insn_decode_t) rec->status;
+	insn->offset = (opdis_off_t) rec->offset;
+	insn->vma = (opdis_vma_t) rec->vma;
+	insn->size = (opdis_off_t) rec->size;
+	insn->category = (enum opdis_insn_cat_t) rec->category;
+	insn->isa = (enum opdis_insn_subset_t) rec->isa;
+	insn->flags.cflow = (enum opdis_cflow_flag_t) rec->flags;
+
+	if ( rec->bytes != NO_STR && rec->size ) {
+		if (! insn->bytes ) {
+			insn->bytes = calloc( 1, rec->size );
+		}
+		if ( insn->bytes ) {
+			memcpy( insn->bytes, strs + rec->bytes, rec->size );
+		}
+	}
+
+	if ( rec->ascii != NO_STR ) {
+		opdis_insn_set_ascii( insn, strs + rec->ascii );
+	}
+	if ( rec->mnemonic != NO_STR ) {
+		opdis_insn_set_mnemonic( insn, strs + rec->mnemonic );
+	}
+	if ( rec->prefixes != NO_STR ) {
+		load_prefixes( insn, strs + rec->prefixes );
+	}
+	if ( rec->comment != NO_STR ) {
+		opdis_insn_add_comment( insn, strs + rec->comment );
+	}
+
+	for ( i = 0; i < rec->num_ops; i++ ) {
+		const cache_op * src = &ops[rec->first_op + i];
+		opdis_op_t * op = opdis_insn_next_avail_op( insn );
+		if (! op ) {
+			op = opdis_op_alloc();
+			if (! op ) {
+				break;
+			}
+			opdis_insn_add_operand( insn, op );
+		}
+
+		op->category = (enum opdis_op_cat_t) src->category;
+		op->flags = (enum opdis_op_flag_t) src->flags;
+		op->data_size = (unsigned char) src->data_size;
+		memcpy( &op->value, src->value.bytes, OP_VALUE_SZ );
+		if ( src->ascii != NO_STR ) {
+			opdis_op_set_ascii( op, strs + src->ascii );
+		}
+	}
+
+	if ( rec->target >= 0 && (uint32_t) rec->target < insn->num_operands ) {
+		insn->target = insn->operands[rec->target];
+	}
+	if ( rec->dest >= 0 && (uint32_t) rec->dest < insn->num_operands ) {
+		insn->dest = insn->operands[rec->dest];
+	}
+	if ( rec->src >= 0 && (uint32_t) rec->src < insn->num_operands ) {
+		insn->src = insn->operands[rec->src];
+	}
+
+	return insn;
+}
+
+int Opdis_cacheLoad( VALUE path, VALUE key, VALUE output ) {
+	const cache_header * hdr;
+	const cache_insn * insns;
+	const uint64_t * errs;
+	const char * base;
+	cache_map * map;
+	VALUE holder, errors;
+	uint64_t i;
+
+	StringValue(key);
+	holder = TypedData_Make_Struct( 0, cache_map, &map_data_type, map );
+	if (! map_file( StringValueCStr(path), map ) ) {
+		return 0;
+	}
+
+	if (! valid_cache( map, key ) ) {
+		return 0;
+	}
+
+	base = (const char *) map->base;
+	hdr = (const cache_header *) base;
+
+	insns = (const cache_insn *) (base + hdr->insn_off);
+	for ( i = 0; i < hdr->num_insns; i++ ) {
+		Opdis_disassemblyAddImage( output, (opdis_vma_t) insns[i].vma,
+					   (unsigned int) insns[i].size,
+					   &insns[i], holder, load_insn );
+	}
+
+	errors = Opdis_disassemblyErrors( output );
+	errs = (const uint64_t *) (base + hdr->err_off);
+	for ( i = 0; i < hdr->num_errors; i++ ) {
+		rb_ary_push( errors, rb_str_new_cstr(base + hdr->str_off +
+						     errs[i]) );
+	}
+
+	RB_GC_GUARD(holder);
+	return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Storing */
+
+typedef struct {
+	char * data;
+	size_t len;
+	size_t alloc;
+	int failed;
+} cache_buf;
+
+/* append 'len' bytes to 'buf' and return their offset */
+static uint64_t buf_append( cache_buf * buf, const void * data, size_t len ) {
+	uint64_t off = buf->len;
+
+	if ( buf->len + len > buf->alloc ) {
+		size_t alloc = buf->alloc ? buf->alloc : 4096;
+		char * data_new;
+
+		while ( alloc < buf->len + len ) {
+			alloc *= 2;
+		}
+
+		data_new = realloc( buf->data, alloc );
+		if (! data_new ) {
+			buf->failed = 1;
+			return NO_STR;
+		}
+		buf->data = data_new;
+		buf->alloc = alloc;
+	}
+
+	memcpy( buf->data + buf->len, data, len );
+	buf->len += len;
+	return off;
+}
+
+static uint64_t buf_append_str( cache_buf * buf, const char * str ) {
+	return str ? buf_append( buf, str, strlen(str) + 1 ) : NO_STR;
+}
+
+static int32_t op_index( const opdis_insn_t * insn, const opdis_op_t * op ) {
+	unsigned int i;
+
+	for ( i = 0; op && i < insn->num_operands; i++ ) {
+		if ( insn->operands[i] == op ) {
+			return (int32_t) i;
+		}
+	}
+
+	return -1;
+}
+
+static void store_insn( const opdis_insn_t * insn, cache_buf * insns,
+			cache_buf * ops, cache_buf * strs ) {
+	cache_insn rec;
+	unsigned int i;
+
+	memset( &rec, 0, sizeof(rec) );
+	rec.vma = insn->vma;
+	rec.offset = insn->offset;
+	rec.size = insn->size;
+	rec.status = (uint32_t) insn->status;
+	rec.category = (uint32_t) insn->category;
+	rec.isa = (uint32_t) insn->isa;
+	rec.flags = (uint32_t) insn->flags.cflow;
+	rec.bytes = (insn->bytes && insn->size) ?
+		    buf_append( strs, insn->bytes, insn->size ) : NO_STR;
+	rec.ascii = buf_append_str( strs, insn->ascii );
+	rec.mnemonic = buf_append_str( strs, insn->mnemonic );
+	rec.prefixes = insn->num_prefixes ?
+		       buf_append_str( strs, insn->prefixes ) : NO_STR;
+	rec.comment = buf_append_str( strs, insn->comment );
+	rec.first_op = (uint32_t) (ops->len / sizeof(cache_op));
+	rec.num_ops = insn->num_operands;
+	rec.target = op_index( insn, insn->target );
+	rec.dest = op_index( insn, insn->dest );
+	rec.src = op_index( insn, insn->src );
+
+	for ( i = 0; i < insn->num_operands; i++ ) {
+		const opdis_op_t * op = insn->operands[i];
+		cache_op crec;
+
+		memset( &crec, 0, sizeof(crec) );
+		crec.category = (uint32_t) op->category;
+		crec.flags = (uint32_t) op->flags;
+		crec.data_size = op->data_size;
+		crec.ascii = buf_append_str( strs, op->ascii );
+		memcpy( crec.value.bytes, &op->value, OP_VALUE_SZ );
+		buf_append( ops, &crec, sizeof(crec) );
+	}
+
+	buf_append( insns, &rec, sizeof(rec) );
+}
+
+/* create 'path' and any missing parent directories. 'path' is modified
+ * while this runs. */
+static void make_dirs( char * path ) {
+	char * p;
+
+	for ( p = path + 1; *p; p++ ) {
+		if ( *p == '/' ) {
+			*p = '\0';
+			mkdir( path, 0777 );
+			*p = '/';
+		}
+	}
+
+	mkdir( path, 0777 );
+}
+
+static int write_cache( const char * path, VALUE key, cache_header * hdr,
+			cache_buf * insns, cache_buf * ops, cache_buf * errs,
+			cache_buf * strs ) {
+	static const char zeros[8] = {0};
+	size_t pad = hdr->insn_off - sizeof(cache_header) - hdr->key_len;
+	FILE * f = fopen( path, "wb" );
+	int ok;
+
+	if (! f ) {
+		return 0;
+	}
+
+	ok = fwrite( hdr, sizeof(cache_header), 1, f ) == 1 &&
+	     fwrite( RSTRING_PTR(key), 1, hdr->key_len, f ) == hdr->key_len &&
+	     fwrite( zeros, 1, pad, f ) == pad &&
+	     fwrite( insns->data, 1, insns->len, f ) == insns->len &&
+	     fwrite( ops->data, 1, ops->len, f ) == ops->len &&
+	     fwrite( errs->data, 1, errs->len, f ) == errs->len &&
+	     fwrite( strs->data, 1, strs->len, f ) == strs->len;
+
+	return (fclose(f) == 0) && ok;
+}
+
+int Opdis_cacheStore( VALUE path, VALUE key, VALUE output ) {
+	cache_buf insns = {0}, ops = {0}, errs = {0}, strs = {0};
+	cache_header hdr;
+	size_t i, count = Opdis_disassemblyCount( output );
+	VALUE errors = rb_ary_dup( Opdis_disassemblyErrors(output) );
+	VALUE dir, tmp;
+	const char * c_path, * c_tmp;
+	char suffix[32];
+	int ok = 0;
+
+	/* everything which may raise is done before buffers are allocated */
+	StringValue(key);
+	c_path = StringValueCStr(path);
+	dir = rb_funcall( rb_cFile, rb_intern("dirname"), 1, path );
+	StringValueCStr(dir);
+	rb_str_modify(dir);
+	snprintf( suffix, sizeof(suffix), ".%ld.tmp", (long) getpid() );
+	tmp = rb_str_plus( path, rb_str_new_cstr(suffix) );
+	c_tmp = StringValueCStr(tmp);
+	for ( i = 0; i < (size_t) RARRAY_LEN(errors); i++ ) {
+		rb_ary_store( errors, i, 
+			      rb_obj_as_string(rb_ary_entry(errors, i)) );
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		store_insn( Opdis_disassemblyInsnAt(output, i), &insns, &ops,
+			    &strs );
+	}
+
+	for ( i = 0; i < (size_t) RARRAY_LEN(errors); i++ ) {
+		VALUE str = rb_ary_entry(errors, i);
+		uint64_t off = buf_append( &strs, RSTRING_PTR(str),
+					   RSTRING_LEN(str) );
+		buf_append( &strs, "", 1 );
+		buf_append( &errs, &off, sizeof(off) );
+	}
+
+	/* the string table always ends in a NUL */
+	buf_append( &strs, "", 1 );
+
+	if (! (insns.failed || ops.failed || errs.failed || strs.failed) ) {
+		memset( &hdr, 0, sizeof(hdr) );
+		memcpy( hdr.magic, OPDIS_CACHE_MAGIC, sizeof(hdr.magic) );
+		hdr.version = OPDIS_CACHE_VERSION;
+		hdr.abi = CACHE_ABI;
+		hdr.key_len = RSTRING_LEN(key);
+		hdr.num_insns = count;
+		hdr.num_ops = ops.len / sizeof(cache_op);
+		hdr.num_errors = errs.len / sizeof(uint64_t);
+		hdr.insn_off = PAD8(sizeof(cache_header) + hdr.key_len);
+		hdr.op_off = hdr.insn_off + insns.len;
+		hdr.err_off = hdr.op_off + ops.len;
+		hdr.str_off = hdr.err_off + errs.len;
+		hdr.str_len = strs.len;
+
+		for ( i = 0; i < count; i++ ) {
+			((cache_insn *) insns.data)[i].self = hdr.insn_off +
+						i * sizeof(cache_insn);
+		}
+
+		/* create the directory if needed */
+		make_dirs( RSTRING_PTR(dir) );
+
+		/* write to a temporary file, then move it into place */
+		ok = write_cache( c_tmp, key, &hdr, &insns, &ops, &errs, 
+				  &strs ) && rename( c_tmp, c_path ) == 0;
+		if (! ok ) {
+			unlink( c_tmp );
+		}
+	}
+
+	free( insns.data );
+	free( ops.data );
+	free( errs.data );
+	free( strs.data );
+
+	RB_GC_GUARD(dir);
+	RB_GC_GUARD(tmp);
+	RB_GC_GUARD(errors);
+	return ok;
+}
@@ -0,0 +1,48 @@
+/* Cache.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_CACHE_H
+#define OPDIS_RB_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <ruby.h>
+
+/* Bump when the layout of cache files changes */
+#define OPDIS_CACHE_VERSION 1
+#define OPDIS_CACHE_MAGIC "OPDISC\r\n"
+#define OPDIS_CACHE_EXT ".opdc"
+
+/* An on-disk disassembly cache. Each file holds the instructions and errors
+ * of one Disassembly in a flat, native-endian layout which is mapped and
+ * used in place: loading a file only adds a record (VMA, size, pointer into
+ * the mapping) per instruction, and an opdis_insn_t is built from the
+ * mapping when an instruction is first accessed. Files are written to a
+ * temporary name and renamed, so readers never see a partial file. */
+
+/* 64-bit hash of 'len' bytes, continuing from 'seed'. This is not a
+ * cryptographic hash. */
+uint64_t Opdis_cacheHash( uint64_t seed, const void * data, size_t len );
+
+/* Hash the contents of the file at 'path'. Returns 0 on failure. The hash
+ * of an unchanged file is remembered, so the file is only read once. */
+int Opdis_cacheHashFile( const char * path, uint64_t * hash );
+
+/* Return the path of the cache file for 'key' in directory 'dir' */
+VALUE Opdis_cachePath( VALUE dir, VALUE key );
+
+/* Add the instructions and errors in the cache file at 'path' to 'output'.
+ * Returns 0, leaving 'output' unchanged, if the file does not exist, is
+ * invalid, or was written for a different key. */
+int Opdis_cacheLoad( VALUE path, VALUE key, VALUE output );
+
+/* Write the instructions and errors in 'output' to the cache file at
+ * 'path'. Returns 0 if the file could not be written. */
+int Opdis_cacheStore( VALUE path, VALUE key, VALUE output );
+
+#endif
@@ -12,136 +12,61 @@
 #include <opdis/model.h>
 #include <opdis/x86_decoder.h>
 
+#include "Arena.h"
 #include "Callbacks.h"
+#include "DecodeContext.h"
 #include "Opdis.h"
 #include "Model.h"
 
 #define IVAR(attr) "@" attr
 #define SETTER(attr) attr "="
 
-static VALUE symToSym, symDecode, symVisited, symResolve;
+static VALUE symDecode, symVisited, symResolve;
+static ID idMethod, idOwner;
 static VALUE clsDecoder, clsX86Decoder, clsX86IntelDecoder;
 static VALUE clsHandler, clsResolver;
 
-static VALUE str_to_sym( const char * str ) {
-	VALUE var = rb_str_new_cstr(str);
-	return rb_funcall(var, symToSym, 0);
-}
-
-#define ALLOC_FIXED_INSN opdis_insn_alloc_fixed(128, 32, 16, 32)
+/* scratch instructions for the built-in callback methods. These are only
+ * used while holding the GVL. */
+static Opdis_insn_arena scratch;
 
 /* ---------------------------------------------------------------------- */
 /* Decoder Class */
 
-static VALUE insn_type_to_str( enum dis_insn_type t ) {
-	const char *s = "Unknown";
-	switch (t) {
-		case dis_noninsn: s = "Invalid"; break;
-		case dis_nonbranch: s = "Not branch"; break;
-		case dis_branch: s = "Unconditional branch"; break;
-		case dis_condbranch: s = "Conditional branch"; break;
-		case dis_jsr: s = "Jump to subroutine"; break;
-		case dis_condjsr: s = "Conditional jump to subroutine"; break;
-		case dis_dref: s = "Data reference"; break;
-		case dis_dref2: s = "Two data references"; break;
-	}
-	return rb_str_new_cstr(s);
-}
-
-static void fill_decoder_hash( VALUE hash, const opdis_insn_buf_t in, 
-                               const opdis_byte_t * buf, opdis_off_t offset,
-                               opdis_vma_t vma, opdis_off_t length ) {
-	unsigned int i;
-	VALUE str, ary;
-	char info = in->insn_info_valid;
-
-	/* instruction location and size */
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_VMA), INT2NUM(vma) );
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_OFF), INT2NUM(offset) );
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_LEN), INT2NUM(length) );
-
-	/* target buffer */
-	str = rb_str_new( (const char *) buf, offset + length );
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_BUF), str );
-	
-	/* decode instruction as provided by libopcodes */
-
-	/* 1. get items from opdis_insn_buf_t */
-	ary = rb_ary_new();
-	for ( i = 0; i < in->item_count; i++ ) {
-		rb_ary_push( ary, rb_str_new_cstr(in->items[i]) );
-	}
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_ITEMS), ary );
-
-	/* 2. get raw ASCII version of insn from libopcodes */
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_STR), 
-		      rb_str_new_cstr(in->string) );
-
-	/* 3. get instruction metadata set by libopcodes */
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_DELAY), 
-		      info ? INT2NUM(in->branch_delay_insns) : Qnil);
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_DATA), 
-		      info ? INT2NUM(in->data_size) : Qnil);
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_TYPE), 
-		      info ? insn_type_to_str(in->insn_type) : Qnil);
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_TGT), 
-		      info ? INT2NUM(in->target) : Qnil);
-	rb_hash_aset( hash, str_to_sym(DECODER_MEMBER_TGT2), 
-		      info ? INT2NUM(in->target2) : Qnil );
-}
-
-static int invoke_builtin_decoder( OPDIS_DECODER fn, VALUE insn, VALUE hash ) {
+static int invoke_builtin_decoder( OPDIS_DECODER fn, VALUE insn, VALUE ctx ) {
 	int rv;
-	VALUE var;
-	opdis_insn_buf_t inbuf;
-        opdis_byte_t * buf;
-	opdis_off_t offset;
-        opdis_vma_t vma;
-	opdis_off_t length;
-	opdis_insn_t * c_insn = ALLOC_FIXED_INSN;
-
-	Opdis_insnToC( insn, c_insn );
+	Opdis_decode_args args;
+	opdis_insn_t * c_insn;
 
-	/* get insn_buf_t from decoder instance; this saves some trouble */
-	Data_Get_Struct( hash, opdis_insn_buffer_t, inbuf );
-	if (! inbuf ) {
+	/* the context wraps the arguments libopdis passed to local_decoder */
+	if (! Opdis_decodeContextArgs( ctx, &args ) ) {
 		/* something went wrong: we weren't called from local_decoder */
-		rb_raise( rb_eRuntimeError, "opdis_insn_buf_t not found" );
+		rb_raise( rb_eRuntimeError, "DecodeContext not valid" );
 	}
 
-	/* convert decoder arguments to C */
-	var = rb_hash_lookup2(hash, str_to_sym(DECODER_MEMBER_VMA), Qfalse);
-	vma = ( Qfalse != var ) ? NUM2UINT(var) : 0;
-
-	var = rb_hash_lookup2(hash, str_to_sym(DECODER_MEMBER_OFF), Qfalse);
-	offset = ( Qfalse != var ) ? NUM2UINT(var) : 0;
-
-	var = rb_hash_lookup2(hash, str_to_sym(DECODER_MEMBER_LEN), Qfalse);
-	length = ( Qfalse != var ) ? NUM2UINT(var) : 0;
-
-	var = rb_hash_lookup2(hash, str_to_sym(DECODER_MEMBER_BUF), Qfalse);
-	buf = ( Qfalse != var ) ? (opdis_byte_t *) RSTRING_PTR(var) : NULL;
-
-	if ( buf == NULL ) {
-		rb_raise( rb_eRuntimeError, "DecodeHash.buf is NULL" );
+	c_insn = Opdis_arenaAlloc( &scratch );
+	if (! c_insn ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate instruction" );
 	}
+	Opdis_insnToC( insn, c_insn );
 
 	/* invoke C decoder callback */
 	// TODO: pass something meaningful in arg
-	rv = fn( inbuf, c_insn, buf, offset, vma, length, NULL );
+	rv = fn( args.in, c_insn, args.buf, args.offset, args.vma, args.length,
+		 NULL );
 	if ( rv ) {
 		// TODO : error handler?
 		Opdis_insnFillFromC( c_insn, insn );
 	}
 
-	opdis_insn_free(c_insn);
+	Opdis_arenaRelease( &scratch, c_insn );
 
 	return rv ? Qtrue : Qfalse;
 }
 
-static VALUE cls_decoder_decode( VALUE instance, VALUE insn, VALUE hash ) {
+static VALUE cls_decoder_decode( VALUE instance, VALUE insn, VALUE ctx ) {
 	rb_thread_schedule();
-	invoke_builtin_decoder(opdis_default_decoder, insn, hash);
+	invoke_builtin_decoder(opdis_default_decoder, insn, ctx);
 	return insn;
 }
 
@@ -154,14 +79,14 @@ static void init_decoder_class( VALUE modOpdis ) {
 /*      ----------------------------------------------------------------- */
 /* 	X86 Decoder Class */
 
-static VALUE cls_x86decoder_decode( VALUE instance, VALUE insn, VALUE hash ) {
+static VALUE cls_x86decoder_decode( VALUE instance, VALUE insn, VALUE ctx ) {
 	rb_thread_schedule();
-	invoke_builtin_decoder(opdis_x86_att_decoder, insn, hash);
+	invoke_builtin_decoder(opdis_x86_att_decoder, insn, ctx);
 	return insn;
 }
 
-static VALUE cls_x86inteldecoder_decode(VALUE instance, VALUE insn, VALUE hash){
-	invoke_builtin_decoder(opdis_x86_intel_decoder, insn, hash);
+static VALUE cls_x86inteldecoder_decode(VALUE instance, VALUE insn, VALUE ctx){
+	invoke_builtin_decoder(opdis_x86_intel_decoder, insn, ctx);
 	return insn;
 }
 
@@ -185,19 +110,25 @@ static void init_x86decoder_class( VALUE modOpdis ) {
 static VALUE cls_handler_visited( VALUE instance, VALUE insn ) {
 	int rv;
 	opdis_t opdis;
-	opdis_insn_t * c_insn = ALLOC_FIXED_INSN;
-
-	Opdis_insnToC( insn, c_insn );
+	opdis_insn_t * c_insn;
 
 	Data_Get_Struct(instance, opdis_info_t, opdis);
 	if (! opdis ) {
 		rb_raise(rb_eRuntimeError, "opdis_t not found in Handler");
 	}
 
+	c_insn = Opdis_arenaAlloc( &scratch );
+	if (! c_insn ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate instruction" );
+	}
+	Opdis_insnToC( insn, c_insn );
+
 	rb_thread_schedule();
 	rv = opdis_default_handler(c_insn, opdis);
+	Opdis_arenaRelease( &scratch, c_insn );
 
-	return rv ? Qtrue : Qfalse;
+	/* the default handler returns 1 (continue) for unvisited insns */
+	return rv ? Qfalse : Qtrue;
 }
 
 /* NOTE: this uses its own opdis_t with a visited_addr tree */
@@ -224,15 +155,19 @@ static void init_handler_class( VALUE modOpdis ) {
 /* Resolver Class */
 
 static VALUE cls_resolver_resolve( VALUE instance, VALUE insn ) {
-	int rv;
-	opdis_insn_t * c_insn = ALLOC_FIXED_INSN;
+	opdis_vma_t vma;
+	opdis_insn_t * c_insn = Opdis_arenaAlloc( &scratch );
 
+	if (! c_insn ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate instruction" );
+	}
 	Opdis_insnToC( insn, c_insn );
 
 	rb_thread_schedule();
-	rv = opdis_default_resolver( c_insn, NULL );
+	vma = opdis_default_resolver( c_insn, NULL );
+	Opdis_arenaRelease( &scratch, c_insn );
 
-	return INT2NUM(rv);
+	return (vma == OPDIS_INVALID_ADDR) ? Qnil : ULL2NUM(vma);
 }
 
 static void init_resolver_class( VALUE modOpdis ) {
@@ -242,11 +177,13 @@ static void init_resolver_class( VALUE modOpdis ) {
 }
 
 void Opdis_initCallbacks( VALUE modOpdis ) {
-	symToSym = rb_intern("to_sym");
+	Opdis_arenaInit( &scratch, bfd_arch_unknown );
 
 	symDecode = rb_intern(DECODER_METHOD);
 	symVisited = rb_intern(HANDLER_METHOD);
 	symResolve = rb_intern(RESOLVER_METHOD); 
+	idMethod = rb_intern("method");
+	idOwner = rb_intern("owner");
 
 	init_resolver_class(modOpdis);
 	init_handler_class(modOpdis);
@@ -254,13 +191,60 @@ void Opdis_initCallbacks( VALUE modOpdis ) {
 	init_x86decoder_class(modOpdis);
 }
 
-VALUE Opdis_decoderHash( const opdis_insn_buf_t in, 
-                         const opdis_byte_t * buf, opdis_off_t offset,
-                         opdis_vma_t vma, opdis_off_t length ) {
-	/* here we cheat and store insn_buf in hash in case one of the local
-	 * decoder base classes gets called */
-	VALUE hash = Data_Wrap_Struct(rb_cHash, NULL, NULL, in);
-	fill_decoder_hash( hash, in, buf, offset, vma, length );
-	return hash;
+/* ---------------------------------------------------------------------- */
+/* Built-in callback detection */
+
+static VALUE get_method_owner( VALUE arg ) {
+	VALUE * args = (VALUE *) arg;
+	VALUE meth = rb_funcall( args[0], idMethod, 1, ID2SYM((ID) args[1]) );
+	return rb_funcall( meth, idOwner, 0 );
+}
+
+/* return the class or module which implements method 'id' for 'obj', or 
+ * nil if this cannot be determined */
+static VALUE method_owner( VALUE obj, ID id ) {
+	VALUE args[2];
+	VALUE owner;
+	int state = 0;
+
+	args[0] = obj;
+	args[1] = (VALUE) id;
+	owner = rb_protect( get_method_owner, (VALUE) args, &state );
+	if ( state ) {
+		rb_set_errinfo( Qnil );
+		return Qnil;
+	}
+
+	return owner;
 }
 
+OPDIS_DECODER Opdis_builtinDecoder( VALUE obj ) {
+	VALUE owner = method_owner( obj, symDecode );
+
+	if ( owner == clsDecoder ) {
+		return opdis_default_decoder;
+	} else if ( owner == clsX86Decoder ) {
+		return opdis_x86_att_decoder;
+	} else if ( owner == clsX86IntelDecoder ) {
+		return opdis_x86_intel_decoder;
+	}
+
+	return NULL;
+}
+
+opdis_t Opdis_builtinHandlerArg( VALUE obj ) {
+	opdis_t opdis;
+
+	if ( TYPE(obj) != T_DATA || 
+	     method_owner( obj, symVisited ) != clsHandler ) {
+		return NULL;
+	}
+
+	Data_Get_Struct( obj, opdis_info_t, opdis );
+	return ( opdis && opdis->visited_addr ) ? opdis : NULL;
+}
+
+OPDIS_RESOLVER Opdis_builtinResolver( VALUE obj ) {
+	return ( method_owner( obj, symResolve ) == clsResolver ) ?
+		opdis_default_resolver : NULL;
+}
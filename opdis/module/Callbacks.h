@@ -8,6 +8,9 @@
 #ifndef OPDIS_RB_CALLBACKS_H
 #define OPDIS_RB_CALLBACKS_H
 
+#include <opdis/opdis.h>
+#include <ruby.h>
+
 /* Resolver */
 
 #define RESOLVER_METHOD "resolve"
@@ -20,24 +23,21 @@
 
 #define DECODER_METHOD "decode"
 
-/* info provided to decoder */
-#define DECODER_MEMBER_VMA "vma"
-#define DECODER_MEMBER_OFF "offset"
-#define DECODER_MEMBER_LEN "size"
-#define DECODER_MEMBER_BUF "buffer"
-#define DECODER_MEMBER_ITEMS "items"
-#define DECODER_MEMBER_STR "raw_insn"
-#define DECODER_MEMBER_DELAY "branch_delay"
-#define DECODER_MEMBER_DATA "data_size"
-#define DECODER_MEMBER_TYPE "type"
-#define DECODER_MEMBER_TGT "target"
-#define DECODER_MEMBER_TGT2 "target2"
-
 void Opdis_initCallbacks( VALUE modOpdis );
 
-/* Genererate a hash suitable for passing to a Ruby Decoder method */
-VALUE Opdis_decoderHash( const opdis_insn_buf_t in, 
-                         const opdis_byte_t * buf, opdis_off_t offset,
-                         opdis_vma_t vma, opdis_off_t length );
+/* The built-in callback classes are thin wrappers around the libopdis
+ * defaults. If 'obj' uses the built-in implementation of the callback
+ * method (i.e. it is an instance of the class, or of a subclass which does
+ * not override the method), these return what to install in the opdis_t 
+ * instead of the Ruby callback. Otherwise they return NULL. */
+
+/* InstructionDecoder, X86Decoder, X86IntelDecoder: the decoder function */
+OPDIS_DECODER Opdis_builtinDecoder( VALUE obj );
+
+/* VisitedAddressTracker: the arg for opdis_default_handler */
+opdis_t Opdis_builtinHandlerArg( VALUE obj );
+
+/* AddressResolver: the resolver function */
+OPDIS_RESOLVER Opdis_builtinResolver( VALUE obj );
 
 #endif
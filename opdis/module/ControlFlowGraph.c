@@ -0,0 +1,510 @@
+/* ControlFlowGraph.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "ControlFlowGraph.h"
+#include "Disassembly.h"
+#include "Model.h"
+
+static VALUE clsCfg, clsBlock, clsEdge;
+
+/* ---------------------------------------------------------------------- */
+/* Native graph */
+
+/* per-instruction marks */
+#define CFG_LEADER	0x01		/* starts a block */
+#define CFG_END		0x02		/* ends a block */
+#define CFG_FALL	0x04		/* falls through to the next insn */
+#define CFG_TARGET	0x08		/* has a branch target */
+#define CFG_TYPE_SHIFT	4		/* edge type of the branch target */
+
+static void cfg_free_scratch( Opdis_cfg * cfg ) {
+	free( cfg->marks );
+	free( cfg->targets );
+	cfg->marks = NULL;
+	cfg->targets = NULL;
+}
+
+static void cfg_mark( void * ptr ) {
+	Opdis_cfg * cfg = (Opdis_cfg *) ptr;
+	rb_gc_mark(cfg->output);
+}
+
+static void cfg_free( void * ptr ) {
+	Opdis_cfg * cfg = (Opdis_cfg *) ptr;
+
+	cfg_free_scratch( cfg );
+	free( cfg->blocks );
+	free( cfg->edges );
+	free( cfg->preds );
+	free( cfg->pred_idx );
+	xfree( cfg );
+}
+
+static size_t cfg_memsize( const void * ptr ) {
+	const Opdis_cfg * cfg = (const Opdis_cfg *) ptr;
+	return sizeof(Opdis_cfg) +
+	       cfg->num_blocks * (sizeof(Opdis_cfg_block) + sizeof(size_t)) +
+	       cfg->num_edges * (sizeof(Opdis_cfg_edge) + sizeof(size_t));
+}
+
+static const rb_data_type_t cfg_data_type = {
+	"Opdis::ControlFlowGraph",
+	{ cfg_mark, cfg_free, cfg_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+#define CFG_ALLOC(count, size) \
+	Opdis_disassemblyAllocArray( count, size, "control flow graph" )
+
+/* index of the block starting at 'vma', or OPDIS_CFG_NO_BLOCK */
+static size_t cfg_find_block( Opdis_cfg * cfg, opdis_vma_t vma ) {
+	size_t lo = 0, hi = cfg->num_blocks;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( cfg->blocks[mid].vma < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return ( lo < cfg->num_blocks && cfg->blocks[lo].vma == vma ) ?
+		lo : OPDIS_CFG_NO_BLOCK;
+}
+
+/* index of the block containing 'vma', or OPDIS_CFG_NO_BLOCK */
+static size_t cfg_find_containing( Opdis_cfg * cfg, opdis_vma_t vma ) {
+	size_t lo = 0, hi = cfg->num_blocks;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( cfg->blocks[mid].vma <= vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return ( lo && vma < cfg->blocks[lo - 1].end ) ?
+		lo - 1 : OPDIS_CFG_NO_BLOCK;
+}
+
+static void cfg_mark_leader( Opdis_cfg * cfg, opdis_vma_t vma ) {
+	long idx = Opdis_disassemblyFind( cfg->output, vma );
+	if ( idx >= 0 ) {
+		cfg->marks[idx] |= CFG_LEADER;
+	}
+}
+
+/* mark block boundaries, using the resolved branch targets */
+static void cfg_mark_insns( Opdis_cfg * cfg, size_t count ) {
+	size_t i;
+
+	for ( i = 0; i < count; i++ ) {
+		const opdis_insn_t * insn = Opdis_disassemblyInsnAt(
+							cfg->output, i );
+		const Opdis_disasm_rec * next;
+		opdis_vma_t next_vma = insn->vma + insn->size;
+		int branch = opdis_insn_is_branch(insn);
+		int fall = opdis_insn_fallthrough(insn) && insn->size;
+		enum Opdis_cfg_edge_type type = cfg_edge_jump;
+
+		if ( branch || ! fall ) {
+			cfg->marks[i] |= CFG_END;
+		}
+		if ( fall ) {
+			cfg->marks[i] |= CFG_FALL;
+		}
+
+		if ( branch && cfg->targets[i] != OPDIS_INVALID_ADDR ) {
+			if ( insn->flags.cflow & (opdis_cflow_flag_call |
+						  opdis_cflow_flag_callcc) ) {
+				type = cfg_edge_call;
+			} else if ( insn->flags.cflow & opdis_cflow_flag_jmpcc ) {
+				type = cfg_edge_cond;
+			}
+
+			cfg->marks[i] |= CFG_TARGET | (type << CFG_TYPE_SHIFT);
+			cfg_mark_leader( cfg, cfg->targets[i] );
+		}
+
+		if (! fall ) {
+			continue;
+		}
+
+		/* a fall-through to anything but the next record (e.g. into
+		 * an overlapping instruction) ends the block */
+		next = Opdis_disassemblyRecAt( cfg->output, i + 1 );
+		if (! next || next->vma != next_vma ) {
+			cfg->marks[i] |= CFG_END;
+			cfg_mark_leader( cfg, next_vma );
+		}
+	}
+}
+
+static void cfg_add_edge( Opdis_cfg * cfg, size_t src, opdis_vma_t target,
+			  enum Opdis_cfg_edge_type type ) {
+	Opdis_cfg_edge * edge = &cfg->edges[cfg->num_edges++];
+
+	edge->src = src;
+	edge->dst = cfg_find_block( cfg, target );
+	edge->target = target;
+	edge->type = (unsigned char) type;
+	cfg->blocks[src].num_edges++;
+}
+
+static void cfg_build( Opdis_cfg * cfg, OPDIS_RESOLVER resolver,
+		       void * resolver_arg ) {
+	size_t i, count = Opdis_disassemblyCount( cfg->output );
+	Opdis_cfg_block * block = NULL;
+
+	cfg->marks = CFG_ALLOC( count, sizeof(unsigned char) );
+	cfg->targets = CFG_ALLOC( count, sizeof(opdis_vma_t) );
+
+	Opdis_disassemblyResolve( cfg->output, cfg->targets, resolver,
+				  resolver_arg );
+	cfg_mark_insns( cfg, count );
+	if ( count ) {
+		cfg->marks[0] |= CFG_LEADER;
+	}
+	if ( cfg->entry != OPDIS_INVALID_ADDR ) {
+		cfg_mark_leader( cfg, cfg->entry );
+	}
+
+	/* blocks */
+	for ( i = 0; i < count; i++ ) {
+		if ( i && cfg->marks[i - 1] & CFG_END ) {
+			cfg->marks[i] |= CFG_LEADER;
+		}
+		if ( cfg->marks[i] & CFG_LEADER ) {
+			cfg->num_blocks++;
+		}
+	}
+
+	cfg->blocks = CFG_ALLOC( cfg->num_blocks,
+				       sizeof(Opdis_cfg_block) );
+	for ( i = 0; i < count; i++ ) {
+		const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt(
+							cfg->output, i );
+
+		if ( cfg->marks[i] & CFG_LEADER ) {
+			block = block ? block + 1 : cfg->blocks;
+			block->vma = rec->vma;
+			block->insn = i;
+		}
+		block->end = rec->vma + rec->size;
+		block->num_insns++;
+	}
+
+	/* edges, from the last instruction of each block */
+	cfg->edges = CFG_ALLOC( cfg->num_blocks * 2,
+				      sizeof(Opdis_cfg_edge) );
+	for ( i = 0; i < cfg->num_blocks; i++ ) {
+		Opdis_cfg_block * b = &cfg->blocks[i];
+		size_t last = b->insn + b->num_insns - 1;
+		unsigned char mark = cfg->marks[last];
+
+		b->edge = cfg->num_edges;
+
+		if ( mark & CFG_TARGET ) {
+			cfg_add_edge( cfg, i, cfg->targets[last],
+				      mark >> CFG_TYPE_SHIFT );
+		}
+		if ( mark & CFG_FALL ) {
+			cfg_add_edge( cfg, i, b->end, cfg_edge_fallthrough );
+		}
+	}
+
+	/* incoming edges, by counting sort on the destination block */
+	cfg->pred_idx = CFG_ALLOC( cfg->num_blocks + 1,
+					 sizeof(size_t) );
+	cfg->preds = CFG_ALLOC( cfg->num_edges, sizeof(size_t) );
+	for ( i = 0; i < cfg->num_edges; i++ ) {
+		if ( cfg->edges[i].dst != OPDIS_CFG_NO_BLOCK ) {
+			cfg->pred_idx[cfg->edges[i].dst + 1]++;
+		}
+	}
+	for ( i = 0; i < cfg->num_blocks; i++ ) {
+		cfg->pred_idx[i + 1] += cfg->pred_idx[i];
+	}
+	for ( i = 0; i < cfg->num_edges; i++ ) {
+		size_t dst = cfg->edges[i].dst;
+		if ( dst != OPDIS_CFG_NO_BLOCK ) {
+			/* pred_idx[dst] is advanced to the end of its group */
+			cfg->preds[cfg->pred_idx[dst]++] = i;
+		}
+	}
+	for ( i = cfg->num_blocks; i > 0; i-- ) {
+		cfg->pred_idx[i] = cfg->pred_idx[i - 1];
+	}
+	cfg->pred_idx[0] = 0;
+
+	cfg_free_scratch( cfg );
+}
+
+/* ---------------------------------------------------------------------- */
+/* ControlFlowGraph Class */
+
+static Opdis_cfg * cfg_data( VALUE instance ) {
+	Opdis_cfg * cfg;
+	TypedData_Get_Struct(instance, Opdis_cfg, &cfg_data_type, cfg);
+	if ( Qnil == cfg->output ) {
+		rb_raise( rb_eRuntimeError, "ControlFlowGraph not initialized" );
+	}
+	return cfg;
+}
+
+static VALUE cls_cfg_alloc( VALUE class ) {
+	Opdis_cfg * cfg;
+	VALUE instance = TypedData_Make_Struct(class, Opdis_cfg,
+					       &cfg_data_type, cfg);
+	cfg->output = Qnil;
+	cfg->entry = OPDIS_INVALID_ADDR;
+	return instance;
+}
+
+/* ControlFlowGraph.new(disassembly, entry=nil) */
+static VALUE cls_cfg_init( int argc, VALUE * argv, VALUE instance ) {
+	Opdis_cfg * cfg;
+	VALUE output, entry;
+
+	rb_scan_args(argc, argv, "11", &output, &entry);
+	Opdis_disassemblyCheck( output );
+
+	TypedData_Get_Struct(instance, Opdis_cfg, &cfg_data_type, cfg);
+	if ( Qnil != cfg->output ) {
+		rb_raise( rb_eRuntimeError, "ControlFlowGraph already built" );
+	}
+
+	cfg->output = output;
+	if ( Qnil != entry ) {
+		cfg->entry = (opdis_vma_t) NUM2ULL(entry);
+	}
+
+	cfg_build( cfg, opdis_default_resolver, NULL );
+
+	return instance;
+}
+
+static VALUE block_value( Opdis_cfg * cfg, size_t idx ) {
+	Opdis_cfg_block * block = &cfg->blocks[idx];
+
+	return rb_struct_new( clsBlock, SIZET2NUM(idx), ULL2NUM(block->vma),
+			      ULL2NUM(block->end),
+			      rb_range_new( SIZET2NUM(block->insn),
+					    SIZET2NUM(block->insn +
+						      block->num_insns), 1 ) );
+}
+
+static VALUE edge_value( Opdis_cfg * cfg, size_t idx ) {
+	static const char * names[] = { CFG_EDGE_FALLTHROUGH, CFG_EDGE_JUMP,
+					CFG_EDGE_COND, CFG_EDGE_CALL };
+	Opdis_cfg_edge * edge = &cfg->edges[idx];
+
+	return rb_struct_new( clsEdge, SIZET2NUM(edge->src),
+			      (edge->dst == OPDIS_CFG_NO_BLOCK) ? Qnil :
+			      		SIZET2NUM(edge->dst),
+			      ULL2NUM(edge->target),
+			      ID2SYM(rb_intern(names[edge->type])) );
+}
+
+/* block index from a Ruby Integer; raises IndexError if out of range */
+static size_t block_index( Opdis_cfg * cfg, VALUE idx ) {
+	long i = NUM2LONG(idx);
+
+	if ( i < 0 ) {
+		i += (long) cfg->num_blocks;
+	}
+	if ( i < 0 || (size_t) i >= cfg->num_blocks ) {
+		rb_raise( rb_eIndexError, "Block index %ld out of range",
+			  NUM2LONG(idx) );
+	}
+
+	return (size_t) i;
+}
+
+static VALUE cls_cfg_disassembly( VALUE instance ) {
+	return cfg_data(instance)->output;
+}
+
+static VALUE cls_cfg_entry( VALUE instance ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	return ( cfg->entry == OPDIS_INVALID_ADDR ) ? Qnil :
+						      ULL2NUM(cfg->entry);
+}
+
+static VALUE cls_cfg_length( VALUE instance ) {
+	return SIZET2NUM(cfg_data(instance)->num_blocks);
+}
+
+static VALUE cls_cfg_get( VALUE instance, VALUE idx ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	long i = NUM2LONG(idx);
+
+	if ( i < 0 ) {
+		i += (long) cfg->num_blocks;
+	}
+	return ( i < 0 || (size_t) i >= cfg->num_blocks ) ? Qnil :
+		block_value( cfg, (size_t) i );
+}
+
+static VALUE cls_cfg_each( VALUE instance ) {
+	Opdis_cfg * cfg;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+
+	cfg = cfg_data(instance);
+	for ( i = 0; i < cfg->num_blocks; i++ ) {
+		rb_yield( block_value(cfg, i) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_cfg_blocks( VALUE instance ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	VALUE ary = rb_ary_new2( cfg->num_blocks );
+	size_t i;
+
+	for ( i = 0; i < cfg->num_blocks; i++ ) {
+		rb_ary_push( ary, block_value(cfg, i) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_cfg_edges( VALUE instance ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	VALUE ary = rb_ary_new2( cfg->num_edges );
+	size_t i;
+
+	for ( i = 0; i < cfg->num_edges; i++ ) {
+		rb_ary_push( ary, edge_value(cfg, i) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_cfg_block_at( VALUE instance, VALUE vma ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	size_t idx = cfg_find_containing( cfg, (opdis_vma_t) NUM2ULL(vma) );
+
+	return ( idx == OPDIS_CFG_NO_BLOCK ) ? Qnil : block_value( cfg, idx );
+}
+
+static VALUE cls_cfg_successors( VALUE instance, VALUE idx ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	Opdis_cfg_block * block = &cfg->blocks[block_index(cfg, idx)];
+	VALUE ary = rb_ary_new2( block->num_edges );
+	size_t i;
+
+	for ( i = 0; i < block->num_edges; i++ ) {
+		rb_ary_push( ary, edge_value(cfg, block->edge + i) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_cfg_predecessors( VALUE instance, VALUE idx ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	size_t b = block_index(cfg, idx);
+	VALUE ary = rb_ary_new2( cfg->pred_idx[b + 1] - cfg->pred_idx[b] );
+	size_t i;
+
+	for ( i = cfg->pred_idx[b]; i < cfg->pred_idx[b + 1]; i++ ) {
+		rb_ary_push( ary, edge_value(cfg, cfg->preds[i]) );
+	}
+
+	return ary;
+}
+
+/* Instructions are looked up by VMA, so this remains correct if the
+ * Disassembly has been modified since the graph was built */
+static VALUE cls_cfg_instructions( VALUE instance, VALUE idx ) {
+	Opdis_cfg * cfg = cfg_data(instance);
+	Opdis_cfg_block * block = &cfg->blocks[block_index(cfg, idx)];
+	opdis_vma_t lo = block->vma, hi = block->end;
+	VALUE ary = rb_ary_new2( block->num_insns );
+	size_t i;
+
+	for ( i = Opdis_disassemblyLowerBound( cfg->output, lo );
+	      i < Opdis_disassemblyCount( cfg->output ); i++ ) {
+		const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt(
+							cfg->output, i );
+		if ( rec->vma >= hi ) {
+			break;
+		}
+		rb_ary_push( ary, Opdis_disassemblyValueAt(cfg->output, i) );
+	}
+
+	return ary;
+}
+
+static void init_cfg_class( VALUE modOpdis ) {
+	clsCfg = rb_define_class_under(modOpdis, OPDIS_CFG_CLASS_NAME,
+				       rb_cObject);
+	rb_define_alloc_func(clsCfg, cls_cfg_alloc);
+	rb_include_module(clsCfg, rb_mEnumerable);
+
+	clsBlock = rb_struct_define_under( clsCfg, CFG_BLOCK_CLASS_NAME,
+					   CFG_BLOCK_INDEX, CFG_BLOCK_START,
+					   CFG_BLOCK_END, CFG_BLOCK_INSNS,
+					   NULL );
+	clsEdge = rb_struct_define_under( clsCfg, CFG_EDGE_CLASS_NAME,
+					  CFG_EDGE_FROM, CFG_EDGE_TO,
+					  CFG_EDGE_TARGET, CFG_EDGE_TYPE,
+					  NULL );
+
+	rb_define_method(clsCfg, "initialize", cls_cfg_init, -1);
+
+	rb_define_method(clsCfg, CFG_ATTR_DISASM, cls_cfg_disassembly, 0);
+	rb_define_method(clsCfg, CFG_ATTR_ENTRY, cls_cfg_entry, 0);
+
+	rb_define_method(clsCfg, CFG_METHOD_GET, cls_cfg_get, 1);
+	rb_define_method(clsCfg, CFG_METHOD_LENGTH, cls_cfg_length, 0);
+	rb_define_method(clsCfg, CFG_METHOD_SIZE, cls_cfg_length, 0);
+	rb_define_method(clsCfg, CFG_METHOD_EACH, cls_cfg_each, 0);
+	rb_define_method(clsCfg, CFG_METHOD_BLOCKS, cls_cfg_blocks, 0);
+	rb_define_method(clsCfg, CFG_METHOD_EDGES, cls_cfg_edges, 0);
+	rb_define_method(clsCfg, CFG_METHOD_BLOCK_AT, cls_cfg_block_at, 1);
+	rb_define_method(clsCfg, CFG_METHOD_SUCC, cls_cfg_successors, 1);
+	rb_define_method(clsCfg, CFG_METHOD_PRED, cls_cfg_predecessors, 1);
+	rb_define_method(clsCfg, CFG_METHOD_INSNS, cls_cfg_instructions, 1);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initControlFlowGraph( VALUE modOpdis ) {
+	init_cfg_class(modOpdis);
+}
+
+VALUE Opdis_cfgNew( VALUE output, opdis_vma_t entry, OPDIS_RESOLVER resolver,
+		    void * resolver_arg ) {
+	VALUE instance = cls_cfg_alloc(clsCfg);
+	Opdis_cfg * cfg;
+
+	TypedData_Get_Struct(instance, Opdis_cfg, &cfg_data_type, cfg);
+	cfg->output = output;
+	cfg->entry = entry;
+
+	cfg_build( cfg, resolver, resolver_arg );
+
+	return instance;
+}
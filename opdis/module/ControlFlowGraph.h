@@ -0,0 +1,105 @@
+/* ControlFlowGraph.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_CFG_H
+#define OPDIS_RB_CFG_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#define OPDIS_CFG_CLASS_NAME "ControlFlowGraph"
+#define CFG_BLOCK_CLASS_NAME "Block"
+#define CFG_EDGE_CLASS_NAME "Edge"
+
+#define CFG_ATTR_DISASM "disassembly"
+#define CFG_ATTR_ENTRY "entry"
+#define CFG_METHOD_GET "[]"
+#define CFG_METHOD_LENGTH "length"
+#define CFG_METHOD_SIZE "size"
+#define CFG_METHOD_EACH "each"
+#define CFG_METHOD_BLOCKS "blocks"
+#define CFG_METHOD_EDGES "edges"
+#define CFG_METHOD_BLOCK_AT "block_at"
+#define CFG_METHOD_SUCC "successors"
+#define CFG_METHOD_PRED "predecessors"
+#define CFG_METHOD_INSNS "instructions"
+
+/* Block members */
+#define CFG_BLOCK_INDEX "index"
+#define CFG_BLOCK_START "start"
+#define CFG_BLOCK_END "end"
+#define CFG_BLOCK_INSNS "insns"
+
+/* Edge members */
+#define CFG_EDGE_FROM "from"
+#define CFG_EDGE_TO "to"
+#define CFG_EDGE_TARGET "target"
+#define CFG_EDGE_TYPE "type"
+
+/* Edge types */
+#define CFG_EDGE_FALLTHROUGH "fallthrough"
+#define CFG_EDGE_JUMP "jump"
+#define CFG_EDGE_COND "cond"
+#define CFG_EDGE_CALL "call"
+
+enum Opdis_cfg_edge_type {
+	cfg_edge_fallthrough,
+	cfg_edge_jump,
+	cfg_edge_cond,
+	cfg_edge_call
+};
+
+/* dst of an edge whose target is not the start of a block */
+#define OPDIS_CFG_NO_BLOCK ((size_t) -1)
+
+/* A basic block: a run of adjacent instructions which is only entered at
+ * its first instruction and only left after its last. Blocks end at every
+ * branch, including calls. */
+typedef struct {
+	opdis_vma_t vma;		/* first instruction */
+	opdis_vma_t end;		/* first byte after the last instruction */
+	size_t insn;			/* index of first instruction */
+	size_t edge;			/* index of first outgoing edge */
+	unsigned int num_insns;
+	unsigned int num_edges;
+} Opdis_cfg_block;
+
+typedef struct {
+	opdis_vma_t target;
+	size_t src;
+	size_t dst;			/* OPDIS_CFG_NO_BLOCK if not a block */
+	unsigned char type;		/* Opdis_cfg_edge_type */
+} Opdis_cfg_edge;
+
+/* Blocks are sorted by VMA and edges by source block, so the outgoing edges
+ * of a block are contiguous. Incoming edges are listed in 'preds', which
+ * holds edge indices grouped by destination block. */
+typedef struct {
+	Opdis_cfg_block * blocks;
+	size_t num_blocks;
+	Opdis_cfg_edge * edges;
+	size_t num_edges;
+	size_t * preds;
+	size_t * pred_idx;		/* num_blocks + 1 offsets into preds */
+	opdis_vma_t entry;
+	VALUE output;			/* Disassembly the graph was built from */
+
+	/* per-instruction state used while building */
+	unsigned char * marks;
+	opdis_vma_t * targets;
+} Opdis_cfg;
+
+void Opdis_initControlFlowGraph( VALUE modOpdis );
+
+/* Build the control flow graph of the instructions in 'output'. Branch
+ * targets are obtained from 'resolver'; if 'entry' is not
+ * OPDIS_INVALID_ADDR, a block starts there. This reads the stored
+ * instructions and decodes nothing. */
+VALUE Opdis_cfgNew( VALUE output, opdis_vma_t entry, OPDIS_RESOLVER resolver,
+		    void * resolver_arg );
+
+#endif
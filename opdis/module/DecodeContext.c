@@ -0,0 +1,434 @@
+/* DecodeContext.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "DecodeContext.h"
+#include "Intern.h"
+
+static VALUE clsDecodeCtx, clsByteView;
+
+/* ---------------------------------------------------------------------- */
+/* DecodeContext Class */
+/* This replaces the Hash formerly passed to InstructionDecoder#decode. It
+ * wraps the decoder arguments without copying them; attributes are 
+ * converted to Ruby the first time they are accessed. A context is only
+ * valid for the duration of the decode call. */
+
+enum ctx_field {
+	ctx_field_vma,
+	ctx_field_offset,
+	ctx_field_size,
+	ctx_field_buffer,
+	ctx_field_items,
+	ctx_field_raw_insn,
+	ctx_field_branch_delay,
+	ctx_field_data_size,
+	ctx_field_type,
+	ctx_field_target,
+	ctx_field_target2,
+	ctx_field_max
+};
+
+static const char * ctx_field_names[ctx_field_max] = {
+	DECODER_MEMBER_VMA, DECODER_MEMBER_OFF, DECODER_MEMBER_LEN,
+	DECODER_MEMBER_BUF, DECODER_MEMBER_ITEMS, DECODER_MEMBER_STR,
+	DECODER_MEMBER_DELAY, DECODER_MEMBER_DATA, DECODER_MEMBER_TYPE,
+	DECODER_MEMBER_TGT, DECODER_MEMBER_TGT2
+};
+
+static ID ctx_field_ids[ctx_field_max];
+
+typedef struct {
+	Opdis_decode_args args;
+	int valid;
+	VALUE fields[ctx_field_max];	/* Qundef until converted */
+} Opdis_decode_ctx;
+
+static void ctx_mark( void * ptr ) {
+	int i;
+	Opdis_decode_ctx * ctx = (Opdis_decode_ctx *) ptr;
+
+	for ( i = 0; i < ctx_field_max; i++ ) {
+		if ( ctx->fields[i] != Qundef ) {
+			rb_gc_mark(ctx->fields[i]);
+		}
+	}
+}
+
+static size_t ctx_memsize( const void * ptr ) {
+	return sizeof(Opdis_decode_ctx);
+}
+
+static const rb_data_type_t ctx_data_type = {
+	"Opdis::DecodeContext",
+	{ ctx_mark, RUBY_TYPED_DEFAULT_FREE, ctx_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+static Opdis_decode_ctx * ctx_data( VALUE instance ) {
+	Opdis_decode_ctx * ctx;
+	TypedData_Get_Struct(instance, Opdis_decode_ctx, &ctx_data_type, ctx);
+	return ctx;
+}
+
+static Opdis_decode_ctx * valid_ctx_data( VALUE instance ) {
+	Opdis_decode_ctx * ctx = ctx_data(instance);
+	if (! ctx->valid ) {
+		rb_raise( rb_eRuntimeError, "DecodeContext used outside of "
+			  "InstructionDecoder#decode" );
+	}
+	return ctx;
+}
+
+static VALUE byte_view_new( VALUE owner, const opdis_byte_t * data,
+			    size_t len );
+static VALUE cls_view_to_s( VALUE instance );
+
+static VALUE insn_type_to_str( enum dis_insn_type t ) {
+	const char *s = "Unknown";
+	switch (t) {
+		case dis_noninsn: s = "Invalid"; break;
+		case dis_nonbranch: s = "Not branch"; break;
+		case dis_branch: s = "Unconditional branch"; break;
+		case dis_condbranch: s = "Conditional branch"; break;
+		case dis_jsr: s = "Jump to subroutine"; break;
+		case dis_condjsr: s = "Conditional jump to subroutine"; break;
+		case dis_dref: s = "Data reference"; break;
+		case dis_dref2: s = "Two data references"; break;
+	}
+	return Opdis_intern(s);
+}
+
+static VALUE ctx_field_from_c( VALUE instance, Opdis_decode_ctx * ctx,
+			       enum ctx_field field ) {
+	const Opdis_decode_args * args = &ctx->args;
+	opdis_insn_buf_t in = args->in;
+	char info = in->insn_info_valid;
+	unsigned int i;
+	VALUE ary;
+
+	switch ( field ) {
+		/* instruction location and size */
+		case ctx_field_vma: return ULL2NUM(args->vma);
+		case ctx_field_offset: return ULL2NUM(args->offset);
+		case ctx_field_size: return ULL2NUM(args->length);
+
+		/* target buffer, up to the end of the instruction */
+		case ctx_field_buffer:
+			return byte_view_new( instance, args->buf, 
+					(size_t) (args->offset + args->length));
+
+		/* decode instruction as provided by libopcodes */
+		case ctx_field_items:
+			ary = rb_ary_new2(in->item_count);
+			for ( i = 0; i < in->item_count; i++ ) {
+				rb_ary_push( ary, 
+					     rb_str_new_cstr(in->items[i]) );
+			}
+			return ary;
+		case ctx_field_raw_insn:
+			return in->string ? rb_str_new_cstr(in->string) : Qnil;
+
+		/* instruction metadata set by libopcodes */
+		case ctx_field_branch_delay:
+			return info ? INT2NUM(in->branch_delay_insns) : Qnil;
+		case ctx_field_data_size:
+			return info ? INT2NUM(in->data_size) : Qnil;
+		case ctx_field_type:
+			return info ? insn_type_to_str(in->insn_type) : Qnil;
+		case ctx_field_target:
+			return info ? ULL2NUM(in->target) : Qnil;
+		case ctx_field_target2:
+			return info ? ULL2NUM(in->target2) : Qnil;
+
+		default: break;
+	}
+
+	return Qnil;
+}
+
+static VALUE ctx_field( VALUE instance, enum ctx_field field ) {
+	Opdis_decode_ctx * ctx = valid_ctx_data(instance);
+
+	if ( ctx->fields[field] == Qundef ) {
+		ctx->fields[field] = ctx_field_from_c( instance, ctx, field );
+	}
+
+	return ctx->fields[field];
+}
+
+#define CTX_READER(name, field) \
+static VALUE cls_ctx_get_##name( VALUE instance ) { \
+	return ctx_field(instance, field); \
+}
+
+CTX_READER(vma, ctx_field_vma)
+CTX_READER(offset, ctx_field_offset)
+CTX_READER(size, ctx_field_size)
+CTX_READER(buffer, ctx_field_buffer)
+CTX_READER(items, ctx_field_items)
+CTX_READER(raw_insn, ctx_field_raw_insn)
+CTX_READER(branch_delay, ctx_field_branch_delay)
+CTX_READER(data_size, ctx_field_data_size)
+CTX_READER(type, ctx_field_type)
+CTX_READER(target, ctx_field_target)
+CTX_READER(target2, ctx_field_target2)
+
+/* Hash-style access, for decoders written against the old Hash argument */
+static VALUE cls_ctx_get( VALUE instance, VALUE key ) {
+	ID id;
+	int i;
+
+	if ( SYMBOL_P(key) ) {
+		id = SYM2ID(key);
+	} else {
+		id = rb_intern( StringValueCStr(key) );
+	}
+
+	for ( i = 0; i < ctx_field_max; i++ ) {
+		if ( ctx_field_ids[i] == id ) {
+			return ctx_field( instance, (enum ctx_field) i );
+		}
+	}
+
+	return Qnil;
+}
+
+/* Hash of all attributes. Note that this copies the buffer. */
+static VALUE cls_ctx_to_h( VALUE instance ) {
+	VALUE hash = rb_hash_new();
+	int i;
+
+	for ( i = 0; i < ctx_field_max; i++ ) {
+		VALUE val = ctx_field( instance, (enum ctx_field) i );
+		if ( i == ctx_field_buffer ) {
+			val = cls_view_to_s( val );
+		}
+		rb_hash_aset( hash, ID2SYM(ctx_field_ids[i]), val );
+	}
+
+	return hash;
+}
+
+static VALUE cls_ctx_valid( VALUE instance ) {
+	return ctx_data(instance)->valid ? Qtrue : Qfalse;
+}
+
+static void init_ctx_class( VALUE modOpdis ) {
+	int i;
+
+	for ( i = 0; i < ctx_field_max; i++ ) {
+		ctx_field_ids[i] = rb_intern(ctx_field_names[i]);
+	}
+
+	clsDecodeCtx = rb_define_class_under(modOpdis, DECODE_CTX_CLASS_NAME,
+					     rb_cObject);
+	rb_undef_alloc_func(clsDecodeCtx);
+
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_VMA, cls_ctx_get_vma, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_OFF, 
+			 cls_ctx_get_offset, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_LEN, cls_ctx_get_size, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_BUF, 
+			 cls_ctx_get_buffer, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_ITEMS, 
+			 cls_ctx_get_items, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_STR, 
+			 cls_ctx_get_raw_insn, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_DELAY, 
+			 cls_ctx_get_branch_delay, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_DATA, 
+			 cls_ctx_get_data_size, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_TYPE, 
+			 cls_ctx_get_type, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_TGT, 
+			 cls_ctx_get_target, 0);
+	rb_define_method(clsDecodeCtx, DECODER_MEMBER_TGT2, 
+			 cls_ctx_get_target2, 0);
+
+	rb_define_method(clsDecodeCtx, DECODE_CTX_METHOD_GET, cls_ctx_get, 1);
+	rb_define_method(clsDecodeCtx, DECODE_CTX_METHOD_TO_H, cls_ctx_to_h, 
+			 0);
+	rb_define_method(clsDecodeCtx, DECODE_CTX_METHOD_VALID, cls_ctx_valid,
+			 0);
+}
+
+/* ---------------------------------------------------------------------- */
+/* ByteView Class */
+/* A read-only view of bytes owned by a DecodeContext. It is only valid 
+ * while its context is. */
+
+typedef struct {
+	const opdis_byte_t * data;
+	size_t len;
+	VALUE owner;			/* DecodeContext */
+} Opdis_byte_view;
+
+static void view_mark( void * ptr ) {
+	rb_gc_mark( ((Opdis_byte_view *) ptr)->owner );
+}
+
+static size_t view_memsize( const void * ptr ) {
+	return sizeof(Opdis_byte_view);
+}
+
+static const rb_data_type_t view_data_type = {
+	"Opdis::ByteView",
+	{ view_mark, RUBY_TYPED_DEFAULT_FREE, view_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+static VALUE byte_view_new( VALUE owner, const opdis_byte_t * data,
+			    size_t len ) {
+	Opdis_byte_view * view;
+	VALUE instance = TypedData_Make_Struct(clsByteView, Opdis_byte_view,
+					       &view_data_type, view);
+	view->data = data;
+	view->len = len;
+	view->owner = owner;
+	return instance;
+}
+
+static Opdis_byte_view * view_data( VALUE instance ) {
+	Opdis_byte_view * view;
+	TypedData_Get_Struct(instance, Opdis_byte_view, &view_data_type, view);
+
+	/* raises if the context has been released */
+	valid_ctx_data( view->owner );
+	return view;
+}
+
+static VALUE cls_view_length( VALUE instance ) {
+	return ULONG2NUM( view_data(instance)->len );
+}
+
+/* view[idx] => Integer, view[start, len] => String */
+static VALUE cls_view_get( int argc, VALUE * argv, VALUE instance ) {
+	Opdis_byte_view * view = view_data(instance);
+	VALUE rb_idx, rb_len;
+	long idx, len;
+
+	rb_scan_args( argc, argv, "11", &rb_idx, &rb_len );
+
+	idx = NUM2LONG(rb_idx);
+	if ( idx < 0 ) {
+		idx += (long) view->len;
+	}
+
+	if ( Qnil == rb_len ) {
+		if ( idx < 0 || (size_t) idx >= view->len ) {
+			return Qnil;
+		}
+		return INT2FIX( view->data[idx] );
+	}
+
+	len = NUM2LONG(rb_len);
+	if ( idx < 0 || (size_t) idx > view->len || len < 0 ) {
+		return Qnil;
+	}
+	/* clamp before forming the end, which may overflow */
+	if ( len > (long) view->len - idx ) {
+		len = (long) view->len - idx;
+	}
+
+	return rb_str_new( (const char *) view->data + idx, len );
+}
+
+static VALUE cls_view_each_byte( VALUE instance ) {
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+
+	/* the view is re-checked on every iteration: the block may outlive
+	 * the decode call */
+	for ( i = 0; i < view_data(instance)->len; i++ ) {
+		rb_yield( INT2FIX(view_data(instance)->data[i]) );
+	}
+
+	return instance;
+}
+
+/* copy the bytes into a binary String */
+static VALUE cls_view_to_s( VALUE instance ) {
+	Opdis_byte_view * view = view_data(instance);
+	return rb_str_new( (const char *) view->data, view->len );
+}
+
+static void init_view_class( VALUE modOpdis ) {
+	clsByteView = rb_define_class_under(modOpdis, BYTE_VIEW_CLASS_NAME,
+					    rb_cObject);
+	rb_undef_alloc_func(clsByteView);
+	rb_include_module(clsByteView, rb_mEnumerable);
+
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_GET, cls_view_get, -1);
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_LENGTH, 
+			 cls_view_length, 0);
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_SIZE, cls_view_length,
+			 0);
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_EACH, 
+			 cls_view_each_byte, 0);
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_EACH_ALIAS, 
+			 cls_view_each_byte, 0);
+	rb_define_method(clsByteView, BYTE_VIEW_METHOD_TO_S, cls_view_to_s, 0);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initDecodeContext( VALUE modOpdis ) {
+	init_ctx_class(modOpdis);
+	init_view_class(modOpdis);
+}
+
+VALUE Opdis_decodeContextNew( const Opdis_decode_args * args ) {
+	Opdis_decode_ctx * ctx;
+	VALUE instance = TypedData_Make_Struct(clsDecodeCtx, Opdis_decode_ctx,
+					       &ctx_data_type, ctx);
+	int i;
+
+	ctx->args = *args;
+	ctx->valid = 1;
+	for ( i = 0; i < ctx_field_max; i++ ) {
+		ctx->fields[i] = Qundef;
+	}
+
+	return instance;
+}
+
+VALUE Opdis_decodeContextRelease( VALUE instance ) {
+	Opdis_decode_ctx * ctx = ctx_data(instance);
+
+	ctx->valid = 0;
+	ctx->args.in = NULL;
+	ctx->args.buf = NULL;
+
+	return Qnil;
+}
+
+int Opdis_decodeContextArgs( VALUE instance, Opdis_decode_args * args ) {
+	Opdis_decode_ctx * ctx;
+
+	if (! rb_typeddata_is_kind_of(instance, &ctx_data_type) ) {
+		return 0;
+	}
+
+	ctx = ctx_data(instance);
+	if (! ctx->valid ) {
+		return 0;
+	}
+
+	*args = ctx->args;
+	return 1;
+}
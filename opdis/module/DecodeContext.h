@@ -0,0 +1,66 @@
+/* DecodeContext.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_DECODE_CONTEXT_H
+#define OPDIS_RB_DECODE_CONTEXT_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#define DECODE_CTX_CLASS_NAME "DecodeContext"
+#define BYTE_VIEW_CLASS_NAME "ByteView"
+
+/* info provided to decoder */
+#define DECODER_MEMBER_VMA "vma"
+#define DECODER_MEMBER_OFF "offset"
+#define DECODER_MEMBER_LEN "size"
+#define DECODER_MEMBER_BUF "buffer"
+#define DECODER_MEMBER_ITEMS "items"
+#define DECODER_MEMBER_STR "raw_insn"
+#define DECODER_MEMBER_DELAY "branch_delay"
+#define DECODER_MEMBER_DATA "data_size"
+#define DECODER_MEMBER_TYPE "type"
+#define DECODER_MEMBER_TGT "target"
+#define DECODER_MEMBER_TGT2 "target2"
+
+#define DECODE_CTX_METHOD_GET "[]"
+#define DECODE_CTX_METHOD_TO_H "to_h"
+#define DECODE_CTX_METHOD_VALID "valid?"
+
+#define BYTE_VIEW_METHOD_GET "[]"
+#define BYTE_VIEW_METHOD_LENGTH "length"
+#define BYTE_VIEW_METHOD_SIZE "size"
+#define BYTE_VIEW_METHOD_EACH "each_byte"
+#define BYTE_VIEW_METHOD_EACH_ALIAS "each"
+#define BYTE_VIEW_METHOD_TO_S "to_s"
+
+/* The arguments passed by libopdis to an OPDIS_DECODER */
+typedef struct {
+	opdis_insn_buf_t in;
+	const opdis_byte_t * buf;
+	opdis_off_t offset;
+	opdis_vma_t vma;
+	opdis_off_t length;
+} Opdis_decode_args;
+
+void Opdis_initDecodeContext( VALUE modOpdis );
+
+/* Create a DecodeContext for the arguments of a decoder callback. Nothing
+ * is copied: the context refers to the libopdis buffers, and Ruby objects
+ * are only created when an attribute is accessed. */
+VALUE Opdis_decodeContextNew( const Opdis_decode_args * args );
+
+/* Invalidate a DecodeContext once the buffers it refers to are no longer
+ * valid. Later attribute accesses raise. Returns Qnil, so that this can 
+ * be passed to rb_ensure. */
+VALUE Opdis_decodeContextRelease( VALUE ctx );
+
+/* Fill 'args' from a valid DecodeContext. Returns 0 if 'ctx' is not a
+ * DecodeContext or has been released. */
+int Opdis_decodeContextArgs( VALUE ctx, Opdis_decode_args * args );
+
+#endif
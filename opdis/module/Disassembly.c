@@ -0,0 +1,1206 @@
+/* Disassembly.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "ControlFlowGraph.h"
+#include "Xrefs.h"
+#include "Pattern.h"
+#include "Disassembly.h"
+#include "Intern.h"
+#include "Model.h"
+
+#define ALLOC_FIXED_INSN opdis_insn_alloc_fixed(128, 32, 16, 32)
+
+/* initial number of records allocated for a store */
+#define STORE_MIN_ALLOC 256
+/* the branch index is rebuilt, rather than updated, once more than one in
+ * this many records are stale */
+#define BRANCH_STALE_RATIO 4
+
+static VALUE clsOutput;
+
+/* ---------------------------------------------------------------------- */
+/* Native store */
+
+static void store_mark( void * ptr ) {
+	size_t i;
+	Opdis_disasm_store * store = (Opdis_disasm_store *) ptr;
+
+	rb_gc_mark(store->errors);
+	rb_gc_mark(store->backing);
+	rb_gc_mark(store->cfg);
+	rb_gc_mark(store->xrefs);
+	rb_gc_mark(store->functions);
+	for ( i = 0; i < store->count; i++ ) {
+		if ( store->recs[i].obj != Qnil ) {
+			rb_gc_mark(store->recs[i].obj);
+		}
+	}
+}
+
+static void store_free( void * ptr ) {
+	size_t i;
+	Opdis_disasm_store * store = (Opdis_disasm_store *) ptr;
+
+	for ( i = 0; i < store->count; i++ ) {
+		if ( store->recs[i].insn ) {
+			opdis_insn_free(store->recs[i].insn);
+		}
+	}
+
+	free(store->recs);
+	free(store->branches.items);
+	free(store->branches.stale);
+	free(store);
+}
+
+static void store_reserve( Opdis_disasm_store * store, size_t count ) {
+	size_t alloc;
+	Opdis_disasm_rec * recs;
+
+	if ( count <= store->alloc ) {
+		return;
+	}
+
+	alloc = store->alloc ? store->alloc : STORE_MIN_ALLOC;
+	while ( alloc < count ) {
+		alloc *= 2;
+	}
+
+	recs = realloc( store->recs, alloc * sizeof(Opdis_disasm_rec) );
+	if (! recs ) {
+		rb_raise( rb_eNoMemError, "Unable to grow Disassembly to %lu "
+			  "instructions", (unsigned long) alloc );
+	}
+
+	store->recs = recs;
+	store->alloc = alloc;
+}
+
+static int rec_cmp( const void * a, const void * b ) {
+	const Opdis_disasm_rec * ra = (const Opdis_disasm_rec *) a;
+	const Opdis_disasm_rec * rb = (const Opdis_disasm_rec *) b;
+
+	if ( ra->vma != rb->vma ) {
+		return (ra->vma < rb->vma) ? -1 : 1;
+	}
+	return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+/* sort records by VMA. Like a Hash, the most recently added instruction for
+ * a VMA replaces any earlier ones. */
+static void store_sort( Opdis_disasm_store * store ) {
+	size_t i, out;
+
+	if ( store->sorted ) {
+		return;
+	}
+
+	qsort( store->recs, store->count, sizeof(Opdis_disasm_rec), rec_cmp );
+
+	for ( i = 0, out = 0; i < store->count; i++ ) {
+		if ( i + 1 < store->count &&
+		     store->recs[i + 1].vma == store->recs[i].vma ) {
+			/* superseded by a later record */
+			if ( store->recs[i].insn ) {
+				opdis_insn_free(store->recs[i].insn);
+			}
+			continue;
+		}
+		store->recs[out++] = store->recs[i];
+	}
+
+	store->count = out;
+	store->sorted = 1;
+}
+
+/* return index of the first record at or after vma */
+static size_t store_lower_bound( Opdis_disasm_store * store, 
+				 opdis_vma_t vma ) {
+	size_t lo = 0, hi;
+
+	store_sort(store);
+
+	hi = store->count;
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( store->recs[mid].vma < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* return index of record for vma, or -1 */
+static long store_find( Opdis_disasm_store * store, opdis_vma_t vma ) {
+	size_t idx = store_lower_bound( store, vma );
+
+	return ( idx < store->count && store->recs[idx].vma == vma ) ?
+		(long) idx : -1;
+}
+
+/* return index of the record containing vma, or -1. As with a backwards
+ * scan, only the nearest record at or before vma is considered. */
+static long store_find_containing( Opdis_disasm_store * store, 
+				   opdis_vma_t vma ) {
+	size_t idx = store_lower_bound( store, vma );
+
+	if ( idx < store->count && store->recs[idx].vma == vma ) {
+		return (long) idx;
+	}
+
+	if ( idx == 0 ) {
+		return -1;
+	}
+
+	idx--;
+	return ( vma - store->recs[idx].vma < store->recs[idx].size ) ?
+		(long) idx : -1;
+}
+
+/* drop the results which describe the current instructions */
+static void store_discard_analysis( Opdis_disasm_store * store ) {
+	store->cfg = Qnil;
+	store->xrefs = Qnil;
+	store->functions = Qnil;
+}
+
+static void branches_invalidate( Opdis_branch_index * br ) {
+	br->valid = 0;
+	br->count = 0;
+	br->num_stale = 0;
+}
+
+/* note that the record at 'vma' was added, replaced or removed */
+static void branches_touch( Opdis_disasm_store * store, opdis_vma_t vma ) {
+	Opdis_branch_index * br = &store->branches;
+
+	if (! br->valid ) {
+		return;
+	}
+
+	if ( br->num_stale > store->count / BRANCH_STALE_RATIO ) {
+		branches_invalidate( br );
+		return;
+	}
+
+	if ( br->num_stale == br->stale_alloc ) {
+		size_t alloc = br->stale_alloc ? br->stale_alloc * 2 : 64;
+		opdis_vma_t * stale = realloc( br->stale,
+					       alloc * sizeof(opdis_vma_t) );
+		if (! stale ) {
+			/* the index is rebuilt when next used */
+			branches_invalidate( br );
+			return;
+		}
+		br->stale = stale;
+		br->stale_alloc = alloc;
+	}
+
+	br->stale[br->num_stale++] = vma;
+}
+
+/* add a record. Either 'insn' or 'image' must be set. */
+static void store_add_rec( Opdis_disasm_store * store, opdis_vma_t vma,
+			   unsigned int size, opdis_insn_t * insn, 
+			   const void * image, VALUE obj ) {
+	Opdis_disasm_rec * rec;
+
+	store_discard_analysis( store );
+	branches_touch( store, vma );
+
+	if ( store->count && store->sorted ) {
+		rec = &store->recs[store->count - 1];
+		if ( rec->vma == vma ) {
+			/* replace existing instruction */
+			if ( rec->insn ) {
+				opdis_insn_free(rec->insn);
+			}
+			rec->insn = insn;
+			rec->image = image;
+			rec->obj = obj;
+			rec->size = size;
+			return;
+		}
+
+		if ( rec->vma > vma ) {
+			store->sorted = 0;
+		}
+	}
+
+	store_reserve( store, store->count + 1 );
+
+	rec = &store->recs[store->count++];
+	rec->vma = vma;
+	rec->size = size;
+	rec->insn = insn;
+	rec->image = image;
+	rec->obj = obj;
+	rec->seq = store->next_seq++;
+}
+
+static void store_add( Opdis_disasm_store * store, opdis_insn_t * insn,
+		       VALUE obj ) {
+	store_add_rec( store, insn->vma, (unsigned int) insn->size, insn, 
+		       NULL, obj );
+}
+
+/* return the C instruction for a record, loading it from its image if
+ * needed */
+static opdis_insn_t * store_rec_insn( Opdis_disasm_store * store, 
+				      size_t idx ) {
+	Opdis_disasm_rec * rec = &store->recs[idx];
+
+	if (! rec->insn ) {
+		rec->insn = store->loader( rec->image );
+		if (! rec->insn ) {
+			rb_raise( rb_eNoMemError, "Unable to load instruction" );
+		}
+	}
+
+	return rec->insn;
+}
+
+/* return the Ruby Instruction object for a record, creating it if needed */
+static VALUE store_rec_value( Opdis_disasm_store * store, size_t idx ) {
+	VALUE obj = store->recs[idx].obj;
+
+	if ( obj == Qnil ) {
+		obj = Opdis_insnFromC( store_rec_insn(store, idx) );
+		/* store may not be modified by Opdis_insnFromC, but be safe */
+		if ( idx < store->count ) {
+			store->recs[idx].obj = obj;
+		}
+	}
+
+	return obj;
+}
+
+static void store_delete( Opdis_disasm_store * store, size_t idx ) {
+	store_discard_analysis( store );
+	branches_touch( store, store->recs[idx].vma );
+
+	if ( store->recs[idx].insn ) {
+		opdis_insn_free(store->recs[idx].insn);
+	}
+
+	memmove( &store->recs[idx], &store->recs[idx + 1],
+		 (store->count - idx - 1) * sizeof(Opdis_disasm_rec) );
+	store->count--;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Branch index */
+
+static int cmp_branch( const void * a, const void * b ) {
+	const Opdis_disasm_branch * ba = (const Opdis_disasm_branch *) a;
+	const Opdis_disasm_branch * bb = (const Opdis_disasm_branch *) b;
+
+	if ( ba->target != bb->target ) {
+		return (ba->target < bb->target) ? -1 : 1;
+	}
+	return (ba->src < bb->src) ? -1 : (ba->src > bb->src);
+}
+
+static int cmp_vma( const void * a, const void * b ) {
+	opdis_vma_t va = *(const opdis_vma_t *) a;
+	opdis_vma_t vb = *(const opdis_vma_t *) b;
+	return (va < vb) ? -1 : (va > vb);
+}
+
+static void branches_add( Opdis_branch_index * br, opdis_vma_t target,
+			  opdis_vma_t src ) {
+	if ( br->count == br->alloc ) {
+		size_t alloc = br->alloc ? br->alloc * 2 : STORE_MIN_ALLOC;
+		Opdis_disasm_branch * items = realloc( br->items,
+					alloc * sizeof(Opdis_disasm_branch) );
+		if (! items ) {
+			rb_raise( rb_eNoMemError, "Unable to allocate branch "
+				  "index" );
+		}
+		br->items = items;
+		br->alloc = alloc;
+	}
+
+	br->items[br->count].target = target;
+	br->items[br->count].src = src;
+	br->count++;
+}
+
+/* add the branch of record 'idx' (if it has one) to the index. 'count' is
+ * the number of records before the resolver was invoked. */
+static void branches_resolve( Opdis_disasm_store * store, size_t idx,
+			      size_t count, OPDIS_RESOLVER resolver,
+			      void * resolver_arg ) {
+	const opdis_insn_t * insn = store_rec_insn( store, idx );
+	opdis_vma_t src = store->recs[idx].vma;
+	opdis_vma_t tgt;
+
+	if (! opdis_insn_is_branch(insn) ) {
+		return;
+	}
+
+	tgt = resolver( insn, resolver_arg );
+
+	/* a Ruby resolver could modify the Disassembly */
+	if ( count != store->count ) {
+		rb_raise( rb_eRuntimeError, "Disassembly modified during "
+			  "branch resolution" );
+	}
+
+	if ( tgt != OPDIS_INVALID_ADDR ) {
+		branches_add( &store->branches, tgt, src );
+	}
+}
+
+/* The index is invalid while it is being built, so a resolver which raises
+ * leaves it to be rebuilt on next use. The arrays are owned by the store,
+ * so nothing leaks. */
+static void branches_rebuild( Opdis_disasm_store * store,
+			      OPDIS_RESOLVER resolver, void * resolver_arg ) {
+	Opdis_branch_index * br = &store->branches;
+	size_t i, count = store->count;
+
+	branches_invalidate( br );
+	br->resolver = resolver;
+
+	for ( i = 0; i < count; i++ ) {
+		branches_resolve( store, i, count, resolver, resolver_arg );
+	}
+
+	if ( br->count ) {
+		qsort( br->items, br->count, sizeof(Opdis_disasm_branch),
+		       cmp_branch );
+	}
+}
+
+/* merge the sorted branches from 'first' on into the sorted ones before */
+static void branches_merge( Opdis_branch_index * br, size_t first ) {
+	size_t n = br->count - first, i = first, j = n, out = br->count;
+	Opdis_disasm_branch * added = malloc( n * sizeof(Opdis_disasm_branch) );
+
+	if (! added ) {
+		qsort( br->items, br->count, sizeof(Opdis_disasm_branch),
+		       cmp_branch );
+		return;
+	}
+	memcpy( added, &br->items[first], n * sizeof(Opdis_disasm_branch) );
+
+	while ( j ) {
+		if ( i && cmp_branch( &br->items[i - 1], &added[j - 1] ) > 0 ) {
+			br->items[--out] = br->items[--i];
+		} else {
+			br->items[--out] = added[--j];
+		}
+	}
+
+	free( added );
+}
+
+/* replace the branches of the stale records. Only these are resolved. */
+static void branches_update( Opdis_disasm_store * store ) {
+	Opdis_branch_index * br = &store->branches;
+	size_t i, out, first, count = store->count;
+
+	br->valid = 0;
+	qsort( br->stale, br->num_stale, sizeof(opdis_vma_t), cmp_vma );
+
+	for ( i = 0, out = 0; i < br->count; i++ ) {
+		if (! bsearch( &br->items[i].src, br->stale, br->num_stale,
+			       sizeof(opdis_vma_t), cmp_vma ) ) {
+			br->items[out++] = br->items[i];
+		}
+	}
+	br->count = out;
+
+	first = br->count;
+	for ( i = 0; i < br->num_stale; i++ ) {
+		long idx;
+
+		if ( i && br->stale[i] == br->stale[i - 1] ) {
+			continue;
+		}
+
+		idx = store_find( store, br->stale[i] );
+		if ( idx >= 0 ) {
+			branches_resolve( store, (size_t) idx, count,
+					  br->resolver, NULL );
+		}
+	}
+	br->num_stale = 0;
+
+	if ( br->count > first ) {
+		qsort( &br->items[first], br->count - first,
+		       sizeof(Opdis_disasm_branch), cmp_branch );
+		branches_merge( br, first );
+	}
+}
+
+#define GET_STORE(instance, store) \
+	Data_Get_Struct(instance, Opdis_disasm_store, store); \
+	if (! store ) { \
+		rb_raise( rb_eRuntimeError, "Invalid Disassembly" ); \
+	}
+
+/* ---------------------------------------------------------------------- */
+/* Disasm Output Class */
+/* This behaves like a Hash of VMA => Instruction entries, with an @errors
+ * attribute that gets filled with error messages from the disassembler.
+ * Instructions are stored as opdis_insn_t records sorted by VMA; Ruby
+ * Instruction objects are created only when they are accessed. */
+
+static VALUE cls_output_alloc( VALUE class ) {
+	Opdis_disasm_store * store;
+	VALUE instance = Data_Make_Struct(class, Opdis_disasm_store,
+					  store_mark, store_free, store);
+	store->errors = rb_ary_new();
+	store->backing = Qnil;
+	store->cfg = Qnil;
+	store->xrefs = Qnil;
+	store->functions = Qnil;
+	store->sorted = 1;
+	return instance;
+}
+
+/* insn containing vma */
+static VALUE cls_output_contain( VALUE instance, VALUE vma ) {
+	Opdis_disasm_store * store;
+	long idx;
+
+	GET_STORE(instance, store);
+
+	idx = store_find_containing( store, (opdis_vma_t) NUM2ULL(vma) );
+	return (idx < 0) ? Qfalse : store_rec_value( store, idx );
+}
+
+/* instructions with lo <= vma < hi, in VMA order */
+static VALUE cls_output_range( VALUE instance, VALUE lo, VALUE hi ) {
+	Opdis_disasm_store * store;
+	opdis_vma_t end = (opdis_vma_t) NUM2ULL(hi);
+	VALUE ary = rb_ary_new();
+	size_t i;
+
+	GET_STORE(instance, store);
+
+	i = store_lower_bound( store, (opdis_vma_t) NUM2ULL(lo) );
+	for ( ; i < store->count && store->recs[i].vma < end; i++ ) {
+		rb_ary_push( ary, store_rec_value(store, i) );
+	}
+
+	return ary;
+}
+
+/* NOTE: the block may modify the Disassembly, so the position of the next
+ * instruction is looked up again on every iteration */
+static VALUE cls_output_each_between( VALUE instance, VALUE lo, VALUE hi ) {
+	Opdis_disasm_store * store;
+	opdis_vma_t vma = (opdis_vma_t) NUM2ULL(lo);
+	opdis_vma_t end = (opdis_vma_t) NUM2ULL(hi);
+	VALUE argv[2];
+	size_t i;
+
+	argv[0] = lo;
+	argv[1] = hi;
+	RETURN_ENUMERATOR(instance, 2, argv);
+	GET_STORE(instance, store);
+
+	for ( ;; ) {
+		i = store_lower_bound( store, vma );
+		if ( i >= store->count || store->recs[i].vma >= end ) {
+			break;
+		}
+
+		/* vma < end, so this cannot overflow */
+		vma = store->recs[i].vma + 1;
+		rb_yield( store_rec_value(store, i) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_output_get( VALUE instance, VALUE vma ) {
+	Opdis_disasm_store * store;
+	long idx;
+
+	GET_STORE(instance, store);
+
+	idx = store_find( store, (opdis_vma_t) NUM2ULL(vma) );
+	return (idx < 0) ? Qnil : store_rec_value( store, idx );
+}
+
+static VALUE cls_output_set( VALUE instance, VALUE vma, VALUE insn ) {
+	Opdis_disasm_store * store;
+	opdis_insn_t * c_insn;
+
+	GET_STORE(instance, store);
+
+	c_insn = ALLOC_FIXED_INSN;
+	if (! Opdis_insnToC( insn, c_insn ) ) {
+		opdis_insn_free(c_insn);
+		rb_raise( rb_eArgError, "Value must be an Opdis::Instruction" );
+	}
+	c_insn->vma = (opdis_vma_t) NUM2ULL(vma);
+
+	store_add( store, c_insn, insn );
+
+	return insn;
+}
+
+static VALUE cls_output_delete( VALUE instance, VALUE vma ) {
+	Opdis_disasm_store * store;
+	VALUE obj;
+	long idx;
+
+	GET_STORE(instance, store);
+
+	idx = store_find( store, (opdis_vma_t) NUM2ULL(vma) );
+	if ( idx < 0 ) {
+		return Qnil;
+	}
+
+	obj = store_rec_value( store, idx );
+	store_delete( store, idx );
+
+	return obj;
+}
+
+static VALUE cls_output_has_key( VALUE instance, VALUE vma ) {
+	Opdis_disasm_store * store;
+	GET_STORE(instance, store);
+
+	return (store_find( store, (opdis_vma_t) NUM2ULL(vma) ) < 0) ?
+		Qfalse : Qtrue;
+}
+
+static VALUE cls_output_length( VALUE instance ) {
+	Opdis_disasm_store * store;
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	return ULONG2NUM(store->count);
+}
+
+static VALUE cls_output_empty( VALUE instance ) {
+	Opdis_disasm_store * store;
+	GET_STORE(instance, store);
+
+	return store->count ? Qfalse : Qtrue;
+}
+
+/* NOTE: the block may modify the Disassembly, so the store is re-checked
+ * on every iteration */
+static VALUE cls_output_each( VALUE instance ) {
+	Opdis_disasm_store * store;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	for ( i = 0; i < store->count; i++ ) {
+		VALUE key = ULL2NUM(store->recs[i].vma);
+		rb_yield( rb_assoc_new(key, store_rec_value(store, i)) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_output_each_key( VALUE instance ) {
+	Opdis_disasm_store * store;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	for ( i = 0; i < store->count; i++ ) {
+		rb_yield( ULL2NUM(store->recs[i].vma) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_output_each_value( VALUE instance ) {
+	Opdis_disasm_store * store;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	for ( i = 0; i < store->count; i++ ) {
+		rb_yield( store_rec_value(store, i) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_output_keys( VALUE instance ) {
+	Opdis_disasm_store * store;
+	VALUE ary;
+	size_t i;
+
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	ary = rb_ary_new2(store->count);
+	for ( i = 0; i < store->count; i++ ) {
+		rb_ary_push( ary, ULL2NUM(store->recs[i].vma) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_output_values( VALUE instance ) {
+	Opdis_disasm_store * store;
+	VALUE ary;
+	size_t i;
+
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	ary = rb_ary_new2(store->count);
+	for ( i = 0; i < store->count; i++ ) {
+		rb_ary_push( ary, store_rec_value(store, i) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_output_to_h( VALUE instance ) {
+	Opdis_disasm_store * store;
+	VALUE hash;
+	size_t i;
+
+	GET_STORE(instance, store);
+
+	store_sort(store);
+	hash = rb_hash_new();
+	for ( i = 0; i < store->count; i++ ) {
+		rb_hash_aset( hash, ULL2NUM(store->recs[i].vma),
+			      store_rec_value(store, i) );
+	}
+
+	return hash;
+}
+
+static VALUE cls_output_errors( VALUE instance ) {
+	Opdis_disasm_store * store;
+	GET_STORE(instance, store);
+
+	return store->errors;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Columnar export */
+
+/* Columns are packed binary Strings in native byte order with one element
+ * per instruction, in VMA order. They are filled from the opdis_insn_t
+ * records, so no Instruction objects are created. */
+
+enum output_column {
+	col_vma,
+	col_size,
+	col_mnemonic,
+	col_category,
+	col_target,
+	col_max
+};
+
+static const char * column_names[col_max] = {
+	OUT_COL_VMA, OUT_COL_SIZE, OUT_COL_MNEMONIC, OUT_COL_CATEGORY,
+	OUT_COL_TARGET
+};
+
+static int column_wanted( VALUE names, enum output_column col ) {
+	long i;
+
+	if ( Qnil == names ) {
+		return 1;
+	}
+
+	for ( i = 0; i < RARRAY_LEN(names); i++ ) {
+		VALUE name = rb_ary_entry(names, i);
+		const char * str = SYMBOL_P(name) ? rb_id2name(SYM2ID(name)) :
+						    StringValueCStr(name);
+		if (! strcmp( str, column_names[col] ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static VALUE sym_for( const char * name ) {
+	return ID2SYM(rb_intern(name));
+}
+
+/* mnemonic ids are assigned in order of first appearance */
+static VALUE column_mnemonics( Opdis_disasm_store * store, VALUE dict ) {
+	VALUE col = rb_str_new( NULL, store->count * sizeof(uint16_t) );
+	uint16_t * out = (uint16_t *) RSTRING_PTR(col);
+	st_table * ids = st_init_strtable();
+	st_data_t id;
+	size_t i;
+
+	for ( i = 0; i < store->count; i++ ) {
+		const char * mnem = store_rec_insn(store, i)->mnemonic;
+		if (! mnem ) {
+			mnem = "";
+		}
+
+		if (! st_lookup(ids, (st_data_t) mnem, &id) ) {
+			id = (st_data_t) RARRAY_LEN(dict);
+			if ( id > 0xFFFF ) {
+				st_free_table(ids);
+				rb_raise( rb_eRangeError, "More than 65536 "
+					  "mnemonics in Disassembly" );
+			}
+			st_insert(ids, (st_data_t) mnem, id);
+			rb_ary_push(dict, Opdis_intern(mnem));
+		}
+		out[i] = (uint16_t) id;
+	}
+
+	st_free_table(ids);
+	return col;
+}
+
+static VALUE cls_output_columns( int argc, VALUE * argv, VALUE instance ) {
+	Opdis_disasm_store * store;
+	VALUE names, hash, col;
+	size_t i, n;
+
+	rb_scan_args(argc, argv, "01", &names);
+	if ( Qnil != names ) {
+		Check_Type(names, T_ARRAY);
+	}
+
+	GET_STORE(instance, store);
+	store_sort(store);
+	n = store->count;
+
+	hash = rb_hash_new();
+	rb_hash_aset( hash, sym_for(OUT_COL_COUNT), ULONG2NUM(n) );
+
+	if ( column_wanted(names, col_vma) ) {
+		col = rb_str_new( NULL, n * sizeof(uint64_t) );
+		for ( i = 0; i < n; i++ ) {
+			uint64_t vma = (uint64_t) store->recs[i].vma;
+			memcpy( RSTRING_PTR(col) + i * sizeof(vma), &vma, 
+				sizeof(vma) );
+		}
+		rb_hash_aset( hash, sym_for(OUT_COL_VMA), col );
+	}
+
+	if ( column_wanted(names, col_size) ) {
+		col = rb_str_new( NULL, n );
+		for ( i = 0; i < n; i++ ) {
+			unsigned int size = store->recs[i].size;
+			RSTRING_PTR(col)[i] = (char) (size > 0xFF ? 0xFF : size);
+		}
+		rb_hash_aset( hash, sym_for(OUT_COL_SIZE), col );
+	}
+
+	if ( column_wanted(names, col_mnemonic) ) {
+		VALUE dict = rb_ary_new();
+		rb_hash_aset( hash, sym_for(OUT_COL_MNEMONIC), 
+			      column_mnemonics(store, dict) );
+		rb_hash_aset( hash, sym_for(OUT_COL_MNEMONICS), dict );
+	}
+
+	if ( column_wanted(names, col_category) ) {
+		VALUE dict = rb_ary_new();
+		size_t num_cats = OPDIS_INSN_NUM_CAT;
+
+		col = rb_str_new( NULL, n );
+		for ( i = 0; i < n; i++ ) {
+			unsigned int cat = store_rec_insn(store, i)->category;
+			RSTRING_PTR(col)[i] = (char) (cat < num_cats ? cat : 0);
+		}
+
+		for ( i = 0; i < num_cats; i++ ) {
+			const char * name = Opdis_insnCategoryNames[i];
+			rb_ary_push( dict, name ? Opdis_intern(name) : Qnil );
+		}
+		rb_hash_aset( hash, sym_for(OUT_COL_CATEGORY), col );
+		rb_hash_aset( hash, sym_for(OUT_COL_CATEGORIES), dict );
+	}
+
+	/* branch targets as resolved by the default resolver */
+	if ( column_wanted(names, col_target) ) {
+		col = rb_str_new( NULL, n * sizeof(uint64_t) );
+		for ( i = 0; i < n; i++ ) {
+			uint64_t tgt = (uint64_t) opdis_default_resolver( 
+						store_rec_insn(store, i), NULL );
+			memcpy( RSTRING_PTR(col) + i * sizeof(tgt), &tgt, 
+				sizeof(tgt) );
+		}
+		rb_hash_aset( hash, sym_for(OUT_COL_TARGET), col );
+	}
+
+	return hash;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Analysis results */
+
+/* The graph attached by a control flow strategy, or one built from the
+ * current instructions with the default resolver */
+static VALUE cls_output_cfg( VALUE instance ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(instance, store);
+	if ( Qnil == store->cfg ) {
+		store->cfg = Opdis_cfgNew( instance, OPDIS_INVALID_ADDR,
+					   opdis_default_resolver, NULL );
+	}
+
+	return store->cfg;
+}
+
+/* The cross-reference index of the current instructions */
+static VALUE cls_output_xrefs( VALUE instance ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(instance, store);
+	if ( Qnil == store->xrefs ) {
+		store->xrefs = Opdis_xrefsNew( instance,
+					       opdis_default_resolver, NULL );
+	}
+
+	return store->xrefs;
+}
+
+/* Matches of an Opdis::Pattern or a pattern String */
+static VALUE cls_output_scan( VALUE instance, VALUE pattern ) {
+	return Opdis_patternScan( pattern, instance );
+}
+
+/* The function table attached by the functions strategy, or nil */
+static VALUE cls_output_functions( VALUE instance ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(instance, store);
+	return store->functions;
+}
+
+static void init_output_class( VALUE modOpdis ) {
+	clsOutput = rb_define_class_under(modOpdis, OPDIS_OUTPUT_CLASS_NAME,
+					  rb_cObject);
+	rb_define_alloc_func(clsOutput, cls_output_alloc);
+	rb_include_module(clsOutput, rb_mEnumerable);
+
+	/* read-only attribute for error list */
+	rb_define_method(clsOutput, OUT_ATTR_ERRORS, cls_output_errors, 0);
+
+	/* Hash interface */
+	rb_define_method(clsOutput, OUT_METHOD_GET, cls_output_get, 1);
+	rb_define_method(clsOutput, OUT_METHOD_SET, cls_output_set, 2);
+	rb_define_method(clsOutput, OUT_METHOD_DELETE, cls_output_delete, 1);
+	rb_define_method(clsOutput, OUT_METHOD_HAS_KEY, cls_output_has_key, 1);
+	rb_define_method(clsOutput, OUT_METHOD_HAS_KEY_ALIAS,
+			 cls_output_has_key, 1);
+	rb_define_method(clsOutput, OUT_METHOD_INCLUDE, cls_output_has_key, 1);
+	rb_define_method(clsOutput, OUT_METHOD_MEMBER, cls_output_has_key, 1);
+	rb_define_method(clsOutput, OUT_METHOD_LENGTH, cls_output_length, 0);
+	rb_define_method(clsOutput, OUT_METHOD_SIZE, cls_output_length, 0);
+	rb_define_method(clsOutput, OUT_METHOD_EMPTY, cls_output_empty, 0);
+	rb_define_method(clsOutput, OUT_METHOD_EACH, cls_output_each, 0);
+	rb_define_method(clsOutput, OUT_METHOD_EACH_PAIR, cls_output_each, 0);
+	rb_define_method(clsOutput, OUT_METHOD_EACH_KEY, cls_output_each_key,
+			 0);
+	rb_define_method(clsOutput, OUT_METHOD_EACH_VALUE,
+			 cls_output_each_value, 0);
+	rb_define_method(clsOutput, OUT_METHOD_KEYS, cls_output_keys, 0);
+	rb_define_method(clsOutput, OUT_METHOD_VALUES, cls_output_values, 0);
+	rb_define_method(clsOutput, OUT_METHOD_TO_H, cls_output_to_h, 0);
+
+	/* columnar export */
+	rb_define_method(clsOutput, OUT_METHOD_COLUMNS, cls_output_columns, -1);
+
+	rb_define_method(clsOutput, OUT_METHOD_CFG, cls_output_cfg, 0);
+	rb_define_method(clsOutput, OUT_METHOD_XREFS, cls_output_xrefs, 0);
+	rb_define_method(clsOutput, OUT_METHOD_SCAN, cls_output_scan, 1);
+	rb_define_method(clsOutput, OUT_METHOD_FUNCTIONS, cls_output_functions,
+			 0);
+
+	rb_define_method(clsOutput, OUT_METHOD_CONTAIN, cls_output_contain, 1);
+	rb_define_method(clsOutput, OUT_METHOD_RANGE, cls_output_range, 2);
+	rb_define_method(clsOutput, OUT_METHOD_EACH_BETWEEN, 
+			 cls_output_each_between, 2);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initDisassembly( VALUE modOpdis ) {
+	init_output_class(modOpdis);
+}
+
+VALUE Opdis_disassemblyNew( void ) {
+	return cls_output_alloc(clsOutput);
+}
+
+void Opdis_disassemblyCheck( VALUE obj ) {
+	if ( Qtrue != rb_obj_is_kind_of( obj, clsOutput ) ) {
+		rb_raise( rb_eTypeError, "Opdis::%s required", 
+			  OPDIS_OUTPUT_CLASS_NAME );
+	}
+}
+
+Opdis_disasm_store * Opdis_disassemblyStore( VALUE output ) {
+	Opdis_disasm_store * store;
+	GET_STORE(output, store);
+	return store;
+}
+
+void Opdis_disassemblyAdd( VALUE output, const opdis_insn_t * insn,
+			   VALUE obj ) {
+	Opdis_disasm_store * store;
+	opdis_insn_t * copy;
+
+	GET_STORE(output, store);
+
+	copy = opdis_insn_dupe(insn);
+	if (! copy ) {
+		rb_raise( rb_eNoMemError, "Unable to copy instruction" );
+	}
+
+	store_add( store, copy, obj );
+}
+
+void Opdis_disassemblyAddOwned( VALUE output, opdis_insn_t * insn, 
+				VALUE obj ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+
+	store_add( store, insn, obj );
+}
+
+void Opdis_disassemblyAddImage( VALUE output, opdis_vma_t vma, 
+				unsigned int size, const void * image,
+				VALUE backing, Opdis_rec_loader loader ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+
+	if ( store->loader && store->loader != loader ) {
+		rb_raise( rb_eArgError, "Disassembly already has a loader" );
+	}
+	store->loader = loader;
+
+	if ( Qnil == store->backing ) {
+		store->backing = rb_ary_new();
+	}
+	if ( rb_ary_entry(store->backing, -1) != backing ) {
+		rb_ary_push( store->backing, backing );
+	}
+
+	store_add_rec( store, vma, size, NULL, image, Qnil );
+}
+
+size_t Opdis_disassemblyCount( VALUE output ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	store_sort(store);
+	return store->count;
+}
+
+const opdis_insn_t * Opdis_disassemblyInsnAt( VALUE output, size_t idx ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	store_sort(store);
+	return ( idx < store->count ) ? store_rec_insn(store, idx) : NULL;
+}
+
+VALUE Opdis_disassemblyValueAt( VALUE output, size_t idx ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	store_sort(store);
+	return ( idx < store->count ) ? store_rec_value(store, idx) : Qnil;
+}
+
+const Opdis_disasm_rec * Opdis_disassemblyRecAt( VALUE output, size_t idx ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	store_sort(store);
+	return ( idx < store->count ) ? &store->recs[idx] : NULL;
+}
+
+size_t Opdis_disassemblyLowerBound( VALUE output, opdis_vma_t vma ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	return store_lower_bound( store, vma );
+}
+
+long Opdis_disassemblyFind( VALUE output, opdis_vma_t vma ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	return store_find( store, vma );
+}
+
+long Opdis_disassemblyFindContaining( VALUE output, opdis_vma_t vma ) {
+	Opdis_disasm_store * store;
+
+	GET_STORE(output, store);
+	return store_find_containing( store, vma );
+}
+
+void Opdis_disassemblyRemove( VALUE output, const size_t * idx, size_t num ) {
+	Opdis_disasm_store * store;
+	size_t i, n, out;
+
+	GET_STORE(output, store);
+	store_sort(store);
+
+	if (! num ) {
+		return;
+	}
+	store_discard_analysis( store );
+	for ( i = 0; i < num; i++ ) {
+		branches_touch( store, store->recs[idx[i]].vma );
+	}
+
+	/* compact the records in one pass, starting at the first removal */
+	for ( i = idx[0], n = 0, out = idx[0]; i < store->count; i++ ) {
+		if ( n < num && idx[n] == i ) {
+			if ( store->recs[i].insn ) {
+				opdis_insn_free(store->recs[i].insn);
+			}
+			n++;
+			continue;
+		}
+		store->recs[out++] = store->recs[i];
+	}
+
+	store->count = out;
+}
+
+void Opdis_disassemblyMerge( VALUE output, VALUE other ) {
+	Opdis_disasm_store * store, * src;
+	size_t i;
+
+	GET_STORE(output, store);
+	GET_STORE(other, src);
+
+	if ( Qnil != src->backing ) {
+		if ( store->loader && store->loader != src->loader ) {
+			rb_raise( rb_eArgError, 
+				  "Disassembly already has a loader" );
+		}
+		store->loader = src->loader;
+
+		if ( Qnil == store->backing ) {
+			store->backing = rb_ary_new();
+		}
+		rb_ary_concat( store->backing, src->backing );
+	}
+
+	store_sort(src);
+	store_reserve( store, store->count + src->count );
+	for ( i = 0; i < src->count; i++ ) {
+		Opdis_disasm_rec * rec = &src->recs[i];
+		store_add_rec( store, rec->vma, rec->size, rec->insn, 
+			       rec->image, rec->obj );
+	}
+	src->count = 0;
+
+	rb_ary_concat( store->errors, src->errors );
+	rb_ary_clear( src->errors );
+}
+
+const Opdis_disasm_branch * Opdis_disassemblyBranches( VALUE output,
+			OPDIS_RESOLVER resolver, void * resolver_arg,
+			size_t * num ) {
+	Opdis_disasm_store * store;
+	Opdis_branch_index * br;
+
+	GET_STORE(output, store);
+	store_sort(store);
+
+	br = &store->branches;
+	if ( br->valid && br->resolver == resolver && ! resolver_arg ) {
+		if ( br->num_stale ) {
+			branches_update( store );
+		}
+	} else {
+		branches_rebuild( store, resolver, resolver_arg );
+	}
+
+	/* only a resolver without state is trusted to give the same
+	 * results next time */
+	br->valid = ( resolver_arg == NULL );
+
+	*num = br->count;
+	return br->items;
+}
+
+void Opdis_disassemblyResolve( VALUE output, opdis_vma_t * targets,
+			       OPDIS_RESOLVER resolver, void * resolver_arg ) {
+	Opdis_disasm_store * store;
+	const Opdis_disasm_branch * br;
+	size_t i, num;
+
+	br = Opdis_disassemblyBranches( output, resolver, resolver_arg, &num );
+
+	GET_STORE(output, store);
+	for ( i = 0; i < store->count; i++ ) {
+		targets[i] = OPDIS_INVALID_ADDR;
+	}
+	for ( i = 0; i < num; i++ ) {
+		long idx = store_find( store, br[i].src );
+		if ( idx >= 0 ) {
+			targets[idx] = br[i].target;
+		}
+	}
+}
+
+void * Opdis_disassemblyAllocArray( size_t count, size_t size,
+				    const char * what ) {
+	void * ptr = calloc( count ? count : 1, size );
+	if (! ptr ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate %s", what );
+	}
+	return ptr;
+}
+
+void Opdis_disassemblySetCfg( VALUE output, VALUE cfg ) {
+	Opdis_disasm_store * store;
+	GET_STORE(output, store);
+	store->cfg = cfg;
+}
+
+void Opdis_disassemblySetFunctions( VALUE output, VALUE functions ) {
+	Opdis_disasm_store * store;
+	GET_STORE(output, store);
+	store->functions = functions;
+}
+
+VALUE Opdis_disassemblyErrors( VALUE output ) {
+	Opdis_disasm_store * store;
+	GET_STORE(output, store);
+	return store->errors;
+}
@@ -0,0 +1,205 @@
+/* Disassembly.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_DISASSEMBLY_H
+#define OPDIS_RB_DISASSEMBLY_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+/* Output */
+
+#define OUT_ATTR_ERRORS "errors"
+#define OUT_METHOD_CONTAIN "containing"
+#define OUT_METHOD_RANGE "range"
+#define OUT_METHOD_EACH_BETWEEN "each_between"
+#define OUT_METHOD_GET "[]"
+#define OUT_METHOD_SET "[]="
+#define OUT_METHOD_EACH "each"
+#define OUT_METHOD_EACH_PAIR "each_pair"
+#define OUT_METHOD_EACH_KEY "each_key"
+#define OUT_METHOD_EACH_VALUE "each_value"
+#define OUT_METHOD_KEYS "keys"
+#define OUT_METHOD_VALUES "values"
+#define OUT_METHOD_LENGTH "length"
+#define OUT_METHOD_SIZE "size"
+#define OUT_METHOD_EMPTY "empty?"
+#define OUT_METHOD_HAS_KEY "key?"
+#define OUT_METHOD_HAS_KEY_ALIAS "has_key?"
+#define OUT_METHOD_INCLUDE "include?"
+#define OUT_METHOD_MEMBER "member?"
+#define OUT_METHOD_DELETE "delete"
+#define OUT_METHOD_TO_H "to_h"
+#define OUT_METHOD_COLUMNS "columns"
+#define OUT_METHOD_CFG "cfg"
+#define OUT_METHOD_XREFS "xrefs"
+#define OUT_METHOD_SCAN "scan"
+#define OUT_METHOD_FUNCTIONS "functions"
+
+/* column names */
+#define OUT_COL_COUNT "count"
+#define OUT_COL_VMA "vma"
+#define OUT_COL_SIZE "size"
+#define OUT_COL_MNEMONIC "mnemonic"
+#define OUT_COL_MNEMONICS "mnemonics"
+#define OUT_COL_CATEGORY "category"
+#define OUT_COL_CATEGORIES "categories"
+#define OUT_COL_TARGET "target"
+
+#define OPDIS_OUTPUT_CLASS_NAME "Disassembly"
+
+/* Create the opdis_insn_t for a record from its image (e.g. an entry in a
+ * mapped cache file). Returns NULL on failure. */
+typedef opdis_insn_t * (*Opdis_rec_loader)( const void * image );
+
+/* A single disassembled instruction. The VMA and size are kept alongside the
+ * opdis_insn_t so that lookups never have to touch the instruction itself.
+ * The Ruby Instruction object is only created when the record is accessed
+ * from Ruby. Records added from an image have no opdis_insn_t until one is
+ * needed. */
+typedef struct {
+	opdis_vma_t vma;
+	opdis_insn_t * insn;
+	const void * image;
+	VALUE obj;
+	unsigned int size;
+	unsigned int seq;		/* insertion order, for duplicate VMAs */
+} Opdis_disasm_rec;
+
+/* A branch: the instruction at 'src' transfers control to 'target' */
+typedef struct {
+	opdis_vma_t target;
+	opdis_vma_t src;
+} Opdis_disasm_branch;
+
+/* The resolved branches of a Disassembly, sorted by target and then by
+ * source. Records added or removed while the index is valid are listed in
+ * 'stale'; only they are resolved again when the index is next used. */
+typedef struct {
+	Opdis_disasm_branch * items;
+	size_t count;
+	size_t alloc;
+	opdis_vma_t * stale;
+	size_t num_stale;
+	size_t stale_alloc;
+	OPDIS_RESOLVER resolver;
+	int valid;
+} Opdis_branch_index;
+
+/* Native Disassembly store: records are kept in a contiguous array that is
+ * sorted by VMA on demand. */
+typedef struct {
+	Opdis_disasm_rec * recs;
+	size_t count;
+	size_t alloc;
+	unsigned int next_seq;
+	int sorted;
+	VALUE errors;
+	VALUE backing;			/* Array of owners of record images */
+	VALUE cfg;			/* ControlFlowGraph, or Qnil */
+	VALUE xrefs;			/* XrefIndex, or Qnil */
+	VALUE functions;		/* FunctionTable, or Qnil */
+	Opdis_rec_loader loader;
+	Opdis_branch_index branches;
+} Opdis_disasm_store;
+
+void Opdis_initDisassembly( VALUE modOpdis );
+
+/* Allocate a new, empty Opdis::Disassembly object */
+VALUE Opdis_disassemblyNew( void );
+
+/* Raise a TypeError unless 'obj' is an Opdis::Disassembly */
+void Opdis_disassemblyCheck( VALUE obj );
+
+/* Return the native store for an Opdis::Disassembly object */
+Opdis_disasm_store * Opdis_disassemblyStore( VALUE output );
+
+/* Add a copy of 'insn' to the Disassembly. If 'obj' is not nil, it is used
+ * as the Ruby representation of the instruction. */
+void Opdis_disassemblyAdd( VALUE output, const opdis_insn_t * insn,
+			   VALUE obj );
+
+/* As Opdis_disassemblyAdd, but the Disassembly takes ownership of 'insn',
+ * which must have been allocated by libopdis */
+void Opdis_disassemblyAddOwned( VALUE output, opdis_insn_t * insn, 
+				VALUE obj );
+
+/* Add a record for the instruction at 'vma', which is created by 'loader'
+ * from 'image' when it is first accessed. 'backing' keeps 'image' valid,
+ * and is retained by the Disassembly. */
+void Opdis_disassemblyAddImage( VALUE output, opdis_vma_t vma, 
+				unsigned int size, const void * image,
+				VALUE backing, Opdis_rec_loader loader );
+
+/* Return the number of instructions in an Opdis::Disassembly object */
+size_t Opdis_disassemblyCount( VALUE output );
+
+/* Return the instruction at index 'idx', in order of VMA */
+const opdis_insn_t * Opdis_disassemblyInsnAt( VALUE output, size_t idx );
+
+/* Return the Opdis::Instruction at index 'idx', in order of VMA */
+VALUE Opdis_disassemblyValueAt( VALUE output, size_t idx );
+
+/* Return the record at index 'idx', in order of VMA, or NULL. The record
+ * is only valid until the Disassembly is next modified. */
+const Opdis_disasm_rec * Opdis_disassemblyRecAt( VALUE output, size_t idx );
+
+/* Return the index of the first instruction at or after 'vma' */
+size_t Opdis_disassemblyLowerBound( VALUE output, opdis_vma_t vma );
+
+/* Return the index of the instruction at 'vma', or -1 */
+long Opdis_disassemblyFind( VALUE output, opdis_vma_t vma );
+
+/* Return the index of the instruction containing 'vma', or -1 */
+long Opdis_disassemblyFindContaining( VALUE output, opdis_vma_t vma );
+
+/* Remove the instructions at the 'num' indices in 'idx', which must be
+ * sorted and unique */
+void Opdis_disassemblyRemove( VALUE output, const size_t * idx, size_t num );
+
+/* Move the instructions and errors of 'other' into 'output'. Instructions
+ * in 'other' replace those at the same VMA in 'output'. */
+void Opdis_disassemblyMerge( VALUE output, VALUE other );
+
+/* Return the branches of the instructions in 'output', sorted by target,
+ * and set 'num' to their number. Targets are obtained from 'resolver'. The
+ * index is kept for a resolver without an argument (e.g. the default
+ * resolver), and only instructions added since it was last used are
+ * resolved again; resolvers with an argument may carry state, so the index
+ * is rebuilt for them on every call. Raises RuntimeError if the resolver
+ * modifies the Disassembly. The array is valid until 'output' is next
+ * modified. */
+const Opdis_disasm_branch * Opdis_disassemblyBranches( VALUE output,
+			OPDIS_RESOLVER resolver, void * resolver_arg,
+			size_t * num );
+
+/* Set targets[i] to the branch target of instruction 'i' of 'output', in
+ * VMA order, or to OPDIS_INVALID_ADDR if it is not a branch or its target
+ * is unknown. 'targets' must have an entry per instruction. This resolves
+ * through the branch index, so the same rules apply; as the resolver can
+ * raise, 'targets' should be owned by a Ruby object. */
+void Opdis_disassemblyResolve( VALUE output, opdis_vma_t * targets,
+			       OPDIS_RESOLVER resolver, void * resolver_arg );
+
+/* Allocate a zeroed array of 'count' items of 'size' bytes, and at least
+ * one item, for a result built from a Disassembly. Raises NoMemError,
+ * naming 'what', on failure. */
+void * Opdis_disassemblyAllocArray( size_t count, size_t size,
+				    const char * what );
+
+/* Attach the ControlFlowGraph built for 'output' by a control flow
+ * strategy. It is discarded, along with the XrefIndex, when 'output' is
+ * modified. */
+void Opdis_disassemblySetCfg( VALUE output, VALUE cfg );
+
+/* Attach the FunctionTable built for 'output' by the functions strategy */
+void Opdis_disassemblySetFunctions( VALUE output, VALUE functions );
+
+/* Return the error list for an Opdis::Disassembly object */
+VALUE Opdis_disassemblyErrors( VALUE output );
+
+#endif
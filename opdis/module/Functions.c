@@ -0,0 +1,365 @@
+/* Functions.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Disassembly.h"
+#include "Functions.h"
+
+static VALUE clsFuncs, clsFunc;
+
+/* ---------------------------------------------------------------------- */
+/* Native table */
+
+#define FN_NO_OWNER ((size_t) -1)
+
+/* per-instruction marks */
+#define FN_FALL		0x01		/* falls through to the next insn */
+#define FN_START	0x02		/* first instruction of a function */
+
+static void fn_free_scratch( Opdis_func_table * tbl ) {
+	free( tbl->starts );
+	free( tbl->targets );
+	free( tbl->marks );
+	free( tbl->owner );
+	free( tbl->stack );
+	tbl->starts = NULL;
+	tbl->targets = NULL;
+	tbl->marks = NULL;
+	tbl->owner = NULL;
+	tbl->stack = NULL;
+}
+
+static void fn_mark( void * ptr ) {
+	Opdis_func_table * tbl = (Opdis_func_table *) ptr;
+	rb_gc_mark(tbl->output);
+}
+
+static void fn_free( void * ptr ) {
+	Opdis_func_table * tbl = (Opdis_func_table *) ptr;
+
+	fn_free_scratch( tbl );
+	free( tbl->funcs );
+	xfree( tbl );
+}
+
+static size_t fn_memsize( const void * ptr ) {
+	const Opdis_func_table * tbl = (const Opdis_func_table *) ptr;
+	return sizeof(Opdis_func_table) + tbl->num_funcs * sizeof(Opdis_func);
+}
+
+static const rb_data_type_t fn_data_type = {
+	"Opdis::FunctionTable",
+	{ fn_mark, fn_free, fn_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+#define FN_ALLOC(count, size) \
+	Opdis_disassemblyAllocArray( count, size, "function table" )
+
+static int cmp_seed( const void * a, const void * b ) {
+	const Opdis_func_seed * sa = (const Opdis_func_seed *) a;
+	const Opdis_func_seed * sb = (const Opdis_func_seed *) b;
+
+	if ( sa->vma != sb->vma ) {
+		return (sa->vma < sb->vma) ? -1 : 1;
+	}
+	return (sa->source < sb->source) ? -1 : (sa->source > sb->source);
+}
+
+/* Collect the function starts: the seeds, then the target of every call.
+ * Other branch targets are left in 'targets', per instruction. */
+static void fn_scan( Opdis_func_table * tbl, size_t count,
+		     const Opdis_func_seed * seeds, size_t num ) {
+	size_t i, alloc = num + 64;
+
+	tbl->starts = FN_ALLOC( alloc, sizeof(Opdis_func_seed) );
+	memcpy( tbl->starts, seeds, num * sizeof(Opdis_func_seed) );
+	tbl->num_starts = num;
+
+	for ( i = 0; i < count; i++ ) {
+		const opdis_insn_t * insn = Opdis_disassemblyInsnAt(
+							tbl->output, i );
+		opdis_vma_t tgt = tbl->targets[i];
+
+		if ( opdis_insn_fallthrough(insn) && insn->size ) {
+			tbl->marks[i] |= FN_FALL;
+		}
+
+		if ( tgt == OPDIS_INVALID_ADDR ||
+		     ! (insn->flags.cflow & (opdis_cflow_flag_call |
+					     opdis_cflow_flag_callcc)) ) {
+			continue;
+		}
+
+		/* a call starts a function, rather than continuing this one */
+		tbl->targets[i] = OPDIS_INVALID_ADDR;
+
+		if ( tbl->num_starts == alloc ) {
+			Opdis_func_seed * starts;
+			alloc *= 2;
+			starts = realloc( tbl->starts,
+					  alloc * sizeof(Opdis_func_seed) );
+			if (! starts ) {
+				rb_raise( rb_eNoMemError, "Unable to allocate "
+					  "function table" );
+			}
+			tbl->starts = starts;
+		}
+		tbl->starts[tbl->num_starts].vma = tgt;
+		tbl->starts[tbl->num_starts].source = func_src_call;
+		tbl->num_starts++;
+	}
+
+	tbl->num_starts = Opdis_funcSeedsSort( tbl->starts, tbl->num_starts );
+}
+
+static void fn_push( Opdis_func_table * tbl, size_t * depth, long idx ) {
+	if ( idx >= 0 && tbl->owner[idx] == FN_NO_OWNER ) {
+		tbl->stack[(*depth)++] = (size_t) idx;
+	}
+}
+
+/* assign the instructions reachable from the start of function 'f' which
+ * belong to no other function */
+static void fn_walk( Opdis_func_table * tbl, size_t f, size_t count ) {
+	Opdis_func * func = &tbl->funcs[f];
+	size_t depth = 0, first = (size_t) Opdis_disassemblyFind( tbl->output,
+								  func->vma );
+
+	func->end = func->vma;
+	tbl->stack[depth++] = first;
+
+	while ( depth ) {
+		size_t i = tbl->stack[--depth];
+		const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt(
+							tbl->output, i );
+		opdis_vma_t next = rec->vma + rec->size;
+
+		if ( tbl->owner[i] != FN_NO_OWNER ||
+		     (i != first && (tbl->marks[i] & FN_START)) ) {
+			continue;
+		}
+
+		tbl->owner[i] = f;
+		func->num_insns++;
+		func->size += rec->size;
+		if ( next > func->end ) {
+			func->end = next;
+		}
+
+		if ( tbl->targets[i] != OPDIS_INVALID_ADDR ) {
+			fn_push( tbl, &depth, Opdis_disassemblyFind(
+						tbl->output, tbl->targets[i] ) );
+		}
+
+		if ( tbl->marks[i] & FN_FALL ) {
+			const Opdis_disasm_rec * adj = (i + 1 < count) ?
+				Opdis_disassemblyRecAt(tbl->output, i + 1) :
+				NULL;
+			fn_push( tbl, &depth, (adj && adj->vma == next) ?
+				 (long) (i + 1) :
+				 Opdis_disassemblyFind(tbl->output, next) );
+		}
+	}
+}
+
+static void fn_build( Opdis_func_table * tbl, const Opdis_func_seed * seeds,
+		      size_t num, OPDIS_RESOLVER resolver,
+		      void * resolver_arg ) {
+	size_t i, count = Opdis_disassemblyCount( tbl->output );
+
+	tbl->targets = FN_ALLOC( count, sizeof(opdis_vma_t) );
+	tbl->marks = FN_ALLOC( count, sizeof(unsigned char) );
+
+	Opdis_disassemblyResolve( tbl->output, tbl->targets, resolver,
+				  resolver_arg );
+	fn_scan( tbl, count, seeds, num );
+
+	/* starts without an instruction are not functions */
+	tbl->funcs = FN_ALLOC( tbl->num_starts, sizeof(Opdis_func) );
+	for ( i = 0; i < tbl->num_starts; i++ ) {
+		long idx = Opdis_disassemblyFind( tbl->output,
+						  tbl->starts[i].vma );
+		if ( idx < 0 ) {
+			continue;
+		}
+
+		tbl->marks[idx] |= FN_START;
+		tbl->funcs[tbl->num_funcs].vma = tbl->starts[i].vma;
+		tbl->funcs[tbl->num_funcs].source = tbl->starts[i].source;
+		tbl->num_funcs++;
+	}
+
+	/* every instruction is pushed at most twice per visit */
+	tbl->owner = FN_ALLOC( count, sizeof(size_t) );
+	tbl->stack = FN_ALLOC( 2 * count + 1, sizeof(size_t) );
+	for ( i = 0; i < count; i++ ) {
+		tbl->owner[i] = FN_NO_OWNER;
+	}
+
+	for ( i = 0; i < tbl->num_funcs; i++ ) {
+		fn_walk( tbl, i, count );
+	}
+
+	fn_free_scratch( tbl );
+}
+
+/* index of the function with the greatest start at or before 'vma' whose
+ * extent includes 'vma', or -1 */
+static long fn_find_containing( Opdis_func_table * tbl, opdis_vma_t vma ) {
+	size_t lo = 0, hi = tbl->num_funcs;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( tbl->funcs[mid].vma <= vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return ( lo && vma < tbl->funcs[lo - 1].end ) ? (long) lo - 1 : -1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* FunctionTable Class */
+
+static Opdis_func_table * fn_data( VALUE instance ) {
+	Opdis_func_table * tbl;
+	TypedData_Get_Struct(instance, Opdis_func_table, &fn_data_type, tbl);
+	return tbl;
+}
+
+static VALUE func_value( Opdis_func_table * tbl, size_t idx ) {
+	static const char * sources[] = { FUNC_SRC_ENTRY, FUNC_SRC_SYMBOL,
+					  FUNC_SRC_GIVEN, FUNC_SRC_CALL };
+	Opdis_func * func = &tbl->funcs[idx];
+
+	return rb_struct_new( clsFunc, ULL2NUM(func->vma), ULL2NUM(func->end),
+			      ULL2NUM(func->size), UINT2NUM(func->num_insns),
+			      ID2SYM(rb_intern(sources[func->source])) );
+}
+
+static VALUE cls_funcs_disassembly( VALUE instance ) {
+	return fn_data(instance)->output;
+}
+
+static VALUE cls_funcs_length( VALUE instance ) {
+	return SIZET2NUM(fn_data(instance)->num_funcs);
+}
+
+static VALUE cls_funcs_get( VALUE instance, VALUE idx ) {
+	Opdis_func_table * tbl = fn_data(instance);
+	long i = NUM2LONG(idx);
+
+	if ( i < 0 ) {
+		i += (long) tbl->num_funcs;
+	}
+	return ( i < 0 || (size_t) i >= tbl->num_funcs ) ? Qnil :
+		func_value( tbl, (size_t) i );
+}
+
+static VALUE cls_funcs_each( VALUE instance ) {
+	Opdis_func_table * tbl;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+
+	tbl = fn_data(instance);
+	for ( i = 0; i < tbl->num_funcs; i++ ) {
+		rb_yield( func_value(tbl, i) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_funcs_starts( VALUE instance ) {
+	Opdis_func_table * tbl = fn_data(instance);
+	VALUE ary = rb_ary_new2( tbl->num_funcs );
+	size_t i;
+
+	for ( i = 0; i < tbl->num_funcs; i++ ) {
+		rb_ary_push( ary, ULL2NUM(tbl->funcs[i].vma) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_funcs_containing( VALUE instance, VALUE vma ) {
+	Opdis_func_table * tbl = fn_data(instance);
+	long idx = fn_find_containing( tbl, (opdis_vma_t) NUM2ULL(vma) );
+
+	return ( idx < 0 ) ? Qnil : func_value( tbl, (size_t) idx );
+}
+
+static void init_functions_class( VALUE modOpdis ) {
+	clsFuncs = rb_define_class_under(modOpdis, OPDIS_FUNCTIONS_CLASS_NAME,
+					 rb_cObject);
+	rb_undef_alloc_func(clsFuncs);
+	rb_include_module(clsFuncs, rb_mEnumerable);
+
+	clsFunc = rb_struct_define_under( clsFuncs, FUNC_CLASS_NAME,
+					  FUNC_MEMBER_START, FUNC_MEMBER_END,
+					  FUNC_MEMBER_SIZE, FUNC_MEMBER_COUNT,
+					  FUNC_MEMBER_SOURCE, NULL );
+
+	rb_define_method(clsFuncs, FUNC_ATTR_DISASM, cls_funcs_disassembly, 0);
+	rb_define_method(clsFuncs, FUNC_METHOD_GET, cls_funcs_get, 1);
+	rb_define_method(clsFuncs, FUNC_METHOD_LENGTH, cls_funcs_length, 0);
+	rb_define_method(clsFuncs, FUNC_METHOD_SIZE, cls_funcs_length, 0);
+	rb_define_method(clsFuncs, FUNC_METHOD_EACH, cls_funcs_each, 0);
+	rb_define_method(clsFuncs, FUNC_METHOD_STARTS, cls_funcs_starts, 0);
+	rb_define_method(clsFuncs, FUNC_METHOD_CONTAIN, cls_funcs_containing,
+			 1);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initFunctions( VALUE modOpdis ) {
+	init_functions_class(modOpdis);
+}
+
+size_t Opdis_funcSeedsSort( Opdis_func_seed * seeds, size_t num ) {
+	size_t i, out;
+
+	if (! num ) {
+		return 0;
+	}
+
+	qsort( seeds, num, sizeof(Opdis_func_seed), cmp_seed );
+
+	for ( i = 1, out = 1; i < num; i++ ) {
+		if ( seeds[i].vma != seeds[out - 1].vma ) {
+			seeds[out++] = seeds[i];
+		}
+	}
+
+	return out;
+}
+
+VALUE Opdis_functionsNew( VALUE output, const Opdis_func_seed * seeds,
+			  size_t num, OPDIS_RESOLVER resolver,
+			  void * resolver_arg ) {
+	Opdis_func_table * tbl;
+	VALUE instance = TypedData_Make_Struct(clsFuncs, Opdis_func_table,
+					       &fn_data_type, tbl);
+
+	tbl->output = output;
+	fn_build( tbl, seeds, num, resolver, resolver_arg );
+
+	return instance;
+}
@@ -0,0 +1,92 @@
+/* Functions.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_FUNCTIONS_H
+#define OPDIS_RB_FUNCTIONS_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#define OPDIS_FUNCTIONS_CLASS_NAME "FunctionTable"
+#define FUNC_CLASS_NAME "Function"
+
+#define FUNC_ATTR_DISASM "disassembly"
+#define FUNC_METHOD_GET "[]"
+#define FUNC_METHOD_LENGTH "length"
+#define FUNC_METHOD_SIZE "size"
+#define FUNC_METHOD_EACH "each"
+#define FUNC_METHOD_STARTS "starts"
+#define FUNC_METHOD_CONTAIN "containing"
+
+/* Function members */
+#define FUNC_MEMBER_START "start"
+#define FUNC_MEMBER_END "end"
+#define FUNC_MEMBER_SIZE "size"
+#define FUNC_MEMBER_COUNT "count"
+#define FUNC_MEMBER_SOURCE "source"
+
+/* Function sources, in order of precedence */
+#define FUNC_SRC_ENTRY "entry"
+#define FUNC_SRC_SYMBOL "symbol"
+#define FUNC_SRC_GIVEN "given"
+#define FUNC_SRC_CALL "call"
+
+enum Opdis_func_source {
+	func_src_entry,
+	func_src_symbol,
+	func_src_given,
+	func_src_call
+};
+
+/* A known function start */
+typedef struct {
+	opdis_vma_t vma;
+	unsigned int source;		/* Opdis_func_source */
+} Opdis_func_seed;
+
+/* A function: the instructions reachable from its start without calls and
+ * without entering another function. These need not be contiguous; 'end'
+ * follows the highest of them. */
+typedef struct {
+	opdis_vma_t vma;		/* start */
+	opdis_vma_t end;
+	opdis_off_t size;		/* bytes of instructions */
+	unsigned int num_insns;
+	unsigned int source;
+} Opdis_func;
+
+/* Functions sorted by start */
+typedef struct {
+	Opdis_func * funcs;
+	size_t num_funcs;
+	VALUE output;			/* Disassembly the table was built from */
+
+	/* used while building */
+	Opdis_func_seed * starts;
+	size_t num_starts;
+	opdis_vma_t * targets;		/* per instruction */
+	unsigned char * marks;		/* per instruction */
+	size_t * owner;			/* per instruction */
+	size_t * stack;
+} Opdis_func_table;
+
+void Opdis_initFunctions( VALUE modOpdis );
+
+/* Sort 'num' seeds by VMA and remove duplicates, keeping the source of
+ * highest precedence. Returns the new number of seeds. */
+size_t Opdis_funcSeedsSort( Opdis_func_seed * seeds, size_t num );
+
+/* Build the function table of the instructions in 'output'. Functions start
+ * at each of the 'num' seeds and at the target of every call in 'output',
+ * resolved by 'resolver'; starts with no instruction are dropped. Every
+ * instruction is assigned to at most one function. This reads the stored
+ * instructions and decodes nothing. */
+VALUE Opdis_functionsNew( VALUE output, const Opdis_func_seed * seeds,
+			  size_t num, OPDIS_RESOLVER resolver,
+			  void * resolver_arg );
+
+#endif
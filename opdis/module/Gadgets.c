@@ -0,0 +1,731 @@
+/* Gadgets.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Gadgets.h"
+#include "Parallel.h"
+
+/* Bytes of a region scanned by a worker at a time */
+#define GADGET_CHUNK_SZ OPDIS_PAR_MIN_CHUNK
+#define GADGET_SEP "; "
+#define GADGET_SEP_LEN 2
+
+static VALUE clsGadget;
+
+/* A search thread. Each worker decodes with its own opdis_t and collects
+ * gadgets in its own list. */
+struct GADGET_WORKER {
+	Opdis_gadget_search * search;
+	opdis_t opdis;
+	opdis_insn_t * insn;
+
+	Opdis_gadget_rec * recs;
+	size_t count;
+	size_t alloc;
+
+	/* text of gadgets [first, last) of the search */
+	size_t first;
+	size_t last;
+	char * text;
+	size_t text_len;
+	size_t text_alloc;
+
+	int failed;			/* out of memory */
+};
+
+/* ---------------------------------------------------------------------- */
+/* Terminator scan */
+
+/* x86 return opcodes C2, C3, CA, CB and the FF group (indirect jmp/call) */
+#define X86_TERM_BYTE(b) ( ((b) & 0xFE) == 0xC2 || ((b) & 0xFE) == 0xCA || \
+			   (b) == 0xFF )
+
+/* operand size, segment, rep and REX prefixes */
+#define X86_PREFIX_BYTE(b) ( ((b) & 0xF0) == 0x40 || (b) == 0x66 || \
+			     (b) == 0xF2 || (b) == 0xF3 || (b) == 0x2E || \
+			     (b) == 0x3E || (b) == 0x26 || (b) == 0x36 || \
+			     (b) == 0x64 || (b) == 0x65 )
+
+/* offset of the first x86 terminator byte in data[pos, end), or end */
+static opdis_off_t x86_next_candidate( const opdis_byte_t * data,
+				       opdis_off_t pos, opdis_off_t end ) {
+#ifdef __SSE2__
+	const __m128i fe = _mm_set1_epi8( (char) 0xFE );
+	const __m128i c2 = _mm_set1_epi8( (char) 0xC2 );
+	const __m128i ca = _mm_set1_epi8( (char) 0xCA );
+	const __m128i ff = _mm_set1_epi8( (char) 0xFF );
+
+	while ( pos + 16 <= end ) {
+		__m128i v = _mm_loadu_si128( (const __m128i *) (data + pos) );
+		__m128i r = _mm_and_si128( v, fe );
+		int bits;
+
+		r = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8(r, c2),
+						_mm_cmpeq_epi8(r, ca) ),
+				  _mm_cmpeq_epi8(v, ff) );
+		bits = _mm_movemask_epi8( r );
+		if ( bits ) {
+			return pos + (opdis_off_t) __builtin_ctz( bits );
+		}
+		pos += 16;
+	}
+#endif
+
+	while ( pos < end && ! X86_TERM_BYTE(data[pos]) ) {
+		pos++;
+	}
+
+	return pos;
+}
+
+/* FF /2 to /5 are the indirect calls and jumps */
+static int x86_may_terminate( const opdis_buffer_t * r, opdis_off_t off ) {
+	unsigned int op;
+
+	if ( r->data[off] != 0xFF ) {
+		return 1;
+	}
+	if ( off + 1 >= r->len ) {
+		return 0;
+	}
+
+	op = (r->data[off + 1] >> 3) & 7;
+	return op >= 2 && op <= 5;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Backward search */
+
+static uint32_t gadget_hash( const opdis_byte_t * bytes, size_t len ) {
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for ( i = 0; i < len; i++ ) {
+		h ^= bytes[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static void add_rec( struct GADGET_WORKER * w, const opdis_buffer_t * r,
+		     opdis_off_t off, opdis_off_t size, unsigned int insns ) {
+	Opdis_gadget_rec * rec;
+
+	if ( w->count == w->alloc ) {
+		size_t alloc = w->alloc ? w->alloc * 2 : 4096;
+		Opdis_gadget_rec * recs = realloc( w->recs,
+					alloc * sizeof(Opdis_gadget_rec) );
+		if (! recs ) {
+			w->failed = 1;
+			return;
+		}
+		w->recs = recs;
+		w->alloc = alloc;
+	}
+
+	rec = &w->recs[w->count++];
+	rec->bytes = r->data + off;
+	rec->vma = r->vma + off;
+	rec->size = (uint16_t) size;
+	rec->num_insns = (uint16_t) insns;
+	rec->hash = gadget_hash( rec->bytes, rec->size );
+}
+
+/* decode the instruction at 'off' into the worker's scratch instruction.
+ * Returns its size, or 0 if the bytes are not a valid instruction. */
+static opdis_off_t decode_at( struct GADGET_WORKER * w,
+			      const opdis_buffer_t * r, opdis_off_t off ) {
+	opdis_insn_t * insn = w->insn;
+	opdis_off_t size;
+
+	opdis_insn_clear( insn );
+	size = opdis_disasm_insn( w->opdis, (opdis_buf_t) r, r->vma + off,
+				  insn );
+	if (! size || insn->status == opdis_decode_invalid ||
+	     off + size > r->len ) {
+		return 0;
+	}
+
+	return size;
+}
+
+/* the OPDIS_GADGET type of the decoded instruction, or 0 */
+static unsigned int terminator_type( const opdis_insn_t * insn ) {
+	if ( insn->category != opdis_insn_cat_cflow ) {
+		return 0;
+	}
+
+	if ( insn->flags.cflow & opdis_cflow_flag_ret ) {
+		return OPDIS_GADGET_RET;
+	}
+
+	/* only branches to a register or memory address end a gadget */
+	if (! insn->target ||
+	     insn->target->category == opdis_op_cat_immediate ) {
+		return 0;
+	}
+
+	if ( insn->flags.cflow & opdis_cflow_flag_jmp ) {
+		return OPDIS_GADGET_JMP;
+	}
+	if ( insn->flags.cflow & opdis_cflow_flag_call ) {
+		return OPDIS_GADGET_CALL;
+	}
+
+	return 0;
+}
+
+/* Record every gadget ending with the terminator at 'term'. Each offset in
+ * the window before it is decoded once; reach[i] is the number of
+ * instructions from window offset i up to the terminator, or 0 if they do
+ * not end exactly at the terminator. */
+static void search_back( struct GADGET_WORKER * w, const opdis_buffer_t * r,
+			 opdis_off_t term, opdis_off_t term_size ) {
+	Opdis_gadget_search * search = w->search;
+	unsigned char reach[OPDIS_GADGET_MAX_DEPTH];
+	opdis_off_t lo, off;
+
+	lo = ( term > search->depth ) ? term - search->depth : 0;
+
+	add_rec( w, r, term, term_size, 1 );
+
+	for ( off = term; off-- > lo; ) {
+		opdis_off_t size = decode_at( w, r, off );
+		unsigned int n = 0;
+
+		if ( size && w->insn->category != opdis_insn_cat_cflow ) {
+			opdis_off_t next = off + size;
+
+			if ( next == term ) {
+				n = 1;
+			} else if ( next < term && reach[next - lo] ) {
+				n = reach[next - lo] + 1;
+			}
+
+			if ( n >= search->max_insns ) {
+				n = 0;
+			}
+		}
+
+		reach[off - lo] = (unsigned char) n;
+		if ( n ) {
+			add_rec( w, r, off, term + term_size - off, n + 1 );
+		}
+	}
+}
+
+static void try_terminator( struct GADGET_WORKER * w,
+			    const opdis_buffer_t * r, opdis_off_t off ) {
+	opdis_off_t size = decode_at( w, r, off );
+
+	if ( size && (terminator_type(w->insn) & w->search->types) ) {
+		search_back( w, r, off, size );
+	}
+}
+
+static void scan_chunk( struct GADGET_WORKER * w,
+			const Opdis_gadget_chunk * chunk ) {
+	const opdis_buffer_t * r = chunk->region;
+	opdis_off_t off = chunk->start;
+
+	/* other architectures have no prefilter: try every offset */
+	if ( w->opdis->config.arch != bfd_arch_i386 ) {
+		for ( ; off < chunk->end && ! w->failed; off++ ) {
+			try_terminator( w, r, off );
+		}
+		return;
+	}
+
+	for ( ;; ) {
+		off = x86_next_candidate( r->data, off, chunk->end );
+		if ( off >= chunk->end || w->failed ) {
+			break;
+		}
+
+		if ( x86_may_terminate( r, off ) ) {
+			try_terminator( w, r, off );
+
+			/* a prefixed terminator is a distinct gadget */
+			if ( off > 0 && X86_PREFIX_BYTE(r->data[off - 1]) ) {
+				try_terminator( w, r, off - 1 );
+			}
+		}
+
+		off++;
+	}
+}
+
+static int worker_running( struct GADGET_WORKER * w, int is_main ) {
+	if ( w->failed ) {
+		return 0;
+	}
+
+	/* only the Ruby thread may service interrupts */
+	if ( is_main ) {
+		return Opdis_runnerCheckInts( w->search->runner );
+	}
+
+	return ! w->search->runner->abort;
+}
+
+/* workers take chunks in turn until none are left */
+static void scan_task( void * item, int is_main ) {
+	struct GADGET_WORKER * w = (struct GADGET_WORKER *) item;
+	Opdis_gadget_search * search = w->search;
+
+	while ( worker_running(w, is_main) ) {
+		size_t idx = __sync_fetch_and_add( &search->next_chunk, 1 );
+		if ( idx >= search->num_chunks ) {
+			break;
+		}
+		scan_chunk( w, &search->chunks[idx] );
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* Deduplication */
+
+static int cmp_rec( const void * a, const void * b ) {
+	const Opdis_gadget_rec * x = (const Opdis_gadget_rec *) a;
+	const Opdis_gadget_rec * y = (const Opdis_gadget_rec *) b;
+	int rv;
+
+	if ( x->hash != y->hash ) {
+		return ( x->hash < y->hash ) ? -1 : 1;
+	}
+	if ( x->size != y->size ) {
+		return ( x->size < y->size ) ? -1 : 1;
+	}
+	rv = memcmp( x->bytes, y->bytes, x->size );
+	if ( rv ) {
+		return rv;
+	}
+	return ( x->vma < y->vma ) ? -1 : ( x->vma > y->vma );
+}
+
+static int same_bytes( const Opdis_gadget_rec * x,
+		       const Opdis_gadget_rec * y ) {
+	return x->hash == y->hash && x->size == y->size &&
+	       ! memcmp( x->bytes, y->bytes, x->size );
+}
+
+static int cmp_gadget_vma( const void * a, const void * b ) {
+	opdis_vma_t x = ((const Opdis_gadget *) a)->vma;
+	opdis_vma_t y = ((const Opdis_gadget *) b)->vma;
+	return ( x < y ) ? -1 : ( x > y );
+}
+
+/* gather the records of all workers and group those with identical bytes.
+ * Returns 0 if out of memory. */
+static int dedupe( Opdis_gadget_search * search ) {
+	size_t i, j, count = 0;
+
+	for ( i = 0; i < search->num_workers; i++ ) {
+		count += search->workers[i].count;
+	}
+
+	search->recs = malloc( (count ? count : 1) *
+			       sizeof(Opdis_gadget_rec) );
+	if (! search->recs ) {
+		return 0;
+	}
+
+	for ( i = 0; i < search->num_workers; i++ ) {
+		struct GADGET_WORKER * w = &search->workers[i];
+		memcpy( search->recs + search->num_recs, w->recs,
+			w->count * sizeof(Opdis_gadget_rec) );
+		search->num_recs += w->count;
+		free( w->recs );
+		w->recs = NULL;
+		w->count = w->alloc = 0;
+	}
+
+	qsort( search->recs, search->num_recs, sizeof(Opdis_gadget_rec),
+	       cmp_rec );
+
+	search->gadgets = malloc( (count ? count : 1) * sizeof(Opdis_gadget) );
+	if (! search->gadgets ) {
+		return 0;
+	}
+
+	for ( i = 0; i < search->num_recs; i = j ) {
+		Opdis_gadget * g = &search->gadgets[search->num_gadgets++];
+
+		for ( j = i + 1; j < search->num_recs &&
+				 same_bytes(&search->recs[i],
+					    &search->recs[j]); j++ ) {
+			/* same gadget */
+		}
+
+		/* records of a gadget are sorted by VMA */
+		memset( g, 0, sizeof(Opdis_gadget) );
+		g->vma = search->recs[i].vma;
+		g->first = i;
+		g->count = j - i;
+	}
+
+	qsort( search->gadgets, search->num_gadgets, sizeof(Opdis_gadget),
+	       cmp_gadget_vma );
+
+	return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Gadget text */
+
+static int text_append( struct GADGET_WORKER * w, const char * str,
+			size_t len ) {
+	if ( w->text_len + len > w->text_alloc ) {
+		size_t alloc = w->text_alloc ? w->text_alloc * 2 : 65536;
+		char * text;
+
+		while ( alloc < w->text_len + len ) {
+			alloc *= 2;
+		}
+
+		text = realloc( w->text, alloc );
+		if (! text ) {
+			w->failed = 1;
+			return 0;
+		}
+		w->text = text;
+		w->text_alloc = alloc;
+	}
+
+	memcpy( w->text + w->text_len, str, len );
+	w->text_len += len;
+	return 1;
+}
+
+/* decode one occurrence of each gadget into "insn; insn; ..." */
+static void text_task( void * item, int is_main ) {
+	struct GADGET_WORKER * w = (struct GADGET_WORKER *) item;
+	Opdis_gadget_search * search = w->search;
+	size_t i;
+
+	for ( i = w->first; i < w->last && worker_running(w, is_main); i++ ) {
+		Opdis_gadget * g = &search->gadgets[i];
+		const Opdis_gadget_rec * rec = &search->recs[g->first];
+		opdis_buffer_t buf;
+		opdis_off_t off = 0;
+		unsigned int n;
+
+		buf.data = (opdis_byte_t *) rec->bytes;
+		buf.len = rec->size;
+		buf.vma = rec->vma;
+
+		g->worker = (unsigned int) (w - search->workers);
+		g->text_off = w->text_len;
+
+		for ( n = 0; n < rec->num_insns && off < buf.len; n++ ) {
+			opdis_off_t size = decode_at( w, &buf, off );
+			const char * ascii = w->insn->ascii;
+
+			if (! size ) {
+				break;
+			}
+			if ( n ) {
+				text_append( w, GADGET_SEP, GADGET_SEP_LEN );
+			}
+			text_append( w, ascii ? ascii : "",
+				     ascii ? strlen(ascii) : 0 );
+			off += size;
+		}
+
+		g->text_len = w->text_len - g->text_off;
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* Search */
+
+static void error_ignore( enum opdis_error_t error, const char * msg,
+			  void * arg ) {
+	/* most offsets before a terminator are not instructions */
+}
+
+static int make_chunks( Opdis_gadget_search * search ) {
+	size_t i, n = 0;
+
+	for ( i = 0; i < search->num_regions; i++ ) {
+		n += (search->regions[i].len + GADGET_CHUNK_SZ - 1) /
+		     GADGET_CHUNK_SZ;
+	}
+
+	search->chunks = malloc( (n ? n : 1) * sizeof(Opdis_gadget_chunk) );
+	if (! search->chunks ) {
+		return 0;
+	}
+
+	for ( i = 0; i < search->num_regions; i++ ) {
+		const opdis_buffer_t * r = &search->regions[i];
+		opdis_off_t off;
+
+		for ( off = 0; off < r->len; off += GADGET_CHUNK_SZ ) {
+			Opdis_gadget_chunk * c =
+				&search->chunks[search->num_chunks++];
+			c->region = r;
+			c->start = off;
+			c->end = ( r->len - off > GADGET_CHUNK_SZ ) ?
+				 off + GADGET_CHUNK_SZ : r->len;
+		}
+	}
+
+	return 1;
+}
+
+static int start_workers( Opdis_gadget_search * search ) {
+	Opdis_runner * runner = search->runner;
+	unsigned int i, n = search->threads;
+
+	if ( n > search->num_chunks ) {
+		n = (unsigned int) search->num_chunks;
+	}
+	if ( n > OPDIS_PAR_MAX_THREADS ) {
+		n = OPDIS_PAR_MAX_THREADS;
+	}
+	if (! n ) {
+		n = 1;
+	}
+
+	search->workers = calloc( n, sizeof(struct GADGET_WORKER) );
+	if (! search->workers ) {
+		return 0;
+	}
+	search->num_workers = n;
+
+	for ( i = 0; i < n; i++ ) {
+		struct GADGET_WORKER * w = &search->workers[i];
+
+		w->search = search;
+		w->opdis = opdis_dupe( runner->opdis );
+		w->insn = Opdis_arenaAlloc( &runner->arena );
+		if (! w->opdis || ! w->insn ) {
+			return 0;
+		}
+
+		opdis_set_error_reporter( w->opdis, error_ignore, w );
+	}
+
+	return 1;
+}
+
+static void stop_workers( Opdis_gadget_search * search ) {
+	unsigned int i;
+
+	for ( i = 0; i < search->num_workers; i++ ) {
+		struct GADGET_WORKER * w = &search->workers[i];
+
+		Opdis_arenaRelease( &search->runner->arena, w->insn );
+		w->insn = NULL;
+		if ( w->opdis ) {
+			opdis_term( w->opdis );
+			w->opdis = NULL;
+		}
+	}
+}
+
+static int workers_failed( Opdis_gadget_search * search ) {
+	unsigned int i;
+
+	for ( i = 0; i < search->num_workers; i++ ) {
+		if ( search->workers[i].failed ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void run_search( void * arg ) {
+	Opdis_gadget_search * search = (Opdis_gadget_search *) arg;
+	Opdis_runner * runner = search->runner;
+	unsigned int i;
+	size_t per;
+
+	if (! make_chunks( search ) || ! start_workers( search ) ) {
+		search->failed = 1;
+		stop_workers( search );
+		return;
+	}
+
+	Opdis_parallelEach( runner, scan_task, search->workers,
+			    sizeof(struct GADGET_WORKER), search->num_workers );
+
+	if ( runner->abort || workers_failed( search ) ||
+	     ! dedupe( search ) ) {
+		search->failed = ! runner->abort;
+		stop_workers( search );
+		return;
+	}
+
+	/* each worker describes a contiguous run of gadgets */
+	per = (search->num_gadgets + search->num_workers - 1) /
+	      search->num_workers;
+	for ( i = 0; i < search->num_workers; i++ ) {
+		struct GADGET_WORKER * w = &search->workers[i];
+		w->first = i * per;
+		w->last = w->first + per;
+		if ( w->first > search->num_gadgets ) {
+			w->first = search->num_gadgets;
+		}
+		if ( w->last > search->num_gadgets ) {
+			w->last = search->num_gadgets;
+		}
+	}
+
+	Opdis_parallelEach( runner, text_task, search->workers,
+			    sizeof(struct GADGET_WORKER), search->num_workers );
+
+	search->failed = workers_failed( search ) && ! runner->abort;
+	stop_workers( search );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initGadgets( VALUE modOpdis ) {
+	clsGadget = rb_struct_define_under( modOpdis, OPDIS_GADGET_CLASS_NAME,
+					    GADGET_MEMBER_VMA,
+					    GADGET_MEMBER_ADDRS,
+					    GADGET_MEMBER_BYTES,
+					    GADGET_MEMBER_TEXT, NULL );
+}
+
+unsigned int Opdis_gadgetType( VALUE name ) {
+	const char * str;
+
+	if ( SYMBOL_P(name) ) {
+		name = rb_sym2str(name);
+	}
+	str = StringValueCStr(name);
+
+	if (! strcmp( str, GADGET_TYPE_RET ) ) {
+		return OPDIS_GADGET_RET;
+	} else if (! strcmp( str, GADGET_TYPE_JMP ) ) {
+		return OPDIS_GADGET_JMP;
+	} else if (! strcmp( str, GADGET_TYPE_CALL ) ) {
+		return OPDIS_GADGET_CALL;
+	}
+
+	rb_raise( rb_eArgError, "Unknown gadget type '%s'", str );
+	return 0;
+}
+
+void Opdis_gadgetInit( Opdis_gadget_search * search ) {
+	memset( search, 0, sizeof(Opdis_gadget_search) );
+	search->types = OPDIS_GADGET_ALL;
+	search->depth = OPDIS_GADGET_DEF_DEPTH;
+	search->max_insns = OPDIS_GADGET_DEF_INSNS;
+	search->threads = 1;
+}
+
+void Opdis_gadgetAddRegion( Opdis_gadget_search * search,
+			    const opdis_buffer_t * buf, int owned ) {
+	size_t n = search->num_regions + 1;
+	opdis_buffer_t * regions;
+	unsigned char * flags;
+
+	regions = realloc( search->regions, n * sizeof(opdis_buffer_t) );
+	if ( regions ) {
+		search->regions = regions;
+	}
+	flags = realloc( search->owned, n );
+	if ( flags ) {
+		search->owned = flags;
+	}
+
+	if (! regions || ! flags ) {
+		if ( owned ) {
+			free( buf->data );
+		}
+		rb_raise( rb_eNoMemError, "Unable to allocate gadget search" );
+	}
+
+	search->regions[search->num_regions] = *buf;
+	search->owned[search->num_regions] = (unsigned char) owned;
+	search->num_regions = n;
+}
+
+void Opdis_gadgetSearch( Opdis_gadget_search * search,
+			 Opdis_runner * runner ) {
+	if ( search->depth > OPDIS_GADGET_MAX_DEPTH ) {
+		search->depth = OPDIS_GADGET_MAX_DEPTH;
+	}
+	if ( search->max_insns > OPDIS_GADGET_MAX_INSNS ) {
+		search->max_insns = OPDIS_GADGET_MAX_INSNS;
+	}
+
+	search->runner = runner;
+	Opdis_runnerRun( runner, run_search, search );
+}
+
+VALUE Opdis_gadgetResults( const Opdis_gadget_search * search ) {
+	VALUE ary;
+	size_t i, j;
+
+	if ( search->failed ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate gadget search" );
+	}
+
+	ary = rb_ary_new2( (long) search->num_gadgets );
+	for ( i = 0; i < search->num_gadgets; i++ ) {
+		const Opdis_gadget * g = &search->gadgets[i];
+		const Opdis_gadget_rec * rec = &search->recs[g->first];
+		const struct GADGET_WORKER * w = &search->workers[g->worker];
+		VALUE addrs = rb_ary_new2( (long) g->count );
+
+		for ( j = 0; j < g->count; j++ ) {
+			rb_ary_push( addrs, ULL2NUM(rec[j].vma) );
+		}
+
+		rb_ary_push( ary, rb_struct_new( clsGadget, ULL2NUM(rec->vma),
+				addrs,
+				rb_str_new( (const char *) rec->bytes,
+					    rec->size ),
+				rb_str_new( w->text + g->text_off,
+					    (long) g->text_len ) ) );
+	}
+
+	return ary;
+}
+
+void Opdis_gadgetFree( Opdis_gadget_search * search ) {
+	size_t i;
+
+	for ( i = 0; i < search->num_workers; i++ ) {
+		free( search->workers[i].recs );
+		free( search->workers[i].text );
+	}
+	free( search->workers );
+
+	for ( i = 0; i < search->num_regions; i++ ) {
+		if ( search->owned[i] ) {
+			free( search->regions[i].data );
+		}
+	}
+	free( search->regions );
+	free( search->owned );
+
+	free( search->chunks );
+	free( search->recs );
+	free( search->gadgets );
+
+	memset( search, 0, sizeof(Opdis_gadget_search) );
+}
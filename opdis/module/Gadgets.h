@@ -0,0 +1,129 @@
+/* Gadgets.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_GADGETS_H
+#define OPDIS_RB_GADGETS_H
+
+#include <stdint.h>
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#include "Runner.h"
+
+#define OPDIS_GADGET_CLASS_NAME "Gadget"
+
+/* Gadget members */
+#define GADGET_MEMBER_VMA "vma"
+#define GADGET_MEMBER_ADDRS "addresses"
+#define GADGET_MEMBER_BYTES "bytes"
+#define GADGET_MEMBER_TEXT "text"
+
+/* names of the gadget types */
+#define GADGET_TYPE_RET "ret"
+#define GADGET_TYPE_JMP "jmp"
+#define GADGET_TYPE_CALL "call"
+
+/* gadget types: the instruction which ends the gadget */
+#define OPDIS_GADGET_RET 0x01		/* return */
+#define OPDIS_GADGET_JMP 0x02		/* jump to register or memory */
+#define OPDIS_GADGET_CALL 0x04		/* call to register or memory */
+#define OPDIS_GADGET_ALL 0x07
+
+/* Bytes searched before each terminator */
+#define OPDIS_GADGET_DEF_DEPTH 16
+#define OPDIS_GADGET_MAX_DEPTH 64
+/* Instructions in a gadget, including the terminator */
+#define OPDIS_GADGET_DEF_INSNS 6
+#define OPDIS_GADGET_MAX_INSNS 32
+
+/* One occurrence of a gadget. 'bytes' points into the searched region. */
+typedef struct {
+	const opdis_byte_t * bytes;
+	opdis_vma_t vma;
+	uint32_t hash;
+	uint16_t size;
+	uint16_t num_insns;
+} Opdis_gadget_rec;
+
+/* A distinct gadget: records [first, first + count) of the search, which
+ * have identical bytes and are sorted by VMA */
+typedef struct {
+	opdis_vma_t vma;		/* lowest VMA */
+	size_t first;
+	size_t count;
+	unsigned int worker;		/* holder of the text */
+	size_t text_off;
+	size_t text_len;
+} Opdis_gadget;
+
+/* A range of a region scanned by one worker at a time */
+typedef struct {
+	const opdis_buffer_t * region;
+	opdis_off_t start;
+	opdis_off_t end;
+} Opdis_gadget_chunk;
+
+struct GADGET_WORKER;
+
+/* A gadget search over regions of executable bytes. Regions are either
+ * borrowed, in which case they must outlive the search, or owned, in which
+ * case their data is freed with the search. */
+typedef struct {
+	/* options */
+	unsigned int types;
+	unsigned int depth;
+	unsigned int max_insns;
+	unsigned int threads;
+
+	opdis_buffer_t * regions;
+	unsigned char * owned;
+	size_t num_regions;
+
+	/* work */
+	Opdis_runner * runner;
+	Opdis_gadget_chunk * chunks;
+	size_t num_chunks;
+	volatile size_t next_chunk;
+	struct GADGET_WORKER * workers;
+	unsigned int num_workers;
+
+	/* results */
+	Opdis_gadget_rec * recs;
+	size_t num_recs;
+	Opdis_gadget * gadgets;
+	size_t num_gadgets;
+	int failed;			/* out of memory */
+} Opdis_gadget_search;
+
+void Opdis_initGadgets( VALUE modOpdis );
+
+/* Return the OPDIS_GADGET flag for the type named by a String or Symbol.
+ * Raises ArgumentError for unknown types. */
+unsigned int Opdis_gadgetType( VALUE name );
+
+/* Initialize a search for all gadget types, with the default limits */
+void Opdis_gadgetInit( Opdis_gadget_search * search );
+
+/* Add 'buf' to the regions searched. If 'owned' is set, the search frees
+ * buf->data, even if this raises. */
+void Opdis_gadgetAddRegion( Opdis_gadget_search * search,
+			    const opdis_buffer_t * buf, int owned );
+
+/* Find the gadgets in all regions, decoding with the opdis_t of 'runner'
+ * on 'threads' workers. This releases the GVL while searching; an aborted
+ * search is reported by Opdis_runnerFinish. */
+void Opdis_gadgetSearch( Opdis_gadget_search * search,
+			 Opdis_runner * runner );
+
+/* Return an Array of the distinct gadgets found, in order of their lowest
+ * VMA. Raises NoMemError if the search ran out of memory. */
+VALUE Opdis_gadgetResults( const Opdis_gadget_search * search );
+
+void Opdis_gadgetFree( Opdis_gadget_search * search );
+
+#endif
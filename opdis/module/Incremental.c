@@ -0,0 +1,624 @@
+/* Incremental.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+
+#include <opdis/opdis.h>
+
+#include "Disassembly.h"
+#include "Incremental.h"
+
+/* Longest instruction that can fall through to an address */
+#define INC_MAX_INSN_SZ 16
+
+/* ---------------------------------------------------------------------- */
+/* Lists */
+
+/* Indices of records in the old Disassembly */
+struct inc_idx_list {
+	size_t * items;
+	size_t count;
+	size_t alloc;
+	int failed;			/* out of memory */
+};
+
+static void idx_add( struct inc_idx_list * list, size_t idx ) {
+	if ( list->failed ) {
+		return;
+	}
+
+	if ( list->count == list->alloc ) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 64;
+		size_t * items = realloc( list->items, alloc * sizeof(size_t) );
+		if (! items ) {
+			list->failed = 1;
+			return;
+		}
+		list->items = items;
+		list->alloc = alloc;
+	}
+
+	list->items[list->count++] = idx;
+}
+
+static int idx_pop( struct inc_idx_list * list, size_t * idx ) {
+	if (! list->count ) {
+		return 0;
+	}
+
+	*idx = list->items[--list->count];
+	return 1;
+}
+
+static int cmp_idx( const void * a, const void * b ) {
+	size_t ia = *(const size_t *) a, ib = *(const size_t *) b;
+	return (ia < ib) ? -1 : (ia > ib);
+}
+
+/* remove the (unique) records in 'list' from 'old' */
+static void remove_records( VALUE old, struct inc_idx_list * list ) {
+	if (! list->count ) {
+		return;
+	}
+
+	qsort( list->items, list->count, sizeof(size_t), cmp_idx );
+	Opdis_disassemblyRemove( old, list->items, list->count );
+}
+
+static void report_oom( Opdis_runner * runner ) {
+	opdis_t opdis = runner->opdis;
+	opdis->error_reporter( opdis_error_unknown,
+			       "Unable to allocate re-disassembly state",
+			       opdis->error_reporter_arg );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Linear disassembly */
+
+struct inc_linear {
+	Opdis_runner * runner;
+	VALUE old;
+	const Opdis_vma_range * changes;
+	size_t num_changes;
+	size_t change;			/* change being swept */
+	opdis_vma_t sync;		/* where the sweep rejoined 'old' */
+	int synced;
+	OPDIS_HANDLER handler;
+	void * handler_arg;
+};
+
+/* is 'vma' inside this or a later change? */
+static int lin_in_change( struct inc_linear * lin, opdis_vma_t vma ) {
+	size_t i;
+
+	for ( i = lin->change; i < lin->num_changes &&
+			       lin->changes[i].lo <= vma; i++ ) {
+		if ( vma < lin->changes[i].hi ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void lin_display( const opdis_insn_t * i, void * arg ) {
+	struct inc_linear * lin = (struct inc_linear *) arg;
+	opdis_insn_t * copy;
+
+	if ( lin->synced ) {
+		return;
+	}
+
+	/* a linear sweep only depends on where it starts: once it reaches
+	 * an unmodified byte at which the original sweep also started an
+	 * instruction, the original output is correct from there on */
+	if ( i->vma >= lin->changes[lin->change].hi &&
+	     ! lin_in_change( lin, i->vma ) &&
+	     Opdis_disassemblyFind( lin->old, i->vma ) >= 0 ) {
+		lin->synced = 1;
+		lin->sync = i->vma;
+		return;
+	}
+
+	copy = opdis_insn_dupe(i);
+	if (! copy ) {
+		report_oom( lin->runner );
+		return;
+	}
+
+	Opdis_runnerPush( lin->runner, copy );
+}
+
+static int lin_handler( const opdis_insn_t * i, void * arg ) {
+	struct inc_linear * lin = (struct inc_linear *) arg;
+
+	if ( lin->synced ) {
+		return 0;
+	}
+
+	return lin->handler( i, lin->handler_arg );
+}
+
+void Opdis_incrementalLinear( Opdis_runner * runner, opdis_buf_t buf,
+			      VALUE old, const Opdis_vma_range * changes,
+			      size_t num_changes, opdis_vma_t vma,
+			      opdis_vma_t end ) {
+	opdis_t opdis = runner->opdis;
+	OPDIS_DISPLAY display = opdis->display;
+	void * display_arg = opdis->display_arg;
+	struct inc_linear lin;
+	struct inc_idx_list removed = {0};
+	opdis_vma_t cursor = vma;
+	size_t c;
+
+	lin.runner = runner;
+	lin.old = old;
+	lin.changes = changes;
+	lin.num_changes = num_changes;
+	lin.handler = opdis->handler;
+	lin.handler_arg = opdis->handler_arg;
+
+	opdis_set_display( opdis, lin_display, &lin );
+	opdis_set_handler( opdis, lin_handler, &lin );
+
+	for ( c = 0; c < num_changes && ! runner->abort; c++ ) {
+		opdis_vma_t from = changes[c].lo;
+		size_t i, count;
+		long idx;
+
+		/* already swept past this change */
+		if ( changes[c].hi <= cursor ) {
+			continue;
+		}
+		if ( from >= end ) {
+			break;
+		}
+
+		/* restart at the instruction which overlaps the change */
+		if ( from < cursor ) {
+			from = cursor;
+		}
+		idx = Opdis_disassemblyFindContaining( old, from );
+		if ( idx >= 0 ) {
+			from = Opdis_disassemblyRecAt( old, idx )->vma;
+		}
+		if ( from < cursor ) {
+			from = cursor;
+		}
+
+		lin.change = c;
+		lin.synced = 0;
+		lin.sync = end;
+		opdis_disasm_linear( opdis, buf, from, end - from );
+
+		/* the old instructions that the sweep replaced */
+		count = Opdis_disassemblyCount( old );
+		for ( i = Opdis_disassemblyLowerBound( old, from );
+		      i < count && Opdis_disassemblyRecAt(old, i)->vma < lin.sync;
+		      i++ ) {
+			idx_add( &removed, i );
+		}
+
+		cursor = lin.sync;
+	}
+
+	opdis_set_display( opdis, display, display_arg );
+	opdis_set_handler( opdis, lin.handler, lin.handler_arg );
+
+	if ( removed.failed ) {
+		report_oom( runner );
+	} else if (! runner->abort ) {
+		remove_records( old, &removed );
+	}
+
+	free( removed.items );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Control flow disassembly */
+
+/* State of records in the old Disassembly */
+#define INC_DIRTY	0x01		/* overlaps a change */
+#define INC_DOWNSTREAM	0x02		/* reachable from a dirty record */
+#define INC_LIVE	0x04		/* downstream, but still reachable */
+#define INC_ROOTED	0x08		/* dirty, and walked again */
+
+struct inc_cflow {
+	Opdis_runner * runner;
+	opdis_buf_t buf;
+	VALUE old;
+	size_t count;
+	opdis_vma_t entry;
+	st_table * flags;		/* record index => INC_ flags */
+	st_table * decoded;		/* buffer offsets decoded by the walk */
+	const Opdis_disasm_branch * edges;	/* sorted by target */
+	size_t num_edges;
+	struct inc_idx_list dirty;
+	struct inc_idx_list downstream;
+	struct inc_idx_list work;
+	opdis_vma_t * flows;		/* addresses waiting to be walked */
+	size_t num_flows;
+	size_t flows_alloc;
+	opdis_insn_t * insn;
+	int failed;
+};
+
+static int cf_in_buf( opdis_buf_t buf, opdis_vma_t vma ) {
+	return vma >= buf->vma && vma - buf->vma < buf->len;
+}
+
+static int cf_flags( struct inc_cflow * cf, size_t idx ) {
+	st_data_t val;
+	return st_lookup( cf->flags, (st_data_t) idx, &val ) ? (int) val : 0;
+}
+
+static void cf_set_flags( struct inc_cflow * cf, size_t idx, int flags ) {
+	st_insert( cf->flags, (st_data_t) idx, (st_data_t) flags );
+}
+
+/* index of the record at 'vma' */
+static long cf_find( struct inc_cflow * cf, opdis_vma_t vma ) {
+	return Opdis_disassemblyFind( cf->old, vma );
+}
+
+/* the targets of the old record 'idx'. Returns the number found. */
+static int cf_successors( struct inc_cflow * cf, size_t idx,
+			  opdis_vma_t * out ) {
+	opdis_t opdis = cf->runner->opdis;
+	const opdis_insn_t * insn = Opdis_disassemblyInsnAt( cf->old, idx );
+	int n = 0;
+
+	if ( opdis_insn_is_branch(insn) ) {
+		opdis_vma_t tgt = opdis->resolver( insn, opdis->resolver_arg );
+		if ( tgt != OPDIS_INVALID_ADDR ) {
+			out[n++] = tgt;
+		}
+	}
+
+	if ( opdis_insn_fallthrough(insn) && insn->size ) {
+		out[n++] = insn->vma + insn->size;
+	}
+
+	return n;
+}
+
+/* can old record 'idx' still be reached through the old instructions? */
+static int cf_pred_live( struct inc_cflow * cf, size_t idx ) {
+	int flags = cf_flags( cf, idx );
+
+	if ( flags & INC_DIRTY ) {
+		return 0;
+	}
+
+	return (! (flags & INC_DOWNSTREAM)) || (flags & INC_LIVE);
+}
+
+/* does an old record which is still reachable lead to 'vma'? */
+static int cf_has_live_pred( struct inc_cflow * cf, opdis_vma_t vma ) {
+	size_t lo = 0, hi = cf->num_edges, i;
+
+	/* branches */
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( cf->edges[mid].target < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for ( ; lo < cf->num_edges && cf->edges[lo].target == vma; lo++ ) {
+		long k = cf_find( cf, cf->edges[lo].src );
+		if ( k >= 0 && cf_pred_live( cf, (size_t) k ) ) {
+			return 1;
+		}
+	}
+
+	/* fall-through from an instruction ending at 'vma' */
+	for ( i = Opdis_disassemblyLowerBound( cf->old, vma ); i > 0; i-- ) {
+		const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt( cf->old,
+								       i - 1 );
+		if ( vma - rec->vma > INC_MAX_INSN_SZ ) {
+			break;
+		}
+
+		if ( rec->vma + rec->size == vma && cf_pred_live(cf, i - 1) &&
+		     opdis_insn_fallthrough( Opdis_disassemblyInsnAt(cf->old,
+								     i - 1) ) ){
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* mark a downstream record, and everything downstream of it, as live */
+static void cf_mark_live( struct inc_cflow * cf, size_t idx ) {
+	int flags = cf_flags( cf, idx );
+
+	if ( (flags & (INC_DOWNSTREAM | INC_LIVE)) != INC_DOWNSTREAM ) {
+		return;
+	}
+
+	cf_set_flags( cf, idx, flags | INC_LIVE );
+	idx_add( &cf->work, idx );
+
+	while ( idx_pop( &cf->work, &idx ) ) {
+		opdis_vma_t succ[2];
+		int i, n = cf_successors( cf, idx, succ );
+
+		for ( i = 0; i < n; i++ ) {
+			long k = cf_find( cf, succ[i] );
+			if ( k < 0 ) {
+				continue;
+			}
+
+			flags = cf_flags( cf, (size_t) k );
+			if ( (flags & (INC_DOWNSTREAM | INC_LIVE)) ==
+			     INC_DOWNSTREAM ) {
+				cf_set_flags( cf, (size_t) k, flags | INC_LIVE );
+				idx_add( &cf->work, (size_t) k );
+			}
+		}
+	}
+}
+
+/* collect the old records reachable from the dirty records */
+static void cf_find_downstream( struct inc_cflow * cf ) {
+	size_t i, idx;
+
+	for ( i = 0; i < cf->dirty.count; i++ ) {
+		idx_add( &cf->work, cf->dirty.items[i] );
+	}
+
+	while ( idx_pop( &cf->work, &idx ) ) {
+		opdis_vma_t succ[2];
+		int j, n = cf_successors( cf, idx, succ );
+
+		for ( j = 0; j < n; j++ ) {
+			long k = cf_find( cf, succ[j] );
+
+			/* the entry point is always reachable */
+			if ( k < 0 || succ[j] == cf->entry ||
+			     cf_flags( cf, (size_t) k ) ) {
+				continue;
+			}
+
+			cf_set_flags( cf, (size_t) k, INC_DOWNSTREAM );
+			idx_add( &cf->downstream, (size_t) k );
+			idx_add( &cf->work, (size_t) k );
+		}
+	}
+}
+
+static void cf_push_flow( struct inc_cflow * cf, opdis_vma_t vma ) {
+	if ( cf->num_flows == cf->flows_alloc ) {
+		size_t alloc = cf->flows_alloc ? cf->flows_alloc * 2 : 64;
+		opdis_vma_t * flows = realloc( cf->flows,
+					       alloc * sizeof(opdis_vma_t) );
+		if (! flows ) {
+			cf->failed = 1;
+			return;
+		}
+		cf->flows = flows;
+		cf->flows_alloc = alloc;
+	}
+
+	cf->flows[cf->num_flows++] = vma;
+}
+
+/* Walk the modified code from 'vma', as opdis_disasm_cflow does. A flow
+ * stops when it reaches an old instruction which is still valid; if that
+ * instruction was downstream of the change, it is still reachable. */
+static void cf_walk( struct inc_cflow * cf, opdis_vma_t vma ) {
+	Opdis_runner * runner = cf->runner;
+	opdis_t opdis = runner->opdis;
+	opdis_insn_t * insn = cf->insn;
+
+	cf_push_flow( cf, vma );
+
+	while ( cf->num_flows && ! cf->failed ) {
+		vma = cf->flows[--cf->num_flows];
+
+		while ( cf_in_buf(cf->buf, vma) &&
+			Opdis_runnerCheckInts(runner) ) {
+			st_data_t off = (st_data_t) (vma - cf->buf->vma);
+			opdis_insn_t * copy;
+			long k = cf_find( cf, vma );
+
+			if ( k >= 0 && ! (cf_flags(cf, (size_t) k) & INC_DIRTY) ){
+				cf_mark_live( cf, (size_t) k );
+				break;
+			}
+
+			if ( st_lookup( cf->decoded, off, NULL ) ) {
+				break;
+			}
+			st_insert( cf->decoded, off, 1 );
+
+			opdis_insn_clear( insn );
+			if (! opdis_disasm_insn( opdis, cf->buf, vma, insn ) ) {
+				break;
+			}
+
+			copy = opdis_insn_dupe( insn );
+			if (! copy ) {
+				cf->failed = 1;
+				break;
+			}
+			Opdis_runnerPush( runner, copy );
+
+			if ( opdis_insn_is_branch(insn) ) {
+				opdis_vma_t tgt = opdis->resolver( insn,
+							opdis->resolver_arg );
+				if ( tgt != OPDIS_INVALID_ADDR &&
+				     cf_in_buf(cf->buf, tgt) ) {
+					cf_push_flow( cf, tgt );
+				}
+			}
+
+			if (! opdis_insn_fallthrough(insn) || ! insn->size ) {
+				break;
+			}
+
+			vma += insn->size;
+		}
+	}
+}
+
+/* Walk again from each dirty record, and each modified byte, which code
+ * that is still reachable leads to. This includes modified bytes which the
+ * old walk failed to decode. Walks can make more of the downstream code
+ * reachable, so repeat until they decode nothing new. */
+static void cf_rewalk( struct inc_cflow * cf, const Opdis_vma_range * changes,
+		       size_t num_changes ) {
+	st_index_t decoded = (st_index_t) -1;
+
+	while ( decoded != cf->decoded->num_entries && ! cf->failed && 
+		! cf->runner->abort ) {
+		size_t i;
+
+		decoded = cf->decoded->num_entries;
+
+		for ( i = 0; i < num_changes; i++ ) {
+			opdis_vma_t vma;
+
+			for ( vma = changes[i].lo; vma < changes[i].hi && 
+			      cf_in_buf(cf->buf, vma); vma++ ) {
+				st_data_t off = (st_data_t) (vma - cf->buf->vma);
+
+				if ( st_lookup( cf->decoded, off, NULL ) ) {
+					continue;
+				}
+
+				if ( vma == cf->entry || 
+				     cf_has_live_pred(cf, vma) ) {
+					cf_walk( cf, vma );
+				}
+			}
+		}
+
+		for ( i = 0; i < cf->dirty.count; i++ ) {
+			size_t idx = cf->dirty.items[i];
+			int flags = cf_flags( cf, idx );
+			opdis_vma_t vma;
+
+			if ( flags & INC_ROOTED ) {
+				continue;
+			}
+
+			vma = Opdis_disassemblyRecAt( cf->old, idx )->vma;
+			if ( vma != cf->entry && ! cf_has_live_pred(cf, vma) ) {
+				continue;
+			}
+
+			cf_set_flags( cf, idx, flags | INC_ROOTED );
+			cf_walk( cf, vma );
+		}
+	}
+}
+
+static void cf_free( struct inc_cflow * cf ) {
+	st_free_table( cf->flags );
+	st_free_table( cf->decoded );
+	free( cf->dirty.items );
+	free( cf->downstream.items );
+	free( cf->work.items );
+	free( cf->flows );
+}
+
+void Opdis_incrementalCflow( Opdis_runner * runner, opdis_buf_t buf,
+			     VALUE old, const Opdis_vma_range * changes,
+			     size_t num_changes, opdis_vma_t entry ) {
+	struct inc_cflow cf;
+	struct inc_idx_list removed = {0};
+	size_t c, i;
+
+	memset( &cf, 0, sizeof(cf) );
+	cf.runner = runner;
+	cf.buf = buf;
+	cf.old = old;
+	cf.count = Opdis_disassemblyCount( old );
+	cf.entry = entry;
+
+	/* the branches of the old Disassembly by target. The index is kept
+	 * with the Disassembly, so only the instructions added since it was
+	 * last used are resolved. This can raise, so it comes first. */
+	cf.edges = Opdis_disassemblyBranches( old, runner->opdis->resolver,
+					      runner->opdis->resolver_arg,
+					      &cf.num_edges );
+
+	cf.insn = Opdis_arenaAlloc( &runner->arena );
+	if (! cf.insn ) {
+		report_oom( runner );
+		return;
+	}
+
+	cf.flags = st_init_numtable();
+	cf.decoded = st_init_numtable();
+
+	/* the old records which overlap a change. Instructions found by
+	 * control flow can overlap, so look further back than the nearest. */
+	for ( c = 0; c < num_changes; c++ ) {
+		opdis_vma_t lo = changes[c].lo;
+
+		for ( i = Opdis_disassemblyLowerBound( old, lo ); i > 0 &&
+		      lo - Opdis_disassemblyRecAt(old, i - 1)->vma <= 
+		      INC_MAX_INSN_SZ; i-- ) 
+			;
+
+		for ( ; i < cf.count &&
+			Opdis_disassemblyRecAt(old, i)->vma < changes[c].hi;
+		      i++ ) {
+			const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt(old,
+									      i);
+			if ( rec->vma + rec->size > lo && ! cf_flags( &cf, i ) ) {
+				cf_set_flags( &cf, i, INC_DIRTY );
+				idx_add( &cf.dirty, i );
+			}
+		}
+	}
+
+	if ( cf.dirty.count ) {
+		cf_find_downstream( &cf );
+
+		/* downstream code with a way in that avoids the change */
+		for ( i = 0; i < cf.downstream.count && ! cf.failed; i++ ) {
+			size_t idx = cf.downstream.items[i];
+			if ( cf_has_live_pred( &cf,
+				Opdis_disassemblyRecAt(old, idx)->vma ) ) {
+				cf_mark_live( &cf, idx );
+			}
+		}
+	}
+
+	cf_rewalk( &cf, changes, num_changes );
+
+	/* dirty records, and downstream records that are now unreachable */
+	for ( i = 0; i < cf.dirty.count; i++ ) {
+		idx_add( &removed, cf.dirty.items[i] );
+	}
+	for ( i = 0; i < cf.downstream.count; i++ ) {
+		if (! (cf_flags( &cf, cf.downstream.items[i] ) & INC_LIVE) ) {
+			idx_add( &removed, cf.downstream.items[i] );
+		}
+	}
+
+	if ( cf.failed || cf.dirty.failed || cf.downstream.failed ||
+	     cf.work.failed || removed.failed ) {
+		report_oom( runner );
+	} else if (! runner->abort ) {
+		remove_records( old, &removed );
+	}
+
+	Opdis_arenaRelease( &runner->arena, cf.insn );
+	free( removed.items );
+	cf_free( &cf );
+}
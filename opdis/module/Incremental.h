@@ -0,0 +1,47 @@
+/* Incremental.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_INCREMENTAL_H
+#define OPDIS_RB_INCREMENTAL_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#include "Runner.h"
+
+/* A range of modified bytes, [lo, hi) */
+typedef struct {
+	opdis_vma_t lo;
+	opdis_vma_t hi;
+} Opdis_vma_range;
+
+/* Incremental re-disassembly: 'old' is a Disassembly produced from 'buf'
+ * before the bytes in 'changes' (sorted, non-overlapping) were modified.
+ * Instructions which are still valid are left in 'old'; instructions which
+ * are not are removed from it. Replacement instructions are passed to the
+ * runner, whose output must not be 'old'. Both are called with the GVL
+ * held (see Opdis_runnerRunLocked). */
+
+/* Linear sweep of [vma, end). Each sweep starts at the instruction which
+ * overlaps a change, and stops at the first instruction boundary after the
+ * change that the original sweep also produced. */
+void Opdis_incrementalLinear( Opdis_runner * runner, opdis_buf_t buf,
+			      VALUE old, const Opdis_vma_range * changes,
+			      size_t num_changes, opdis_vma_t vma,
+			      opdis_vma_t end );
+
+/* Control flow disassembly from 'entry'. Instructions which overlap a
+ * change are decoded again from each address at which the original walk
+ * entered them, and the walk stops at instructions that are still valid.
+ * Instructions which were only reachable through the old instructions are
+ * removed. Targets outside 'buf' are not followed. The handler of the
+ * runner's opdis_t is not consulted. */
+void Opdis_incrementalCflow( Opdis_runner * runner, opdis_buf_t buf,
+			     VALUE old, const Opdis_vma_range * changes,
+			     size_t num_changes, opdis_vma_t entry );
+
+#endif
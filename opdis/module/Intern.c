@@ -0,0 +1,95 @@
+/* Intern.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include "Intern.h"
+
+/* Table of C string -> frozen Ruby String. The keys are owned by the table;
+ * the values are kept alive by the 'strings' array, which is registered
+ * with the GC. Interned strings are never released. */
+static st_table * intern_tbl = NULL;
+static VALUE intern_strings = Qnil;
+
+static VALUE new_frozen( const char * str, long len ) {
+	VALUE var = rb_str_new(str, len);
+	OBJ_FREEZE(var);
+	return var;
+}
+
+VALUE Opdis_intern( const char * str ) {
+	st_data_t val;
+	char * key;
+	VALUE var;
+	long len;
+
+	if (! str ) {
+		str = "";
+	}
+
+	if ( st_lookup(intern_tbl, (st_data_t) str, &val) ) {
+		return (VALUE) val;
+	}
+
+	len = (long) strlen(str);
+	if ( len > OPDIS_INTERN_MAX_LEN || 
+	     intern_tbl->num_entries >= OPDIS_INTERN_MAX_ENTRIES ) {
+		return new_frozen(str, len);
+	}
+
+	var = new_frozen(str, len);
+	rb_ary_push(intern_strings, var);
+
+	key = ALLOC_N(char, len + 1);
+	memcpy(key, str, len + 1);
+	st_insert(intern_tbl, (st_data_t) key, (st_data_t) var);
+
+	return var;
+}
+
+VALUE Opdis_internSplit( const char * str, const char * sep ) {
+	char buf[OPDIS_INTERN_MAX_LEN + 1];
+	VALUE ary = rb_ary_new();
+	size_t len;
+
+	if (! str ) {
+		return ary;
+	}
+
+	while ( *str ) {
+		str += strspn(str, sep);
+		len = strcspn(str, sep);
+		if (! len ) {
+			break;
+		}
+
+		if ( len <= OPDIS_INTERN_MAX_LEN ) {
+			memcpy(buf, str, len);
+			buf[len] = '\0';
+			rb_ary_push(ary, Opdis_intern(buf));
+		} else {
+			rb_ary_push(ary, new_frozen(str, (long) len));
+		}
+
+		str += len;
+	}
+
+	return ary;
+}
+
+void Opdis_initIntern( void ) {
+	if ( intern_tbl ) {
+		return;
+	}
+
+	intern_tbl = st_init_strtable();
+	intern_strings = rb_ary_new();
+	rb_gc_register_address(&intern_strings);
+}
@@ -0,0 +1,29 @@
+/* Intern.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_INTERN_H
+#define OPDIS_RB_INTERN_H
+
+#include <ruby.h>
+
+/* Strings longer than this are never interned */
+#define OPDIS_INTERN_MAX_LEN 64
+/* Maximum number of entries in the intern table */
+#define OPDIS_INTERN_MAX_ENTRIES 8192
+
+void Opdis_initIntern( void );
+
+/* Return a frozen String for 'str'. Repeated calls with the same contents
+ * return the same object, so mnemonics, register names, flags and the like
+ * are only allocated once per process. A NULL 'str' yields "". */
+VALUE Opdis_intern( const char * str );
+
+/* Split 'str' on any of the characters in 'sep' and return an Array of
+ * interned Strings. Empty tokens are skipped. */
+VALUE Opdis_internSplit( const char * str, const char * sep );
+
+#endif
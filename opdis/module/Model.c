@@ -11,6 +11,7 @@
 #include <opdis/model.h>
 
 #include "Model.h"
+#include "Intern.h"
 
 static VALUE symToSym, symToS;
 static VALUE clsInsn, clsOp, clsReg, clsAbsAddr;
@@ -47,14 +48,14 @@ static VALUE cls_op_init(VALUE instance) {
 }
 
 static void define_op_constants() {
-	rb_define_const(clsOp, OP_FLAG_R_NAME, rb_str_new_cstr(OP_FLAG_R));
-	rb_define_const(clsOp, OP_FLAG_W_NAME, rb_str_new_cstr(OP_FLAG_W));
-	rb_define_const(clsOp, OP_FLAG_X_NAME, rb_str_new_cstr(OP_FLAG_X));
+	rb_define_const(clsOp, OP_FLAG_R_NAME, Opdis_intern(OP_FLAG_R));
+	rb_define_const(clsOp, OP_FLAG_W_NAME, Opdis_intern(OP_FLAG_W));
+	rb_define_const(clsOp, OP_FLAG_X_NAME, Opdis_intern(OP_FLAG_X));
 	rb_define_const(clsOp, OP_FLAG_SIGNED_NAME,
-			rb_str_new_cstr(OP_FLAG_SIGNED));
+			Opdis_intern(OP_FLAG_SIGNED));
 	rb_define_const(clsOp, OP_FLAG_ADDR_NAME,
-			rb_str_new_cstr(OP_FLAG_ADDR));
-	rb_define_const(clsOp, OP_FLAG_IND_NAME, rb_str_new_cstr(OP_FLAG_IND));
+			Opdis_intern(OP_FLAG_ADDR));
+	rb_define_const(clsOp, OP_FLAG_IND_NAME, Opdis_intern(OP_FLAG_IND));
 }
 
 static void init_op_class( VALUE modOpdis ) {
@@ -76,55 +77,55 @@ static void init_op_class( VALUE modOpdis ) {
 static void set_ruby_reg_flags( VALUE instance, enum opdis_reg_flag_t val ) {
 	VALUE flags = rb_iv_get(instance, IVAR(REG_ATTR_FLAGS) );
 	if ( val & opdis_reg_flag_gen ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_GEN) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_GEN) );
 	}
 	if ( val & opdis_reg_flag_fpu ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_FPU) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_FPU) );
 	}
 	if ( val & opdis_reg_flag_gpu ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_GPU) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_GPU) );
 	}
 	if ( val & opdis_reg_flag_simd ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_SIMD) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_SIMD) );
 	}
 	if ( val & opdis_reg_flag_task ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_TASK) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_TASK) );
 	}
 	if ( val & opdis_reg_flag_mem ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_MEM) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_MEM) );
 	}
 	if ( val & opdis_reg_flag_debug ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_DBG) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_DBG) );
 	}
 	if ( val & opdis_reg_flag_pc ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_PC) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_PC) );
 	}
 	if ( val & opdis_reg_flag_flags ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_CC) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_CC) );
 	}
 	if ( val & opdis_reg_flag_stack ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_STACK) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_STACK) );
 	}
 	if ( val & opdis_reg_flag_frame ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_FRAME) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_FRAME) );
 	}
 	if ( val & opdis_reg_flag_seg ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_SEG) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_SEG) );
 	}
 	if ( val & opdis_reg_flag_zero ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_Z) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_Z) );
 	}
 	if ( val & opdis_reg_flag_argsin ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_IN) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_IN) );
 	}
 	if ( val & opdis_reg_flag_argsout ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_OUT) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_OUT) );
 	}
 	if ( val & opdis_reg_flag_locals ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_LOCALS) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_LOCALS) );
 	}
 	if ( val & opdis_reg_flag_return ) {
-		rb_ary_push(flags, rb_str_new_cstr( REG_FLAG_RET) );
+		rb_ary_push(flags, Opdis_intern( REG_FLAG_RET) );
 	}
 }
 
@@ -176,7 +177,7 @@ static void set_c_reg_flags( opdis_reg_t * dest, VALUE reg ) {
 static void fill_ruby_reg( opdis_reg_t * reg, VALUE dest ) {
 	rb_iv_set(dest, IVAR(REG_ATTR_ID), UINT2NUM(reg->id) );
 	rb_iv_set(dest, IVAR(REG_ATTR_SIZE), UINT2NUM(reg->size) );
-	rb_iv_set(dest, IVAR(GEN_ATTR_ASCII), rb_str_new_cstr(reg->ascii) );
+	rb_iv_set(dest, IVAR(GEN_ATTR_ASCII), Opdis_intern(reg->ascii) );
 	set_ruby_reg_flags(dest, reg->flags);
 }
 
@@ -228,39 +229,39 @@ static void init_reg_attributes( VALUE class ) {
 
 static void define_reg_constants( VALUE class ) {
 	rb_define_const(class, REG_FLAG_GEN_NAME,
-			rb_str_new_cstr(REG_FLAG_GEN));
+			Opdis_intern(REG_FLAG_GEN));
 	rb_define_const(class, REG_FLAG_FPU_NAME,
-			rb_str_new_cstr(REG_FLAG_FPU));
+			Opdis_intern(REG_FLAG_FPU));
 	rb_define_const(class, REG_FLAG_GPU_NAME,
-			rb_str_new_cstr(REG_FLAG_GPU));
+			Opdis_intern(REG_FLAG_GPU));
 	rb_define_const(class, REG_FLAG_SIMD_NAME,
-			rb_str_new_cstr(REG_FLAG_SIMD));
+			Opdis_intern(REG_FLAG_SIMD));
 	rb_define_const(class, REG_FLAG_TASK_NAME,
-			rb_str_new_cstr(REG_FLAG_TASK));
+			Opdis_intern(REG_FLAG_TASK));
 	rb_define_const(class, REG_FLAG_MEM_NAME,
-			rb_str_new_cstr(REG_FLAG_MEM));
+			Opdis_intern(REG_FLAG_MEM));
 	rb_define_const(class, REG_FLAG_DBG_NAME,
-			rb_str_new_cstr(REG_FLAG_DBG));
+			Opdis_intern(REG_FLAG_DBG));
 	rb_define_const(class, REG_FLAG_PC_NAME,
-			rb_str_new_cstr(REG_FLAG_PC));
+			Opdis_intern(REG_FLAG_PC));
 	rb_define_const(class, REG_FLAG_CC_NAME,
-			rb_str_new_cstr(REG_FLAG_CC));
+			Opdis_intern(REG_FLAG_CC));
 	rb_define_const(class, REG_FLAG_STACK_NAME,
-			rb_str_new_cstr(REG_FLAG_STACK));
+			Opdis_intern(REG_FLAG_STACK));
 	rb_define_const(class, REG_FLAG_FRAME_NAME,
-			rb_str_new_cstr(REG_FLAG_FRAME));
+			Opdis_intern(REG_FLAG_FRAME));
 	rb_define_const(class, REG_FLAG_SEG_NAME,
-			rb_str_new_cstr(REG_FLAG_SEG));
+			Opdis_intern(REG_FLAG_SEG));
 	rb_define_const(class, REG_FLAG_Z_NAME,
-			rb_str_new_cstr(REG_FLAG_Z));
+			Opdis_intern(REG_FLAG_Z));
 	rb_define_const(class, REG_FLAG_IN_NAME,
-			rb_str_new_cstr(REG_FLAG_IN));
+			Opdis_intern(REG_FLAG_IN));
 	rb_define_const(class, REG_FLAG_OUT_NAME,
-			rb_str_new_cstr(REG_FLAG_OUT));
+			Opdis_intern(REG_FLAG_OUT));
 	rb_define_const(class, REG_FLAG_LOCALS_NAME,
-			rb_str_new_cstr(REG_FLAG_LOCALS));
+			Opdis_intern(REG_FLAG_LOCALS));
 	rb_define_const(class, REG_FLAG_RET_NAME,
-			rb_str_new_cstr(REG_FLAG_RET));
+			Opdis_intern(REG_FLAG_RET));
 }
 
 static VALUE cls_reg_init(VALUE instance) {
@@ -425,7 +426,7 @@ static void fill_ruby_addrexpr( opdis_addr_expr_t * expr, VALUE dest ) {
 	}
 
 	rb_iv_set( dest, IVAR(ADDR_EXP_ATTR_SHIFT), 
-		   rb_str_new_cstr(get_expr_shift_str(expr->shift)) );
+		   Opdis_intern(get_expr_shift_str(expr->shift)) );
 }
 
 static VALUE addrexpr_op_from_c( opdis_addr_expr_t * expr ) {
@@ -546,15 +547,15 @@ static void init_addrexpr_class( VALUE modOpdis ) {
 
 	/* constants */
 	rb_define_const(clsAddrExprOp, ADDR_EXP_SHIFT_LSL_NAME,
-			rb_str_new_cstr(ADDR_EXP_SHIFT_LSL));
+			Opdis_intern(ADDR_EXP_SHIFT_LSL));
 	rb_define_const(clsAddrExprOp, ADDR_EXP_SHIFT_LSR_NAME,
-			rb_str_new_cstr(ADDR_EXP_SHIFT_LSR));
+			Opdis_intern(ADDR_EXP_SHIFT_LSR));
 	rb_define_const(clsAddrExprOp, ADDR_EXP_SHIFT_ASL_NAME,
-			rb_str_new_cstr(ADDR_EXP_SHIFT_ASL));
+			Opdis_intern(ADDR_EXP_SHIFT_ASL));
 	rb_define_const(clsAddrExprOp, ADDR_EXP_SHIFT_ROR_NAME,
-			rb_str_new_cstr(ADDR_EXP_SHIFT_ROR));
+			Opdis_intern(ADDR_EXP_SHIFT_ROR));
 	rb_define_const(clsAddrExprOp, ADDR_EXP_SHIFT_RRX_NAME,
-			rb_str_new_cstr(ADDR_EXP_SHIFT_RRX));
+			Opdis_intern(ADDR_EXP_SHIFT_RRX));
 }
  
 /* ---------------------------------------------------------------------- */
@@ -630,22 +631,22 @@ static void set_rb_op_flags( VALUE instance, enum opdis_op_flag_t val ) {
 	VALUE flags = rb_iv_get(instance, IVAR(OP_ATTR_FLAGS) );
 	
 	if ( val & opdis_op_flag_r ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_R) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_R) );
 	}
 	if ( val & opdis_op_flag_w ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_W) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_W) );
 	}
 	if ( val & opdis_op_flag_x ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_X) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_X) );
 	}
 	if ( val & opdis_op_flag_signed ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_SIGNED) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_SIGNED) );
 	}
 	if ( val & opdis_op_flag_address ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_ADDR) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_ADDR) );
 	}
 	if ( val & opdis_op_flag_indirect ) {
-		rb_ary_push(flags, rb_str_new_cstr(OP_FLAG_IND) );
+		rb_ary_push(flags, Opdis_intern(OP_FLAG_IND) );
 	}
 }
 
@@ -709,51 +710,141 @@ static VALUE op_from_c( opdis_op_t * op ) {
 
 /* ---------------------------------------------------------------------- */
 /* Instruction Class */
+/* An Instruction wraps a copy of the opdis_insn_t it was created from. Its
+ * attributes are converted to Ruby objects the first time they are read,
+ * and cached from then on. Assigning an attribute replaces the cached
+ * value; the C instruction itself is never modified. */
+
+enum insn_field_t {
+	insn_field_status,
+	insn_field_ascii,
+	insn_field_offset,
+	insn_field_vma,
+	insn_field_size,
+	insn_field_bytes,
+	insn_field_prefixes,
+	insn_field_mnemonic,
+	insn_field_category,
+	insn_field_isa,
+	insn_field_flags,
+	insn_field_comment,
+	insn_field_operands,
+	insn_field_tgt_idx,
+	insn_field_dest_idx,
+	insn_field_src_idx,
+	insn_field_max
+};
+
+typedef struct {
+	opdis_insn_t * insn;		/* NULL for Instruction.new */
+	VALUE fields[insn_field_max];	/* Qundef until decoded */
+} Opdis_insn_data;
+
+static void insn_data_mark( void * ptr ) {
+	int i;
+	Opdis_insn_data * data = (Opdis_insn_data *) ptr;
+
+	for ( i = 0; i < insn_field_max; i++ ) {
+		if ( data->fields[i] != Qundef ) {
+			rb_gc_mark(data->fields[i]);
+		}
+	}
+}
+
+static void insn_data_free( void * ptr ) {
+	Opdis_insn_data * data = (Opdis_insn_data *) ptr;
+
+	if ( data->insn ) {
+		opdis_insn_free(data->insn);
+	}
+	xfree(data);
+}
+
+static size_t insn_data_memsize( const void * ptr ) {
+	const Opdis_insn_data * data = (const Opdis_insn_data *) ptr;
+	return sizeof(Opdis_insn_data) + 
+	       ((data->insn) ? sizeof(opdis_insn_t) + data->insn->size : 0);
+}
 
-static VALUE cls_insn_init(VALUE instance) {
-	rb_iv_set(instance, IVAR(INSN_ATTR_OPERANDS), rb_ary_new() );
-	rb_iv_set(instance, IVAR(INSN_ATTR_STATUS), rb_ary_new() );
+static const rb_data_type_t insn_data_type = {
+	"Opdis::Instruction",
+	{ insn_data_mark, insn_data_free, insn_data_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
 
+static void insn_data_reset( Opdis_insn_data * data ) {
+	int i;
+	for ( i = 0; i < insn_field_max; i++ ) {
+		data->fields[i] = Qundef;
+	}
+}
+
+static VALUE cls_insn_alloc( VALUE class ) {
+	Opdis_insn_data * data;
+	VALUE instance = TypedData_Make_Struct(class, Opdis_insn_data, 
+					       &insn_data_type, data);
+	data->insn = NULL;
+	insn_data_reset(data);
 	return instance;
 }
 
-static void set_attr_if_alias( VALUE instance, const char * name, int idx, 
-				opdis_op_t * a, opdis_op_t * b ) {
-	if ( a && b && a == b ) {
-		rb_iv_set(instance, name, INT2NUM(idx) );
+static Opdis_insn_data * insn_data( VALUE instance ) {
+	Opdis_insn_data * data;
+	TypedData_Get_Struct(instance, Opdis_insn_data, &insn_data_type, data);
+	return data;
+}
+
+static VALUE str_from_c( const char * str ) {
+	return rb_str_new_cstr( str ? str : "" );
+}
+
+static VALUE alias_idx_from_c( const opdis_insn_t * insn, opdis_op_t * alias ){
+	unsigned int i;
+
+	if (! alias ) {
+		return Qnil;
 	}
+
+	for ( i=0; i < insn->num_operands; i++ ) {
+		if ( insn->operands[i] == alias ) {
+			return INT2NUM(i);
+		}
+	}
+
+	return Qnil;
 }
 
+const char * Opdis_insnCategoryNames[OPDIS_INSN_NUM_CAT] = {
+	NULL, INSN_CAT_CFLOW, INSN_CAT_STACK, INSN_CAT_LOST, INSN_CAT_TEST,
+	INSN_CAT_MATH, INSN_CAT_BIT, INSN_CAT_IO, INSN_CAT_TRAP,
+	INSN_CAT_PRIV, INSN_CAT_NOP
+};
 
-static enum opdis_insn_cat_t insn_category_code( VALUE insn ) {
-	VALUE val = rb_iv_get(insn, IVAR(INSN_ATTR_CATEGORY));
-	if (! strcmp(INSN_CAT_CFLOW , StringValueCStr(val)) ) {
-		return opdis_insn_cat_cflow;
-	} else if (! strcmp(INSN_CAT_STACK , StringValueCStr(val)) ) {
-		return opdis_insn_cat_stack;
-	} else if (! strcmp(INSN_CAT_LOST , StringValueCStr(val)) ) {
-		return opdis_insn_cat_lost;
-	} else if (! strcmp(INSN_CAT_TEST , StringValueCStr(val)) ) {
-		return opdis_insn_cat_test;
-	} else if (! strcmp(INSN_CAT_MATH , StringValueCStr(val)) ) {
-		return opdis_insn_cat_math;
-	} else if (! strcmp(INSN_CAT_BIT , StringValueCStr(val)) ) {
-		return opdis_insn_cat_bit;
-	} else if (! strcmp(INSN_CAT_IO , StringValueCStr(val)) ) {
-		return opdis_insn_cat_io;
-	} else if (! strcmp(INSN_CAT_TRAP , StringValueCStr(val)) ) {
-		return opdis_insn_cat_trap;
-	} else if (! strcmp(INSN_CAT_PRIV , StringValueCStr(val)) ) {
-		return opdis_insn_cat_priv;
-	} else if (! strcmp(INSN_CAT_NOP , StringValueCStr(val)) ) {
-		return opdis_insn_cat_nop;
+static enum opdis_insn_cat_t insn_category_code( VALUE val ) {
+	const char * name;
+	int i;
+
+	if ( val == Qnil ) {
+		return opdis_insn_cat_unknown;
+	}
+
+	name = StringValueCStr(val);
+	for ( i = opdis_insn_cat_unknown + 1; i < OPDIS_INSN_NUM_CAT; i++ ) {
+		if (! strcmp(Opdis_insnCategoryNames[i], name) ) {
+			return (enum opdis_insn_cat_t) i;
+		}
 	}
 
 	return opdis_insn_cat_unknown;
 }
 
-static enum opdis_insn_subset_t insn_isa_code( VALUE insn ) {
-	VALUE val = rb_iv_get(insn, IVAR(INSN_ATTR_ISA));
+static enum opdis_insn_subset_t insn_isa_code( VALUE val ) {
+	if ( val == Qnil ) {
+		return opdis_insn_subset_gen;
+	}
+
 	if (! strcmp(INSN_ISA_FPU , StringValueCStr(val)) ) {
 		return opdis_insn_subset_fpu;
 	} else if (! strcmp(INSN_ISA_GPU , StringValueCStr(val)) ) {
@@ -767,14 +858,16 @@ static enum opdis_insn_subset_t insn_isa_code( VALUE insn ) {
 	return opdis_insn_subset_gen;
 }
 
-static void insn_set_flags( opdis_insn_t * dest, VALUE insn ) {
-	int i;
-	struct RArray * ary = RARRAY( rb_iv_get(insn, IVAR(INSN_ATTR_FLAGS)) );
+static void insn_set_flags( opdis_insn_t * dest, VALUE ary ) {
+	long i;
 
 	dest->flags.cflow = opdis_cflow_flag_none;
+	if ( ary == Qnil ) {
+		return;
+	}
 
 	for ( i=0; i < RARRAY_LEN(ary); i++ ) {
-		VALUE val = RARRAY_PTR(ary)[i];
+		VALUE val = rb_ary_entry(ary, i);
 		switch (dest->category) {
 			case opdis_insn_cat_cflow:
 				if (! strcmp(INSN_FLAG_CALL, 
@@ -871,14 +964,16 @@ static void insn_set_flags( opdis_insn_t * dest, VALUE insn ) {
 	}
 }
 
-static enum opdis_insn_decode_t insn_status_code( VALUE instance ) {
-	int i;
+static enum opdis_insn_decode_t insn_status_code( VALUE ary ) {
+	long i;
 	enum opdis_insn_decode_t status = opdis_decode_invalid;
-	struct RArray * ary = RARRAY( rb_iv_get(instance, 
-						IVAR(INSN_ATTR_STATUS)) );
+
+	if ( ary == Qnil ) {
+		return status;
+	}
 
 	for ( i=0; i < RARRAY_LEN(ary); i++ ) {
-		VALUE val = RARRAY_PTR(ary)[i];
+		VALUE val = rb_ary_entry(ary, i);
 		if (! strcmp(INSN_DECODE_BASIC, StringValueCStr(val)) ) {
 			status |= opdis_decode_basic;
 		} else if (! strcmp(INSN_DECODE_MNEM, StringValueCStr(val)) ) {
@@ -897,133 +992,242 @@ static enum opdis_insn_decode_t insn_status_code( VALUE instance ) {
 	return status;
 }
 
-static void set_insn_status( VALUE instance, enum opdis_insn_decode_t val ) {
-	VALUE status = rb_iv_get(instance, IVAR(INSN_ATTR_STATUS) );
+static VALUE status_from_c( enum opdis_insn_decode_t val ) {
+	VALUE status = rb_ary_new();
 
 	if ( val == opdis_decode_invalid ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_INVALID) );
-		return;
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_INVALID) );
+		return status;
 	}
 
 	if ( val & opdis_decode_basic ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_BASIC) );
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_BASIC) );
 	}
 	if ( val & opdis_decode_mnem ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_MNEM) );
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_MNEM) );
 	}
 	if ( val & opdis_decode_ops ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_OPS) );
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_OPS) );
 	}
 	if ( val & opdis_decode_mnem_flags ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_MNEMFLG) );
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_MNEMFLG) );
 	}
 	if ( val & opdis_decode_op_flags ) {
-		rb_ary_push(status, rb_str_new_cstr( INSN_DECODE_OPFLG) );
+		rb_ary_push(status, Opdis_intern( INSN_DECODE_OPFLG) );
 	}
+
+	return status;
 }
 
-static void fill_ruby_insn( const opdis_insn_t * insn, VALUE dest ) {
+/* convert a single field of a C instruction to a Ruby object */
+static VALUE insn_field_from_c( const opdis_insn_t * insn, 
+				enum insn_field_t field ) {
 	unsigned int i;
 	char buf[128];
-	VALUE ops = rb_iv_get(dest, IVAR(INSN_ATTR_OPERANDS) );
+	VALUE ary;
 
-	set_insn_status( dest, insn->status );
+	/* Instruction.new : fields start out empty */
+	if (! insn ) {
+		return ( field == insn_field_status || 
+			 field == insn_field_operands ) ? rb_ary_new() : Qnil;
+	}
 
-	rb_iv_set(dest, IVAR(GEN_ATTR_ASCII), rb_str_new_cstr(insn->ascii));
+	buf[0] = '\0';
 
-	rb_iv_set(dest, IVAR(INSN_ATTR_OFFSET), OFFT2NUM(insn->offset));
-	rb_iv_set(dest, IVAR(INSN_ATTR_VMA), OFFT2NUM(insn->vma));
-	rb_iv_set(dest, IVAR(INSN_ATTR_SIZE), UINT2NUM(insn->size));
-	rb_iv_set(dest, IVAR(INSN_ATTR_BYTES), 
-		  rb_str_new((const char *) insn->bytes, insn->size ));
+	switch (field) {
+		case insn_field_status:
+			return status_from_c(insn->status);
+		case insn_field_ascii:
+			return str_from_c(insn->ascii);
+		case insn_field_offset:
+			return OFFT2NUM(insn->offset);
+		case insn_field_vma:
+			return ULL2NUM(insn->vma);
+		case insn_field_size:
+			return UINT2NUM(insn->size);
+		case insn_field_bytes:
+			return rb_str_new((const char *) insn->bytes, 
+					  insn->size );
+		case insn_field_prefixes:
+			return Opdis_internSplit(insn->prefixes, " ");
+		case insn_field_mnemonic:
+			return Opdis_intern(insn->mnemonic);
+		case insn_field_comment:
+			return str_from_c(insn->comment);
+		case insn_field_category:
+			opdis_insn_cat_str( insn, buf, 128 );
+			return Opdis_intern(buf);
+		case insn_field_isa:
+			opdis_insn_isa_str( insn, buf, 128 );
+			return Opdis_intern(buf);
+		case insn_field_flags:
+			opdis_insn_flags_str( insn, buf, 128, "|" );
+			return Opdis_internSplit(buf, "|");
+		case insn_field_operands:
+			ary = rb_ary_new2(insn->num_operands);
+			for ( i=0; i < insn->num_operands; i++ ) {
+				rb_ary_push( ary, op_from_c(insn->operands[i]) );
+			}
+			return ary;
+		case insn_field_tgt_idx:
+			return alias_idx_from_c(insn, insn->target);
+		case insn_field_dest_idx:
+			return alias_idx_from_c(insn, insn->dest);
+		case insn_field_src_idx:
+			return alias_idx_from_c(insn, insn->src);
+		default: break;
+	}
+
+	return Qnil;
+}
 
-	rb_iv_set(dest, IVAR(INSN_ATTR_PREFIXES), 
-		  rb_str_split(rb_str_new_cstr(insn->prefixes), " "));
-	rb_iv_set(dest, IVAR(INSN_ATTR_MNEMONIC), 
-		  rb_str_new_cstr(insn->mnemonic));
-	rb_iv_set(dest, IVAR(INSN_ATTR_COMMENT), 
-		  rb_str_new_cstr(insn->comment));
+/* return field, decoding it from the C instruction if necessary */
+static VALUE insn_field( VALUE instance, enum insn_field_t field ) {
+	Opdis_insn_data * data = insn_data(instance);
+	VALUE val = data->fields[field];
 
-	buf[0] = '\0';
-	opdis_insn_cat_str( insn, buf, 128 );
-	rb_iv_set(dest, IVAR(INSN_ATTR_CATEGORY), rb_str_new_cstr(buf));
+	if ( val == Qundef ) {
+		val = insn_field_from_c( data->insn, field );
+		data->fields[field] = val;
+	}
 
-	buf[0] = '\0';
-	opdis_insn_isa_str( insn, buf, 128 );
-	rb_iv_set(dest, IVAR(INSN_ATTR_ISA), rb_str_new_cstr(buf));
+	return val;
+}
 
-	buf[0] = '\0';
-	opdis_insn_flags_str( insn, buf, 128, "|" );
-	rb_iv_set(dest, IVAR(INSN_ATTR_FLAGS), 
-		  rb_str_split(rb_str_new_cstr(buf), "|"));
+static VALUE insn_set_field( VALUE instance, enum insn_field_t field, 
+			     VALUE val ) {
+	insn_data(instance)->fields[field] = val;
+	return val;
+}
 
-	rb_ary_clear(ops);
-	for ( i=0; i < insn->num_operands; i++ ) {
-		set_attr_if_alias( dest, IVAR(INSN_ATTR_TGT_IDX), i,
-				   insn->operands[i], insn->target );
-		set_attr_if_alias( dest, IVAR(INSN_ATTR_DEST_IDX), i,
-				   insn->operands[i], insn->dest );
-		set_attr_if_alias( dest, IVAR(INSN_ATTR_SRC_IDX), i,
-				   insn->operands[i], insn->src );
-				   
-		rb_ary_push( ops, op_from_c(insn->operands[i]) );
-	}
+/* returns true if field has not been decoded or assigned from Ruby */
+static int insn_field_pristine( Opdis_insn_data * data, 
+				enum insn_field_t field ) {
+	return (data->insn && data->fields[field] == Qundef) ? 1 : 0;
+}
+
+/* attribute readers and writers */
+#define INSN_READER(name, field) \
+static VALUE cls_insn_get_##name( VALUE instance ) { \
+	return insn_field(instance, field); \
+}
+
+#define INSN_WRITER(name, field) \
+static VALUE cls_insn_set_##name( VALUE instance, VALUE val ) { \
+	return insn_set_field(instance, field, val); \
 }
 
+#define INSN_ACCESSOR(name, field) \
+INSN_READER(name, field) \
+INSN_WRITER(name, field)
+
+INSN_ACCESSOR(status, insn_field_status)
+INSN_ACCESSOR(ascii, insn_field_ascii)
+INSN_ACCESSOR(prefixes, insn_field_prefixes)
+INSN_ACCESSOR(mnemonic, insn_field_mnemonic)
+INSN_ACCESSOR(category, insn_field_category)
+INSN_ACCESSOR(isa, insn_field_isa)
+INSN_ACCESSOR(flags, insn_field_flags)
+INSN_ACCESSOR(comment, insn_field_comment)
+INSN_ACCESSOR(operands, insn_field_operands)
+INSN_ACCESSOR(tgt_idx, insn_field_tgt_idx)
+INSN_ACCESSOR(dest_idx, insn_field_dest_idx)
+INSN_ACCESSOR(src_idx, insn_field_src_idx)
+INSN_READER(offset, insn_field_offset)
+INSN_READER(vma, insn_field_vma)
+INSN_READER(size, insn_field_size)
+INSN_READER(bytes, insn_field_bytes)
+
 static VALUE insn_from_c( const opdis_insn_t * insn ) {
-	VALUE args[1] = {Qnil};
-	VALUE var = rb_class_new_instance(0, args, clsInsn);
-	if ( var != Qnil ) {
-		fill_ruby_insn( insn, var );
+	VALUE var = cls_insn_alloc(clsInsn);
+	Opdis_insn_data * data = insn_data(var);
+
+	data->insn = opdis_insn_dupe(insn);
+	if (! data->insn ) {
+		return Qnil;
 	}
+
 	return var;
 }
 
+/* replace the C instruction wrapped by an Instruction object */
+static void fill_ruby_insn( const opdis_insn_t * insn, VALUE dest ) {
+	Opdis_insn_data * data = insn_data(dest);
+	opdis_insn_t * copy = opdis_insn_dupe(insn);
+
+	if ( data->insn ) {
+		opdis_insn_free(data->insn);
+	}
+
+	data->insn = copy;
+	insn_data_reset(data);
+}
+
 static void insn_to_c( VALUE insn, opdis_insn_t * dest ) {
-	int i;
-	VALUE var;
-	struct RArray * ary;
+	long i;
+	VALUE var, ary, tgt_idx, dest_idx, src_idx;
 
-	dest->status = insn_status_code(insn);
+	dest->status = insn_status_code(insn_field(insn, insn_field_status));
 
-	var = rb_iv_get(insn, IVAR(GEN_ATTR_ASCII));
-	opdis_insn_set_ascii(dest, StringValueCStr(var));
+	var = insn_field(insn, insn_field_ascii);
+	if ( var != Qnil ) {
+		opdis_insn_set_ascii(dest, StringValueCStr(var));
+	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_OFFSET));
-	dest->offset = (opdis_off_t) NUM2ULL(var);
+	var = insn_field(insn, insn_field_offset);
+	if ( var != Qnil ) {
+		dest->offset = (opdis_off_t) NUM2ULL(var);
+	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_VMA));
-	dest->vma = (opdis_vma_t) NUM2ULL(var);
+	var = insn_field(insn, insn_field_vma);
+	if ( var != Qnil ) {
+		dest->vma = (opdis_vma_t) NUM2ULL(var);
+	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_SIZE));
-	dest->size = (opdis_off_t) NUM2ULL(var);
+	var = insn_field(insn, insn_field_size);
+	if ( var != Qnil ) {
+		dest->size = (opdis_off_t) NUM2ULL(var);
+	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_BYTES));
-	if (! dest->bytes ) {
-		dest->bytes = calloc( 1, dest->size );
+	var = insn_field(insn, insn_field_bytes);
+	if ( var != Qnil && dest->size ) {
+		if (! dest->bytes ) {
+			dest->bytes = calloc( 1, dest->size );
+		}
+		memcpy( dest->bytes, RSTRING_PTR(var), 
+			((opdis_off_t) RSTRING_LEN(var) < dest->size) ?
+				(opdis_off_t) RSTRING_LEN(var) : dest->size );
 	}
-	memcpy( dest->bytes, RSTRING_PTR(var), dest->size );
 
-	ary = RARRAY( rb_iv_get(insn, IVAR(INSN_ATTR_PREFIXES)) );
-	for ( i=0; i < RARRAY_LEN(ary); i++ ) {
-		VALUE val = RARRAY_PTR(ary)[i];
+	ary = insn_field(insn, insn_field_prefixes);
+	for ( i=0; ary != Qnil && i < RARRAY_LEN(ary); i++ ) {
+		VALUE val = rb_ary_entry(ary, i);
 		opdis_insn_add_prefix(dest, StringValueCStr(val));
 	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_MNEMONIC));
-	opdis_insn_set_mnemonic(dest, StringValueCStr(var));
+	var = insn_field(insn, insn_field_mnemonic);
+	if ( var != Qnil ) {
+		opdis_insn_set_mnemonic(dest, StringValueCStr(var));
+	}
 
-	var = rb_iv_get(insn, IVAR(INSN_ATTR_COMMENT));
-	opdis_insn_add_comment(dest, StringValueCStr(var));
+	var = insn_field(insn, insn_field_comment);
+	if ( var != Qnil ) {
+		opdis_insn_add_comment(dest, StringValueCStr(var));
+	}
 
-	dest->category = insn_category_code(insn);
-	dest->isa = insn_isa_code(insn);
+	dest->category = insn_category_code(insn_field(insn, 
+						insn_field_category));
+	dest->isa = insn_isa_code(insn_field(insn, insn_field_isa));
 
-	insn_set_flags(dest, insn);
+	insn_set_flags(dest, insn_field(insn, insn_field_flags));
 
-	ary = RARRAY( rb_iv_get(insn, IVAR(INSN_ATTR_OPERANDS)) );
-	for ( i=0; i < RARRAY_LEN(ary); i++ ) {
-		VALUE val = RARRAY_PTR(ary)[i];
+	tgt_idx = insn_field(insn, insn_field_tgt_idx);
+	dest_idx = insn_field(insn, insn_field_dest_idx);
+	src_idx = insn_field(insn, insn_field_src_idx);
+
+	ary = insn_field(insn, insn_field_operands);
+	for ( i=0; ary != Qnil && i < RARRAY_LEN(ary); i++ ) {
+		VALUE val = rb_ary_entry(ary, i);
 		opdis_op_t * op = opdis_insn_next_avail_op(dest);
 		if (! op ) {
 			op = opdis_op_alloc();
@@ -1032,50 +1236,76 @@ static void insn_to_c( VALUE insn, opdis_insn_t * dest ) {
 
 		op_to_c( val, op );
 
-		if ( i == NUM2INT(rb_iv_get(insn, IVAR(INSN_ATTR_TGT_IDX))) ) {
+		if ( tgt_idx != Qnil && i == NUM2LONG(tgt_idx) ) {
 			dest->target = op;
 		}
-		if ( i == NUM2INT(rb_iv_get(insn, IVAR(INSN_ATTR_DEST_IDX))) ) {
+		if ( dest_idx != Qnil && i == NUM2LONG(dest_idx) ) {
 			dest->dest = op;
 		}
-		if ( i == NUM2INT(rb_iv_get(insn, IVAR(INSN_ATTR_SRC_IDX))) ) {
+		if ( src_idx != Qnil && i == NUM2LONG(src_idx) ) {
 			dest->src = op;
 		}
 	}
 }
 
-static VALUE get_aliased_operand( VALUE instance, const char * alias ) {
-	VALUE idx = rb_iv_get(instance, alias);
-	VALUE ops = rb_iv_get(instance, IVAR(INSN_ATTR_OPERANDS) );
+static VALUE get_aliased_operand( VALUE instance, enum insn_field_t alias ) {
+	VALUE idx = insn_field(instance, alias);
+	VALUE ops = insn_field(instance, insn_field_operands);
 
-	return (idx == Qnil) ? idx : rb_ary_entry(ops, NUM2LONG(idx));
+	return (idx == Qnil || ops == Qnil) ? Qnil : 
+		rb_ary_entry(ops, NUM2LONG(idx));
 }
 
 static VALUE cls_insn_tgt( VALUE instance ) {
-	return get_aliased_operand(instance, IVAR(INSN_ATTR_TGT_IDX) );
+	return get_aliased_operand(instance, insn_field_tgt_idx);
 }
 
 static VALUE cls_insn_dest( VALUE instance ) {
-	return get_aliased_operand(instance, IVAR(INSN_ATTR_DEST_IDX) );
+	return get_aliased_operand(instance, insn_field_dest_idx);
 }
 
 static VALUE cls_insn_src( VALUE instance ) {
-	return get_aliased_operand(instance, IVAR(INSN_ATTR_SRC_IDX) );
+	return get_aliased_operand(instance, insn_field_src_idx);
+}
+
+static VALUE cls_insn_to_s( VALUE instance ) {
+	return insn_field(instance, insn_field_ascii);
 }
 
 static int is_cflow_insn( VALUE instance ) {
-	VALUE cat = rb_iv_get(instance, IVAR(INSN_ATTR_CATEGORY) );
+	VALUE cat = insn_field(instance, insn_field_category);
 	return (cat != Qnil && ! strcmp(INSN_CAT_CFLOW, StringValueCStr(cat))) ?
 		1 : 0;
 }
 
 static int insn_has_flag( VALUE instance, const char * flg ) {
-	VALUE flags = rb_iv_get(instance, IVAR(INSN_ATTR_FLAGS) );
-	return (flags != Qnil && rb_ary_includes(flags, rb_str_new_cstr(flg))) ?
+	VALUE flags = insn_field(instance, insn_field_flags);
+	return (flags != Qnil && rb_ary_includes(flags, Opdis_intern(flg))) ?
 		1 : 0;
 }
 
+/* branch? and fallthrough? are answered from the C instruction unless
+ * category or flags have been read or changed from Ruby */
+static int insn_c_answerable( VALUE instance, const opdis_insn_t ** insn ) {
+	Opdis_insn_data * data = insn_data(instance);
+
+	*insn = data->insn;
+	return insn_field_pristine(data, insn_field_category) &&
+	       insn_field_pristine(data, insn_field_flags);
+}
+
 static VALUE cls_insn_branch( VALUE instance ) {
+	const opdis_insn_t * insn;
+
+	if ( insn_c_answerable(instance, &insn) ) {
+		return ( insn->category == opdis_insn_cat_cflow &&
+			 (insn->flags.cflow & (opdis_cflow_flag_call |
+					       opdis_cflow_flag_callcc |
+					       opdis_cflow_flag_jmpcc |
+					       opdis_cflow_flag_jmp)) ) ?
+			Qtrue : Qfalse;
+	}
+
 	if ( is_cflow_insn(instance) && 
 	     (insn_has_flag(instance, INSN_FLAG_CALL) ||
 	      insn_has_flag(instance, INSN_FLAG_CALLCC) ||
@@ -1088,6 +1318,15 @@ static VALUE cls_insn_branch( VALUE instance ) {
 }
 
 static VALUE cls_insn_fallthrough( VALUE instance ) {
+	const opdis_insn_t * insn;
+
+	if ( insn_c_answerable(instance, &insn) ) {
+		return ( insn->category == opdis_insn_cat_cflow &&
+			 (insn->flags.cflow & (opdis_cflow_flag_ret |
+					       opdis_cflow_flag_jmp)) ) ?
+			Qfalse : Qtrue;
+	}
+
 	if ( is_cflow_insn(instance) && 
 	     (insn_has_flag(instance, INSN_FLAG_RET) ||
 	      insn_has_flag(instance, INSN_FLAG_JMP)) ) {
@@ -1099,121 +1338,144 @@ static VALUE cls_insn_fallthrough( VALUE instance ) {
 
 static void define_insn_constants() {
 	rb_define_const(clsInsn, INSN_DECODE_INVALID_NAME,
-			rb_str_new_cstr(INSN_DECODE_INVALID));
+			Opdis_intern(INSN_DECODE_INVALID));
 	rb_define_const(clsInsn, INSN_DECODE_BASIC_NAME,
-			rb_str_new_cstr(INSN_DECODE_BASIC));
+			Opdis_intern(INSN_DECODE_BASIC));
 	rb_define_const(clsInsn, INSN_DECODE_MNEM_NAME,
-			rb_str_new_cstr(INSN_DECODE_MNEM));
+			Opdis_intern(INSN_DECODE_MNEM));
 	rb_define_const(clsInsn, INSN_DECODE_OPS_NAME,
-			rb_str_new_cstr(INSN_DECODE_OPS));
+			Opdis_intern(INSN_DECODE_OPS));
 	rb_define_const(clsInsn, INSN_DECODE_MNEMFLG_NAME,
-			rb_str_new_cstr(INSN_DECODE_MNEMFLG));
+			Opdis_intern(INSN_DECODE_MNEMFLG));
 	rb_define_const(clsInsn, INSN_DECODE_OPFLG_NAME,
-			rb_str_new_cstr(INSN_DECODE_OPFLG));
+			Opdis_intern(INSN_DECODE_OPFLG));
 
 	rb_define_const(clsInsn, INSN_ISA_GEN_NAME,
-			rb_str_new_cstr(INSN_ISA_GEN));
+			Opdis_intern(INSN_ISA_GEN));
 	rb_define_const(clsInsn, INSN_ISA_FPU_NAME,
-			rb_str_new_cstr(INSN_ISA_FPU));
+			Opdis_intern(INSN_ISA_FPU));
 	rb_define_const(clsInsn, INSN_ISA_GPU_NAME,
-			rb_str_new_cstr(INSN_ISA_GPU));
+			Opdis_intern(INSN_ISA_GPU));
 	rb_define_const(clsInsn, INSN_ISA_SIMD_NAME,
-			rb_str_new_cstr(INSN_ISA_SIMD));
+			Opdis_intern(INSN_ISA_SIMD));
 	rb_define_const(clsInsn, INSN_ISA_VM_NAME,
-			rb_str_new_cstr(INSN_ISA_VM));
+			Opdis_intern(INSN_ISA_VM));
 
 	rb_define_const(clsInsn, INSN_CAT_CFLOW_NAME,
-			rb_str_new_cstr(INSN_CAT_CFLOW));
+			Opdis_intern(INSN_CAT_CFLOW));
 	rb_define_const(clsInsn, INSN_CAT_STACK_NAME,
-			rb_str_new_cstr(INSN_CAT_STACK));
+			Opdis_intern(INSN_CAT_STACK));
 	rb_define_const(clsInsn, INSN_CAT_LOST_NAME,
-			rb_str_new_cstr(INSN_CAT_LOST));
+			Opdis_intern(INSN_CAT_LOST));
 	rb_define_const(clsInsn, INSN_CAT_TEST_NAME,
-			rb_str_new_cstr(INSN_CAT_TEST));
+			Opdis_intern(INSN_CAT_TEST));
 	rb_define_const(clsInsn, INSN_CAT_MATH_NAME,
-			rb_str_new_cstr(INSN_CAT_MATH));
+			Opdis_intern(INSN_CAT_MATH));
 	rb_define_const(clsInsn, INSN_CAT_BIT_NAME,
-			rb_str_new_cstr(INSN_CAT_BIT));
+			Opdis_intern(INSN_CAT_BIT));
 	rb_define_const(clsInsn, INSN_CAT_IO_NAME,
-			rb_str_new_cstr(INSN_CAT_IO));
+			Opdis_intern(INSN_CAT_IO));
 	rb_define_const(clsInsn, INSN_CAT_TRAP_NAME,
-			rb_str_new_cstr(INSN_CAT_TRAP));
+			Opdis_intern(INSN_CAT_TRAP));
 	rb_define_const(clsInsn, INSN_CAT_PRIV_NAME,
-			rb_str_new_cstr(INSN_CAT_PRIV));
+			Opdis_intern(INSN_CAT_PRIV));
 	rb_define_const(clsInsn, INSN_CAT_NOP_NAME,
-			rb_str_new_cstr(INSN_CAT_NOP));
+			Opdis_intern(INSN_CAT_NOP));
 
 	rb_define_const(clsInsn, INSN_FLAG_CALL_NAME,
-			rb_str_new_cstr(INSN_FLAG_CALL));
+			Opdis_intern(INSN_FLAG_CALL));
 	rb_define_const(clsInsn, INSN_FLAG_CALLCC_NAME,
-			rb_str_new_cstr(INSN_FLAG_CALLCC));
+			Opdis_intern(INSN_FLAG_CALLCC));
 	rb_define_const(clsInsn, INSN_FLAG_JMP_NAME,
-			rb_str_new_cstr(INSN_FLAG_JMP));
+			Opdis_intern(INSN_FLAG_JMP));
 	rb_define_const(clsInsn, INSN_FLAG_JMPCC_NAME,
-			rb_str_new_cstr(INSN_FLAG_JMPCC));
+			Opdis_intern(INSN_FLAG_JMPCC));
 	rb_define_const(clsInsn, INSN_FLAG_RET_NAME,
-			rb_str_new_cstr(INSN_FLAG_RET));
+			Opdis_intern(INSN_FLAG_RET));
 	rb_define_const(clsInsn, INSN_FLAG_PUSH_NAME,
-			rb_str_new_cstr(INSN_FLAG_PUSH));
+			Opdis_intern(INSN_FLAG_PUSH));
 	rb_define_const(clsInsn, INSN_FLAG_POP_NAME,
-			rb_str_new_cstr(INSN_FLAG_POP));
+			Opdis_intern(INSN_FLAG_POP));
 	rb_define_const(clsInsn, INSN_FLAG_FRAME_NAME,
-			rb_str_new_cstr(INSN_FLAG_FRAME));
+			Opdis_intern(INSN_FLAG_FRAME));
 	rb_define_const(clsInsn, INSN_FLAG_UNFRAME_NAME,
-			rb_str_new_cstr(INSN_FLAG_UNFRAME));
+			Opdis_intern(INSN_FLAG_UNFRAME));
 	rb_define_const(clsInsn, INSN_FLAG_AND_NAME,
-			rb_str_new_cstr(INSN_FLAG_AND));
+			Opdis_intern(INSN_FLAG_AND));
 	rb_define_const(clsInsn, INSN_FLAG_OR_NAME,
-			rb_str_new_cstr(INSN_FLAG_OR));
+			Opdis_intern(INSN_FLAG_OR));
 	rb_define_const(clsInsn, INSN_FLAG_XOR_NAME,
-			rb_str_new_cstr(INSN_FLAG_XOR));
+			Opdis_intern(INSN_FLAG_XOR));
 	rb_define_const(clsInsn, INSN_FLAG_NOT_NAME,
-			rb_str_new_cstr(INSN_FLAG_NOT));
+			Opdis_intern(INSN_FLAG_NOT));
 	rb_define_const(clsInsn, INSN_FLAG_LSL_NAME,
-			rb_str_new_cstr(INSN_FLAG_LSL));
+			Opdis_intern(INSN_FLAG_LSL));
 	rb_define_const(clsInsn, INSN_FLAG_LSR_NAME,
-			rb_str_new_cstr(INSN_FLAG_LSR));
+			Opdis_intern(INSN_FLAG_LSR));
 	rb_define_const(clsInsn, INSN_FLAG_ASL_NAME,
-			rb_str_new_cstr(INSN_FLAG_ASL));
+			Opdis_intern(INSN_FLAG_ASL));
 	rb_define_const(clsInsn, INSN_FLAG_ASR_NAME,
-			rb_str_new_cstr(INSN_FLAG_ASR));
+			Opdis_intern(INSN_FLAG_ASR));
 	rb_define_const(clsInsn, INSN_FLAG_ROL_NAME,
-			rb_str_new_cstr(INSN_FLAG_ROL));
+			Opdis_intern(INSN_FLAG_ROL));
 	rb_define_const(clsInsn, INSN_FLAG_ROR_NAME,
-			rb_str_new_cstr(INSN_FLAG_ROR));
+			Opdis_intern(INSN_FLAG_ROR));
 	rb_define_const(clsInsn, INSN_FLAG_RCL_NAME,
-			rb_str_new_cstr(INSN_FLAG_RCL));
+			Opdis_intern(INSN_FLAG_RCL));
 	rb_define_const(clsInsn, INSN_FLAG_RCR_NAME,
-			rb_str_new_cstr(INSN_FLAG_RCR));
+			Opdis_intern(INSN_FLAG_RCR));
 	rb_define_const(clsInsn, INSN_FLAG_IN_NAME,
-			rb_str_new_cstr(INSN_FLAG_IN));
+			Opdis_intern(INSN_FLAG_IN));
 	rb_define_const(clsInsn, INSN_FLAG_OUT_NAME,
-			rb_str_new_cstr(INSN_FLAG_OUT));
+			Opdis_intern(INSN_FLAG_OUT));
 }
 
 static void define_insn_attributes() {
 
 	/* read-write attributes */
-	rb_define_attr(clsInsn, INSN_ATTR_STATUS, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_PREFIXES, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_MNEMONIC, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_CATEGORY, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_ISA, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_FLAGS, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_COMMENT, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_OPERANDS, 1, 1);
+	rb_define_method(clsInsn, INSN_ATTR_STATUS, cls_insn_get_status, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_STATUS), 
+			 cls_insn_set_status, 1);
+	rb_define_method(clsInsn, INSN_ATTR_PREFIXES, cls_insn_get_prefixes, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_PREFIXES), 
+			 cls_insn_set_prefixes, 1);
+	rb_define_method(clsInsn, INSN_ATTR_MNEMONIC, cls_insn_get_mnemonic, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_MNEMONIC), 
+			 cls_insn_set_mnemonic, 1);
+	rb_define_method(clsInsn, INSN_ATTR_CATEGORY, cls_insn_get_category, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_CATEGORY), 
+			 cls_insn_set_category, 1);
+	rb_define_method(clsInsn, INSN_ATTR_ISA, cls_insn_get_isa, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_ISA), cls_insn_set_isa, 1);
+	rb_define_method(clsInsn, INSN_ATTR_FLAGS, cls_insn_get_flags, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_FLAGS), 
+			 cls_insn_set_flags, 1);
+	rb_define_method(clsInsn, INSN_ATTR_COMMENT, cls_insn_get_comment, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_COMMENT), 
+			 cls_insn_set_comment, 1);
+	rb_define_method(clsInsn, INSN_ATTR_OPERANDS, cls_insn_get_operands, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_OPERANDS), 
+			 cls_insn_set_operands, 1);
 
 	/* private attributes */
-	rb_define_attr(clsInsn, GEN_ATTR_ASCII, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_TGT_IDX, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_DEST_IDX, 1, 1);
-	rb_define_attr(clsInsn, INSN_ATTR_SRC_IDX, 1, 1);
+	rb_define_method(clsInsn, GEN_ATTR_ASCII, cls_insn_get_ascii, 0);
+	rb_define_method(clsInsn, SETTER(GEN_ATTR_ASCII), 
+			 cls_insn_set_ascii, 1);
+	rb_define_method(clsInsn, INSN_ATTR_TGT_IDX, cls_insn_get_tgt_idx, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_TGT_IDX), 
+			 cls_insn_set_tgt_idx, 1);
+	rb_define_method(clsInsn, INSN_ATTR_DEST_IDX, cls_insn_get_dest_idx, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_DEST_IDX), 
+			 cls_insn_set_dest_idx, 1);
+	rb_define_method(clsInsn, INSN_ATTR_SRC_IDX, cls_insn_get_src_idx, 0);
+	rb_define_method(clsInsn, SETTER(INSN_ATTR_SRC_IDX), 
+			 cls_insn_set_src_idx, 1);
 
 	/* read-only attributes */
-	rb_define_attr(clsInsn, INSN_ATTR_OFFSET, 1, 0);
-	rb_define_attr(clsInsn, INSN_ATTR_VMA, 1, 0);
-	rb_define_attr(clsInsn, INSN_ATTR_SIZE, 1, 0);
-	rb_define_attr(clsInsn, INSN_ATTR_BYTES, 1, 0);
+	rb_define_method(clsInsn, INSN_ATTR_OFFSET, cls_insn_get_offset, 0);
+	rb_define_method(clsInsn, INSN_ATTR_VMA, cls_insn_get_vma, 0);
+	rb_define_method(clsInsn, INSN_ATTR_SIZE, cls_insn_get_size, 0);
+	rb_define_method(clsInsn, INSN_ATTR_BYTES, cls_insn_get_bytes, 0);
 
 	/* getters */
 	rb_define_method(clsInsn, INSN_ATTR_TGT, cls_insn_tgt, 0);
@@ -1223,8 +1485,8 @@ static void define_insn_attributes() {
 
 static void init_insn_class( VALUE modOpdis ) {
 	clsInsn = rb_define_class_under(modOpdis, "Instruction", rb_cObject);
-	rb_define_method(clsInsn, "initialize", cls_insn_init, 0);
-	rb_define_method(clsInsn, "to_s", cls_generic_to_s, 0);
+	rb_define_alloc_func(clsInsn, cls_insn_alloc);
+	rb_define_method(clsInsn, "to_s", cls_insn_to_s, 0);
 	rb_define_method(clsInsn, "branch?", cls_insn_branch, 0);
 	rb_define_method(clsInsn, "fallthrough?", cls_insn_fallthrough, 0);
 
@@ -1255,8 +1517,15 @@ VALUE Opdis_insnFromC( const opdis_insn_t * insn ) {
 	return var;
 }
 
+VALUE Opdis_insnFromOwnedC( opdis_insn_t * insn ) {
+	VALUE var = cls_insn_alloc(clsInsn);
+	insn_data(var)->insn = insn;
+	return var;
+}
+
 int Opdis_insnFillFromC( const opdis_insn_t * insn, VALUE dest ) {
-	if (insn == NULL || dest == Qnil) {
+	if (insn == NULL || dest == Qnil ||
+	    ! rb_typeddata_is_kind_of(dest, &insn_data_type) ) {
 		return 0;
 	}
 					      
@@ -1265,7 +1534,8 @@ int Opdis_insnFillFromC( const opdis_insn_t * insn, VALUE dest ) {
 }
 
 int Opdis_insnToC( VALUE insn, opdis_insn_t * c_insn ) {
-	if (insn == Qnil || c_insn == NULL) {
+	if (insn == Qnil || c_insn == NULL || 
+	    ! rb_typeddata_is_kind_of(insn, &insn_data_type) ) {
 		return 0;
 	}
 
@@ -78,6 +78,8 @@
 #define INSN_CAT_PRIV "privileged"
 #define INSN_CAT_NOP_NAME "CAT_NOP"
 #define INSN_CAT_NOP "no-op"
+/* number of opdis_insn_cat_t codes */
+#define OPDIS_INSN_NUM_CAT (opdis_insn_cat_nop + 1)
 
 #define INSN_FLAG_CALL_NAME "FLG_CALL"
 #define INSN_FLAG_CALL "call"
@@ -216,11 +218,18 @@
 #define REG_FLAG_RET_NAME "FLG_RET"
 #define REG_FLAG_RET "return"
 
+/* Names of the opdis_insn_cat_t codes; code 0 (unknown) has no name */
+extern const char * Opdis_insnCategoryNames[OPDIS_INSN_NUM_CAT];
+
 void Opdis_initModel( VALUE modOpdis );
 
 /* Allocate and fill a Ruby Opdis::Instruction object from an opdis_insn_t */
 VALUE Opdis_insnFromC( const opdis_insn_t * insn );
 
+/* Wrap an opdis_insn_t in a Ruby Opdis::Instruction object. The object
+ * takes ownership of 'insn', which must have been allocated by libopdis. */
+VALUE Opdis_insnFromOwnedC( opdis_insn_t * insn );
+
 /* Fill a Ruby Opdis::Instruction object from an opdis_insn_t */
 int Opdis_insnFillFromC( const opdis_insn_t * insn, VALUE dest );
 
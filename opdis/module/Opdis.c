@@ -8,23 +8,48 @@
 #include <errno.h>
 #include <string.h>
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define OPDIS_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <ruby.h>
 #include "ruby_compat.h"
+#ifdef HAVE_RUBY_IO_BUFFER_H
+#include <ruby/io/buffer.h>
+#endif
 
 #include <opdis/opdis.h>
+#include <opdis/x86_decoder.h>
 
 #include "Opdis.h"
 #include "Arch.h"
+#include "Cache.h"
 #include "Callbacks.h"
+#include "ControlFlowGraph.h"
+#include "Functions.h"
+#include "Gadgets.h"
+#include "Xrefs.h"
+#include "Pattern.h"
+#include "Incremental.h"
+#include "DecodeContext.h"
+#include "Disassembly.h"
+#include "Intern.h"
 #include "Model.h"
+#include "Parallel.h"
+#include "Runner.h"
+#include "Statistics.h"
 
 #define IVAR(attr) "@" attr
 #define SETTER(attr) attr "="
 
 static VALUE symToSym, symRead, symCall, symSize, symPath;
+static VALUE symFileno, symPos, symSetPos;
 static VALUE symDecode, symVisited, symResolve;
 
-static VALUE clsDisasm, clsOutput;
+static VALUE clsDisasm;
 
 static VALUE modOpdis;
 
@@ -40,68 +65,6 @@ static VALUE clsBfdSym = Qnil;
 
 #define GET_BFD_CLASS(cls,name) (cls = cls == Qnil ? path2class(name) : cls)
 
-#define ALLOC_FIXED_INSN opdis_insn_alloc_fixed(128, 32, 16, 32)
-
-
-/* ---------------------------------------------------------------------- */
-/* Disasm Output Class */
-/* This is basically a Hash of VMA => Instruction entries, with an @errors
- * attribute that gets filled with error messages from the disassembler */
-
-/* insn containing vma */
-static VALUE cls_output_contain( VALUE instance, VALUE vma ) {
-	unsigned long long addr = NUM2ULL(vma);
-	/* NOTE: '32 bytes is the largest insn' may not be valid */
-	unsigned long long orig = addr, min = addr - 32;
-	int cont = 1;
-
-	/* iterate backwards from vma looking for insn containing vma */
-	for ( cont = 1; cont > 0 && addr >= min; addr -= 1 ) {
-		VALUE rb_size;
-		VALUE val = rb_hash_lookup2( instance, ULL2NUM(addr), Qfalse ); 
-
-		if ( val == Qfalse ) {
-			if ( addr == 0 ) {
-				cont = 0;
-			}
-			continue;
-		}
-
-		/* requested vma exists; return it */
-		if ( addr == orig ) {
-			return val;
-		}
-
-		/* does insn contain (insn.size + addr) requested vma? */
-		rb_size = rb_funcall(val, rb_intern(IVAR(INSN_ATTR_SIZE)), 0);
-		if ( rb_size == Qnil || addr + NUM2UINT(rb_size) < orig ) {
-			/* nope - no insn contains requested vma */
-			cont = 0;
-		} else {
-			/* yup - found it */
-			return val;
-		}
-	}
-
-	return Qfalse;
-}
-
-static VALUE cls_output_init( VALUE instance ) {
-	rb_iv_set(instance, IVAR(OUT_ATTR_ERRORS), rb_ary_new() );
-	return instance;
-}
-
-static void init_output_class( VALUE modOpdis ) {
-	clsOutput = rb_define_class_under(modOpdis, OPDIS_OUTPUT_CLASS_NAME, 
-					  rb_cHash);
-	rb_define_method(clsOutput, "initialize", cls_output_init, 0);
-
-	/* read-only attribute for error list */
-	rb_define_attr(clsOutput, OUT_ATTR_ERRORS, 1, 0);
-
-	/* setters */
-	rb_define_method(clsOutput, OUT_METHOD_CONTAIN, cls_output_contain, 1);
-}
 
 
 /* ---------------------------------------------------------------------- */
@@ -145,27 +108,67 @@ static VALUE cls_disasm_strategies( VALUE class ) {
 	rb_ary_push( ary, rb_str_new_cstr(DIS_STRAT_SYMBOL) );
 	rb_ary_push( ary, rb_str_new_cstr(DIS_STRAT_SECTION) );
 	rb_ary_push( ary, rb_str_new_cstr(DIS_STRAT_ENTRY) );
+	rb_ary_push( ary, rb_str_new_cstr(DIS_STRAT_FUNCTIONS) );
 	return ary;
 }
 
-/* local decoder callback: this calls the decode method in the object provided
- * by the user. */
-static int local_decoder( const opdis_insn_buf_t in, opdis_insn_t * out,
-                          const opdis_byte_t * buf, opdis_off_t offset,
-                          opdis_vma_t vma, opdis_off_t length, void * arg ) {
-	/* Build a hash containing the arguments passed to the decoder */
-	VALUE hash = Opdis_decoderHash( in, buf, offset, vma, length );
+/* Ruby callbacks are invoked through the Runner, which holds the GVL for
+ * the duration of the call. The callback arg is an Opdis_rb_callback. */
+
+struct DECODER_CALL {
+	VALUE obj;
+	Opdis_decode_args args;
+	opdis_insn_t * out;
+	VALUE ctx;
+	int rv;
+};
+
+static VALUE call_decoder_body( VALUE arg ) {
+	struct DECODER_CALL * c = (struct DECODER_CALL *) arg;
 	/* Create a Ruby Opdis::Instruction object based on the C object */
-	VALUE insn = Opdis_insnFromC(out);
-	VALUE obj = (VALUE) arg;
+	VALUE insn = Opdis_insnFromC(c->out);
 
 	/* invoke decode method in Decoder object */
-	VALUE var = rb_funcall(obj, symDecode, 2, insn, hash);
+	VALUE var = rb_funcall(c->obj, symDecode, 2, insn, c->ctx);
 
 	/* Move info back to C domain */
-	Opdis_insnToC( insn, out );
+	Opdis_insnToC( insn, c->out );
 
-	return (Qfalse == var || Qnil == var) ? 0 : 1;
+	c->rv = (Qfalse == var || Qnil == var) ? 0 : 1;
+	return Qnil;
+}
+
+static VALUE call_decoder( VALUE arg ) {
+	struct DECODER_CALL * c = (struct DECODER_CALL *) arg;
+
+	/* Wrap the arguments passed to the decoder. The context refers to 
+	 * libopdis buffers, so it must not be usable after this call. */
+	c->ctx = Opdis_decodeContextNew( &c->args );
+	return rb_ensure( call_decoder_body, arg, Opdis_decodeContextRelease,
+			  c->ctx );
+}
+
+/* local decoder callback: this calls the decode method in the object provided
+ * by the user. */
+static int local_decoder( const opdis_insn_buf_t in, opdis_insn_t * out,
+                          const opdis_byte_t * buf, opdis_off_t offset,
+                          opdis_vma_t vma, opdis_off_t length, void * arg ) {
+	Opdis_rb_callback * cb = (Opdis_rb_callback *) arg;
+	struct DECODER_CALL c;
+
+	c.obj = cb->obj;
+	c.args.in = in;
+	c.args.buf = buf;
+	c.args.offset = offset;
+	c.args.vma = vma;
+	c.args.length = length;
+	c.out = out;
+	c.ctx = Qnil;
+	c.rv = 0;
+
+	Opdis_runnerCall( cb->runner, call_decoder, (VALUE) &c );
+
+	return c.rv;
 }
 
 static VALUE cls_disasm_set_decoder(VALUE instance, VALUE obj) {
@@ -192,17 +195,37 @@ static VALUE cls_disasm_set_decoder(VALUE instance, VALUE obj) {
 	return Qtrue;
 }
 
+struct INSN_CALL {
+	VALUE obj;
+	const opdis_insn_t * insn;
+	VALUE rv;
+};
+
+static VALUE call_handler( VALUE arg ) {
+	struct INSN_CALL * c = (struct INSN_CALL *) arg;
+	VALUE insn = Opdis_insnFromC(c->insn);
+
+	/* invoke visited? method in Handler object */
+	c->rv = rb_funcall(c->obj, symVisited, 1, insn);
+	return Qnil;
+}
+
 /* local insn handler object: this invokes the visited? method in the handler
  * object provided by the user. */
 static int local_handler( const opdis_insn_t * i, void * arg ) {
-	VALUE obj = (VALUE) arg;
-	VALUE insn = Opdis_insnFromC(i);
+	Opdis_rb_callback * cb = (Opdis_rb_callback *) arg;
+	struct INSN_CALL c;
 
-	/* invoke visited? method in Handler object */
-	VALUE var = rb_funcall(obj, symVisited, 1, insn);
+	c.obj = cb->obj;
+	c.insn = i;
+	c.rv = Qtrue;
+
+	if (! Opdis_runnerCall( cb->runner, call_handler, (VALUE) &c ) ) {
+		return 0;
+	}
 
 	/* True means already visited, so continue = 0 */
-	return (Qtrue == var) ? 0 : 1;
+	return (Qtrue == c.rv) ? 0 : 1;
 }
 
 static VALUE cls_disasm_set_handler(VALUE instance, VALUE obj) {
@@ -229,16 +252,88 @@ static VALUE cls_disasm_set_handler(VALUE instance, VALUE obj) {
 	return Qtrue;
 }
 
+static VALUE call_resolver( VALUE arg ) {
+	struct INSN_CALL * c = (struct INSN_CALL *) arg;
+	VALUE insn = Opdis_insnFromC(c->insn);
+
+	/* invoke resolve method in Resolver object */
+	VALUE vma = rb_funcall(c->obj, symResolve, 1, insn);
+
+	/* convert here, where a bad return value can raise */
+	c->rv = (Qnil == vma) ? Qnil : ULL2NUM(NUM2ULL(vma));
+	return Qnil;
+}
+
 /* local resolver callback: this invokes the ruby resolve method in the object
  * provided by the user */
 static opdis_vma_t local_resolver ( const opdis_insn_t * i, void * arg ) {
-	VALUE obj = (VALUE) arg;
-	VALUE insn = Opdis_insnFromC(i);
+	Opdis_rb_callback * cb = (Opdis_rb_callback *) arg;
+	struct INSN_CALL c;
 
-	/* invoke resolve method in Resolver object */
-	VALUE vma = rb_funcall(obj, symResolve, 1, insn);
+	c.obj = cb->obj;
+	c.insn = i;
+	c.rv = Qnil;
+
+	if (! Opdis_runnerCall( cb->runner, call_resolver, (VALUE) &c ) ) {
+		return OPDIS_INVALID_ADDR;
+	}
+
+	return (Qnil == c.rv) ? OPDIS_INVALID_ADDR : (opdis_vma_t) NUM2ULL(c.rv);
+}
+
+/* Ruby callback objects bound to a Runner for one disassembly */
+struct RB_CALLBACKS {
+	Opdis_rb_callback decoder;
+	Opdis_rb_callback handler;
+	Opdis_rb_callback resolver;
+};
 
-	return (Qnil == vma) ? OPDIS_INVALID_ADDR : (opdis_vma_t) NUM2UINT(vma);
+/* the Disassembler stores Ruby callback objects as the callback arg; point
+ * the (duplicated) opdis_t at Opdis_rb_callback wrappers instead. Objects
+ * which use a built-in callback implementation are replaced by the
+ * libopdis callback they wrap, avoiding the conversion to and from Ruby
+ * for every instruction. */
+static void bind_rb_callbacks( opdis_t opdis, Opdis_runner * runner,
+			       struct RB_CALLBACKS * cbs ) {
+	if ( opdis->decoder == local_decoder ) {
+		OPDIS_DECODER fn;
+
+		cbs->decoder.obj = (VALUE) opdis->decoder_arg;
+		cbs->decoder.runner = runner;
+		opdis->decoder_arg = &cbs->decoder;
+
+		fn = Opdis_builtinDecoder( cbs->decoder.obj );
+		if ( fn ) {
+			opdis_set_decoder( opdis, fn, NULL );
+		}
+	}
+
+	if ( opdis->handler == local_handler ) {
+		opdis_t tracker;
+
+		cbs->handler.obj = (VALUE) opdis->handler_arg;
+		cbs->handler.runner = runner;
+		opdis->handler_arg = &cbs->handler;
+
+		tracker = Opdis_builtinHandlerArg( cbs->handler.obj );
+		if ( tracker ) {
+			opdis_set_handler( opdis, opdis_default_handler, 
+					   tracker );
+		}
+	}
+
+	if ( opdis->resolver == local_resolver ) {
+		OPDIS_RESOLVER fn;
+
+		cbs->resolver.obj = (VALUE) opdis->resolver_arg;
+		cbs->resolver.runner = runner;
+		opdis->resolver_arg = &cbs->resolver;
+
+		fn = Opdis_builtinResolver( cbs->resolver.obj );
+		if ( fn ) {
+			opdis_set_resolver( opdis, fn, NULL );
+		}
+	}
 }
 
 static VALUE cls_disasm_set_resolver(VALUE instance, VALUE obj) {
@@ -299,8 +394,7 @@ static VALUE cls_disasm_get_syntax(VALUE instance) {
 	return str;
 }
 
-static VALUE cls_disasm_set_syntax(VALUE instance, VALUE syntax) {
-	opdis_t  opdis;
+static void set_syntax( opdis_t opdis, VALUE syntax ) {
 	enum opdis_x86_syntax_t syn;
 	VALUE syntax_s = rb_any_to_s(syntax);
 	const char * str = StringValueCStr(syntax_s);
@@ -313,11 +407,17 @@ static VALUE cls_disasm_set_syntax(VALUE instance, VALUE syntax) {
 		rb_raise(rb_eArgError, "Syntax must be 'intel' or 'att'");
 	}
 
+	opdis_set_x86_syntax(opdis, syn);
+}
+
+static VALUE cls_disasm_set_syntax(VALUE instance, VALUE syntax) {
+	opdis_t  opdis;
+
 	Data_Get_Struct(instance, opdis_info_t, opdis);
 	if (! opdis ) {
 		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
 	}
-	opdis_set_x86_syntax(opdis, syn);
+	set_syntax(opdis, syntax);
 
 	return Qtrue;
 }
@@ -353,24 +453,31 @@ static VALUE cls_disasm_get_arch(VALUE instance) {
 	return rb_str_new_cstr(arg.name);
 }
 
-static VALUE cls_disasm_set_arch(VALUE instance, VALUE arch) {
-	opdis_t  opdis;
+/* returns 0 if 'arch' is not a known architecture */
+static int set_arch( opdis_t opdis, VALUE arch ) {
 	const Opdis_disasm_def * def;
 	const char * name = rb_string_value_cstr(&arch);
 
+	def = Opdis_disasm_for_name( name );
+	if ( def == Opdis_disasm_invalid() ) {
+		return 0;
+	}
+
+	opdis->config.application_data = def->fn;
+	opdis->config.arch = def->arch;
+	opdis->config.mach = def->mach;
+	return 1;
+}
+
+static VALUE cls_disasm_set_arch(VALUE instance, VALUE arch) {
+	opdis_t  opdis;
+
 	Data_Get_Struct(instance, opdis_info_t, opdis);
 	if (! opdis ) {
 		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
 	}
 
-	def = Opdis_disasm_for_name( name );
-
-	if ( def != Opdis_disasm_invalid() ) {
-		struct disassemble_info * info = &opdis->config;
-		info->application_data = def->fn;
-		info->arch = def->arch;
-		info->mach = def->mach;
-
+	if ( set_arch(opdis, arch) ) {
 		rb_iv_set(instance, IVAR(DIS_ATTR_ARCH), arch);
 	}
 
@@ -425,117 +532,249 @@ static void cls_disasm_handle_args( VALUE instance, VALUE hash ) {
 
 	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_ARCH), Qfalse);
 	if ( Qfalse != var ) cls_disasm_set_arch(instance, var);
+
+	/* Ruby extension settings */
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_CACHE), Qfalse);
+	if ( Qfalse != var ) rb_iv_set(instance, IVAR(DIS_ATTR_CACHE), var);
 }
 
-struct DISPLAY_ARGS { VALUE output; VALUE block; };
+/* configure 'opdis' for 'abfd'. The arch, syntax and options arguments in
+ * 'hash' override the BFD configuration. */
+static void config_from_bfd( opdis_t opdis, bfd * abfd, VALUE hash ) {
+	VALUE var;
 
-/* local display handler: this adds instructions to a Disassembly object
- * and invokes block if provided. */
-static void local_display( const opdis_insn_t * i, void * arg ) {
-	struct DISPLAY_ARGS * args = (struct DISPLAY_ARGS *) arg;
-	VALUE insn = Opdis_insnFromC(i);
+	opdis_config_from_bfd( opdis, abfd );
 
-	if ( insn == Qnil ) {
-		char buf[128];
-		VALUE errors = rb_iv_get(args->output, IVAR(OUT_ATTR_ERRORS));
-		snprintf( buf, 127-1, "%s: Unable to convert C insn to Ruby", 
-			  DIS_ERR_DECODE );
-		rb_ary_push( errors, rb_str_new_cstr(buf) );
-		return;
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_ARCH), Qfalse);
+	if ( Qfalse != var ) set_arch(opdis, var);
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_SYNTAX), Qfalse);
+	if ( Qfalse != var ) set_syntax(opdis, var);
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_OPTIONS), Qfalse);
+	if ( Qfalse != var ) {
+		opdis_set_disassembler_options( opdis, StringValueCStr(var) );
+	}
+}
+
+static void config_buf_from_args( opdis_buf_t buf, VALUE hash ) {
+	VALUE var;
+
+	/* buffer vma */
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_BUFVMA), Qfalse);
+	if ( Qfalse != var && Qnil != var ) buf->vma = NUM2ULL(var);
+
+	// TODO: other options? 
+}
+
+/* Disassembly target. For non-BFD targets, 'buf' points to 'local', whose
+ * data is borrowed from a Ruby object: 'owner' keeps that object alive and
+ * unchanged until the disassembly has finished. */
+struct OPDIS_TGT {
+	bfd * abfd; 
+	asection * sec; 
+	asymbol * sym; 
+	opdis_buf_t buf;
+	opdis_buffer_t local;
+	VALUE owner;
+	VALUE locked_iobuf;
+	void * map_base;
+	size_t map_len;
+};
+
+/* borrow the bytes of a String. Mutable strings are replaced by a frozen
+ * copy-on-write twin, so the bytes are shared rather than copied and
+ * later writes to the original do not affect the disassembly. */
+static void tgt_borrow_string( struct OPDIS_TGT * tgt, VALUE str ) {
+	if (! OBJ_FROZEN(str) ) {
+		str = rb_str_new_frozen(str);
+	}
+
+	tgt->owner = str;
+	tgt->local.data = (opdis_byte_t *) RSTRING_PTR(str);
+	tgt->local.len = (opdis_off_t) RSTRING_LEN(str);
+}
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+/* borrow the memory of an IO::Buffer; it stays locked until the target
+ * is released */
+static void tgt_borrow_iobuf( struct OPDIS_TGT * tgt, VALUE iobuf ) {
+	const void * base;
+	size_t size;
+
+	rb_io_buffer_get_bytes_for_reading( iobuf, &base, &size );
+	rb_io_buffer_lock( iobuf );
+
+	tgt->owner = iobuf;
+	tgt->locked_iobuf = iobuf;
+	tgt->local.data = (opdis_byte_t *) base;
+	tgt->local.len = (opdis_off_t) size;
+}
+
+/* unlock a borrowed IO::Buffer between runs of a Session. The buffer may
+ * be resized or freed until it is locked again by tgt_relock_iobuf. */
+static void tgt_unlock_iobuf( struct OPDIS_TGT * tgt ) {
+	if ( Qnil != tgt->locked_iobuf ) {
+		rb_io_buffer_unlock( tgt->locked_iobuf );
+		tgt->locked_iobuf = Qnil;
 	}
+}
+
+/* lock the IO::Buffer unlocked by tgt_unlock_iobuf, and borrow its memory
+ * again, keeping the buffer vma */
+static void tgt_relock_iobuf( struct OPDIS_TGT * tgt ) {
+	const void * base;
+	size_t size;
 
-	if ( Qnil != args->block ) {
-		rb_funcall(args->block, symCall, 1, insn);
+	if ( Qnil != tgt->locked_iobuf || 
+	     Qtrue != rb_obj_is_kind_of( tgt->owner, rb_cIOBuffer ) ) {
+		return;
 	}
 
-	rb_hash_aset( args->output, INT2NUM(i->vma), insn );
+	rb_io_buffer_get_bytes_for_reading( tgt->owner, &base, &size );
+	if (! base || ! size ) {
+		rb_raise(rb_eArgError, "Cannot disassemble empty buffer");
+	}
+	rb_io_buffer_lock( tgt->owner );
 
-	rb_thread_schedule();
+	tgt->locked_iobuf = tgt->owner;
+	tgt->local.data = (opdis_byte_t *) base;
+	tgt->local.len = (opdis_off_t) size;
 }
+#endif
+
+#ifdef OPDIS_USE_MMAP
+/* map a File read-only from its current position to the end. Returns 0 if
+ * the IO cannot be mapped (pipes, sockets, empty files), in which case the
+ * caller falls back to IO#read. On success the IO is positioned at EOF, as
+ * it would be after IO#read. */
+static int tgt_map_io( struct OPDIS_TGT * tgt, VALUE io ) {
+	struct stat st;
+	off_t pos, map_off;
+	long page_sz = sysconf(_SC_PAGESIZE);
+	void * base;
+	int fd;
+
+	if (! rb_respond_to(io, symFileno) ) {
+		return 0;
+	}
+
+	fd = NUM2INT(rb_funcall(io, symFileno, 0));
+	pos = (off_t) NUM2OFFT(rb_funcall(io, symPos, 0));
 
-/* local error handler: this appends errors to a ruby array in arg */
-static void local_error( enum opdis_error_t error, const char * msg,
-                         void * arg ) {
-	const char * type;
-	char buf[128] = {0};
-	VALUE errors = (VALUE) arg;
+	if ( fstat(fd, &st) || ! S_ISREG(st.st_mode) || st.st_size <= pos ) {
+		return 0;
+	}
 
-	switch (error) {
-		case opdis_error_bounds: type = DIS_ERR_BOUNDS; break;
-		case opdis_error_invalid_insn: type = DIS_ERR_INVALID; break;
-		case opdis_error_decode_insn: type = DIS_ERR_DECODE; break;
-		case opdis_error_bfd: type = DIS_ERR_BFD; break;
-		case opdis_error_max_items: type = DIS_ERR_MAX; break;
-		case opdis_error_unknown: 
-		default: type = DIS_ERR_UNK; break;
+	/* mapping offset must be page-aligned */
+	map_off = pos - (pos % (page_sz > 0 ? page_sz : 4096));
+	base = mmap( NULL, (size_t) (st.st_size - map_off), PROT_READ, 
+		     MAP_PRIVATE, fd, map_off );
+	if ( base == MAP_FAILED ) {
+		return 0;
 	}
 
-	snprintf( buf, 128-1, "%s: %s", type, msg );
+	tgt->map_base = base;
+	tgt->map_len = (size_t) (st.st_size - map_off);
+	tgt->local.data = (opdis_byte_t *) base + (pos - map_off);
+	tgt->local.len = (opdis_off_t) (st.st_size - pos);
+
+	rb_funcall(io, symSetPos, 1, OFFT2NUM(st.st_size));
 
-	/* append error message to error list */
-	rb_ary_push( errors, rb_str_new_cstr(buf) );
+	return 1;
 }
+#endif
 
-static void config_buf_from_args( opdis_buf_t buf, VALUE hash ) {
-	VALUE var;
+/* pack an Array of byte values into a String owned by the target */
+static void tgt_pack_array( struct OPDIS_TGT * tgt, VALUE ary ) {
+	long i, len = RARRAY_LEN(ary);
+	VALUE str = rb_str_new( NULL, len );
+	unsigned char * sbuf = (unsigned char *) RSTRING_PTR(str);
 
-	/* buffer vma */
-	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_BUFVMA), Qfalse);
-	if ( Qfalse != var && Qnil != var ) buf->vma = NUM2UINT(var);
+	for( i=0; i < len; i++ ) {
+		sbuf[i] = (unsigned char) NUM2UINT(rb_ary_entry( ary, i ));
+	}
 
-	// TODO: other options? 
+	OBJ_FREEZE(str);
+	tgt_borrow_string( tgt, str );
 }
 
-static opdis_buf_t opdis_buf_for_target( VALUE tgt, VALUE hash ) {
-	unsigned char * buf = NULL;
-	unsigned int buf_len = 0;
-	opdis_buf_t obuf;
+static void opdis_buf_for_target( VALUE tgt, VALUE hash, 
+				  struct OPDIS_TGT * out ) {
 
 	/* String object containing bytes */
 	if ( Qtrue == rb_obj_is_kind_of( tgt, rb_cString ) ) {
-		buf = (unsigned char*) RSTRING_PTR(tgt);
-		buf_len = RSTRING_LEN(tgt);
+		tgt_borrow_string( out, tgt );
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+	/* IO::Buffer object containing bytes */
+	} else if ( Qtrue == rb_obj_is_kind_of( tgt, rb_cIOBuffer ) ) {
+		tgt_borrow_iobuf( out, tgt );
+#endif
 
 	/* Array object containing bytes */
 	} else if ( Qtrue == rb_obj_is_kind_of( tgt, rb_cArray ) ) {
-		unsigned int i;
-		unsigned char * sbuf;
-		buf_len = RARRAY_LEN(tgt);
-		sbuf = alloca(buf_len);
-		for( i=0; i < buf_len; i++ ) {
-			VALUE val = rb_ary_entry( tgt, i );
-			sbuf[i] = (unsigned char) NUM2UINT(val);
-		}
-
-		buf = sbuf;
+		tgt_pack_array( out, tgt );
 
 	/* IO object containing bytes */
 	} else if ( Qtrue == rb_obj_is_kind_of( tgt, rb_cIO ) ) {
-		VALUE str = rb_funcall( tgt, symRead, 0 );
-		buf = (unsigned char*) RSTRING_PTR(str);
-		buf_len = RSTRING_LEN(str);
+		VALUE str;
+#ifdef OPDIS_USE_MMAP
+		/* regular files are disassembled straight from the page cache */
+		if (! tgt_map_io( out, tgt ) ) {
+#endif
+		str = rb_funcall( tgt, symRead, 0 );
+		if ( Qnil == str ) {
+			rb_raise(rb_eArgError, "Cannot disassemble empty buffer");
+		}
+		tgt_borrow_string( out, StringValue(str) );
+#ifdef OPDIS_USE_MMAP
+		}
+#endif
 
 	} else {
-		rb_raise(rb_eArgError, "Buffer must be a String, IO or Array");
+		rb_raise(rb_eArgError, 
+			 "Buffer must be a String, IO::Buffer, IO or Array");
 	}
 
-	if (! buf || ! buf_len ) {
+	if (! out->local.data || ! out->local.len ) {
 		rb_raise(rb_eArgError, "Cannot disassemble empty buffer");
 	}
 
-	obuf = opdis_buf_alloc( buf_len, 0 );
-	opdis_buf_fill( obuf, 0, buf, buf_len );
+	out->local.vma = 0;
+	out->buf = &out->local;
 
 	/* apply target-specific args (vma, etc) */
-	config_buf_from_args( obuf, hash );
+	config_buf_from_args( out->buf, hash );
+}
+
+/* release anything borrowed by load_target */
+static VALUE release_target( VALUE arg ) {
+	struct OPDIS_TGT * tgt = (struct OPDIS_TGT *) arg;
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+	tgt_unlock_iobuf( tgt );
+#endif
+
+#ifdef OPDIS_USE_MMAP
+	if ( tgt->map_base ) {
+		munmap( tgt->map_base, tgt->map_len );
+		tgt->map_base = NULL;
+	}
+#endif
+
+	tgt->buf = NULL;
+	tgt->owner = Qnil;
 
-	return obuf;
+	return Qnil;
 }
 
-struct OPDIS_TGT {bfd * abfd; asection * sec; asymbol * sym; opdis_buf_t buf;};
+/* fill 'out' based on the Ruby object type of 'tgt' */
+static void load_target_object( VALUE tgt, VALUE hash, 
+				struct OPDIS_TGT * out ) {
 
-static void load_target( opdis_t opdis, VALUE tgt, VALUE hash, 
-			 struct OPDIS_TGT * out ) {
+	out->owner = Qnil;
+	out->locked_iobuf = Qnil;
 
 	/* Ruby Bfd::Target object */
 	if ( Qnil != GET_BFD_CLASS(clsBfdTgt, BFD_TGT_PATH) &&
@@ -565,176 +804,1386 @@ static void load_target( opdis_t opdis, VALUE tgt, VALUE hash,
 
 	/* Other non-Bfd Ruby object */
 	} else {
-		out->buf = opdis_buf_for_target( tgt, hash );
+		opdis_buf_for_target( tgt, hash, out );
 	}
+}
+
+static void load_target( opdis_t opdis, VALUE tgt, VALUE hash, 
+			 struct OPDIS_TGT * out ) {
+
+	load_target_object( tgt, hash, out );
 
 	/* Set arch, etc based on BFD info */
 	if ( out->abfd ) {
-		opdis_config_from_bfd( opdis, out->abfd );
+		config_from_bfd( opdis, out->abfd, hash );
 	}
 }
 
-static void perform_disassembly( VALUE instance, opdis_t opdis, VALUE target,
-				 VALUE hash ) {
-	VALUE var;
-	VALUE rb_vma = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_VMA), 
-				       INT2NUM(0));
-	VALUE rb_len = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_LEN), 
-				       INT2NUM(0));
-	opdis_vma_t vma = NUM2ULL(rb_vma);
-	opdis_off_t len = NUM2UINT(rb_len);
-	const char * strategy = DIS_STRAT_LINEAR;
-	struct OPDIS_TGT tgt = {0};
-
-	/* load target based on its Ruby object type */
-	load_target( opdis, target, hash, &tgt );
+enum disasm_strategy {
+	strat_single,
+	strat_linear,
+	strat_cflow,
+	strat_symbol,
+	strat_section,
+	strat_entry,
+	strat_functions
+};
 
-	/* apply general args (syntax, arch, etc), overriding Bfd config */
-	cls_disasm_handle_args(instance, hash);
+static enum disasm_strategy strategy_for_name( const char * name, 
+					       struct OPDIS_TGT * tgt ) {
+	if (! strcmp( name, DIS_STRAT_SINGLE ) ) {
+		return strat_single;
+	} else if (! strcmp( name, DIS_STRAT_LINEAR ) ) {
+		return strat_linear;
+	} else if (! strcmp( name, DIS_STRAT_CFLOW ) ) {
+		return strat_cflow;
+	} else if (! strcmp( name, DIS_STRAT_SYMBOL ) ) {
+		if (! tgt->sym ) {
+			rb_raise(rb_eArgError, "Bfd::Symbol required");
+		}
+		return strat_symbol;
+	} else if (! strcmp( name, DIS_STRAT_SECTION ) ) {
+		if (! tgt->sec ) {
+			rb_raise(rb_eArgError, "Bfd::Section required");
+		}
+		return strat_section;
+	} else if (! strcmp( name, DIS_STRAT_ENTRY ) ) {
+		if (! tgt->abfd ) {
+			rb_raise(rb_eArgError, "Bfd::Target required");
+		}
+		return strat_entry;
+	} else if (! strcmp( name, DIS_STRAT_FUNCTIONS ) ) {
+		return strat_functions;
+	}
 
-	/* get disassembly algorithm to use */
-	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_STRATEGY), Qfalse);
-	if ( Qfalse != var ) strategy = StringValueCStr(var);
+	rb_raise(rb_eArgError, "Unknown strategy '%s'", name);
+	return strat_linear;
+}
 
-	rb_thread_schedule();
+/* Everything needed to run a strategy. This must not touch Ruby objects:
+ * it is executed without the GVL. */
+struct STRATEGY_ARGS {
+	opdis_t opdis;
+	Opdis_runner * runner;
+	struct OPDIS_TGT * tgt;
+	enum disasm_strategy strategy;
+	opdis_vma_t vma;
+	opdis_off_t len;
+	unsigned int threads;
+	const opdis_vma_t * seeds;	/* function starts, sorted */
+	size_t num_seeds;
+	Opdis_insn_stats * stats;	/* count instead of output, or NULL */
+};
 
-	// Disable garbage collection
-	// TODO: INVESTIGATE why without this, ruby crashes!
-	rb_gc_disable();
+/* number of worker threads requested by the 'threads' argument */
+static unsigned int threads_from_arg( VALUE var ) {
+	unsigned int n;
 
-	/* Single instruction disassembly */
-	if (! strcmp( strategy, DIS_STRAT_SINGLE ) ) {
-		opdis_insn_t * insn = ALLOC_FIXED_INSN;
+	if ( Qtrue == var ) {
+		return Opdis_parallelCpuCount();
+	}
 
-		if ( tgt.abfd ) {
-			opdis_disasm_bfd_insn( opdis, tgt.abfd, vma, insn );
-		} else {
-			opdis_disasm_insn( opdis, tgt.buf, vma, insn );
-		}
+	if ( Qfalse == var || Qnil == var ) {
+		return 1;
+	}
 
-		/* invoke display function */
-		opdis->display( insn, opdis->display_arg );
+	n = NUM2UINT(var);
+	if ( n > OPDIS_PAR_MAX_THREADS ) {
+		n = OPDIS_PAR_MAX_THREADS;
+	}
 
-		opdis_insn_free(insn);
+	return n ? n : 1;
+}
 
-	/* Linear disassembly */
-	} else if (! strcmp( strategy, DIS_STRAT_LINEAR ) ) {
-		if ( tgt.abfd ) {
-		 	opdis_disasm_bfd_linear( opdis, tgt.abfd, vma, len );
-		} else {
-		 	opdis_disasm_linear( opdis, tgt.buf, vma, len );
-		}
+/* read the contents of a BFD section into 'buf'. The caller must free
+ * buf->data. */
+static int section_buffer( asection * sec, opdis_buffer_t * buf ) {
+	bfd_byte * data = NULL;
 
-	/* Control Flow disassembly */
-	} else if (! strcmp( strategy, DIS_STRAT_CFLOW ) ) {
-		if ( tgt.abfd ) {
-			opdis_disasm_bfd_cflow( opdis, tgt.abfd, vma );
-		} else {
-			opdis_disasm_cflow( opdis, tgt.buf, vma );
-		}
+	if (! sec->size || 
+	    ! bfd_malloc_and_get_section( sec->owner, sec, &data ) ) {
+		return 0;
+	}
 
-	/* Control Flow disassembly of BFD symbol */
-	} else if (! strcmp( strategy, DIS_STRAT_SYMBOL ) ) {
-		if (! tgt.sym ) {
-			rb_raise(rb_eArgError, "Bfd::Symbol required");
-		}
-		opdis_disasm_bfd_symbol( opdis, tgt.sym );
+	buf->len = (opdis_off_t) sec->size;
+	buf->vma = (opdis_vma_t) sec->vma;
+	buf->data = (opdis_byte_t *) data;
+	return 1;
+}
 
-	/* Linear disassembly of BFD section */
-	} else if (! strcmp( strategy, DIS_STRAT_SECTION ) ) {
-		if (! tgt.sec ) {
-			rb_raise(rb_eArgError, "Bfd::Section required");
-		}
-		opdis_disasm_bfd_section( opdis, tgt.sec );
+/* control flow disassembly of 'buf' from each of 'num' addresses. An
+ * address reached from an earlier one is not decoded again. */
+static void cflow_seeds( struct STRATEGY_ARGS * args, opdis_buf_t buf,
+			 const opdis_vma_t * seeds, size_t num ) {
+	size_t i;
 
-	/* Control Flow disassembly of BFD entry point */
-	} else if (! strcmp( strategy, DIS_STRAT_ENTRY ) ) {
-		if (! tgt.abfd ) {
-			rb_raise(rb_eArgError, "Bfd::Target required");
-		}
-		opdis_disasm_bfd_entry( opdis, tgt.abfd );
-	} else {
-		if ( tgt.buf ) {
-			opdis_buf_free(tgt.buf);
-		}
-		rb_raise(rb_eArgError, "Unknown strategy '%s'", strategy);
+	if ( args->threads > 1 && Opdis_parallelCflowSeeds( args->runner, 
+					buf, seeds, num, args->threads ) ) {
+		return;
 	}
 
-	if ( tgt.buf ) {
-		opdis_buf_free(tgt.buf);
+	for ( i = 0; i < num && ! args->runner->abort; i++ ) {
+		opdis_disasm_cflow( args->opdis, buf, seeds[i] );
 	}
-
-	// Enable garbage collection
-	// TODO: INVESTIGATE why ruby needs gc disable/enable
-	rb_gc_enable();
 }
 
+/* linear disassembly of a BFD section across worker threads */
+static int parallel_section( struct STRATEGY_ARGS * args ) {
+	opdis_buffer_t buf;
+	int rv;
 
-/* Disassembler strategies produce blocks */
-static VALUE cls_disasm_disassemble(VALUE instance, VALUE tgt, VALUE hash ) {
-	opdis_t opdis, opdis_orig;
-	VALUE args[1] = {Qnil};
-	struct DISPLAY_ARGS display_args = { Qnil, Qnil };
-
-	/* Create duplicate opdis_t in order to be threadsafe */
-	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
-	if (! opdis_orig ) {
-		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
-	}
-	opdis = opdis_dupe(opdis_orig);
-
-	/* yield to a block, if provided */
-	if ( rb_block_given_p() ) {
-		display_args.block = rb_block_proc();
+	if (! section_buffer( args->tgt->sec, &buf ) ) {
+		return 0;
 	}
 
-	display_args.output = rb_class_new_instance( 0, args, clsOutput );
+	rv = Opdis_parallelLinear( args->runner, &buf, buf.vma, buf.len,
+				   args->threads );
 
-	opdis_set_display( opdis, local_display, &display_args );
-
-	opdis_set_error_reporter( opdis, local_error, 
-			(void *) rb_iv_get(display_args.output, 
-					   IVAR(OUT_ATTR_ERRORS)) );
+	free( buf.data );
+	return rv;
+}
 
-	perform_disassembly( instance, opdis, tgt, hash );
+/* the BFD section containing 'vma', or NULL */
+static asection * section_for_vma( bfd * abfd, opdis_vma_t vma ) {
+	asection * sec;
 
-	opdis_term(opdis);
+	for ( sec = abfd->sections; sec; sec = sec->next ) {
+		if ( vma >= sec->vma && vma < sec->vma + sec->size ) {
+			break;
+		}
+	}
 
-	return display_args.output;
+	return sec;
 }
 
-/* new: takes hash of arguments */
-static VALUE cls_disasm_new(VALUE class, VALUE hash) {
-	VALUE instance;
-	VALUE argv[1] = { Qnil };
-	opdis_t opdis = opdis_init();
+/* control flow disassembly from 'vma' across worker threads. For BFD
+ * targets, only the section containing 'vma' is followed, as in 
+ * opdis_disasm_bfd_cflow. */
+static int parallel_cflow( struct STRATEGY_ARGS * args, opdis_vma_t vma ) {
+	bfd * abfd = args->tgt->abfd;
+	asection * sec;
+	opdis_buffer_t buf;
+	int rv;
+
+	if (! abfd ) {
+		return Opdis_parallelCflow( args->runner, args->tgt->buf, vma,
+					    args->threads );
+	}
 
-	instance = Data_Wrap_Struct(class, NULL, opdis_term, opdis);
-	rb_obj_call_init(instance, 0, argv);
+	sec = section_for_vma( abfd, vma );
+	if (! sec || ! section_buffer( sec, &buf ) ) {
+		return 0;
+	}
 
-	cls_disasm_handle_args(instance, hash);
+	rv = Opdis_parallelCflow( args->runner, &buf, vma, args->threads );
 
-	return instance;
+	free( buf.data );
+	return rv;
 }
 
-/* usage: writes a list of disassembler options to IO object */
-static VALUE cls_disasm_usage(VALUE class, VALUE io) {
-	const char * filename;
-	VALUE path;
-	FILE * f;
+/* control flow disassembly from every function start. For BFD targets, 
+ * each start is followed within its own section. */
+static void run_functions( struct STRATEGY_ARGS * args ) {
+	bfd * abfd = args->tgt->abfd;
+	const opdis_vma_t * seeds = args->seeds;
+	size_t i, j, num = args->num_seeds;
 
-	if (! rb_respond_to(io, symPath) ) {
-		rb_raise( rb_eArgError, "Argument must respond to :path" );
+	if (! num ) {
+		seeds = &args->vma;
+		num = 1;
 	}
 
-	/* get path from ruby File object */
-	path = rb_funcall(io, symPath, 0);
-	if ( Qnil == path ) {
-		rb_raise( rb_eArgError, "Object#path returned nil" );
+	if (! abfd ) {
+		cflow_seeds( args, args->tgt->buf, seeds, num );
+		return;
 	}
 
-	filename = StringValueCStr(path);
-	f = fopen( filename, "w");
+	/* seeds are sorted, so those in one section are adjacent */
+	for ( i = 0; i < num && ! args->runner->abort; i = j ) {
+		asection * sec = section_for_vma( abfd, seeds[i] );
+		opdis_buffer_t buf;
+
+		for ( j = i + 1; sec && j < num && 
+				 seeds[j] < sec->vma + sec->size; j++ ) {
+			/* same section */
+		}
+
+		if (! sec || ! section_buffer( sec, &buf ) ) {
+			args->opdis->error_reporter( opdis_error_bfd, 
+					"Unable to read section",
+					args->opdis->error_reporter_arg );
+			continue;
+		}
+
+		cflow_seeds( args, &buf, &seeds[i], j - i );
+		free( buf.data );
+	}
+}
+
+static void run_strategy( void * arg ) {
+	struct STRATEGY_ARGS * args = (struct STRATEGY_ARGS *) arg;
+	struct OPDIS_TGT * tgt = args->tgt;
+	opdis_t opdis = args->opdis;
+	opdis_insn_t * insn;
+
+	switch ( args->strategy ) {
+		/* Single instruction disassembly */
+		case strat_single:
+			insn = Opdis_arenaAlloc( &args->runner->arena );
+			if (! insn ) {
+				break;
+			}
+
+			if ( tgt->abfd ) {
+				opdis_disasm_bfd_insn( opdis, tgt->abfd, 
+						       args->vma, insn );
+			} else {
+				opdis_disasm_insn( opdis, tgt->buf, args->vma, 
+						   insn );
+			}
+
+			/* invoke display function */
+			opdis->display( insn, opdis->display_arg );
+
+			Opdis_arenaRelease( &args->runner->arena, insn );
+			break;
+
+		/* Linear disassembly */
+		case strat_linear:
+			if ( tgt->abfd ) {
+				opdis_disasm_bfd_linear( opdis, tgt->abfd, 
+							 args->vma, args->len );
+			} else if ( args->threads < 2 || 
+				    ! Opdis_parallelLinear( args->runner,
+						tgt->buf, args->vma, args->len,
+						args->threads ) ) {
+				opdis_disasm_linear( opdis, tgt->buf, 
+						     args->vma, args->len );
+			}
+			break;
+
+		/* Control Flow disassembly */
+		case strat_cflow:
+			if ( args->threads > 1 && 
+			     parallel_cflow( args, args->vma ) ) {
+				/* done by worker threads */
+			} else if ( tgt->abfd ) {
+				opdis_disasm_bfd_cflow( opdis, tgt->abfd, 
+							args->vma );
+			} else {
+				opdis_disasm_cflow( opdis, tgt->buf, 
+						    args->vma );
+			}
+			break;
+
+		/* Control Flow disassembly of BFD symbol */
+		case strat_symbol:
+			if ( args->threads < 2 || ! parallel_cflow( args, 
+					tgt->sym->section->vma + 
+					tgt->sym->value ) ) {
+				opdis_disasm_bfd_symbol( opdis, tgt->sym );
+			}
+			break;
+
+		/* Linear disassembly of BFD section */
+		case strat_section:
+			if ( args->threads < 2 || ! parallel_section( args ) ) {
+				opdis_disasm_bfd_section( opdis, tgt->sec );
+			}
+			break;
+
+		/* Control Flow disassembly of BFD entry point */
+		case strat_entry:
+			if ( args->threads < 2 || ! parallel_cflow( args, 
+					bfd_get_start_address(tgt->abfd) ) ) {
+				opdis_disasm_bfd_entry( opdis, tgt->abfd );
+			}
+			break;
+
+		/* Control Flow disassembly from every function start */
+		case strat_functions:
+			run_functions( args );
+			break;
+	}
+}
+
+/* callbacks replaced by bind_rb_callbacks and the runner */
+struct SAVED_CALLBACKS {
+	OPDIS_DECODER decoder;
+	OPDIS_HANDLER handler;
+	OPDIS_RESOLVER resolver;
+	void * decoder_arg;
+	void * handler_arg;
+	void * resolver_arg;
+};
+
+static void save_callbacks( opdis_t opdis, struct SAVED_CALLBACKS * saved ) {
+	saved->decoder = opdis->decoder;
+	saved->decoder_arg = opdis->decoder_arg;
+	saved->handler = opdis->handler;
+	saved->handler_arg = opdis->handler_arg;
+	saved->resolver = opdis->resolver;
+	saved->resolver_arg = opdis->resolver_arg;
+}
+
+static void restore_callbacks( opdis_t opdis, 
+			       const struct SAVED_CALLBACKS * saved ) {
+	opdis->decoder = saved->decoder;
+	opdis->decoder_arg = saved->decoder_arg;
+	opdis->handler = saved->handler;
+	opdis->handler_arg = saved->handler_arg;
+	opdis->resolver = saved->resolver;
+	opdis->resolver_arg = saved->resolver_arg;
+}
+
+/* Run a configured strategy on 'opdis' and return the Array of errors. The
+ * callbacks of 'opdis' are restored afterwards, so it can be run again. */
+static VALUE execute_strategy( opdis_t opdis, struct STRATEGY_ARGS * args, 
+			       VALUE output, VALUE block ) {
+	struct STRATEGY_ARGS strat = *args;
+	struct RB_CALLBACKS cbs = {{Qnil}, {Qnil}, {Qnil}};
+	struct SAVED_CALLBACKS saved;
+	Opdis_runner runner;
+
+	save_callbacks( opdis, &saved );
+	strat.opdis = opdis;
+	strat.runner = &runner;
+
+	/* route Ruby callbacks through the runner */
+	bind_rb_callbacks( opdis, &runner, &cbs );
+
+	/* worker threads; Ruby callbacks and address trackers require a 
+	 * serial sweep, and streaming must not buffer the output of parallel
+	 * workers */
+	if ( Qnil == output || 
+	     opdis->decoder == local_decoder ||
+	     Qnil != cbs.handler.obj ||
+	     ( opdis->resolver == local_resolver && 
+	       strat.strategy != strat_linear && 
+	       strat.strategy != strat_section ) ) {
+		strat.threads = 1;
+	}
+
+#if defined(OPDIS_USE_MMAP) && defined(MADV_SEQUENTIAL)
+	/* linear sweeps of mapped files read ahead through the page cache */
+	if ( strat.tgt->map_base && strat.strategy == strat_linear ) {
+		madvise( strat.tgt->map_base, strat.tgt->map_len, 
+			 MADV_SEQUENTIAL );
+	}
+#endif
+
+	/* route libopdis output through the runner */
+	Opdis_runnerInit( &runner, opdis, output, block );
+	runner.stats = strat.stats;
+
+	Opdis_runnerRun( &runner, run_strategy, &strat );
+
+	restore_callbacks( opdis, &saved );
+
+	/* the callback objects are only referenced from C while running */
+	RB_GC_GUARD(cbs.decoder.obj);
+	RB_GC_GUARD(cbs.handler.obj);
+	RB_GC_GUARD(cbs.resolver.obj);
+
+	/* re-raises exceptions from Ruby callbacks */
+	Opdis_runnerFinish( &runner );
+
+	return runner.errors;
+}
+
+/* forget the addresses visited by a previous run of 'opdis' */
+static void reset_visited_addr( opdis_t opdis ) {
+	if ( opdis->visited_addr ) {
+		opdis_vma_tree_free( opdis->visited_addr );
+		opdis->visited_addr = opdis_vma_tree_init();
+	}
+}
+
+/* fill 'strat' from the disassembly arguments in 'hash' */
+static void config_strategy_from_args( VALUE hash, struct OPDIS_TGT * tgt,
+				       struct STRATEGY_ARGS * strat ) {
+	VALUE var;
+	const char * strategy = DIS_STRAT_LINEAR;
+
+	strat->tgt = tgt;
+	strat->seeds = NULL;
+	strat->num_seeds = 0;
+	strat->stats = NULL;
+	strat->vma = NUM2ULL(rb_hash_lookup2(hash, str_to_sym(DIS_ARG_VMA), 
+					     INT2NUM(0)));
+	strat->len = NUM2UINT(rb_hash_lookup2(hash, str_to_sym(DIS_ARG_LEN), 
+					      INT2NUM(0)));
+
+	/* get disassembly algorithm to use */
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_STRATEGY), Qfalse);
+	if ( Qfalse != var ) strategy = StringValueCStr(var);
+	strat->strategy = strategy_for_name( strategy, tgt );
+
+	/* worker threads */
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_THREADS), Qfalse);
+	strat->threads = threads_from_arg( var );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Incremental disassembly */
+
+static int cmp_vma_range( const void * a, const void * b ) {
+	const Opdis_vma_range * ra = (const Opdis_vma_range *) a;
+	const Opdis_vma_range * rb = (const Opdis_vma_range *) b;
+	return (ra->lo < rb->lo) ? -1 : (ra->lo > rb->lo);
+}
+
+/* Convert the changes argument of redisassemble (an Array of Ranges of
+ * modified VMAs, or of single modified VMAs) to sorted, merged ranges. The
+ * returned String owns the ranges. */
+static VALUE changes_from_arg( VALUE changes, size_t * num ) {
+	VALUE str;
+	Opdis_vma_range * ranges;
+	long i, n;
+	size_t out;
+
+	if ( TYPE(changes) != T_ARRAY ) {
+		changes = rb_ary_new3( 1, changes );
+	}
+
+	n = RARRAY_LEN(changes);
+	str = rb_str_new( NULL, n * sizeof(Opdis_vma_range) );
+
+	for ( i = 0; i < n; i++ ) {
+		VALUE item = rb_ary_entry(changes, i);
+		VALUE beg, end;
+		opdis_vma_t lo, hi;
+		int excl;
+
+		if ( rb_obj_is_kind_of(item, rb_cRange) && 
+		     rb_range_values(item, &beg, &end, &excl) ) {
+			lo = NUM2ULL(beg);
+			hi = NUM2ULL(end);
+			if ( hi < lo || (excl && hi == lo) ) {
+				rb_raise(rb_eArgError, "Empty range in changes");
+			}
+			hi += excl ? 0 : 1;
+		} else {
+			lo = NUM2ULL(item);
+			hi = lo + 1;
+		}
+
+		ranges = (Opdis_vma_range *) RSTRING_PTR(str);
+		ranges[i].lo = lo;
+		ranges[i].hi = hi;
+	}
+
+	ranges = (Opdis_vma_range *) RSTRING_PTR(str);
+	qsort( ranges, (size_t) n, sizeof(Opdis_vma_range), cmp_vma_range );
+
+	/* merge overlapping and adjacent ranges */
+	for ( i = 0, out = 0; i < n; i++ ) {
+		if ( out && ranges[i].lo <= ranges[out - 1].hi ) {
+			if ( ranges[i].hi > ranges[out - 1].hi ) {
+				ranges[out - 1].hi = ranges[i].hi;
+			}
+			continue;
+		}
+		ranges[out++] = ranges[i];
+	}
+
+	*num = out;
+	return str;
+}
+
+/* the address at which a strategy starts */
+static opdis_vma_t strategy_start( struct STRATEGY_ARGS * args ) {
+	struct OPDIS_TGT * tgt = args->tgt;
+
+	switch ( args->strategy ) {
+		case strat_symbol:
+			return tgt->sym->section->vma + tgt->sym->value;
+		case strat_section:
+			return tgt->sec->vma;
+		case strat_entry:
+			return bfd_get_start_address(tgt->abfd);
+		default:
+			return args->vma;
+	}
+}
+
+struct INCREMENTAL_ARGS {
+	struct STRATEGY_ARGS * strat;
+	VALUE old;
+	const Opdis_vma_range * changes;
+	size_t num_changes;
+};
+
+/* The incremental equivalent of run_strategy. This is run with the GVL
+ * held, as it reads the old Disassembly. */
+static void run_incremental( void * arg ) {
+	struct INCREMENTAL_ARGS * inc = (struct INCREMENTAL_ARGS *) arg;
+	struct STRATEGY_ARGS * args = inc->strat;
+	struct OPDIS_TGT * tgt = args->tgt;
+	opdis_t opdis = args->opdis;
+	opdis_buffer_t local = {0};
+	opdis_buf_t buf = tgt->buf;
+	opdis_vma_t vma = strategy_start( args ), end;
+
+	/* BFD strategies only read the section containing their start */
+	if ( tgt->abfd ) {
+		asection * sec = tgt->sec ? tgt->sec : 
+					    section_for_vma( tgt->abfd, vma );
+		if (! sec || ! section_buffer( sec, &local ) ) {
+			opdis->error_reporter( opdis_error_bfd, 
+					       "Unable to read section",
+					       opdis->error_reporter_arg );
+			return;
+		}
+		buf = &local;
+	}
+
+	if ( vma < buf->vma ) {
+		vma = buf->vma;
+	}
+	end = buf->vma + buf->len;
+
+	switch ( args->strategy ) {
+		case strat_single:
+			if ( vma < end ) {
+				end = vma + 1;
+			}
+			Opdis_incrementalLinear( args->runner, buf, inc->old,
+						 inc->changes, inc->num_changes,
+						 vma, end );
+			break;
+
+		case strat_linear:
+		case strat_section:
+			if ( args->strategy == strat_linear && args->len &&
+			     vma + args->len < end ) {
+				end = vma + args->len;
+			}
+			Opdis_incrementalLinear( args->runner, buf, inc->old,
+						 inc->changes, inc->num_changes,
+						 vma, end );
+			break;
+
+		case strat_cflow:
+		case strat_symbol:
+		case strat_entry:
+			Opdis_incrementalCflow( args->runner, buf, inc->old,
+						inc->changes, inc->num_changes,
+						vma );
+			break;
+
+		case strat_functions:
+			/* rejected by run_disassembly */
+			break;
+	}
+
+	free( local.data );
+}
+
+/* Re-disassemble the modified bytes of a target into 'old', which was
+ * produced from the unmodified target by the same strategy. Replacement
+ * instructions are yielded to 'block'. Returns 'old'. */
+static VALUE execute_incremental( opdis_t opdis, struct STRATEGY_ARGS * args,
+				  VALUE old, VALUE changes, VALUE block ) {
+	struct STRATEGY_ARGS strat = *args;
+	struct INCREMENTAL_ARGS inc;
+	struct RB_CALLBACKS cbs = {{Qnil}, {Qnil}, {Qnil}};
+	struct SAVED_CALLBACKS saved;
+	Opdis_runner runner;
+	VALUE ranges, output;
+	size_t num;
+
+	ranges = changes_from_arg( changes, &num );
+	output = Opdis_disassemblyNew();
+
+	inc.strat = &strat;
+	inc.old = old;
+	inc.changes = (const Opdis_vma_range *) RSTRING_PTR(ranges);
+	inc.num_changes = num;
+
+	save_callbacks( opdis, &saved );
+	strat.opdis = opdis;
+	strat.runner = &runner;
+
+	bind_rb_callbacks( opdis, &runner, &cbs );
+	reset_visited_addr( opdis );
+
+	/* replacement instructions are collected in 'output' */
+	Opdis_runnerInit( &runner, opdis, output, block );
+	Opdis_runnerRunLocked( &runner, run_incremental, &inc );
+
+	restore_callbacks( opdis, &saved );
+
+	RB_GC_GUARD(cbs.decoder.obj);
+	RB_GC_GUARD(cbs.handler.obj);
+	RB_GC_GUARD(cbs.resolver.obj);
+	RB_GC_GUARD(ranges);
+
+	Opdis_runnerFinish( &runner );
+
+	Opdis_disassemblyMerge( old, output );
+	return old;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Disassembly cache */
+
+/* name of the libopdis decoder used for 'opdis', or NULL if it is a Ruby
+ * decoder whose output cannot be cached */
+static const char * cache_decoder_name( opdis_t opdis ) {
+	OPDIS_DECODER fn = opdis->decoder;
+
+	if ( fn == local_decoder ) {
+		fn = Opdis_builtinDecoder( (VALUE) opdis->decoder_arg );
+	}
+
+	if (! fn ) {
+		return NULL;
+	} else if ( fn == opdis_x86_att_decoder ) {
+		return "x86-att";
+	} else if ( fn == opdis_x86_intel_decoder ) {
+		return "x86-intel";
+	} else if ( fn == opdis_default_decoder ) {
+		return "default";
+	}
+
+	return "native";
+}
+
+/* Return the cache key for a disassembly, or nil if its output cannot be
+ * cached. The key covers the contents of the target, the part of it being
+ * disassembled, and every setting which affects the output. */
+static VALUE cache_key( opdis_t opdis, struct STRATEGY_ARGS * strat ) {
+	struct OPDIS_TGT * tgt = strat->tgt;
+	const char * decoder = cache_decoder_name( opdis );
+	char buf[256];
+	uint64_t hash;
+	VALUE key;
+
+	/* address trackers are stateful, and Ruby resolvers unknown */
+	if (! decoder || opdis->handler == local_handler ||
+	     ( opdis->resolver == local_resolver &&
+	       ! Opdis_builtinResolver((VALUE) opdis->resolver_arg) ) ) {
+		return Qnil;
+	}
+
+	if ( tgt->abfd ) {
+		if (! Opdis_cacheHashFile( bfd_get_filename(tgt->abfd), 
+					   &hash ) ) {
+			return Qnil;
+		}
+	} else {
+		hash = Opdis_cacheHash( 0, tgt->buf->data, tgt->buf->len );
+	}
+
+	snprintf( buf, sizeof(buf), "opdis-%d|%016llx|%d|%lu|%s|%s|%d|"
+		  "%llx|%llx|%llx|", OPDIS_CACHE_VERSION, 
+		  (unsigned long long) hash, (int) opdis->config.arch, 
+		  (unsigned long) opdis->config.mach, 
+		  (opdis->disassembler == print_insn_i386_intel) ? 
+		  	DIS_SYNTAX_INTEL : DIS_SYNTAX_ATT, 
+		  decoder, (int) strat->strategy, 
+		  (unsigned long long) strat->vma, 
+		  (unsigned long long) strat->len, 
+		  (unsigned long long) (tgt->buf ? tgt->buf->vma : 0) );
+	key = rb_str_new_cstr( buf );
+
+	if ( opdis->config.disassembler_options ) {
+		rb_str_cat2( key, opdis->config.disassembler_options );
+	}
+
+	/* the part of a BFD being disassembled */
+	if ( tgt->sym ) {
+		snprintf( buf, sizeof(buf), "|symbol:%llx:", 
+			  (unsigned long long) tgt->sym->value );
+		rb_str_cat2( key, buf );
+		rb_str_cat2( key, tgt->sym->name ? tgt->sym->name : "" );
+		rb_str_cat2( key, ":" );
+		rb_str_cat2( key, tgt->sym->section->name );
+	} else if ( tgt->sec ) {
+		rb_str_cat2( key, "|section:" );
+		rb_str_cat2( key, tgt->sec->name );
+	}
+
+	/* function starts, which include any given as arguments */
+	if ( strat->num_seeds ) {
+		size_t i;
+		rb_str_cat2( key, "|functions:" );
+		for ( i = 0; i < strat->num_seeds; i++ ) {
+			snprintf( buf, sizeof(buf), "%llx,", 
+				  (unsigned long long) strat->seeds[i] );
+			rb_str_cat2( key, buf );
+		}
+	}
+
+	return key;
+}
+
+static void yield_cached( VALUE output, VALUE block ) {
+	size_t i;
+
+	if ( Qnil == block ) {
+		return;
+	}
+
+	for ( i = 0; i < Opdis_disassemblyCount(output); i++ ) {
+		rb_funcall( block, symCall, 1, 
+			    Opdis_disassemblyValueAt(output, i) );
+	}
+}
+
+/* Ruby resolver for graph construction, which runs with the GVL held */
+static opdis_vma_t cfg_rb_resolver( const opdis_insn_t * i, void * arg ) {
+	struct INSN_CALL c;
+
+	c.obj = (VALUE) arg;
+	c.insn = i;
+	c.rv = Qnil;
+	call_resolver( (VALUE) &c );
+
+	return (Qnil == c.rv) ? OPDIS_INVALID_ADDR : (opdis_vma_t) NUM2ULL(c.rv);
+}
+
+/* the resolver to use when analysing the output of 'opdis', so that
+ * branch targets are resolved as they were during disassembly */
+static OPDIS_RESOLVER analysis_resolver( opdis_t opdis, void ** arg ) {
+	OPDIS_RESOLVER fn = opdis->resolver;
+
+	*arg = opdis->resolver_arg;
+	if ( fn == local_resolver ) {
+		fn = Opdis_builtinResolver( (VALUE) *arg );
+		if ( fn ) {
+			*arg = NULL;
+		} else {
+			fn = cfg_rb_resolver;
+		}
+	}
+
+	return fn;
+}
+
+/* Attach the control flow graph of a control flow disassembly to 'output',
+ * with a block starting at 'entry' */
+static void attach_cfg( opdis_t opdis, enum disasm_strategy strategy,
+			opdis_vma_t entry, VALUE output ) {
+	OPDIS_RESOLVER fn;
+	void * arg;
+
+	if ( strategy != strat_cflow && strategy != strat_symbol &&
+	     strategy != strat_entry ) {
+		return;
+	}
+
+	fn = analysis_resolver( opdis, &arg );
+	Opdis_disassemblySetCfg( output, Opdis_cfgNew( output, entry, fn, 
+						       arg ) );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Function detection */
+
+static void add_seed( VALUE str, opdis_vma_t vma, 
+		      enum Opdis_func_source source ) {
+	Opdis_func_seed seed;
+
+	seed.vma = vma;
+	seed.source = source;
+	rb_str_cat( str, (const char *) &seed, sizeof(seed) );
+}
+
+/* add the addresses of the function symbols in 'abfd' (or in 'sec', if it
+ * is not NULL) to 'str' */
+static void add_symbol_seeds( VALUE str, bfd * abfd, asection * sec ) {
+	long i, num, bound = bfd_get_symtab_upper_bound( abfd );
+	asymbol ** syms;
+	VALUE buf;
+
+	if ( bound <= 0 ) {
+		return;
+	}
+
+	/* the symbol table is owned by a String, in case rb_str_cat raises */
+	buf = rb_str_new( NULL, bound );
+	syms = (asymbol **) RSTRING_PTR(buf);
+	num = bfd_canonicalize_symtab( abfd, syms );
+
+	for ( i = 0; i < num; i++ ) {
+		asymbol * sym = syms[i];
+
+		if (! (sym->flags & BSF_FUNCTION) || ! sym->section ||
+		     ! (sym->section->flags & SEC_CODE) ||
+		     (sec && sym->section != sec) ) {
+			continue;
+		}
+
+		add_seed( str, sym->section->vma + sym->value, 
+			  func_src_symbol );
+	}
+
+	RB_GC_GUARD(buf);
+}
+
+/* Collect the function starts for the functions strategy: the target's
+ * entry point (or symbol, or the start address for buffers), its function
+ * symbols, and the VMAs in the 'functions' argument. Returns a String of
+ * sorted Opdis_func_seed; 'vmas' is set to a String of their addresses, 
+ * which 'strat' refers to. */
+static VALUE function_seeds( VALUE hash, struct OPDIS_TGT * tgt, 
+			     struct STRATEGY_ARGS * strat, VALUE * vmas ) {
+	VALUE str = rb_str_new( NULL, 0 ), given;
+	Opdis_func_seed * seeds;
+	opdis_vma_t * addrs;
+	size_t i, num;
+
+	if ( tgt->sym ) {
+		add_seed( str, tgt->sym->section->vma + tgt->sym->value,
+			  func_src_symbol );
+	} else if ( tgt->abfd ) {
+		opdis_vma_t entry = bfd_get_start_address(tgt->abfd);
+		if (! tgt->sec || section_for_vma(tgt->abfd, entry) == tgt->sec ) {
+			add_seed( str, entry, func_src_entry );
+		}
+		add_symbol_seeds( str, tgt->abfd, tgt->sec );
+	} else {
+		add_seed( str, strat->vma, func_src_entry );
+	}
+
+	given = rb_hash_lookup2( hash, str_to_sym(DIS_ARG_FUNCTIONS), Qnil );
+	if ( Qnil != given ) {
+		given = rb_Array( given );
+		for ( i = 0; i < (size_t) RARRAY_LEN(given); i++ ) {
+			add_seed( str, NUM2ULL(rb_ary_entry(given, i)),
+				  func_src_given );
+		}
+	}
+
+	seeds = (Opdis_func_seed *) RSTRING_PTR(str);
+	num = Opdis_funcSeedsSort( seeds, 
+				   RSTRING_LEN(str) / sizeof(Opdis_func_seed) );
+	rb_str_set_len( str, num * sizeof(Opdis_func_seed) );
+
+	*vmas = rb_str_new( NULL, num * sizeof(opdis_vma_t) );
+	addrs = (opdis_vma_t *) RSTRING_PTR(*vmas);
+	for ( i = 0; i < num; i++ ) {
+		addrs[i] = seeds[i].vma;
+	}
+
+	strat->seeds = addrs;
+	strat->num_seeds = num;
+	return str;
+}
+
+/* Attach the function table of a functions disassembly to 'output' */
+static void attach_functions( opdis_t opdis, VALUE seeds, VALUE output ) {
+	void * arg;
+	OPDIS_RESOLVER fn = analysis_resolver( opdis, &arg );
+
+	Opdis_disassemblySetFunctions( output, Opdis_functionsNew( output,
+				(const Opdis_func_seed *) RSTRING_PTR(seeds),
+				RSTRING_LEN(seeds) / sizeof(Opdis_func_seed),
+				fn, arg ) );
+}
+
+/* Collect the function starts if 'strat' is the functions strategy.
+ * Returns nil for other strategies. See function_seeds. */
+static VALUE collect_seeds( VALUE hash, struct STRATEGY_ARGS * strat,
+			    VALUE * vmas ) {
+	*vmas = Qnil;
+	if ( strat->strategy != strat_functions ) {
+		return Qnil;
+	}
+
+	return function_seeds( hash, strat->tgt, strat, vmas );
+}
+
+/* Attach the analyses built by the strategy to 'output', if any */
+static void attach_analyses( opdis_t opdis, enum disasm_strategy strategy,
+			     opdis_vma_t entry, VALUE seeds, VALUE output ) {
+	if ( Qnil == output ) {
+		return;
+	}
+
+	attach_cfg( opdis, strategy, entry, output );
+	if ( Qnil != seeds ) {
+		attach_functions( opdis, seeds, output );
+	}
+}
+
+/* Run 'strat', whose function starts were collected by collect_seeds.
+ * If 'path' is not nil, the output is loaded from that cache file when it
+ * holds 'key', and stored there otherwise. Unless 'attach' is 0, the 
+ * analyses of the strategy are then attached to the output. */
+static VALUE execute_analyzed( opdis_t opdis, struct STRATEGY_ARGS * strat,
+			       VALUE seeds, VALUE output, VALUE block,
+			       VALUE path, VALUE key, int attach ) {
+	VALUE errors;
+	int cached = 0;
+
+	if ( Qnil != path && Opdis_cacheLoad( path, key, output ) ) {
+		cached = 1;
+		yield_cached( output, block );
+		errors = Opdis_disassemblyErrors( output );
+	} else {
+		errors = execute_strategy( opdis, strat, output, block );
+	}
+
+	if ( attach ) {
+		attach_analyses( opdis, strat->strategy, 
+				 strategy_start(strat), seeds, output );
+	}
+
+	if ( Qnil != path && ! cached ) {
+		Opdis_cacheStore( path, key, output );
+	}
+
+	return errors;
+}
+
+struct DISASM_ARGS {
+	VALUE instance;
+	opdis_t opdis;
+	VALUE hash;
+	VALUE output;
+	VALUE changes;			/* modified bytes, or Qnil */
+	VALUE block;
+	Opdis_insn_stats * stats;	/* statistics-only run, or NULL */
+	struct OPDIS_TGT * tgt;
+};
+
+static VALUE run_disassembly( VALUE arg ) {
+	struct DISASM_ARGS * args = (struct DISASM_ARGS *) arg;
+	struct STRATEGY_ARGS strat;
+	VALUE cache_dir, key = Qnil, path = Qnil, errors;
+	VALUE seeds, seed_vmas;
+
+	config_strategy_from_args( args->hash, args->tgt, &strat );
+	strat.stats = args->stats;
+
+	if ( strat.strategy == strat_functions && Qnil != args->changes ) {
+		rb_raise( rb_eArgError, "Strategy '%s' cannot be "
+			  "re-disassembled", DIS_STRAT_FUNCTIONS );
+	}
+	seeds = collect_seeds( args->hash, &strat, &seed_vmas );
+
+	if ( Qnil != args->changes ) {
+		return execute_incremental( args->opdis, &strat, args->output,
+					    args->changes, args->block );
+	}
+
+	/* serve the Disassembly from the cache, if possible */
+	cache_dir = rb_iv_get(args->instance, IVAR(DIS_ATTR_CACHE));
+	if ( Qnil != cache_dir && Qnil != args->output ) {
+		key = cache_key( args->opdis, &strat );
+	}
+
+	if ( Qnil != key ) {
+		path = Opdis_cachePath( cache_dir, key );
+	}
+
+	errors = execute_analyzed( args->opdis, &strat, seeds, args->output,
+				   args->block, path, key, 1 );
+
+	/* strat refers to the seed addresses while running */
+	RB_GC_GUARD(seed_vmas);
+	return errors;
+}
+
+/* Returns the list of errors encountered, or 'output' if 'changes' is not
+ * nil. If 'stats' is not NULL, instructions are counted in it instead of
+ * being output. */
+static VALUE perform_disassembly( VALUE instance, opdis_t opdis, VALUE target,
+				 VALUE hash, VALUE output, VALUE changes,
+				 VALUE block, Opdis_insn_stats * stats ) {
+	struct OPDIS_TGT tgt = {0};
+	struct DISASM_ARGS args;
+	VALUE errors;
+
+	/* load target based on its Ruby object type */
+	load_target( opdis, target, hash, &tgt );
+
+	args.instance = instance;
+	args.opdis = opdis;
+	args.hash = hash;
+	args.output = output;
+	args.changes = changes;
+	args.block = block;
+	args.stats = stats;
+	args.tgt = &tgt;
+
+	/* borrowed buffers must be released even if disassembly raises */
+	errors = rb_ensure( run_disassembly, (VALUE) &args, release_target, 
+			    (VALUE) &tgt );
+
+	RB_GC_GUARD(tgt.owner);
+	return errors;
+}
+
+
+/* Disassembler strategies produce blocks */
+static VALUE cls_disasm_disassemble(VALUE instance, VALUE tgt, VALUE hash ) {
+	opdis_t opdis, opdis_orig;
+	VALUE output, block = Qnil;
+
+	/* Create duplicate opdis_t in order to be threadsafe */
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated */
+	cls_disasm_handle_args(instance, hash);
+	opdis = opdis_dupe(opdis_orig);
+
+	/* yield to a block, if provided */
+	if ( rb_block_given_p() ) {
+		block = rb_block_proc();
+	}
+
+	output = Opdis_disassemblyNew();
+
+	perform_disassembly( instance, opdis, tgt, hash, output, Qnil, block,
+			     NULL );
+
+	opdis_term(opdis);
+
+	return output;
+}
+
+/* Re-disassemble the modified bytes of a target into an existing
+ * Disassembly */
+static VALUE cls_disasm_redisassemble( VALUE instance, VALUE tgt, 
+				       VALUE output, VALUE changes, 
+				       VALUE hash ) {
+	opdis_t opdis, opdis_orig;
+	VALUE block = Qnil;
+
+	Opdis_disassemblyCheck( output );
+
+	/* Create duplicate opdis_t in order to be threadsafe */
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated */
+	cls_disasm_handle_args(instance, hash);
+	opdis = opdis_dupe(opdis_orig);
+
+	/* yield replacement instructions to a block, if provided */
+	if ( rb_block_given_p() ) {
+		block = rb_block_proc();
+	}
+
+	perform_disassembly( instance, opdis, tgt, hash, output, changes, 
+			     block, NULL );
+
+	opdis_term(opdis);
+
+	return output;
+}
+
+/* Stream instructions to a block without storing them */
+static VALUE cls_disasm_each_insn(VALUE instance, VALUE tgt, VALUE hash ) {
+	opdis_t opdis, opdis_orig;
+	VALUE errors;
+
+	if (! rb_block_given_p() ) {
+		rb_raise( rb_eLocalJumpError, "no block given" );
+	}
+
+	/* Create duplicate opdis_t in order to be threadsafe */
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated */
+	cls_disasm_handle_args(instance, hash);
+	opdis = opdis_dupe(opdis_orig);
+
+	errors = perform_disassembly( instance, opdis, tgt, hash, Qnil, Qnil,
+				      rb_block_proc(), NULL );
+
+	opdis_term(opdis);
+
+	return errors;
+}
+
+struct STATS_ARGS {
+	VALUE instance;
+	opdis_t opdis;
+	VALUE tgt;
+	VALUE hash;
+	Opdis_insn_stats stats;
+};
+
+static VALUE run_statistics( VALUE arg ) {
+	struct STATS_ARGS * args = (struct STATS_ARGS *) arg;
+	VALUE errors;
+
+	errors = perform_disassembly( args->instance, args->opdis, args->tgt,
+				      args->hash, Qnil, Qnil, Qnil, 
+				      &args->stats );
+
+	return Opdis_statsToHash( &args->stats, errors );
+}
+
+static VALUE free_statistics( VALUE arg ) {
+	struct STATS_ARGS * args = (struct STATS_ARGS *) arg;
+
+	Opdis_statsFree( &args->stats );
+	opdis_term( args->opdis );
+	return Qnil;
+}
+
+/* Count the instructions in a target without creating Instruction objects */
+static VALUE cls_disasm_statistics( VALUE instance, VALUE tgt, VALUE hash ) {
+	struct STATS_ARGS args;
+	opdis_t opdis_orig;
+
+	/* Create duplicate opdis_t in order to be threadsafe */
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated */
+	cls_disasm_handle_args(instance, hash);
+
+	args.instance = instance;
+	args.tgt = tgt;
+	args.hash = hash;
+	Opdis_statsInit( &args.stats );
+	args.opdis = opdis_dupe(opdis_orig);
+
+	/* the mnemonic table is malloc'd, so it is released if this raises */
+	return rb_ensure( run_statistics, (VALUE) &args, free_statistics,
+			  (VALUE) &args );
+}
+
+struct GADGET_ARGS {
+	VALUE instance;
+	opdis_t opdis;
+	VALUE tgt;
+	VALUE hash;
+	struct OPDIS_TGT target;
+	Opdis_gadget_search search;
+};
+
+/* fill 'search' from the gadget arguments in 'hash' */
+static void config_gadgets_from_args( VALUE hash, 
+				      Opdis_gadget_search * search ) {
+	VALUE var;
+	long i;
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_DEPTH), Qnil);
+	if ( Qnil != var ) search->depth = NUM2UINT(var);
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_MAX_INSNS), Qnil);
+	if ( Qnil != var ) search->max_insns = NUM2UINT(var);
+
+	if (! search->depth || ! search->max_insns ) {
+		rb_raise( rb_eArgError, "Gadget depth and max_insns must be "
+			  "positive" );
+	}
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_TYPES), Qnil);
+	if ( Qnil != var ) {
+		var = rb_Array(var);
+		search->types = 0;
+		for ( i = 0; i < RARRAY_LEN(var); i++ ) {
+			search->types |= Opdis_gadgetType(rb_ary_entry(var, i));
+		}
+	}
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_THREADS), Qfalse);
+	search->threads = threads_from_arg( var );
+}
+
+static void gadget_section( Opdis_gadget_search * search, asection * sec ) {
+	opdis_buffer_t buf;
+
+	if ( section_buffer( sec, &buf ) ) {
+		Opdis_gadgetAddRegion( search, &buf, 1 );
+	}
+}
+
+/* add the code of a target to the regions searched for gadgets. For BFD 
+ * targets, this is every code section; for buffers, the bytes from the 
+ * vma argument to the end, or for length bytes. */
+static void gadget_regions( VALUE hash, struct OPDIS_TGT * tgt,
+			    Opdis_gadget_search * search ) {
+	opdis_buffer_t buf;
+	opdis_vma_t vma;
+	opdis_off_t len;
+	asection * sec;
+
+	if ( tgt->sym ) {
+		gadget_section( search, tgt->sym->section );
+		return;
+	}
+
+	if ( tgt->sec ) {
+		gadget_section( search, tgt->sec );
+		return;
+	}
+
+	if ( tgt->abfd ) {
+		for ( sec = tgt->abfd->sections; sec; sec = sec->next ) {
+			if ( sec->flags & SEC_CODE ) {
+				gadget_section( search, sec );
+			}
+		}
+		return;
+	}
+
+	buf = *tgt->buf;
+	vma = NUM2ULL(rb_hash_lookup2(hash, str_to_sym(DIS_ARG_VMA), 
+				      ULL2NUM(buf.vma)));
+	len = NUM2UINT(rb_hash_lookup2(hash, str_to_sym(DIS_ARG_LEN), 
+				       INT2NUM(0)));
+	if ( vma < buf.vma || vma >= buf.vma + buf.len ) {
+		rb_raise( rb_eArgError, "VMA is not in buffer" );
+	}
+
+	buf.data += vma - buf.vma;
+	buf.len -= (opdis_off_t) (vma - buf.vma);
+	buf.vma = vma;
+	if ( len && len < buf.len ) {
+		buf.len = len;
+	}
+
+	Opdis_gadgetAddRegion( search, &buf, 0 );
+}
+
+static VALUE search_gadgets( VALUE arg ) {
+	struct GADGET_ARGS * args = (struct GADGET_ARGS *) arg;
+	struct RB_CALLBACKS cbs = {{Qnil}, {Qnil}, {Qnil}};
+	Opdis_runner runner;
+
+	config_gadgets_from_args( args->hash, &args->search );
+	gadget_regions( args->hash, &args->target, &args->search );
+
+	bind_rb_callbacks( args->opdis, &runner, &cbs );
+
+	/* a Ruby decoder can only be called from the Ruby thread */
+	if ( args->opdis->decoder == local_decoder ) {
+		args->search.threads = 1;
+	}
+
+	Opdis_runnerInit( &runner, args->opdis, Qnil, Qnil );
+	Opdis_gadgetSearch( &args->search, &runner );
+
+	RB_GC_GUARD(cbs.decoder.obj);
+
+	/* re-raises exceptions from the Ruby decoder and interrupts */
+	Opdis_runnerFinish( &runner );
+
+	return Opdis_gadgetResults( &args->search );
+}
+
+static VALUE run_gadgets( VALUE arg ) {
+	struct GADGET_ARGS * args = (struct GADGET_ARGS *) arg;
+
+	/* load target based on its Ruby object type */
+	load_target( args->opdis, args->tgt, args->hash, &args->target );
+
+	/* borrowed buffers must be released even if the search raises */
+	return rb_ensure( search_gadgets, arg, release_target, 
+			  (VALUE) &args->target );
+}
+
+static VALUE free_gadgets( VALUE arg ) {
+	struct GADGET_ARGS * args = (struct GADGET_ARGS *) arg;
+
+	Opdis_gadgetFree( &args->search );
+	opdis_term( args->opdis );
+	return Qnil;
+}
+
+/* Find the ROP/JOP gadgets in a target */
+static VALUE cls_disasm_gadgets( VALUE instance, VALUE tgt, VALUE hash ) {
+	struct GADGET_ARGS args;
+	opdis_t opdis_orig;
+
+	/* Create duplicate opdis_t in order to be threadsafe */
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated */
+	cls_disasm_handle_args(instance, hash);
+
+	memset( &args.target, 0, sizeof(args.target) );
+	args.instance = instance;
+	args.tgt = tgt;
+	args.hash = hash;
+	Opdis_gadgetInit( &args.search );
+	args.opdis = opdis_dupe(opdis_orig);
+
+	/* section contents and results are malloc'd, so they are released if
+	 * this raises */
+	return rb_ensure( run_gadgets, (VALUE) &args, free_gadgets,
+			  (VALUE) &args );
+}
+
+/* Ruby callback objects are stored as the callback args of the opdis_t.
+ * Marking them (rather than relying on the instance variables set by the
+ * accessors) also pins them, so compaction cannot move them. */
+static void disasm_mark( void * data ) {
+	opdis_t opdis = (opdis_t) data;
+
+	if ( opdis->decoder == local_decoder ) {
+		rb_gc_mark( (VALUE) opdis->decoder_arg );
+	}
+
+	if ( opdis->handler == local_handler ) {
+		rb_gc_mark( (VALUE) opdis->handler_arg );
+	}
+
+	if ( opdis->resolver == local_resolver ) {
+		rb_gc_mark( (VALUE) opdis->resolver_arg );
+	}
+}
+
+/* new: takes hash of arguments */
+static VALUE cls_disasm_new(VALUE class, VALUE hash) {
+	VALUE instance;
+	VALUE argv[1] = { Qnil };
+	opdis_t opdis = opdis_init();
+
+	instance = Data_Wrap_Struct(class, disasm_mark, opdis_term, opdis);
+	rb_obj_call_init(instance, 0, argv);
+
+	cls_disasm_handle_args(instance, hash);
+
+	return instance;
+}
+
+/* usage: writes a list of disassembler options to IO object */
+static VALUE cls_disasm_usage(VALUE class, VALUE io) {
+	const char * filename;
+	VALUE path;
+	FILE * f;
+
+	if (! rb_respond_to(io, symPath) ) {
+		rb_raise( rb_eArgError, "Argument must respond to :path" );
+	}
+
+	/* get path from ruby File object */
+	path = rb_funcall(io, symPath, 0);
+	if ( Qnil == path ) {
+		rb_raise( rb_eArgError, "Object#path returned nil" );
+	}
+
+	filename = StringValueCStr(path);
+	f = fopen( filename, "w");
 	if (! f ) {
 		rb_raise( rb_eRuntimeError, 
 			  "Could not open %s object for write: %s", 
@@ -749,6 +2198,462 @@ static VALUE cls_disasm_usage(VALUE class, VALUE io) {
 	return Qtrue;
 }
 
+/* ---------------------------------------------------------------------- */
+/* Session Class */
+
+/* A Session is a target and disassembly configuration prepared by
+ * Disassembler#prepare. The argument Hash is parsed, the opdis_t is 
+ * duplicated and configured, and the target is loaded once; each run only
+ * supplies a new vma and length. */
+typedef struct {
+	opdis_t opdis;
+	struct OPDIS_TGT tgt;
+	struct STRATEGY_ARGS strat;
+	VALUE target;
+	VALUE hash;			/* arguments, for the function starts */
+	VALUE callbacks[3];		/* decoder, handler, resolver */
+	int loaded;			/* target has not been released */
+	int busy;			/* a run is in progress */
+} Opdis_session;
+
+static VALUE clsSession;
+
+static void session_mark( void * ptr ) {
+	int i;
+	Opdis_session * sess = (Opdis_session *) ptr;
+
+	rb_gc_mark(sess->target);
+	rb_gc_mark(sess->hash);
+	rb_gc_mark(sess->tgt.owner);
+	rb_gc_mark(sess->tgt.locked_iobuf);
+	for ( i = 0; i < 3; i++ ) {
+		rb_gc_mark(sess->callbacks[i]);
+	}
+}
+
+/* An IO::Buffer target is only locked during a run, so nothing is left
+ * locked when an unclosed Session is collected */
+static void session_free( void * ptr ) {
+	Opdis_session * sess = (Opdis_session *) ptr;
+
+#ifdef OPDIS_USE_MMAP
+	if ( sess->tgt.map_base ) {
+		munmap( sess->tgt.map_base, sess->tgt.map_len );
+	}
+#endif
+	if ( sess->opdis ) {
+		opdis_term( sess->opdis );
+	}
+	xfree( sess );
+}
+
+static size_t session_memsize( const void * ptr ) {
+	return sizeof(Opdis_session);
+}
+
+static const rb_data_type_t session_data_type = {
+	"Opdis::Session",
+	{ session_mark, session_free, session_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+static Opdis_session * session_data( VALUE instance ) {
+	Opdis_session * sess;
+	TypedData_Get_Struct(instance, Opdis_session, &session_data_type, 
+			     sess);
+	if (! sess->loaded ) {
+		rb_raise( rb_eRuntimeError, "Session is closed" );
+	}
+	return sess;
+}
+
+struct SESSION_LOAD {
+	Opdis_session * sess;
+	VALUE hash;
+};
+
+static VALUE session_load( VALUE arg ) {
+	struct SESSION_LOAD * load = (struct SESSION_LOAD *) arg;
+	Opdis_session * sess = load->sess;
+
+	load_target( sess->opdis, sess->target, load->hash, &sess->tgt );
+	config_strategy_from_args( load->hash, &sess->tgt, &sess->strat );
+	return Qnil;
+}
+
+/* Disassembler#ext_prepare: parse args and load target once */
+static VALUE cls_disasm_prepare( VALUE instance, VALUE tgt, VALUE hash ) {
+	struct SESSION_LOAD load;
+	Opdis_session * sess;
+	opdis_t opdis_orig;
+	VALUE session;
+	int state = 0;
+
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) before the opdis_t is 
+	 * duplicated, so that they apply to every run */
+	cls_disasm_handle_args(instance, hash);
+
+	session = TypedData_Make_Struct(clsSession, Opdis_session, 
+					&session_data_type, sess);
+	sess->target = tgt;
+	sess->hash = hash;
+	sess->tgt.owner = Qnil;
+	sess->tgt.locked_iobuf = Qnil;
+	sess->callbacks[0] = sess->callbacks[1] = sess->callbacks[2] = Qnil;
+	sess->opdis = opdis_dupe(opdis_orig);
+
+	load.sess = sess;
+	load.hash = hash;
+	rb_protect( session_load, (VALUE) &load, &state );
+	if ( state ) {
+		release_target( (VALUE) &sess->tgt );
+		rb_jump_tag( state );
+	}
+	sess->loaded = 1;
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+	/* each run locks the IO::Buffer again */
+	tgt_unlock_iobuf( &sess->tgt );
+#endif
+
+	/* the duplicated opdis_t refers to the Ruby callback objects */
+	if ( sess->opdis->decoder == local_decoder ) {
+		sess->callbacks[0] = (VALUE) sess->opdis->decoder_arg;
+	}
+	if ( sess->opdis->handler == local_handler ) {
+		sess->callbacks[1] = (VALUE) sess->opdis->handler_arg;
+	}
+	if ( sess->opdis->resolver == local_resolver ) {
+		sess->callbacks[2] = (VALUE) sess->opdis->resolver_arg;
+	}
+
+	return session;
+}
+
+struct SESSION_RUN {
+	Opdis_session * sess;
+	struct STRATEGY_ARGS strat;
+	VALUE output;
+	VALUE block;
+};
+
+static VALUE session_run( VALUE arg ) {
+	struct SESSION_RUN * run = (struct SESSION_RUN *) arg;
+	opdis_t opdis = run->sess->opdis;
+	VALUE seeds, seed_vmas, errors;
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+	tgt_relock_iobuf( &run->sess->tgt );
+#endif
+
+	reset_visited_addr( opdis );
+	seeds = collect_seeds( run->sess->hash, &run->strat, &seed_vmas );
+	errors = execute_analyzed( opdis, &run->strat, seeds, run->output, 
+				   run->block, Qnil, Qnil, 1 );
+
+	/* strat refers to the seed addresses while running */
+	RB_GC_GUARD(seed_vmas);
+	return errors;
+}
+
+static VALUE session_run_done( VALUE arg ) {
+	struct SESSION_RUN * run = (struct SESSION_RUN *) arg;
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+	tgt_unlock_iobuf( &run->sess->tgt );
+#endif
+	run->sess->busy = 0;
+	return Qnil;
+}
+
+/* run the session for 'vma' and 'len' (nil for the prepared values) */
+static VALUE session_perform( VALUE instance, VALUE vma, VALUE len, 
+			      VALUE output, VALUE block ) {
+	struct SESSION_RUN run;
+	Opdis_session * sess = session_data(instance);
+
+	/* the opdis_t is modified while running */
+	if ( sess->busy ) {
+		rb_raise( rb_eRuntimeError, "Session is already running" );
+	}
+
+	run.sess = sess;
+	run.strat = sess->strat;
+	run.output = output;
+	run.block = block;
+	if ( Qnil != vma ) run.strat.vma = NUM2ULL(vma);
+	if ( Qnil != len ) run.strat.len = NUM2UINT(len);
+
+	sess->busy = 1;
+	return rb_ensure( session_run, (VALUE) &run, session_run_done, 
+			  (VALUE) &run );
+}
+
+static VALUE cls_session_disassemble( VALUE instance, VALUE vma, VALUE len ) {
+	VALUE output = Opdis_disassemblyNew();
+	VALUE block = rb_block_given_p() ? rb_block_proc() : Qnil;
+
+	session_perform( instance, vma, len, output, block );
+	return output;
+}
+
+static VALUE cls_session_each_insn( VALUE instance, VALUE vma, VALUE len ) {
+	if (! rb_block_given_p() ) {
+		rb_raise( rb_eLocalJumpError, "no block given" );
+	}
+
+	return session_perform( instance, vma, len, Qnil, rb_block_proc() );
+}
+
+/* release the target. This is also done when the Session is collected. */
+static VALUE cls_session_close( VALUE instance ) {
+	Opdis_session * sess;
+	TypedData_Get_Struct(instance, Opdis_session, &session_data_type, 
+			     sess);
+
+	if ( sess->busy ) {
+		rb_raise( rb_eRuntimeError, "Session is running" );
+	}
+
+	if ( sess->loaded ) {
+		release_target( (VALUE) &sess->tgt );
+		sess->loaded = 0;
+		sess->target = Qnil;
+		sess->hash = Qnil;
+	}
+
+	return Qnil;
+}
+
+static VALUE cls_session_closed( VALUE instance ) {
+	Opdis_session * sess;
+	TypedData_Get_Struct(instance, Opdis_session, &session_data_type, 
+			     sess);
+	return sess->loaded ? Qfalse : Qtrue;
+}
+
+static VALUE cls_session_target( VALUE instance ) {
+	Opdis_session * sess;
+	TypedData_Get_Struct(instance, Opdis_session, &session_data_type, 
+			     sess);
+	return sess->target;
+}
+
+static void init_session_class( VALUE modOpdis ) {
+	clsSession = rb_define_class_under(modOpdis, OPDIS_SESSION_CLASS_NAME, 
+					   rb_cObject);
+	rb_undef_alloc_func(clsSession);
+
+	rb_define_method(clsSession, SESS_METHOD_DISASM, 
+			 cls_session_disassemble, 2);
+	rb_define_method(clsSession, SESS_METHOD_EACH_INSN, 
+			 cls_session_each_insn, 2);
+	rb_define_method(clsSession, SESS_METHOD_CLOSE, cls_session_close, 0);
+	rb_define_method(clsSession, SESS_METHOD_CLOSED, cls_session_closed, 0);
+	rb_define_method(clsSession, SESS_ATTR_TARGET, cls_session_target, 0);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Batch disassembly */
+
+struct BATCH_ARGS {
+	opdis_t opdis;
+	VALUE items;
+	VALUE hash;
+	VALUE block;
+	VALUE results;			/* Array, or Disassembly if combined */
+	int combined;
+	struct OPDIS_TGT tgt;
+	VALUE target;			/* loaded target, or Qundef */
+	bfd * abfd;			/* BFD the opdis_t is configured for */
+};
+
+static VALUE batch_release( VALUE arg ) {
+	struct BATCH_ARGS * b = (struct BATCH_ARGS *) arg;
+
+	if ( Qundef != b->target ) {
+		release_target( (VALUE) &b->tgt );
+		b->target = Qundef;
+	}
+
+	return Qnil;
+}
+
+/* load 'target' unless it is the target of the previous item. The opdis_t
+ * is only reconfigured when the BFD changes. */
+static void batch_load( struct BATCH_ARGS * b, VALUE target ) {
+	if ( target == b->target ) {
+		return;
+	}
+
+	batch_release( (VALUE) b );
+	memset( &b->tgt, 0, sizeof(b->tgt) );
+	b->tgt.owner = Qnil;
+	b->tgt.locked_iobuf = Qnil;
+
+	b->target = target;
+	load_target_object( target, b->hash, &b->tgt );
+
+	if ( b->tgt.abfd && b->tgt.abfd != b->abfd ) {
+		config_from_bfd( b->opdis, b->tgt.abfd, b->hash );
+		b->abfd = b->tgt.abfd;
+	}
+}
+
+static VALUE run_batch( VALUE arg ) {
+	struct BATCH_ARGS * b = (struct BATCH_ARGS *) arg;
+	struct STRATEGY_ARGS base, strat;
+	const char * strategy = DIS_STRAT_LINEAR;
+	VALUE var, dflt_target, seeds, seed_vmas, all_seeds = Qnil;
+	enum disasm_strategy cfg_strategy = strat_linear;
+	opdis_vma_t cfg_entry = 0;
+	long i;
+
+	base.vma = NUM2ULL(rb_hash_lookup2(b->hash, str_to_sym(DIS_ARG_VMA), 
+					   INT2NUM(0)));
+	base.len = NUM2UINT(rb_hash_lookup2(b->hash, str_to_sym(DIS_ARG_LEN), 
+					    INT2NUM(0)));
+
+	var = rb_hash_lookup2(b->hash, str_to_sym(DIS_ARG_STRATEGY), Qfalse);
+	if ( Qfalse != var ) strategy = StringValueCStr(var);
+
+	var = rb_hash_lookup2(b->hash, str_to_sym(DIS_ARG_THREADS), Qfalse);
+	base.threads = threads_from_arg( var );
+	base.seeds = NULL;
+	base.num_seeds = 0;
+	base.stats = NULL;
+
+	dflt_target = rb_hash_lookup2(b->hash, str_to_sym(DIS_ARG_TARGET), 
+				      Qnil);
+
+	for ( i = 0; i < RARRAY_LEN(b->items); i++ ) {
+		VALUE item = rb_ary_entry(b->items, i);
+		VALUE target = dflt_target, vma = Qnil, len = Qnil;
+		VALUE beg, end, output;
+		int excl;
+
+		/* a range of addresses in the default target */
+		if ( rb_obj_is_kind_of(item, rb_cRange) && 
+		     rb_range_values(item, &beg, &end, &excl) ) {
+			opdis_vma_t first = NUM2ULL(beg), last = NUM2ULL(end);
+			if ( last < first || (excl && last == first) ) {
+				rb_raise(rb_eArgError, "Empty range in batch");
+			}
+			vma = beg;
+			len = ULL2NUM( last - first + (excl ? 0 : 1) );
+
+		/* [target, vma, length]. Arrays of bytes are targets. */
+		} else if ( TYPE(item) == T_ARRAY && RARRAY_LEN(item) > 0 &&
+			    ! rb_obj_is_kind_of(rb_ary_entry(item, 0), 
+					       rb_cInteger) ) {
+			target = rb_ary_entry(item, 0);
+			vma = rb_ary_entry(item, 1);
+			len = rb_ary_entry(item, 2);
+
+		} else {
+			target = item;
+		}
+
+		if ( Qnil == target ) {
+			rb_raise(rb_eArgError, "No target for batch item %ld", 
+				 i);
+		}
+
+		batch_load( b, target );
+
+		strat = base;
+		strat.tgt = &b->tgt;
+		strat.strategy = strategy_for_name( strategy, &b->tgt );
+		if ( Qnil != vma ) strat.vma = NUM2ULL(vma);
+		if ( Qnil != len ) strat.len = NUM2UINT(len);
+
+		reset_visited_addr( b->opdis );
+
+		output = b->combined ? b->results : Opdis_disassemblyNew();
+		seeds = collect_seeds( b->hash, &strat, &seed_vmas );
+		execute_analyzed( b->opdis, &strat, seeds, output, b->block,
+				  Qnil, Qnil, ! b->combined );
+		RB_GC_GUARD(seed_vmas);
+
+		if (! b->combined ) {
+			rb_ary_push( b->results, output );
+		} else {
+			/* the combined graph starts at the first item */
+			if (! i ) {
+				cfg_strategy = strat.strategy;
+				cfg_entry = strategy_start(&strat);
+			}
+			if ( Qnil != seeds ) {
+				if ( Qnil == all_seeds ) {
+					all_seeds = rb_str_new(NULL, 0);
+				}
+				rb_str_append( all_seeds, seeds );
+			}
+		}
+
+		RB_GC_GUARD(b->tgt.owner);
+	}
+
+	/* one function table for the starts of every item */
+	if ( Qnil != all_seeds ) {
+		size_t num = RSTRING_LEN(all_seeds) / sizeof(Opdis_func_seed);
+		num = Opdis_funcSeedsSort( 
+			(Opdis_func_seed *) RSTRING_PTR(all_seeds), num );
+		rb_str_set_len( all_seeds, num * sizeof(Opdis_func_seed) );
+	}
+
+	if ( b->combined && RARRAY_LEN(b->items) ) {
+		attach_analyses( b->opdis, cfg_strategy, cfg_entry, all_seeds,
+				 b->results );
+	}
+
+	return b->results;
+}
+
+static VALUE batch_done( VALUE arg ) {
+	struct BATCH_ARGS * b = (struct BATCH_ARGS *) arg;
+
+	batch_release( arg );
+	opdis_term( b->opdis );
+	return Qnil;
+}
+
+/* Disassemble every item in an Array with one opdis_t */
+static VALUE cls_disasm_batch( VALUE instance, VALUE items, VALUE hash ) {
+	struct BATCH_ARGS b;
+	opdis_t opdis_orig;
+	VALUE var;
+
+	Check_Type(items, T_ARRAY);
+
+	Data_Get_Struct(instance, opdis_info_t, opdis_orig);
+	if (! opdis_orig ) {
+		rb_raise( rb_eRuntimeError, "Invalid opdis_t" );
+	}
+
+	/* apply general args (syntax, arch, etc) once for all items */
+	cls_disasm_handle_args(instance, hash);
+
+	var = rb_hash_lookup2(hash, str_to_sym(DIS_ARG_COMBINED), Qfalse);
+	b.combined = RTEST(var);
+	b.results = b.combined ? Opdis_disassemblyNew() : 
+				 rb_ary_new2(RARRAY_LEN(items));
+	b.items = items;
+	b.hash = hash;
+	b.block = rb_block_given_p() ? rb_block_proc() : Qnil;
+	b.target = Qundef;
+	b.abfd = NULL;
+	b.opdis = opdis_dupe(opdis_orig);
+
+	return rb_ensure( run_batch, (VALUE) &b, batch_done, (VALUE) &b );
+}
+
 static void define_disasm_constants() {
 	/* Error types */
 	rb_define_const(clsDisasm, DIS_ERR_BOUNDS_NAME,
@@ -775,6 +2680,8 @@ static void define_disasm_constants() {
 			rb_str_new_cstr(DIS_STRAT_SECTION));
 	rb_define_const(clsDisasm, DIS_STRAT_ENTRY_NAME,
 			rb_str_new_cstr(DIS_STRAT_ENTRY));
+	rb_define_const(clsDisasm, DIS_STRAT_FUNCTIONS_NAME,
+			rb_str_new_cstr(DIS_STRAT_FUNCTIONS));
 
 	/* Lists of symbolic constants */
 	rb_define_singleton_method(clsDisasm, DIS_CONST_STRATEGIES, 
@@ -796,6 +2703,9 @@ static void init_disasm_class( VALUE modOpdis ) {
 	rb_define_attr(clsDisasm, DIS_ATTR_HANDLER, 1, 0);
 	rb_define_attr(clsDisasm, DIS_ATTR_RESOLVER, 1, 0);
 
+	/* read-write attributes */
+	rb_define_attr(clsDisasm, DIS_ATTR_CACHE, 1, 1);
+
 	/* setters */
 	rb_define_method(clsDisasm, SETTER(DIS_ATTR_DECODER), 
 			 cls_disasm_set_decoder, 1);
@@ -821,6 +2731,15 @@ static void init_disasm_class( VALUE modOpdis ) {
 	/* methods */
 	rb_define_method(clsDisasm, DIS_METHOD_DISASM, cls_disasm_disassemble, 
 			 2);
+	rb_define_method(clsDisasm, DIS_METHOD_EACH_INSN, cls_disasm_each_insn,
+			 2);
+	rb_define_method(clsDisasm, DIS_METHOD_PREPARE, cls_disasm_prepare, 2);
+	rb_define_method(clsDisasm, DIS_METHOD_BATCH, cls_disasm_batch, 2);
+	rb_define_method(clsDisasm, DIS_METHOD_REDISASM, 
+			 cls_disasm_redisassemble, 4);
+	rb_define_method(clsDisasm, DIS_METHOD_STATS, cls_disasm_statistics, 
+			 2);
+	rb_define_method(clsDisasm, DIS_METHOD_GADGETS, cls_disasm_gadgets, 2);
 
 	define_disasm_constants();
 }
@@ -834,6 +2753,9 @@ void Init_OpdisExt() {
 	symRead = rb_intern("read");
 	symSize = rb_intern("size");
 	symPath = rb_intern("path");
+	symFileno = rb_intern("fileno");
+	symPos = rb_intern("pos");
+	symSetPos = rb_intern("pos=");
 
 	symDecode = rb_intern(DECODER_METHOD);
 	symVisited = rb_intern(HANDLER_METHOD);
@@ -841,10 +2763,19 @@ void Init_OpdisExt() {
 
 	modOpdis = rb_define_module(OPDIS_MODULE_NAME);
 
+	Opdis_initIntern();
+
 	init_disasm_class(modOpdis);
-	init_output_class(modOpdis);
+	init_session_class(modOpdis);
+	Opdis_initDisassembly(modOpdis);
+	Opdis_initControlFlowGraph(modOpdis);
+	Opdis_initFunctions(modOpdis);
+	Opdis_initXrefs(modOpdis);
+	Opdis_initPattern(modOpdis);
+	Opdis_initGadgets(modOpdis);
 
 	Opdis_initCallbacks(modOpdis);
+	Opdis_initDecodeContext(modOpdis);
 
 	Opdis_initModel(modOpdis);
 }
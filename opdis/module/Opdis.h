@@ -10,8 +10,20 @@
 
 /* method names */
 #define DIS_METHOD_DISASM "ext_disassemble"
+#define DIS_METHOD_EACH_INSN "ext_each_instruction"
+#define DIS_METHOD_PREPARE "ext_prepare"
+#define DIS_METHOD_BATCH "ext_disassemble_batch"
+#define DIS_METHOD_REDISASM "ext_redisassemble"
+#define DIS_METHOD_STATS "ext_statistics"
+#define DIS_METHOD_GADGETS "ext_gadgets"
 #define DIS_METHOD_usage "ext_usage"
 
+#define SESS_METHOD_DISASM "ext_disassemble"
+#define SESS_METHOD_EACH_INSN "ext_each_instruction"
+#define SESS_METHOD_CLOSE "close"
+#define SESS_METHOD_CLOSED "closed?"
+#define SESS_ATTR_TARGET "target"
+
 /* attribute names */
 #define DIS_ATTR_DECODER "insn_decoder"
 #define DIS_ATTR_HANDLER "addr_tracker"
@@ -20,6 +32,7 @@
 #define DIS_ATTR_SYNTAX "syntax"
 #define DIS_ATTR_ARCH "arch"
 #define DIS_ATTR_OPTS "opcodes_options"
+#define DIS_ATTR_CACHE "cache_dir"
 
 /* argument (hash) names */
 #define DIS_ARG_DECODER DIS_ATTR_DECODER 
@@ -34,6 +47,14 @@
 #define DIS_ARG_OFFSET "offset"
 #define DIS_ARG_LEN "length"
 #define DIS_ARG_BUFVMA "buffer_vma"
+#define DIS_ARG_THREADS "threads"
+#define DIS_ARG_TARGET "target"
+#define DIS_ARG_COMBINED "combined"
+#define DIS_ARG_CACHE DIS_ATTR_CACHE
+#define DIS_ARG_FUNCTIONS "functions"
+#define DIS_ARG_DEPTH "depth"
+#define DIS_ARG_MAX_INSNS "max_insns"
+#define DIS_ARG_TYPES "types"
 
 /* constants */
 #define DIS_ERR_BOUNDS_NAME "ERROR_BOUNDS"
@@ -60,6 +81,8 @@
 #define DIS_STRAT_SECTION "bfd-section"
 #define DIS_STRAT_ENTRY_NAME "STRATEGY_ENTRY"
 #define DIS_STRAT_ENTRY "bfd-entry"
+#define DIS_STRAT_FUNCTIONS_NAME "STRATEGY_FUNCTIONS"
+#define DIS_STRAT_FUNCTIONS "functions"
 
 #define DIS_CONST_STRATEGIES "STRATEGIES"
 
@@ -70,11 +93,6 @@
 
 #define DIS_CONST_SYNTAXES "SYNTAXES"
 
-/* Output */
-
-#define OUT_ATTR_ERRORS "errors"
-#define OUT_METHOD_CONTAIN "containing"
-
 /* BFD */
 #define BFD_TGT_PATH "Bfd::Target"
 #define BFD_SEC_PATH "Bfd::Section"
@@ -82,7 +100,7 @@
 
 #define OPDIS_MODULE_NAME "Opdis"
 #define OPDIS_DISASM_CLASS_NAME "Disassembler"
-#define OPDIS_OUTPUT_CLASS_NAME "Disassembly"
+#define OPDIS_SESSION_CLASS_NAME "Session"
 
 void Init_OpdisExt();
 
@@ -0,0 +1,1050 @@
+/* Parallel.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <ruby.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <opdis/opdis.h>
+
+#include "Parallel.h"
+
+#define PAR_ERR_MSG_SZ 128
+/* how often a waiting Ruby thread checks for interrupts, in ms */
+#define PAR_WAIT_MS 50
+
+unsigned int Opdis_parallelCpuCount( void ) {
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( n > 0 ) {
+		return (n > OPDIS_PAR_MAX_THREADS) ? OPDIS_PAR_MAX_THREADS :
+						     (unsigned int) n;
+	}
+#endif
+	return 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/* ---------------------------------------------------------------------- */
+/* Result lists */
+
+/* An error reported by libopdis while producing instruction 'idx' */
+struct par_error {
+	size_t idx;
+	enum opdis_error_t type;
+	char msg[PAR_ERR_MSG_SZ];
+};
+
+/* Instructions (in VMA order) and errors produced by one sweep */
+struct par_list {
+	opdis_insn_t ** insns;
+	size_t count;
+	size_t alloc;
+	struct par_error * errors;
+	size_t num_errors;
+	size_t errors_alloc;
+	int failed;			/* out of memory */
+};
+
+static void list_add_insn( struct par_list * list, const opdis_insn_t * i ) {
+	opdis_insn_t * copy;
+
+	if ( list->failed ) {
+		return;
+	}
+
+	if ( list->count == list->alloc ) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 4096;
+		opdis_insn_t ** insns = realloc( list->insns,
+						 alloc * sizeof(opdis_insn_t *));
+		if (! insns ) {
+			list->failed = 1;
+			return;
+		}
+		list->insns = insns;
+		list->alloc = alloc;
+	}
+
+	copy = opdis_insn_dupe(i);
+	if (! copy ) {
+		list->failed = 1;
+		return;
+	}
+
+	list->insns[list->count++] = copy;
+}
+
+static void list_add_error( struct par_list * list, enum opdis_error_t type,
+			    const char * msg ) {
+	struct par_error * err;
+
+	if ( list->failed ) {
+		return;
+	}
+
+	if ( list->num_errors == list->errors_alloc ) {
+		size_t alloc = list->errors_alloc ? list->errors_alloc * 2 : 16;
+		struct par_error * errors = realloc( list->errors,
+					alloc * sizeof(struct par_error) );
+		if (! errors ) {
+			list->failed = 1;
+			return;
+		}
+		list->errors = errors;
+		list->errors_alloc = alloc;
+	}
+
+	err = &list->errors[list->num_errors++];
+	err->idx = list->count;
+	err->type = type;
+	strncpy( err->msg, msg ? msg : "", PAR_ERR_MSG_SZ - 1 );
+	err->msg[PAR_ERR_MSG_SZ - 1] = '\0';
+}
+
+/* index of the instruction at 'vma', or -1 */
+static long list_find( const struct par_list * list, opdis_vma_t vma ) {
+	size_t lo = 0, hi = list->count;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		opdis_vma_t mid_vma = list->insns[mid]->vma;
+
+		if ( mid_vma == vma ) {
+			return (long) mid;
+		} else if ( mid_vma < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return -1;
+}
+
+static void list_free( struct par_list * list ) {
+	size_t i;
+
+	for ( i = 0; i < list->count; i++ ) {
+		if ( list->insns[i] ) {
+			opdis_insn_free( list->insns[i] );
+		}
+	}
+
+	free( list->insns );
+	free( list->errors );
+	memset( list, 0, sizeof(struct par_list) );
+}
+
+/* Pass instructions [from, to) of 'list' and their errors to the runner.
+ * Errors reported after the last instruction are only passed on if
+ * 'trailing' is set. The runner takes ownership of the instructions.
+ * Returns the VMA following the last instruction, or 'next' if no
+ * instructions were passed on. */
+static opdis_vma_t list_emit( Opdis_runner * runner, struct par_list * list,
+			      size_t from, size_t to, int trailing,
+			      opdis_vma_t next ) {
+	opdis_t opdis = runner->opdis;
+	size_t i;
+
+	for ( i = 0; i < list->num_errors; i++ ) {
+		struct par_error * err = &list->errors[i];
+		if ( err->idx >= from &&
+		     (err->idx < to || (trailing && err->idx == to)) ) {
+			opdis->error_reporter( err->type, err->msg,
+					       opdis->error_reporter_arg );
+		}
+	}
+
+	for ( i = from; i < to; i++ ) {
+		opdis_insn_t * insn = list->insns[i];
+		list->insns[i] = NULL;
+		next = insn->vma + insn->size;
+		Opdis_runnerPush( runner, insn );
+	}
+
+	return next;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Workers */
+
+struct par_shared {
+	Opdis_runner * runner;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	unsigned int running;
+};
+
+/* A range of the buffer swept by one worker */
+struct par_chunk {
+	struct par_shared * shared;
+	opdis_t opdis;
+	opdis_buf_t buf;
+	opdis_vma_t start;
+	opdis_vma_t end;
+	struct par_list list;
+	int is_main;			/* swept by the Ruby thread */
+	int started;			/* has its own pthread */
+	pthread_t thread;
+};
+
+static void chunk_display( const opdis_insn_t * i, void * arg ) {
+	struct par_chunk * chunk = (struct par_chunk *) arg;
+	list_add_insn( &chunk->list, i );
+}
+
+static void chunk_error( enum opdis_error_t error, const char * msg,
+			 void * arg ) {
+	struct par_chunk * chunk = (struct par_chunk *) arg;
+	list_add_error( &chunk->list, error, msg );
+}
+
+static int chunk_handler( const opdis_insn_t * i, void * arg ) {
+	struct par_chunk * chunk = (struct par_chunk *) arg;
+
+	if ( chunk->list.failed ) {
+		return 0;
+	}
+
+	/* only the Ruby thread may service interrupts */
+	if ( chunk->is_main ) {
+		return Opdis_runnerCheckInts( chunk->shared->runner );
+	}
+
+	return ! chunk->shared->runner->abort;
+}
+
+static void chunk_sweep( struct par_chunk * chunk ) {
+	opdis_disasm_linear( chunk->opdis, chunk->buf, chunk->start,
+			     (opdis_off_t) (chunk->end - chunk->start) );
+}
+
+static void * chunk_thread( void * arg ) {
+	struct par_chunk * chunk = (struct par_chunk *) arg;
+	struct par_shared * shared = chunk->shared;
+
+	chunk_sweep( chunk );
+
+	pthread_mutex_lock( &shared->lock );
+	shared->running--;
+	pthread_cond_signal( &shared->done );
+	pthread_mutex_unlock( &shared->lock );
+
+	return NULL;
+}
+
+/* wait for all worker threads, servicing Ruby interrupts meanwhile */
+static void wait_for_workers( struct par_shared * shared ) {
+	pthread_mutex_lock( &shared->lock );
+
+	while ( shared->running ) {
+		struct timeval now;
+		struct timespec ts;
+
+		gettimeofday( &now, NULL );
+		ts.tv_sec = now.tv_sec;
+		ts.tv_nsec = (now.tv_usec * 1000) + (PAR_WAIT_MS * 1000000L);
+		if ( ts.tv_nsec >= 1000000000L ) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+
+		pthread_cond_timedwait( &shared->done, &shared->lock, &ts );
+
+		if ( shared->runner->interrupted ) {
+			pthread_mutex_unlock( &shared->lock );
+			Opdis_runnerCheckInts( shared->runner );
+			pthread_mutex_lock( &shared->lock );
+		}
+	}
+
+	pthread_mutex_unlock( &shared->lock );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Generic tasks */
+
+struct par_task {
+	struct par_shared * shared;
+	OPDIS_PAR_TASK fn;
+	void * item;
+	int started;
+	pthread_t thread;
+};
+
+static void * task_thread( void * arg ) {
+	struct par_task * task = (struct par_task *) arg;
+	struct par_shared * shared = task->shared;
+
+	task->fn( task->item, 0 );
+
+	pthread_mutex_lock( &shared->lock );
+	shared->running--;
+	pthread_cond_signal( &shared->done );
+	pthread_mutex_unlock( &shared->lock );
+
+	return NULL;
+}
+
+void Opdis_parallelEach( Opdis_runner * runner, OPDIS_PAR_TASK task,
+			 void * items, size_t item_sz, unsigned int num ) {
+	struct par_task tasks[OPDIS_PAR_MAX_THREADS];
+	struct par_shared shared;
+	unsigned int i;
+
+	if ( num > OPDIS_PAR_MAX_THREADS ) {
+		num = OPDIS_PAR_MAX_THREADS;
+	}
+
+	shared.runner = runner;
+	shared.running = 0;
+	pthread_mutex_init( &shared.lock, NULL );
+	pthread_cond_init( &shared.done, NULL );
+
+	memset( tasks, 0, sizeof(tasks) );
+	for ( i = 0; i < num; i++ ) {
+		tasks[i].shared = &shared;
+		tasks[i].fn = task;
+		tasks[i].item = (char *) items + (i * item_sz);
+	}
+
+	for ( i = 1; i < num; i++ ) {
+		pthread_mutex_lock( &shared.lock );
+		shared.running++;
+		pthread_mutex_unlock( &shared.lock );
+
+		if (! pthread_create( &tasks[i].thread, NULL, task_thread,
+				      &tasks[i] ) ) {
+			tasks[i].started = 1;
+		} else {
+			pthread_mutex_lock( &shared.lock );
+			shared.running--;
+			pthread_mutex_unlock( &shared.lock );
+		}
+	}
+
+	for ( i = 0; i < num; i++ ) {
+		if ( i == 0 || ! tasks[i].started ) {
+			task( tasks[i].item, 1 );
+		}
+	}
+
+	wait_for_workers( &shared );
+
+	for ( i = 1; i < num; i++ ) {
+		if ( tasks[i].started ) {
+			pthread_join( tasks[i].thread, NULL );
+		}
+	}
+
+	pthread_mutex_destroy( &shared.lock );
+	pthread_cond_destroy( &shared.done );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Resynchronization */
+
+/* A serial sweep from the end of one chunk's valid output until it reaches
+ * an instruction which a later chunk also decoded */
+struct par_resync {
+	Opdis_runner * runner;
+	struct par_chunk * chunks;
+	unsigned int num_chunks;
+	struct par_list list;
+	long sync_chunk;		/* -1 until synchronized */
+	long sync_idx;
+};
+
+static long chunk_for_vma( struct par_resync * r, opdis_vma_t vma ) {
+	unsigned int i;
+	for ( i = 0; i < r->num_chunks; i++ ) {
+		if ( vma >= r->chunks[i].start && vma < r->chunks[i].end ) {
+			return (long) i;
+		}
+	}
+	return -1;
+}
+
+static void resync_display( const opdis_insn_t * i, void * arg ) {
+	struct par_resync * r = (struct par_resync *) arg;
+	long chunk, idx;
+
+	if ( r->sync_chunk >= 0 ) {
+		return;
+	}
+
+	chunk = chunk_for_vma( r, i->vma );
+	if ( chunk >= 0 ) {
+		idx = list_find( &r->chunks[chunk].list, i->vma );
+		if ( idx >= 0 ) {
+			/* the chunk's output is correct from here on */
+			r->sync_chunk = chunk;
+			r->sync_idx = idx;
+			return;
+		}
+	}
+
+	list_add_insn( &r->list, i );
+}
+
+static void resync_error( enum opdis_error_t error, const char * msg,
+			  void * arg ) {
+	struct par_resync * r = (struct par_resync *) arg;
+	if ( r->sync_chunk < 0 ) {
+		list_add_error( &r->list, error, msg );
+	}
+}
+
+static int resync_handler( const opdis_insn_t * i, void * arg ) {
+	struct par_resync * r = (struct par_resync *) arg;
+
+	if ( r->sync_chunk >= 0 || r->list.failed ) {
+		return 0;
+	}
+
+	return Opdis_runnerCheckInts( r->runner );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Linear disassembly */
+
+static void merge_chunks( Opdis_runner * runner, struct par_chunk * chunks,
+			  unsigned int num_chunks, opdis_vma_t end ) {
+	unsigned int k = 0;
+	opdis_vma_t next = chunks[0].start;
+	long idx = 0;
+
+	while ( k < num_chunks && ! runner->abort ) {
+		struct par_chunk * chunk = &chunks[k];
+
+		if ( k > 0 ) {
+			if ( next >= chunk->end ) {
+				/* covered by an instruction in a prior chunk */
+				k++;
+				continue;
+			}
+
+			idx = list_find( &chunk->list, next );
+		}
+
+		if ( idx < 0 ) {
+			/* chunk began mid-instruction: sweep serially until
+			 * the output matches a chunk's */
+			struct par_resync r;
+			opdis_t opdis = chunks[0].opdis;
+
+			memset( &r, 0, sizeof(r) );
+			r.runner = runner;
+			r.chunks = chunks;
+			r.num_chunks = num_chunks;
+			r.sync_chunk = r.sync_idx = -1;
+
+			opdis_set_display( opdis, resync_display, &r );
+			opdis_set_handler( opdis, resync_handler, &r );
+			opdis_set_error_reporter( opdis, resync_error, &r );
+
+			opdis_disasm_linear( opdis, chunk->buf, next,
+					     (opdis_off_t) (end - next) );
+
+			next = list_emit( runner, &r.list, 0, r.list.count,
+					  (r.sync_chunk < 0), next );
+			list_free( &r.list );
+
+			if ( r.sync_chunk < 0 ) {
+				/* swept to the end without synchronizing */
+				break;
+			}
+
+			k = (unsigned int) r.sync_chunk;
+			idx = r.sync_idx;
+			chunk = &chunks[k];
+		}
+
+		next = list_emit( runner, &chunk->list, (size_t) idx,
+				  chunk->list.count, (k == num_chunks - 1),
+				  next );
+		k++;
+	}
+}
+
+int Opdis_parallelLinear( Opdis_runner * runner, opdis_buf_t buf,
+			  opdis_vma_t vma, opdis_off_t len,
+			  unsigned int threads ) {
+	struct par_chunk chunks[OPDIS_PAR_MAX_THREADS];
+	struct par_shared shared;
+	opdis_vma_t end, buf_end = buf->vma + buf->len;
+	opdis_off_t chunk_sz;
+	unsigned int i, num_chunks;
+	int failed = 0;
+
+	/* let the serial sweep report out-of-bounds requests */
+	if ( vma < buf->vma || vma >= buf_end ) {
+		return 0;
+	}
+
+	end = ( len && vma + len < buf_end ) ? vma + len : buf_end;
+
+	if ( threads > OPDIS_PAR_MAX_THREADS ) {
+		threads = OPDIS_PAR_MAX_THREADS;
+	}
+
+	chunk_sz = (opdis_off_t) ((end - vma + threads - 1) / threads);
+	if ( chunk_sz < OPDIS_PAR_MIN_CHUNK ) {
+		chunk_sz = OPDIS_PAR_MIN_CHUNK;
+	}
+
+	num_chunks = (unsigned int) ((end - vma + chunk_sz - 1) / chunk_sz);
+	if ( num_chunks < 2 ) {
+		return 0;
+	}
+
+	shared.runner = runner;
+	shared.running = 0;
+	pthread_mutex_init( &shared.lock, NULL );
+	pthread_cond_init( &shared.done, NULL );
+
+	memset( chunks, 0, sizeof(chunks) );
+	for ( i = 0; i < num_chunks; i++ ) {
+		struct par_chunk * chunk = &chunks[i];
+
+		chunk->shared = &shared;
+		chunk->buf = buf;
+		chunk->start = vma + (i * chunk_sz);
+		chunk->end = (i == num_chunks - 1) ? end :
+						     chunk->start + chunk_sz;
+		chunk->is_main = (i == 0);
+
+		chunk->opdis = opdis_dupe( runner->opdis );
+		if (! chunk->opdis ) {
+			failed = 1;
+			break;
+		}
+
+		opdis_set_display( chunk->opdis, chunk_display, chunk );
+		opdis_set_handler( chunk->opdis, chunk_handler, chunk );
+		opdis_set_error_reporter( chunk->opdis, chunk_error, chunk );
+	}
+
+	if (! failed ) {
+		/* the Ruby thread sweeps chunk 0, and any chunk whose thread
+		 * could not be created */
+		for ( i = 1; i < num_chunks; i++ ) {
+			pthread_mutex_lock( &shared.lock );
+			shared.running++;
+			pthread_mutex_unlock( &shared.lock );
+
+			if (! pthread_create( &chunks[i].thread, NULL,
+					      chunk_thread, &chunks[i] ) ) {
+				chunks[i].started = 1;
+			} else {
+				pthread_mutex_lock( &shared.lock );
+				shared.running--;
+				pthread_mutex_unlock( &shared.lock );
+			}
+		}
+
+		chunk_sweep( &chunks[0] );
+
+		for ( i = 1; i < num_chunks; i++ ) {
+			if (! chunks[i].started && ! runner->abort ) {
+				chunks[i].is_main = 1;
+				chunk_sweep( &chunks[i] );
+			}
+		}
+
+		wait_for_workers( &shared );
+
+		for ( i = 1; i < num_chunks; i++ ) {
+			if ( chunks[i].started ) {
+				pthread_join( chunks[i].thread, NULL );
+			}
+		}
+
+		for ( i = 0; i < num_chunks; i++ ) {
+			failed |= chunks[i].list.failed;
+		}
+
+		if (! failed ) {
+			merge_chunks( runner, chunks, num_chunks, end );
+		}
+	}
+
+	for ( i = 0; i < num_chunks; i++ ) {
+		list_free( &chunks[i].list );
+		if ( chunks[i].opdis ) {
+			opdis_term( chunks[i].opdis );
+		}
+	}
+
+	pthread_mutex_destroy( &shared.lock );
+	pthread_cond_destroy( &shared.done );
+
+	/* out of memory: fall back to a serial sweep unless aborted */
+	return ( failed && ! runner->abort ) ? 0 : 1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Control flow disassembly */
+
+#define CF_BITS (8 * sizeof(unsigned long))
+/* idle iterations spent yielding before a worker starts sleeping */
+#define CF_IDLE_SPIN 64
+#define CF_IDLE_USEC 100
+
+/* Branch targets waiting to be followed. The owning worker pushes and pops
+ * at the tail; idle workers steal from the head. */
+struct cf_deque {
+	pthread_mutex_t lock;
+	opdis_vma_t * items;
+	size_t head;
+	size_t tail;
+	size_t alloc;
+};
+
+struct cf_worker;
+
+struct cf_shared {
+	struct par_shared sync;
+	opdis_buf_t buf;
+	/* one bit per byte of 'buf': set once an instruction at that
+	 * address has been claimed for decoding */
+	volatile unsigned long * visited;
+	struct cf_worker * workers;
+	unsigned int num_workers;
+	volatile long pending;		/* queued or in-progress flows */
+	volatile int failed;		/* out of memory */
+};
+
+struct cf_worker {
+	struct cf_shared * shared;
+	unsigned int id;
+	opdis_t opdis;
+	opdis_insn_t * insn;
+	struct cf_deque deque;
+	struct par_list list;
+	int is_main;
+	int started;
+	pthread_t thread;
+};
+
+static int cf_in_buf( opdis_buf_t buf, opdis_vma_t vma ) {
+	return vma >= buf->vma && vma - buf->vma < buf->len;
+}
+
+static int cf_is_visited( struct cf_shared * shared, opdis_vma_t vma ) {
+	opdis_off_t off = vma - shared->buf->vma;
+	unsigned long bits = __atomic_load_n( &shared->visited[off / CF_BITS],
+					      __ATOMIC_RELAXED );
+	return (bits & (1UL << (off % CF_BITS))) != 0;
+}
+
+/* Mark 'vma' as visited. Returns 1 if this caller was the first to do so */
+static int cf_claim( struct cf_shared * shared, opdis_vma_t vma ) {
+	opdis_off_t off = vma - shared->buf->vma;
+	unsigned long mask = 1UL << (off % CF_BITS);
+	return ! (__sync_fetch_and_or( &shared->visited[off / CF_BITS], 
+				       mask ) & mask);
+}
+
+static int cf_push( struct cf_worker * w, opdis_vma_t vma ) {
+	struct cf_deque * dq = &w->deque;
+	int ok = 1;
+
+	pthread_mutex_lock( &dq->lock );
+
+	if ( dq->tail == dq->alloc ) {
+		if ( dq->head ) {
+			/* reuse the space freed by thieves */
+			memmove( dq->items, &dq->items[dq->head],
+				 (dq->tail - dq->head) * sizeof(opdis_vma_t) );
+			dq->tail -= dq->head;
+			dq->head = 0;
+		} else {
+			size_t alloc = dq->alloc ? dq->alloc * 2 : 256;
+			opdis_vma_t * items = realloc( dq->items, 
+						alloc * sizeof(opdis_vma_t) );
+			if ( items ) {
+				dq->items = items;
+				dq->alloc = alloc;
+			} else {
+				ok = 0;
+			}
+		}
+	}
+
+	if ( ok ) {
+		__sync_add_and_fetch( &w->shared->pending, 1 );
+		dq->items[dq->tail++] = vma;
+	}
+
+	pthread_mutex_unlock( &dq->lock );
+	return ok;
+}
+
+static int cf_pop( struct cf_deque * dq, opdis_vma_t * vma ) {
+	int ok = 0;
+
+	pthread_mutex_lock( &dq->lock );
+	if ( dq->tail > dq->head ) {
+		*vma = dq->items[--dq->tail];
+		ok = 1;
+	}
+	pthread_mutex_unlock( &dq->lock );
+
+	return ok;
+}
+
+static int cf_steal( struct cf_deque * dq, opdis_vma_t * vma ) {
+	int ok = 0;
+
+	pthread_mutex_lock( &dq->lock );
+	if ( dq->tail > dq->head ) {
+		*vma = dq->items[dq->head++];
+		ok = 1;
+	}
+	pthread_mutex_unlock( &dq->lock );
+
+	return ok;
+}
+
+static int cf_next( struct cf_worker * w, opdis_vma_t * vma ) {
+	struct cf_shared * shared = w->shared;
+	unsigned int i;
+
+	if ( cf_pop( &w->deque, vma ) ) {
+		return 1;
+	}
+
+	for ( i = 1; i < shared->num_workers; i++ ) {
+		struct cf_worker * victim = 
+			&shared->workers[(w->id + i) % shared->num_workers];
+		if ( cf_steal( &victim->deque, vma ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void cf_error( enum opdis_error_t error, const char * msg, 
+		      void * arg ) {
+	struct cf_worker * w = (struct cf_worker *) arg;
+	list_add_error( &w->list, error, msg );
+}
+
+static int cf_running( struct cf_worker * w ) {
+	struct cf_shared * shared = w->shared;
+
+	if ( shared->failed || w->list.failed ) {
+		shared->failed = 1;
+		return 0;
+	}
+
+	/* only the Ruby thread may service interrupts */
+	if ( w->is_main ) {
+		return Opdis_runnerCheckInts( shared->sync.runner );
+	}
+
+	return ! shared->sync.runner->abort;
+}
+
+/* Follow one flow of execution, as opdis_disasm_cflow does, until it 
+ * reaches an instruction which does not fall through or which has already
+ * been decoded. Branch targets are queued for any worker to follow. */
+static void cf_flow( struct cf_worker * w, opdis_vma_t vma ) {
+	struct cf_shared * shared = w->shared;
+	opdis_buf_t buf = shared->buf;
+	opdis_t opdis = w->opdis;
+	opdis_insn_t * insn = w->insn;
+
+	while ( cf_in_buf(buf, vma) && cf_claim(shared, vma) && 
+		cf_running(w) ) {
+
+		opdis_insn_clear( insn );
+		if (! opdis_disasm_insn( opdis, buf, vma, insn ) ) {
+			break;
+		}
+
+		list_add_insn( &w->list, insn );
+
+		if ( opdis_insn_is_branch(insn) ) {
+			opdis_vma_t tgt = opdis->resolver( insn, 
+						opdis->resolver_arg );
+			if ( tgt != OPDIS_INVALID_ADDR && cf_in_buf(buf, tgt) &&
+			     ! cf_is_visited(shared, tgt) &&
+			     ! cf_push(w, tgt) ) {
+				shared->failed = 1;
+			}
+		}
+
+		if (! opdis_insn_fallthrough(insn) || ! insn->size ) {
+			break;
+		}
+
+		vma += insn->size;
+	}
+}
+
+static void cf_work( struct cf_worker * w ) {
+	struct cf_shared * shared = w->shared;
+	unsigned int idle = 0;
+	opdis_vma_t vma;
+
+	while ( cf_running(w) ) {
+		if ( cf_next(w, &vma) ) {
+			cf_flow( w, vma );
+			__sync_sub_and_fetch( &shared->pending, 1 );
+			idle = 0;
+			continue;
+		}
+
+		/* flows in progress on other workers may still queue work */
+		if (! __atomic_load_n( &shared->pending, __ATOMIC_ACQUIRE ) ) {
+			break;
+		}
+
+		if ( ++idle < CF_IDLE_SPIN ) {
+			sched_yield();
+		} else {
+			usleep( CF_IDLE_USEC );
+		}
+	}
+}
+
+static void * cf_thread( void * arg ) {
+	struct cf_worker * w = (struct cf_worker *) arg;
+	struct par_shared * sync = &w->shared->sync;
+
+	cf_work( w );
+
+	pthread_mutex_lock( &sync->lock );
+	sync->running--;
+	pthread_cond_signal( &sync->done );
+	pthread_mutex_unlock( &sync->lock );
+
+	return NULL;
+}
+
+static int cmp_insn_vma( const void * a, const void * b ) {
+	const opdis_insn_t * ia = *(const opdis_insn_t **) a;
+	const opdis_insn_t * ib = *(const opdis_insn_t **) b;
+	return (ia->vma < ib->vma) ? -1 : (ia->vma > ib->vma);
+}
+
+/* Pass errors, then instructions in VMA order, to the runner */
+static int cf_emit( struct cf_shared * shared ) {
+	Opdis_runner * runner = shared->sync.runner;
+	opdis_t opdis = runner->opdis;
+	opdis_insn_t ** all;
+	size_t i, j, count = 0;
+
+	for ( i = 0; i < shared->num_workers; i++ ) {
+		count += shared->workers[i].list.count;
+	}
+
+	all = malloc( (count ? count : 1) * sizeof(opdis_insn_t *) );
+	if (! all ) {
+		return 0;
+	}
+
+	for ( count = 0, i = 0; i < shared->num_workers; i++ ) {
+		struct par_list * list = &shared->workers[i].list;
+
+		for ( j = 0; j < list->num_errors; j++ ) {
+			opdis->error_reporter( list->errors[j].type,
+					       list->errors[j].msg,
+					       opdis->error_reporter_arg );
+		}
+
+		for ( j = 0; j < list->count; j++ ) {
+			all[count++] = list->insns[j];
+			list->insns[j] = NULL;
+		}
+	}
+
+	qsort( all, count, sizeof(opdis_insn_t *), cmp_insn_vma );
+
+	for ( i = 0; i < count; i++ ) {
+		if ( runner->abort ) {
+			opdis_insn_free( all[i] );
+		} else {
+			Opdis_runnerPush( runner, all[i] );
+		}
+	}
+
+	free( all );
+	return 1;
+}
+
+int Opdis_parallelCflow( Opdis_runner * runner, opdis_buf_t buf,
+			 opdis_vma_t vma, unsigned int threads ) {
+	/* let the serial walk report out-of-bounds requests */
+	if (! cf_in_buf(buf, vma) ) {
+		return 0;
+	}
+
+	return Opdis_parallelCflowSeeds( runner, buf, &vma, 1, threads );
+}
+
+int Opdis_parallelCflowSeeds( Opdis_runner * runner, opdis_buf_t buf,
+			      const opdis_vma_t * seeds, size_t num_seeds,
+			      unsigned int threads ) {
+	struct cf_worker workers[OPDIS_PAR_MAX_THREADS];
+	struct cf_shared shared;
+	unsigned int i;
+	size_t j, queued = 0;
+	int failed = 0;
+
+	if ( threads < 2 ) {
+		return 0;
+	}
+
+	if ( threads > OPDIS_PAR_MAX_THREADS ) {
+		threads = OPDIS_PAR_MAX_THREADS;
+	}
+
+	memset( &shared, 0, sizeof(shared) );
+	shared.sync.runner = runner;
+	shared.buf = buf;
+	shared.workers = workers;
+	shared.num_workers = threads;
+	shared.visited = calloc( (buf->len + CF_BITS - 1) / CF_BITS, 
+				 sizeof(unsigned long) );
+	if (! shared.visited ) {
+		return 0;
+	}
+
+	pthread_mutex_init( &shared.sync.lock, NULL );
+	pthread_cond_init( &shared.sync.done, NULL );
+
+	memset( workers, 0, sizeof(workers) );
+	for ( i = 0; i < threads; i++ ) {
+		workers[i].shared = &shared;
+		workers[i].id = i;
+		workers[i].is_main = (i == 0);
+		pthread_mutex_init( &workers[i].deque.lock, NULL );
+	}
+
+	for ( i = 0; i < threads; i++ ) {
+		struct cf_worker * w = &workers[i];
+
+		w->opdis = opdis_dupe( runner->opdis );
+		w->insn = Opdis_arenaAlloc( &runner->arena );
+		if (! w->opdis || ! w->insn ) {
+			failed = 1;
+			break;
+		}
+
+		opdis_set_error_reporter( w->opdis, cf_error, w );
+	}
+
+	/* deal the seeds out to the workers */
+	for ( j = 0; ! failed && j < num_seeds; j++ ) {
+		if (! cf_in_buf(buf, seeds[j]) ) {
+			continue;
+		}
+		if (! cf_push( &workers[queued % threads], seeds[j] ) ) {
+			failed = 1;
+		}
+		queued++;
+	}
+
+	if (! failed && queued ) {
+		for ( i = 1; i < threads; i++ ) {
+			pthread_mutex_lock( &shared.sync.lock );
+			shared.sync.running++;
+			pthread_mutex_unlock( &shared.sync.lock );
+
+			if (! pthread_create( &workers[i].thread, NULL,
+					      cf_thread, &workers[i] ) ) {
+				workers[i].started = 1;
+			} else {
+				pthread_mutex_lock( &shared.sync.lock );
+				shared.sync.running--;
+				pthread_mutex_unlock( &shared.sync.lock );
+			}
+		}
+
+		/* the Ruby thread works too; its queue is stolen from if
+		 * some workers could not be started */
+		cf_work( &workers[0] );
+
+		wait_for_workers( &shared.sync );
+
+		for ( i = 1; i < threads; i++ ) {
+			if ( workers[i].started ) {
+				pthread_join( workers[i].thread, NULL );
+			}
+		}
+
+		failed = shared.failed;
+		if (! failed && ! runner->abort ) {
+			failed = ! cf_emit( &shared );
+		}
+	} else {
+		failed = 1;
+	}
+
+	for ( i = 0; i < threads; i++ ) {
+		struct cf_worker * w = &workers[i];
+		list_free( &w->list );
+		free( w->deque.items );
+		pthread_mutex_destroy( &w->deque.lock );
+		Opdis_arenaRelease( &runner->arena, w->insn );
+		if ( w->opdis ) {
+			opdis_term( w->opdis );
+		}
+	}
+
+	free( (void *) shared.visited );
+	pthread_mutex_destroy( &shared.sync.lock );
+	pthread_cond_destroy( &shared.sync.done );
+
+	/* out of memory: fall back to a serial walk unless aborted */
+	return ( failed && ! runner->abort ) ? 0 : 1;
+}
+
+#else
+
+void Opdis_parallelEach( Opdis_runner * runner, OPDIS_PAR_TASK task,
+			 void * items, size_t item_sz, unsigned int num ) {
+	unsigned int i;
+
+	for ( i = 0; i < num; i++ ) {
+		task( (char *) items + (i * item_sz), 1 );
+	}
+}
+
+/* no thread support: callers always perform a serial sweep */
+int Opdis_parallelLinear( Opdis_runner * runner, opdis_buf_t buf,
+			  opdis_vma_t vma, opdis_off_t len,
+			  unsigned int threads ) {
+	return 0;
+}
+
+int Opdis_parallelCflow( Opdis_runner * runner, opdis_buf_t buf,
+			 opdis_vma_t vma, unsigned int threads ) {
+	return 0;
+}
+
+int Opdis_parallelCflowSeeds( Opdis_runner * runner, opdis_buf_t buf,
+			      const opdis_vma_t * seeds, size_t num_seeds,
+			      unsigned int threads ) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/* Parallel.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_PARALLEL_H
+#define OPDIS_RB_PARALLEL_H
+
+#include <opdis/opdis.h>
+
+#include "Runner.h"
+
+/* Upper bound on worker threads. Disassemblers in libopcodes before
+ * binutils 2.39 keep static state, so unless extconf.rb found a reentrant
+ * libopcodes, decoding is never split across threads. */
+#ifdef OPDIS_REENTRANT_OPCODES
+#define OPDIS_PAR_MAX_THREADS 64
+#else
+#define OPDIS_PAR_MAX_THREADS 1
+#endif
+/* Smallest range of bytes worth handing to a worker */
+#define OPDIS_PAR_MIN_CHUNK 0x10000
+
+/* Number of online CPUs, or 1 if this cannot be determined */
+unsigned int Opdis_parallelCpuCount( void );
+
+/* A task run by Opdis_parallelEach. 'is_main' is set if it runs on the
+ * Ruby thread, which alone may call Opdis_runnerCheckInts; other tasks
+ * should stop when the runner is aborted. */
+typedef void (*OPDIS_PAR_TASK)( void * item, int is_main );
+
+/* Run task() on each of the 'num' items of 'item_sz' bytes at 'items', one
+ * worker thread per item (at most OPDIS_PAR_MAX_THREADS). The calling
+ * thread runs the first item, and any item whose thread could not be
+ * started; without thread support, all items are run in turn. Returns when
+ * every task has finished. This is called without the GVL. */
+void Opdis_parallelEach( Opdis_runner * runner, OPDIS_PAR_TASK task,
+			 void * items, size_t item_sz, unsigned int num );
+
+/* Linear disassembly of 'len' bytes of 'buf' starting at 'vma', split
+ * across 'threads' workers. Each worker runs on its own opdis_dupe() of
+ * the runner's opdis_t; chunk edges are resynchronized so that the output
+ * is identical to opdis_disasm_linear(). Instructions and errors are
+ * passed to the runner in order. This is called without the GVL.
+ *
+ * Returns 0 without producing output if the range is too small to split
+ * or the workers could not be started; the caller should then perform a
+ * serial sweep. */
+int Opdis_parallelLinear( Opdis_runner * runner, opdis_buf_t buf,
+			  opdis_vma_t vma, opdis_off_t len,
+			  unsigned int threads );
+
+/* Control flow disassembly of 'buf' starting at 'vma', shared between
+ * 'threads' workers. Branch targets are placed on the discovering worker's
+ * deque, from which idle workers steal; a visited bitmap shared by all
+ * workers ensures each address is decoded once. Targets outside 'buf' are
+ * not followed. Instructions are passed to the runner in VMA order. This
+ * is called without the GVL.
+ *
+ * Returns 0 without producing output if the workers could not be started;
+ * the caller should then perform a serial walk. */
+int Opdis_parallelCflow( Opdis_runner * runner, opdis_buf_t buf,
+			 opdis_vma_t vma, unsigned int threads );
+
+/* As Opdis_parallelCflow, but the walk starts from each of the 'num_seeds'
+ * addresses in 'seeds'; no address is decoded twice, however many seeds
+ * reach it. Seeds outside 'buf' are ignored. Returns 0 without producing
+ * output if no seed is in 'buf'. */
+int Opdis_parallelCflowSeeds( Opdis_runner * runner, opdis_buf_t buf,
+			      const opdis_vma_t * seeds, size_t num_seeds,
+			      unsigned int threads );
+
+#endif
@@ -0,0 +1,754 @@
+/* Pattern.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Pattern.h"
+#include "Disassembly.h"
+#include "Intern.h"
+
+static VALUE clsPattern, clsMatch;
+
+/* ---------------------------------------------------------------------- */
+/* Compiled pattern */
+
+static void pattern_mark( void * ptr ) {
+	Opdis_pattern * pat = (Opdis_pattern *) ptr;
+	rb_gc_mark(pat->source);
+}
+
+static void pattern_free( void * ptr ) {
+	Opdis_pattern * pat = (Opdis_pattern *) ptr;
+	size_t i;
+
+	for ( i = 0; i < pat->num_steps; i++ ) {
+		free( pat->steps[i].mnems );
+		free( pat->steps[i].ops );
+	}
+	free( pat->steps );
+	xfree( pat );
+}
+
+static size_t pattern_memsize( const void * ptr ) {
+	const Opdis_pattern * pat = (const Opdis_pattern *) ptr;
+	size_t i, size = sizeof(Opdis_pattern);
+
+	for ( i = 0; i < pat->num_steps; i++ ) {
+		size += sizeof(Opdis_pat_step) +
+			pat->steps[i].num_mnems * sizeof(Opdis_pat_mnem) +
+			pat->steps[i].num_ops * sizeof(Opdis_pat_op);
+	}
+
+	return size;
+}
+
+static const rb_data_type_t pattern_data_type = {
+	"Opdis::Pattern",
+	{ pattern_mark, pattern_free, pattern_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+/* grow the array at '*ptr', which holds 'num' items, by one item */
+static void * pattern_append( void ** ptr, size_t num, size_t size ) {
+	char * items = realloc( *ptr, (num + 1) * size );
+
+	if (! items ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate pattern" );
+	}
+
+	*ptr = items;
+	memset( items + num * size, 0, size );
+	return items + num * size;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Parser */
+
+/* The pattern is compiled into the Opdis_pattern of a Ruby object, so the
+ * partly-built pattern is released if a syntax error is raised. */
+struct PAT_PARSER {
+	Opdis_pattern * pat;
+	const char * src;
+	const char * p;
+};
+
+static void parse_error( struct PAT_PARSER * ps, const char * msg ) {
+	rb_raise( rb_eArgError, "Invalid pattern at offset %ld: %s",
+		  (long) (ps->p - ps->src), msg );
+}
+
+static void skip_space( struct PAT_PARSER * ps ) {
+	while ( isspace((unsigned char) *ps->p) ) {
+		ps->p++;
+	}
+}
+
+static int is_word_char( char c ) {
+	return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+/* copy the word at the parse position into 'buf' */
+static void parse_word( struct PAT_PARSER * ps, char * buf, size_t size ) {
+	size_t len = 0;
+
+	while ( is_word_char(ps->p[len]) ) {
+		len++;
+	}
+	if (! len ) {
+		parse_error( ps, "name expected" );
+	}
+	if ( len >= size ) {
+		parse_error( ps, "name too long" );
+	}
+
+	memcpy( buf, ps->p, len );
+	buf[len] = '\0';
+	ps->p += len;
+}
+
+static unsigned int parse_uint( struct PAT_PARSER * ps ) {
+	unsigned long n;
+	char * end;
+
+	if (! isdigit((unsigned char) *ps->p) ) {
+		parse_error( ps, "number expected" );
+	}
+	n = strtoul( ps->p, &end, 10 );
+	ps->p = end;
+
+	return ( n > OPDIS_PAT_MAX_REPEAT ) ? OPDIS_PAT_MAX_REPEAT :
+					      (unsigned int) n;
+}
+
+/* @name: index of a register variable, which is added if new */
+static unsigned char parse_var( struct PAT_PARSER * ps ) {
+	Opdis_pattern * pat = ps->pat;
+	char name[OPDIS_PAT_NAME_SZ];
+	size_t i;
+
+	ps->p++;
+	parse_word( ps, name, sizeof(name) );
+
+	for ( i = 0; i < pat->num_vars; i++ ) {
+		if (! strcmp( pat->vars[i], name ) ) {
+			return (unsigned char) i;
+		}
+	}
+
+	if ( pat->num_vars == OPDIS_PAT_MAX_VARS ) {
+		parse_error( ps, "too many variables" );
+	}
+	strcpy( pat->vars[pat->num_vars], name );
+	return (unsigned char) pat->num_vars++;
+}
+
+/* register name, variable or wildcard */
+static void parse_reg( struct PAT_PARSER * ps, Opdis_pat_op * op ) {
+	if ( *ps->p == '@' ) {
+		op->var = parse_var( ps );
+		op->flags |= PAT_OP_VAR;
+		return;
+	}
+
+	if ( *ps->p == '*' ) {
+		ps->p++;
+		return;
+	}
+
+	/* AT&T register names start with % */
+	if ( *ps->p == '%' ) {
+		ps->p++;
+	}
+	parse_word( ps, op->reg, sizeof(op->reg) );
+	if ( strcmp( op->reg, PAT_KW_REG ) ) {
+		op->flags |= PAT_OP_NAME;
+	}
+}
+
+static void parse_operand( struct PAT_PARSER * ps, Opdis_pat_step * step ) {
+	Opdis_pat_op * op = pattern_append( (void **) &step->ops,
+					    step->num_ops,
+					    sizeof(Opdis_pat_op) );
+	const char * p;
+	char * end;
+
+	step->num_ops++;
+	skip_space( ps );
+	p = ps->p;
+
+	if (! strncmp( p, "...", 3 ) ) {
+		op->kind = pat_op_rest;
+		ps->p += 3;
+
+	} else if ( *p == '*' ) {
+		op->kind = pat_op_any;
+		ps->p++;
+
+	} else if ( *p == '[' ) {
+		op->kind = pat_op_mem;
+		op->flags |= PAT_OP_BASE;
+		ps->p++;
+		skip_space( ps );
+		parse_reg( ps, op );
+		skip_space( ps );
+		if ( *ps->p != ']' ) {
+			parse_error( ps, "']' expected" );
+		}
+		ps->p++;
+
+	} else if ( *p == '$' || *p == '-' || isdigit((unsigned char) *p) ) {
+		/* AT&T immediates start with $ */
+		if ( *p == '$' ) {
+			p++;
+		}
+		op->kind = pat_op_imm;
+		op->flags |= PAT_OP_VALUE;
+		op->value = ( *p == '-' ) ? (uint64_t) strtoll( p, &end, 0 ) :
+					    (uint64_t) strtoull( p, &end, 0 );
+		if ( end == p || is_word_char(*end) ) {
+			parse_error( ps, "invalid number" );
+		}
+		ps->p = end;
+
+	} else if ( *p == '@' || *p == '%' ) {
+		op->kind = pat_op_reg;
+		parse_reg( ps, op );
+
+	} else {
+		parse_word( ps, op->reg, sizeof(op->reg) );
+		if (! strcmp( op->reg, PAT_KW_IMM ) ) {
+			op->kind = pat_op_imm;
+		} else if (! strcmp( op->reg, PAT_KW_MEM ) ) {
+			op->kind = pat_op_mem;
+		} else {
+			op->kind = pat_op_reg;
+			if ( strcmp( op->reg, PAT_KW_REG ) ) {
+				op->flags |= PAT_OP_NAME;
+			}
+		}
+	}
+
+	if (! (op->flags & PAT_OP_NAME) ) {
+		op->reg[0] = '\0';
+	}
+}
+
+static void parse_quantifier( struct PAT_PARSER * ps, Opdis_pat_step * step ) {
+	switch ( *ps->p ) {
+		case '?':
+			ps->p++;
+			step->min = 0;
+			return;
+		case '+':
+			ps->p++;
+			step->max = OPDIS_PAT_MAX_REPEAT;
+			return;
+		case '{':
+			break;
+		default:
+			return;
+	}
+
+	ps->p++;
+	skip_space( ps );
+	step->min = step->max = parse_uint( ps );
+	skip_space( ps );
+	if ( *ps->p == ',' ) {
+		ps->p++;
+		skip_space( ps );
+		step->max = ( *ps->p == '}' ) ? OPDIS_PAT_MAX_REPEAT :
+						parse_uint( ps );
+		skip_space( ps );
+	}
+	if ( *ps->p != '}' ) {
+		parse_error( ps, "'}' expected" );
+	}
+	ps->p++;
+
+	if ( step->max < step->min || ! step->max ) {
+		parse_error( ps, "invalid repetition" );
+	}
+}
+
+/* mnemonic[|mnemonic...] [operand[, operand...]] [quantifier] */
+static void parse_step( struct PAT_PARSER * ps ) {
+	Opdis_pattern * pat = ps->pat;
+	Opdis_pat_step * step = pattern_append( (void **) &pat->steps,
+						pat->num_steps,
+						sizeof(Opdis_pat_step) );
+
+	pat->num_steps++;
+	step->min = step->max = 1;
+
+	skip_space( ps );
+	if ( *ps->p == '*' ) {
+		ps->p++;
+	} else {
+		for ( ;; ) {
+			Opdis_pat_mnem * m = pattern_append(
+						(void **) &step->mnems,
+						step->num_mnems,
+						sizeof(Opdis_pat_mnem) );
+			step->num_mnems++;
+
+			parse_word( ps, m->text, sizeof(m->text) );
+			if ( *ps->p == '*' ) {
+				m->prefix = 1;
+				ps->p++;
+			}
+
+			skip_space( ps );
+			if ( *ps->p != '|' ) {
+				break;
+			}
+			ps->p++;
+			skip_space( ps );
+		}
+	}
+
+	skip_space( ps );
+	if ( *ps->p && ! strchr( ";{?+", *ps->p ) ) {
+		for ( ;; ) {
+			parse_operand( ps, step );
+			skip_space( ps );
+			if ( *ps->p != ',' ) {
+				break;
+			}
+			ps->p++;
+		}
+	} else {
+		step->any_ops = 1;
+	}
+
+	parse_quantifier( ps, step );
+	skip_space( ps );
+}
+
+/* step[; step...] */
+static void pattern_compile( Opdis_pattern * pat, const char * src ) {
+	struct PAT_PARSER ps;
+	unsigned int min = 0;
+	size_t i;
+
+	ps.pat = pat;
+	ps.src = ps.p = src;
+
+	for ( ;; ) {
+		parse_step( &ps );
+		if ( *ps.p != ';' ) {
+			break;
+		}
+		ps.p++;
+	}
+
+	if ( *ps.p ) {
+		parse_error( &ps, "';' expected" );
+	}
+
+	for ( i = 0; i < pat->num_steps; i++ ) {
+		min += pat->steps[i].min;
+	}
+	if (! min ) {
+		parse_error( &ps, "pattern matches no instructions" );
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* Matcher */
+
+/* register names bound to the variables of a pattern; "" if unbound */
+struct PAT_BINDS {
+	char regs[OPDIS_PAT_MAX_VARS][OPDIS_REG_NAME_SZ];
+};
+
+/* A point to backtrack to: steps[s..] at instruction 'idx'. The bindings
+ * at that point follow it in the backtracking stack. */
+struct PAT_CHOICE {
+	size_t s;
+	size_t idx;
+};
+
+struct PAT_MATCH {
+	const Opdis_pattern * pat;
+	VALUE output;
+	size_t count;
+	size_t start;			/* index of first instruction */
+	size_t binds_size;		/* bytes of PAT_BINDS in use */
+	struct PAT_BINDS binds;		/* bindings of the last match */
+
+	/* backtracking stack. The String owns the memory, so a scan which
+	 * raises leaks nothing. */
+	VALUE stack;
+	size_t choice_size;		/* bytes per choice, with bindings */
+	size_t num_choices;
+};
+
+static void binds_copy( struct PAT_MATCH * m, struct PAT_BINDS * dst,
+			const struct PAT_BINDS * src ) {
+	if ( m->binds_size ) {
+		memcpy( dst, src, m->binds_size );
+	}
+}
+
+static const char * reg_name( const opdis_reg_t * reg ) {
+	return ( reg->ascii[0] == '%' ) ? reg->ascii + 1 : reg->ascii;
+}
+
+static int reg_matches( const Opdis_pat_op * pop, const opdis_reg_t * reg,
+			struct PAT_BINDS * b ) {
+	const char * name = reg_name( reg );
+	char * bound;
+
+	if ( pop->flags & PAT_OP_NAME ) {
+		return ! strcasecmp( pop->reg, name );
+	}
+
+	if (! (pop->flags & PAT_OP_VAR) ) {
+		return 1;
+	}
+
+	bound = b->regs[pop->var];
+	if ( bound[0] ) {
+		return ! strcasecmp( bound, name );
+	}
+
+	snprintf( bound, OPDIS_REG_NAME_SZ, "%s", name );
+	return 1;
+}
+
+static int op_matches( const Opdis_pat_op * pop, const opdis_op_t * op,
+		       struct PAT_BINDS * b ) {
+	switch ( pop->kind ) {
+		case pat_op_reg:
+			return op->category == opdis_op_cat_register &&
+			       reg_matches( pop, &op->value.reg, b );
+
+		case pat_op_imm:
+			if ( op->category != opdis_op_cat_immediate ) {
+				return 0;
+			}
+			return ! (pop->flags & PAT_OP_VALUE) ||
+			       pop->value == op->value.immediate.u ||
+			       pop->value ==
+			       		(uint64_t) op->value.immediate.s ||
+			       pop->value == op->value.immediate.vma;
+
+		case pat_op_mem:
+			if (! (pop->flags & PAT_OP_BASE) ) {
+				return op->category == opdis_op_cat_expr ||
+				       op->category == opdis_op_cat_absolute;
+			}
+			return op->category == opdis_op_cat_expr &&
+			       (op->value.expr.elements &
+			        opdis_addr_expr_base) &&
+			       reg_matches( pop, &op->value.expr.base, b );
+
+		default:
+			return 1;
+	}
+}
+
+/* match the operand list 'pops' against 'ops'. '...' matches any number of
+ * operands, so alternatives are tried with a copy of the bindings. */
+static int ops_match( struct PAT_MATCH * m, const Opdis_pat_op * pops,
+		      size_t num_pops, opdis_op_t * const * ops,
+		      size_t num_ops, struct PAT_BINDS * b ) {
+	struct PAT_BINDS tmp;
+	size_t i;
+
+	if (! num_pops ) {
+		return ! num_ops;
+	}
+
+	if ( pops->kind == pat_op_rest ) {
+		for ( i = 0; i <= num_ops; i++ ) {
+			binds_copy( m, &tmp, b );
+			if ( ops_match( m, pops + 1, num_pops - 1, ops + i,
+					num_ops - i, &tmp ) ) {
+				binds_copy( m, b, &tmp );
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (! num_ops ) {
+		return 0;
+	}
+
+	binds_copy( m, &tmp, b );
+	if ( op_matches( pops, ops[0], &tmp ) &&
+	     ops_match( m, pops + 1, num_pops - 1, ops + 1, num_ops - 1,
+			&tmp ) ) {
+		binds_copy( m, b, &tmp );
+		return 1;
+	}
+
+	return 0;
+}
+
+static int mnem_matches( const Opdis_pat_step * step, const char * mnem ) {
+	size_t i;
+
+	if (! step->num_mnems ) {
+		return 1;
+	}
+	if (! mnem ) {
+		return 0;
+	}
+
+	for ( i = 0; i < step->num_mnems; i++ ) {
+		const Opdis_pat_mnem * pm = &step->mnems[i];
+		if ( pm->prefix ? ! strncasecmp( pm->text, mnem,
+						 strlen(pm->text) ) :
+				  ! strcasecmp( pm->text, mnem ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int insn_matches( struct PAT_MATCH * m, const Opdis_pat_step * step,
+			 size_t idx, struct PAT_BINDS * b ) {
+	const opdis_insn_t * insn;
+
+	/* a match only covers adjacent instructions */
+	if ( idx > m->start ) {
+		const Opdis_disasm_rec * prev = Opdis_disassemblyRecAt(
+							m->output, idx - 1 );
+		const Opdis_disasm_rec * rec = Opdis_disassemblyRecAt(
+							m->output, idx );
+		if ( prev->vma + prev->size != rec->vma ) {
+			return 0;
+		}
+	}
+
+	insn = Opdis_disassemblyInsnAt( m->output, idx );
+	return mnem_matches( step, insn->mnemonic ) &&
+	       ( step->any_ops || ops_match( m, step->ops, step->num_ops,
+					     insn->operands,
+					     insn->num_operands, b ) );
+}
+
+static struct PAT_CHOICE * choice_at( struct PAT_MATCH * m, size_t i ) {
+	return (struct PAT_CHOICE *) (RSTRING_PTR(m->stack) +
+				      i * m->choice_size);
+}
+
+static void choice_push( struct PAT_MATCH * m, size_t s, size_t idx,
+			 const struct PAT_BINDS * b ) {
+	struct PAT_CHOICE * c;
+	size_t len = (m->num_choices + 1) * m->choice_size;
+
+	if ( (size_t) RSTRING_LEN(m->stack) < len ) {
+		rb_str_resize( m->stack, len * 2 );
+	}
+
+	c = choice_at( m, m->num_choices++ );
+	c->s = s;
+	c->idx = idx;
+	binds_copy( m, (struct PAT_BINDS *) (c + 1), b );
+}
+
+/* Match the pattern at instruction 'idx'. Repetitions are greedy: each
+ * repetition which could also have been the last pushes a choice to
+ * continue with the next step instead, and a failure resumes at the most
+ * recent choice. Returns the index after the match, or -1. Raises
+ * RuntimeError if more than OPDIS_PAT_MAX_WORK instructions are tested. */
+static long match_steps( struct PAT_MATCH * m, size_t idx ) {
+	struct PAT_BINDS b, tmp;
+	size_t s = 0, work = 0;
+	unsigned int reps = 0;
+
+	memset( &b, 0, sizeof(b) );
+	m->num_choices = 0;
+
+	while ( s < m->pat->num_steps ) {
+		const Opdis_pat_step * step = &m->pat->steps[s];
+		struct PAT_CHOICE * c;
+
+		if ( reps < step->max && idx < m->count ) {
+			if ( ++work > OPDIS_PAT_MAX_WORK ) {
+				rb_raise( rb_eRuntimeError, "Pattern is too "
+					  "complex: more than %d instructions "
+					  "tested at index %lu",
+					  OPDIS_PAT_MAX_WORK,
+					  (unsigned long) m->start );
+			}
+
+			binds_copy( m, &tmp, &b );
+			if ( insn_matches( m, step, idx, &tmp ) ) {
+				if ( reps >= step->min ) {
+					choice_push( m, s + 1, idx, &b );
+				}
+				binds_copy( m, &b, &tmp );
+				reps++;
+				idx++;
+				continue;
+			}
+		}
+
+		if ( reps >= step->min ) {
+			s++;
+			reps = 0;
+			continue;
+		}
+
+		if (! m->num_choices ) {
+			return -1;
+		}
+
+		c = choice_at( m, --m->num_choices );
+		s = c->s;
+		idx = c->idx;
+		reps = 0;
+		binds_copy( m, &b, (struct PAT_BINDS *) (c + 1) );
+	}
+
+	binds_copy( m, &m->binds, &b );
+	return (long) idx;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Pattern Class */
+
+static Opdis_pattern * pattern_data( VALUE instance ) {
+	Opdis_pattern * pat;
+	TypedData_Get_Struct(instance, Opdis_pattern, &pattern_data_type, pat);
+	if ( Qnil == pat->source ) {
+		rb_raise( rb_eRuntimeError, "Pattern not initialized" );
+	}
+	return pat;
+}
+
+static VALUE cls_pattern_alloc( VALUE class ) {
+	Opdis_pattern * pat;
+	VALUE instance = TypedData_Make_Struct(class, Opdis_pattern,
+					       &pattern_data_type, pat);
+	pat->source = Qnil;
+	return instance;
+}
+
+/* Pattern.new(source) */
+static VALUE cls_pattern_init( VALUE instance, VALUE source ) {
+	Opdis_pattern * pat;
+
+	TypedData_Get_Struct(instance, Opdis_pattern, &pattern_data_type, pat);
+	if ( Qnil != pat->source ) {
+		rb_raise( rb_eRuntimeError, "Pattern already compiled" );
+	}
+
+	source = rb_str_new_frozen( StringValue(source) );
+	pattern_compile( pat, StringValueCStr(source) );
+	pat->source = source;
+
+	return instance;
+}
+
+static VALUE cls_pattern_source( VALUE instance ) {
+	return pattern_data(instance)->source;
+}
+
+static VALUE match_value( struct PAT_MATCH * m, size_t end ) {
+	const Opdis_disasm_rec * first = Opdis_disassemblyRecAt( m->output,
+								 m->start );
+	const Opdis_disasm_rec * last = Opdis_disassemblyRecAt( m->output,
+								end - 1 );
+	VALUE captures = rb_hash_new();
+	size_t i;
+
+	for ( i = 0; i < m->pat->num_vars; i++ ) {
+		if ( m->binds.regs[i][0] ) {
+			rb_hash_aset( captures,
+				      rb_str_new_cstr(m->pat->vars[i]),
+				      Opdis_intern(m->binds.regs[i]) );
+		}
+	}
+
+	return rb_struct_new( clsMatch, ULL2NUM(first->vma),
+			      ULL2NUM(last->vma + last->size),
+			      rb_range_new( SIZET2NUM(m->start),
+					    SIZET2NUM(end), 1 ),
+			      captures );
+}
+
+static VALUE pattern_scan( VALUE instance, VALUE output ) {
+	struct PAT_MATCH m;
+	VALUE ary = rb_ary_new();
+
+	Opdis_disassemblyCheck( output );
+
+	m.pat = pattern_data(instance);
+	m.output = output;
+	m.count = Opdis_disassemblyCount( output );
+	m.binds_size = m.pat->num_vars * OPDIS_REG_NAME_SZ;
+
+	/* choices are kept aligned for their size_t members */
+	m.choice_size = (sizeof(struct PAT_CHOICE) + m.binds_size +
+			 sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	m.stack = rb_str_new( NULL, 64 * m.choice_size );
+
+	for ( m.start = 0; m.start < m.count; ) {
+		long end;
+
+		end = match_steps( &m, m.start );
+		if ( end > (long) m.start ) {
+			rb_ary_push( ary, match_value(&m, (size_t) end) );
+			m.start = (size_t) end;
+		} else {
+			m.start++;
+		}
+	}
+
+	RB_GC_GUARD(instance);
+	RB_GC_GUARD(m.stack);
+	return ary;
+}
+
+static void init_pattern_class( VALUE modOpdis ) {
+	clsPattern = rb_define_class_under(modOpdis, OPDIS_PATTERN_CLASS_NAME,
+					   rb_cObject);
+	rb_define_alloc_func(clsPattern, cls_pattern_alloc);
+
+	clsMatch = rb_struct_define_under( clsPattern, PAT_MATCH_CLASS_NAME,
+					   PAT_MATCH_START, PAT_MATCH_END,
+					   PAT_MATCH_INSNS, PAT_MATCH_CAPTURES,
+					   NULL );
+
+	rb_define_method(clsPattern, "initialize", cls_pattern_init, 1);
+
+	rb_define_method(clsPattern, PAT_ATTR_SOURCE, cls_pattern_source, 0);
+	rb_define_method(clsPattern, PAT_METHOD_TO_S, cls_pattern_source, 0);
+	rb_define_method(clsPattern, PAT_METHOD_SCAN, pattern_scan, 1);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initPattern( VALUE modOpdis ) {
+	init_pattern_class(modOpdis);
+}
+
+VALUE Opdis_patternScan( VALUE pattern, VALUE output ) {
+	if (! rb_obj_is_kind_of( pattern, clsPattern ) ) {
+		pattern = rb_class_new_instance( 1, &pattern, clsPattern );
+	}
+
+	return pattern_scan( pattern, output );
+}
@@ -0,0 +1,94 @@
+/* Pattern.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_PATTERN_H
+#define OPDIS_RB_PATTERN_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#define OPDIS_PATTERN_CLASS_NAME "Pattern"
+#define PAT_MATCH_CLASS_NAME "Match"
+
+#define PAT_ATTR_SOURCE "source"
+#define PAT_METHOD_TO_S "to_s"
+#define PAT_METHOD_SCAN "scan"
+
+/* Match members */
+#define PAT_MATCH_START "start"
+#define PAT_MATCH_END "end"
+#define PAT_MATCH_INSNS "insns"
+#define PAT_MATCH_CAPTURES "captures"
+
+/* operand keywords */
+#define PAT_KW_REG "reg"
+#define PAT_KW_IMM "imm"
+#define PAT_KW_MEM "mem"
+
+/* Longest mnemonic or variable name in a pattern */
+#define OPDIS_PAT_NAME_SZ 32
+/* Maximum number of register variables in a pattern */
+#define OPDIS_PAT_MAX_VARS 8
+/* Upper bound of an open repetition such as {2,} */
+#define OPDIS_PAT_MAX_REPEAT 256
+/* Instructions tested from one start position before a scan gives up */
+#define OPDIS_PAT_MAX_WORK 1000000
+
+typedef struct {
+	char text[OPDIS_PAT_NAME_SZ];
+	unsigned char prefix;		/* match any mnemonic starting 'text' */
+} Opdis_pat_mnem;
+
+enum Opdis_pat_op_kind {
+	pat_op_any,			/* * */
+	pat_op_rest,			/* ... : any number of operands */
+	pat_op_reg,
+	pat_op_imm,
+	pat_op_mem
+};
+
+/* Opdis_pat_op flags */
+#define PAT_OP_NAME	0x01		/* register named 'reg' */
+#define PAT_OP_VAR	0x02		/* register bound to variable 'var' */
+#define PAT_OP_VALUE	0x04		/* immediate equal to 'value' */
+#define PAT_OP_BASE	0x08		/* memory operand with a base register */
+
+typedef struct {
+	unsigned char kind;		/* Opdis_pat_op_kind */
+	unsigned char flags;
+	unsigned char var;
+	char reg[OPDIS_REG_NAME_SZ];
+	uint64_t value;
+} Opdis_pat_op;
+
+/* One instruction of a pattern, repeated 'min' to 'max' times */
+typedef struct {
+	Opdis_pat_mnem * mnems;		/* alternatives; none matches any */
+	size_t num_mnems;
+	Opdis_pat_op * ops;
+	size_t num_ops;
+	int any_ops;			/* no operand list was given */
+	unsigned int min;
+	unsigned int max;
+} Opdis_pat_step;
+
+typedef struct {
+	Opdis_pat_step * steps;
+	size_t num_steps;
+	char vars[OPDIS_PAT_MAX_VARS][OPDIS_PAT_NAME_SZ];
+	size_t num_vars;
+	VALUE source;			/* frozen String, or Qnil */
+} Opdis_pattern;
+
+void Opdis_initPattern( VALUE modOpdis );
+
+/* Return an Array of the non-overlapping matches of 'pattern' (an
+ * Opdis::Pattern or a pattern String) in the instructions of 'output'.
+ * This reads the stored instructions and decodes nothing. */
+VALUE Opdis_patternScan( VALUE pattern, VALUE output );
+
+#endif
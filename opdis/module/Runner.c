@@ -0,0 +1,469 @@
+/* Runner.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdio.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#if defined(HAVE_RUBY_THREAD_H) && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) \
+    && defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2) \
+    && defined(HAVE_RB_THREAD_CALL_WITH_GVL)
+#define OPDIS_USE_NOGVL
+#include <ruby/thread.h>
+#endif
+
+#if defined(HAVE_PTHREAD_H) && ! defined(OPDIS_REENTRANT_OPCODES)
+#define OPDIS_DECODE_LOCK
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <opdis/opdis.h>
+
+#include "Opdis.h"
+#include "Disassembly.h"
+#include "Model.h"
+#include "Runner.h"
+
+static ID symCall = 0;
+
+/* ---------------------------------------------------------------------- */
+/* Calling into Ruby */
+
+struct RUNNER_CALL {
+	Opdis_runner * runner;
+	VALUE (*fn)(VALUE);
+	VALUE arg;
+};
+
+static void * runner_call_protected( void * arg ) {
+	struct RUNNER_CALL * call = (struct RUNNER_CALL *) arg;
+	Opdis_runner * runner = call->runner;
+	int nogvl = runner->nogvl;
+	int state = 0;
+
+	/* nested calls must not try to acquire the GVL again */
+	runner->nogvl = 0;
+	rb_protect( call->fn, call->arg, &state );
+	runner->nogvl = nogvl;
+
+	if ( state ) {
+		runner->state = state;
+		runner->abort = 1;
+	}
+
+	return NULL;
+}
+
+int Opdis_runnerCall( Opdis_runner * runner, VALUE (*fn)(VALUE), 
+		      VALUE arg ) {
+	struct RUNNER_CALL call;
+
+	if ( runner->abort ) {
+		return 0;
+	}
+
+	call.runner = runner;
+	call.fn = fn;
+	call.arg = arg;
+
+#ifdef OPDIS_USE_NOGVL
+	if ( runner->nogvl ) {
+		rb_thread_call_with_gvl( runner_call_protected, &call );
+		return ! runner->abort;
+	}
+#endif
+
+	runner_call_protected( &call );
+	return ! runner->abort;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Instruction queue */
+
+static VALUE runner_drain( VALUE arg ) {
+	Opdis_runner * runner = (Opdis_runner *) arg;
+
+	while ( runner->queue_head < runner->queue_len ) {
+		opdis_insn_t * insn = runner->queue[runner->queue_head];
+		VALUE obj = Qnil;
+
+		/* insn stays queued until it has an owner, so that it is
+		 * freed by Opdis_runnerFinish if a conversion raises */
+		if ( Qnil == runner->output ) {
+			/* streaming: the Instruction takes ownership of insn,
+			 * which is released once the block is done with it */
+			obj = Opdis_insnFromOwnedC(insn);
+			runner->queue_head++;
+			rb_funcall(runner->block, symCall, 1, obj);
+			continue;
+		}
+
+		/* Ruby Instruction objects are only created for the block; the
+		 * Disassembly creates them on demand otherwise */
+		if ( Qnil != runner->block ) {
+			obj = Opdis_insnFromC(insn);
+			if ( obj == Qnil ) {
+				runner->queue_head++;
+				char buf[128];
+				snprintf( buf, 128-1, 
+					  "%s: Unable to convert C insn to Ruby",
+					  DIS_ERR_DECODE );
+				rb_ary_push( runner->errors, 
+					     rb_str_new_cstr(buf) );
+				opdis_insn_free(insn);
+				continue;
+			}
+		}
+
+		/* the Disassembly takes ownership of insn */
+		runner->queue_head++;
+		Opdis_disassemblyAddOwned( runner->output, insn, obj );
+
+		if ( Qnil != obj ) {
+			rb_funcall(runner->block, symCall, 1, obj);
+		}
+	}
+
+	runner->queue_head = runner->queue_len = 0;
+
+	return Qnil;
+}
+
+static void runner_free_queue( Opdis_runner * runner ) {
+	while ( runner->queue_head < runner->queue_len ) {
+		opdis_insn_free( runner->queue[runner->queue_head++] );
+	}
+
+	runner->queue_head = runner->queue_len = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* libopdis callbacks */
+
+void Opdis_runnerPush( Opdis_runner * runner, opdis_insn_t * insn ) {
+	if ( runner->abort ) {
+		opdis_insn_free(insn);
+		return;
+	}
+
+	runner->queue[runner->queue_len++] = insn;
+
+	if ( runner->queue_len == OPDIS_RUNNER_QUEUE_SZ ) {
+		Opdis_runnerCall( runner, runner_drain, (VALUE) runner );
+	}
+}
+
+static void runner_display( const opdis_insn_t * i, void * arg ) {
+	Opdis_runner * runner = (Opdis_runner *) arg;
+	opdis_insn_t * copy;
+
+	if ( runner->abort ) {
+		return;
+	}
+
+	if ( runner->stats ) {
+		Opdis_statsAdd( runner->stats, i );
+		return;
+	}
+
+	copy = opdis_insn_dupe(i);
+	if (! copy ) {
+		runner->opdis->error_reporter( opdis_error_unknown, 
+				"Unable to copy instruction",
+				runner->opdis->error_reporter_arg );
+		return;
+	}
+
+	Opdis_runnerPush( runner, copy );
+}
+
+struct RUNNER_ERROR {
+	Opdis_runner * runner;
+	const char * msg;
+};
+
+static VALUE runner_push_error( VALUE arg ) {
+	struct RUNNER_ERROR * err = (struct RUNNER_ERROR *) arg;
+
+	/* append error message to error list */
+	rb_ary_push( err->runner->errors, rb_str_new_cstr(err->msg) );
+	return Qnil;
+}
+
+/* error handler: this appends errors to the Disassembly error list */
+static void runner_error( enum opdis_error_t error, const char * msg,
+			  void * arg ) {
+	const char * type;
+	char buf[128] = {0};
+	struct RUNNER_ERROR err;
+
+	switch (error) {
+		case opdis_error_bounds: type = DIS_ERR_BOUNDS; break;
+		case opdis_error_invalid_insn: type = DIS_ERR_INVALID; break;
+		case opdis_error_decode_insn: type = DIS_ERR_DECODE; break;
+		case opdis_error_bfd: type = DIS_ERR_BFD; break;
+		case opdis_error_max_items: type = DIS_ERR_MAX; break;
+		case opdis_error_unknown: 
+		default: type = DIS_ERR_UNK; break;
+	}
+
+	snprintf( buf, 128-1, "%s: %s", type, msg );
+
+	err.runner = (Opdis_runner *) arg;
+	err.msg = buf;
+	Opdis_runnerCall( err.runner, runner_push_error, (VALUE) &err );
+}
+
+static VALUE runner_check_ints( VALUE arg ) {
+	rb_thread_check_ints();
+	return Qnil;
+}
+
+int Opdis_runnerCheckInts( Opdis_runner * runner ) {
+	if ( runner->interrupted ) {
+		runner->interrupted = 0;
+		Opdis_runnerCall( runner, runner_check_ints, Qnil );
+	}
+
+	return ! runner->abort;
+}
+
+/* handler: this is consulted before every instruction is followed, so it
+ * is where the runner services interrupts and stops after an exception */
+static int runner_handler( const opdis_insn_t * i, void * arg ) {
+	Opdis_runner * runner = (Opdis_runner *) arg;
+
+	if (! Opdis_runnerCheckInts( runner ) ) {
+		return 0;
+	}
+
+	return runner->handler( i, runner->handler_arg );
+}
+
+/* ---------------------------------------------------------------------- */
+/* Decoder lock */
+
+#ifdef OPDIS_DECODE_LOCK
+/* A non-reentrant libopcodes must not be used by two Ruby threads at once,
+ * so runs are serialized. The lock is recursive, as a Ruby callback may
+ * start a nested disassembly. It is only waited for without the GVL, since
+ * its holder may need the GVL to finish, and the wait is broken up so that
+ * the waiting thread can be interrupted. */
+static pthread_mutex_t decode_lock;
+static pthread_once_t decode_lock_once = PTHREAD_ONCE_INIT;
+
+/* time between attempts to take the lock */
+#define DECODE_LOCK_POLL_NSEC 1000000
+
+static void decode_lock_init( void ) {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( &decode_lock, &attr );
+	pthread_mutexattr_destroy( &attr );
+}
+
+#ifdef OPDIS_USE_NOGVL
+struct DECODE_WAIT {
+	volatile int cancel;
+	int acquired;
+};
+
+/* poll for the lock until it is taken or Ruby interrupts the wait */
+static void * decode_lock_poll( void * arg ) {
+	struct DECODE_WAIT * wait = (struct DECODE_WAIT *) arg;
+	struct timespec ts = { 0, DECODE_LOCK_POLL_NSEC };
+
+	while (! wait->cancel ) {
+		if (! pthread_mutex_trylock( &decode_lock ) ) {
+			wait->acquired = 1;
+			break;
+		}
+		nanosleep( &ts, NULL );
+	}
+
+	return NULL;
+}
+
+static void decode_lock_ubf( void * arg ) {
+	((struct DECODE_WAIT *) arg)->cancel = 1;
+}
+#endif
+
+/* take the lock; this must be called with the GVL held. Interrupts which
+ * arrive while waiting are serviced, and may raise. */
+static void decode_lock_acquire( void ) {
+#ifdef OPDIS_USE_NOGVL
+	struct DECODE_WAIT wait;
+#endif
+
+	pthread_once( &decode_lock_once, decode_lock_init );
+	if (! pthread_mutex_trylock( &decode_lock ) ) {
+		return;
+	}
+
+#ifdef OPDIS_USE_NOGVL
+	wait.acquired = 0;
+	while (! wait.acquired ) {
+		wait.cancel = 0;
+		rb_thread_call_without_gvl2( decode_lock_poll, &wait, 
+					     decode_lock_ubf, &wait );
+		if (! wait.acquired ) {
+			rb_thread_check_ints();
+		}
+	}
+#else
+	pthread_mutex_lock( &decode_lock );
+#endif
+}
+
+static void decode_lock_release( void ) {
+	pthread_mutex_unlock( &decode_lock );
+}
+#endif
+
+/* ---------------------------------------------------------------------- */
+/* Runner */
+
+void Opdis_runnerInit( Opdis_runner * runner, opdis_t opdis, VALUE output,
+		       VALUE block ) {
+	if (! symCall ) {
+		symCall = rb_intern("call");
+	}
+
+	runner->opdis = opdis;
+	runner->output = output;
+	runner->errors = ( Qnil == output ) ? rb_ary_new() :
+					      Opdis_disassemblyErrors(output);
+	runner->block = block;
+	runner->queue_head = runner->queue_len = 0;
+	runner->nogvl = runner->interrupted = runner->abort = 0;
+	runner->state = 0;
+	runner->stats = NULL;
+
+	runner->handler = opdis->handler;
+	runner->handler_arg = opdis->handler_arg;
+
+	Opdis_arenaInit( &runner->arena, opdis->config.arch );
+
+	opdis_set_display( opdis, runner_display, runner );
+	opdis_set_error_reporter( opdis, runner_error, runner );
+	opdis_set_handler( opdis, runner_handler, runner );
+}
+
+#ifdef OPDIS_USE_NOGVL
+struct RUNNER_RUN {
+	void (*fn)(void *);
+	void * arg;
+	int done;
+};
+
+static void * runner_run_nogvl( void * arg ) {
+	struct RUNNER_RUN * run = (struct RUNNER_RUN *) arg;
+	run->fn( run->arg );
+	run->done = 1;
+	return NULL;
+}
+
+/* unblocking function: Ruby wants this thread's attention */
+static void runner_ubf( void * arg ) {
+	((Opdis_runner *) arg)->interrupted = 1;
+}
+#endif
+
+void Opdis_runnerRun( Opdis_runner * runner, void (*fn)(void *), 
+		      void * arg ) {
+#ifdef OPDIS_USE_NOGVL
+	struct RUNNER_RUN run;
+	run.fn = fn;
+	run.arg = arg;
+	run.done = 0;
+
+	/* interrupts are serviced by the handler, so the call must not raise
+	 * on return while the lock is held. It does not run fn at all if an
+	 * interrupt was already pending; that is serviced, then fn is run. */
+	while (! run.done ) {
+#ifdef OPDIS_DECODE_LOCK
+		decode_lock_acquire();
+#endif
+		runner->nogvl = 1;
+		rb_thread_call_without_gvl2( runner_run_nogvl, &run, 
+					     runner_ubf, runner );
+		runner->nogvl = 0;
+#ifdef OPDIS_DECODE_LOCK
+		decode_lock_release();
+#endif
+		if (! run.done ) {
+			rb_thread_check_ints();
+		}
+	}
+#else
+#ifdef OPDIS_DECODE_LOCK
+	decode_lock_acquire();
+	fn( arg );
+	decode_lock_release();
+#else
+	fn( arg );
+#endif
+#endif
+
+	/* hand remaining instructions to Ruby */
+	if ( runner->queue_len ) {
+		Opdis_runnerCall( runner, runner_drain, (VALUE) runner );
+	}
+}
+
+struct RUNNER_LOCKED {
+	void (*fn)(void *);
+	void * arg;
+};
+
+static VALUE runner_run_locked( VALUE arg ) {
+	struct RUNNER_LOCKED * run = (struct RUNNER_LOCKED *) arg;
+	run->fn( run->arg );
+	return Qnil;
+}
+
+void Opdis_runnerRunLocked( Opdis_runner * runner, void (*fn)(void *), 
+			    void * arg ) {
+	struct RUNNER_LOCKED run;
+	int state = 0;
+
+	run.fn = fn;
+	run.arg = arg;
+
+#ifdef OPDIS_DECODE_LOCK
+	decode_lock_acquire();
+	rb_protect( runner_run_locked, (VALUE) &run, &state );
+	decode_lock_release();
+#else
+	rb_protect( runner_run_locked, (VALUE) &run, &state );
+#endif
+	if ( state ) {
+		runner->state = state;
+		runner->abort = 1;
+		return;
+	}
+
+	if ( runner->queue_len ) {
+		Opdis_runnerCall( runner, runner_drain, (VALUE) runner );
+	}
+}
+
+void Opdis_runnerFinish( Opdis_runner * runner ) {
+	runner_free_queue( runner );
+	Opdis_arenaFree( &runner->arena );
+
+	if ( runner->state ) {
+		int state = runner->state;
+		runner->state = 0;
+		rb_jump_tag(state);
+	}
+}
@@ -0,0 +1,90 @@
+/* Runner.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_RUNNER_H
+#define OPDIS_RB_RUNNER_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#include "Arena.h"
+#include "Statistics.h"
+
+/* Number of instructions queued before they are handed to Ruby */
+#define OPDIS_RUNNER_QUEUE_SZ 256
+
+/* A Runner executes a libopdis strategy without holding the GVL (where the
+ * Ruby version supports it). Instructions emitted by the display callback
+ * are copied into a bounded queue; the GVL is only reacquired to drain the
+ * queue into the Disassembly object and the user's block, and to invoke
+ * Ruby callbacks. Exceptions raised by Ruby code are caught, stop the
+ * disassembly, and are re-raised by Opdis_runnerFinish. */
+typedef struct {
+	opdis_t opdis;
+	VALUE output;			/* Opdis::Disassembly, or Qnil */
+	VALUE errors;			/* Array of error messages */
+	VALUE block;			/* block to yield to, or Qnil */
+
+	opdis_insn_t * queue[OPDIS_RUNNER_QUEUE_SZ];
+	unsigned int queue_head;
+	unsigned int queue_len;
+
+	/* scratch instructions for this disassembly */
+	Opdis_insn_arena arena;
+
+	/* if set, instructions are counted here and not output */
+	Opdis_insn_stats * stats;
+
+	/* handler which was installed before the runner wrapped it */
+	OPDIS_HANDLER handler;
+	void * handler_arg;
+
+	int nogvl;			/* running without the GVL */
+	volatile int interrupted;	/* Ruby has interrupts pending */
+	volatile int abort;		/* stop disassembly asap */
+	int state;			/* rb_protect state of first exception */
+} Opdis_runner;
+
+/* Argument for callbacks which invoke a method on a Ruby object */
+typedef struct {
+	VALUE obj;
+	Opdis_runner * runner;
+} Opdis_rb_callback;
+
+/* Install the runner's display, error and handler callbacks in 'opdis'.
+ * If 'output' is Qnil, the runner streams instructions to 'block' without
+ * retaining them, and errors are collected in a new Array. */
+void Opdis_runnerInit( Opdis_runner * runner, opdis_t opdis, VALUE output,
+		       VALUE block );
+
+/* Invoke fn(arg) with the GVL released, then drain the queue */
+void Opdis_runnerRun( Opdis_runner * runner, void (*fn)(void *), void * arg );
+
+/* As Opdis_runnerRun, but fn(arg) is invoked with the GVL held. This is for
+ * short runs which read Ruby-owned data, such as an existing Disassembly.
+ * An exception raised by fn aborts the runner. */
+void Opdis_runnerRunLocked( Opdis_runner * runner, void (*fn)(void *), 
+			    void * arg );
+
+/* Release queued instructions and re-raise any exception caught while
+ * running */
+void Opdis_runnerFinish( Opdis_runner * runner );
+
+/* Queue an instruction for output, as the display callback does. The
+ * runner takes ownership of 'insn'. Must be called from the thread which
+ * invoked Opdis_runnerRun. */
+void Opdis_runnerPush( Opdis_runner * runner, opdis_insn_t * insn );
+
+/* Service pending Ruby interrupts. Returns 0 if the runner has been 
+ * aborted. Must be called from the thread which invoked Opdis_runnerRun. */
+int Opdis_runnerCheckInts( Opdis_runner * runner );
+
+/* Call fn(arg) with the GVL held, trapping exceptions. This may be called
+ * from any libopdis callback. Returns 0 if the runner has been aborted. */
+int Opdis_runnerCall( Opdis_runner * runner, VALUE (*fn)(VALUE), VALUE arg );
+
+#endif
@@ -0,0 +1,208 @@
+/* Statistics.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Statistics.h"
+#include "Intern.h"
+#include "Model.h"
+
+#define STATS_MIN_ALLOC 256
+
+static const char * isa_names[OPDIS_STATS_NUM_ISA] = {
+	INSN_ISA_GEN, INSN_ISA_FPU, INSN_ISA_GPU, INSN_ISA_SIMD, INSN_ISA_VM
+};
+
+/* ---------------------------------------------------------------------- */
+/* Mnemonic table */
+
+/* FNV-1a */
+static size_t mnem_hash( const char * str ) {
+	size_t h = (size_t) 2166136261UL;
+
+	while ( *str ) {
+		h ^= (unsigned char) *str++;
+		h *= (size_t) 16777619UL;
+	}
+
+	return h;
+}
+
+static Opdis_stats_mnem * mnem_slot( Opdis_stats_mnem * tbl, size_t alloc,
+				     const char * mnem ) {
+	size_t i = mnem_hash( mnem ) & (alloc - 1);
+
+	while ( tbl[i].mnemonic && strcmp(tbl[i].mnemonic, mnem) ) {
+		i = (i + 1) & (alloc - 1);
+	}
+
+	return &tbl[i];
+}
+
+/* double the table, keeping it at most half full */
+static int mnem_grow( Opdis_insn_stats * stats ) {
+	size_t i, alloc = stats->alloc ? stats->alloc * 2 : STATS_MIN_ALLOC;
+	Opdis_stats_mnem * tbl = calloc( alloc, sizeof(Opdis_stats_mnem) );
+
+	if (! tbl ) {
+		return 0;
+	}
+
+	for ( i = 0; i < stats->alloc; i++ ) {
+		if ( stats->mnemonics[i].mnemonic ) {
+			*mnem_slot( tbl, alloc, stats->mnemonics[i].mnemonic )
+				= stats->mnemonics[i];
+		}
+	}
+
+	free( stats->mnemonics );
+	stats->mnemonics = tbl;
+	stats->alloc = alloc;
+	return 1;
+}
+
+static void mnem_count( Opdis_insn_stats * stats, const char * mnem ) {
+	Opdis_stats_mnem * slot;
+
+	if ( (stats->num_mnemonics + 1) * 2 > stats->alloc &&
+	     ! mnem_grow(stats) ) {
+		stats->failed = 1;
+		return;
+	}
+
+	slot = mnem_slot( stats->mnemonics, stats->alloc, mnem );
+	if (! slot->mnemonic ) {
+		slot->mnemonic = strdup( mnem );
+		if (! slot->mnemonic ) {
+			stats->failed = 1;
+			return;
+		}
+		stats->num_mnemonics++;
+	}
+
+	slot->count++;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_statsInit( Opdis_insn_stats * stats ) {
+	memset( stats, 0, sizeof(Opdis_insn_stats) );
+}
+
+void Opdis_statsFree( Opdis_insn_stats * stats ) {
+	size_t i;
+
+	for ( i = 0; i < stats->alloc; i++ ) {
+		free( stats->mnemonics[i].mnemonic );
+	}
+	free( stats->mnemonics );
+
+	Opdis_statsInit( stats );
+}
+
+void Opdis_statsAdd( Opdis_insn_stats * stats, const opdis_insn_t * insn ) {
+	stats->count++;
+	stats->bytes += insn->size;
+
+	if ( (unsigned int) insn->category < OPDIS_STATS_NUM_CAT ) {
+		stats->categories[insn->category]++;
+	}
+	if ( (unsigned int) insn->isa < OPDIS_STATS_NUM_ISA ) {
+		stats->isa[insn->isa]++;
+	}
+
+	if ( insn->mnemonic && insn->mnemonic[0] ) {
+		mnem_count( stats, insn->mnemonic );
+	}
+}
+
+static int cmp_mnem_count( const void * a, const void * b ) {
+	const Opdis_stats_mnem * x = *(const Opdis_stats_mnem * const *) a;
+	const Opdis_stats_mnem * y = *(const Opdis_stats_mnem * const *) b;
+
+	if ( x->count != y->count ) {
+		return ( x->count > y->count ) ? -1 : 1;
+	}
+	return strcmp( x->mnemonic, y->mnemonic );
+}
+
+static VALUE stats_mnemonics( const Opdis_insn_stats * stats ) {
+	VALUE hash = rb_hash_new();
+	VALUE buf = rb_str_new( NULL,
+			stats->num_mnemonics * sizeof(Opdis_stats_mnem *) );
+	const Opdis_stats_mnem ** sorted;
+	size_t i, n = 0;
+
+	/* the sort buffer is a String, so it is released if this raises */
+	sorted = (const Opdis_stats_mnem **) RSTRING_PTR(buf);
+	for ( i = 0; i < stats->alloc; i++ ) {
+		if ( stats->mnemonics[i].mnemonic ) {
+			sorted[n++] = &stats->mnemonics[i];
+		}
+	}
+	qsort( (void *) sorted, n, sizeof(Opdis_stats_mnem *),
+	       cmp_mnem_count );
+
+	for ( i = 0; i < n; i++ ) {
+		rb_hash_aset( hash, Opdis_intern(sorted[i]->mnemonic),
+			      ULL2NUM(sorted[i]->count) );
+	}
+
+	RB_GC_GUARD(buf);
+	return hash;
+}
+
+/* Hash of name => count for the non-zero counts */
+static VALUE stats_counts( const unsigned long long * counts,
+			   const char ** names, size_t num ) {
+	VALUE hash = rb_hash_new();
+	size_t i;
+
+	for ( i = 0; i < num; i++ ) {
+		if ( counts[i] ) {
+			rb_hash_aset( hash, names[i] ? Opdis_intern(names[i]) :
+					    Qnil, ULL2NUM(counts[i]) );
+		}
+	}
+
+	return hash;
+}
+
+static VALUE sym_for( const char * name ) {
+	return ID2SYM(rb_intern(name));
+}
+
+VALUE Opdis_statsToHash( const Opdis_insn_stats * stats, VALUE errors ) {
+	VALUE hash;
+
+	if ( stats->failed ) {
+		rb_raise( rb_eNoMemError, "Unable to allocate instruction "
+			  "statistics" );
+	}
+
+	hash = rb_hash_new();
+	rb_hash_aset( hash, sym_for(STATS_KEY_COUNT), ULL2NUM(stats->count) );
+	rb_hash_aset( hash, sym_for(STATS_KEY_BYTES), ULL2NUM(stats->bytes) );
+	rb_hash_aset( hash, sym_for(STATS_KEY_MNEMONICS),
+		      stats_mnemonics(stats) );
+	rb_hash_aset( hash, sym_for(STATS_KEY_CATEGORIES),
+		      stats_counts(stats->categories, Opdis_insnCategoryNames,
+				   OPDIS_STATS_NUM_CAT) );
+	rb_hash_aset( hash, sym_for(STATS_KEY_ISA),
+		      stats_counts(stats->isa, isa_names,
+				   OPDIS_STATS_NUM_ISA) );
+	rb_hash_aset( hash, sym_for(STATS_KEY_ERRORS), errors );
+
+	return hash;
+}
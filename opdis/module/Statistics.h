@@ -0,0 +1,60 @@
+/* Statistics.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_STATISTICS_H
+#define OPDIS_RB_STATISTICS_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#include "Model.h"
+
+/* result keys */
+#define STATS_KEY_COUNT "count"
+#define STATS_KEY_BYTES "bytes"
+#define STATS_KEY_MNEMONICS "mnemonics"
+#define STATS_KEY_CATEGORIES "categories"
+#define STATS_KEY_ISA "isa"
+#define STATS_KEY_ERRORS "errors"
+
+/* opdis_insn_cat_t and opdis_insn_subset_t values */
+#define OPDIS_STATS_NUM_CAT OPDIS_INSN_NUM_CAT
+#define OPDIS_STATS_NUM_ISA (opdis_insn_subset_vm + 1)
+
+typedef struct {
+	char * mnemonic;		/* NULL if the slot is empty */
+	unsigned long long count;
+} Opdis_stats_mnem;
+
+/* Counts of the instructions emitted by a disassembly. Mnemonics are kept
+ * in an open-addressed hash table. Nothing here uses the Ruby allocator, so
+ * instructions can be counted without the GVL. */
+typedef struct {
+	unsigned long long count;
+	unsigned long long bytes;
+	unsigned long long categories[OPDIS_STATS_NUM_CAT];
+	unsigned long long isa[OPDIS_STATS_NUM_ISA];
+
+	Opdis_stats_mnem * mnemonics;
+	size_t num_mnemonics;
+	size_t alloc;			/* power of two */
+	int failed;			/* an allocation failed */
+} Opdis_insn_stats;
+
+void Opdis_statsInit( Opdis_insn_stats * stats );
+
+void Opdis_statsFree( Opdis_insn_stats * stats );
+
+/* Count 'insn'. This does not require the GVL. */
+void Opdis_statsAdd( Opdis_insn_stats * stats, const opdis_insn_t * insn );
+
+/* Return the counts as a Hash, with 'errors' as the error list. Mnemonics
+ * are listed from most to least frequent. Raises NoMemError if counting
+ * failed. */
+VALUE Opdis_statsToHash( const Opdis_insn_stats * stats, VALUE errors );
+
+#endif
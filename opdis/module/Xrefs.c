@@ -0,0 +1,404 @@
+/* Xrefs.c
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ruby.h>
+#include "ruby_compat.h"
+
+#include <opdis/opdis.h>
+
+#include "Xrefs.h"
+#include "Disassembly.h"
+
+#define XREF_MIN_ALLOC 256
+
+static VALUE clsXrefs, clsXref;
+
+/* ---------------------------------------------------------------------- */
+/* Native index */
+
+static void xrefs_mark( void * ptr ) {
+	Opdis_xref_index * idx = (Opdis_xref_index *) ptr;
+	rb_gc_mark(idx->output);
+}
+
+static void xrefs_free( void * ptr ) {
+	Opdis_xref_index * idx = (Opdis_xref_index *) ptr;
+
+	free( idx->xrefs );
+	free( idx->by_to );
+	free( idx->targets );
+	xfree( idx );
+}
+
+static size_t xrefs_memsize( const void * ptr ) {
+	const Opdis_xref_index * idx = (const Opdis_xref_index *) ptr;
+	return sizeof(Opdis_xref_index) + idx->alloc * sizeof(Opdis_xref) +
+	       (idx->by_to ? idx->num_xrefs * sizeof(Opdis_xref_to) : 0);
+}
+
+static const rb_data_type_t xrefs_data_type = {
+	"Opdis::XrefIndex",
+	{ xrefs_mark, xrefs_free, xrefs_memsize, },
+#ifdef RUBY_TYPED_FREE_IMMEDIATELY
+	0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+#endif
+};
+
+static void xrefs_add( Opdis_xref_index * idx, opdis_vma_t from,
+		       opdis_vma_t to, enum Opdis_xref_type type ) {
+	Opdis_xref * xref;
+
+	if ( idx->num_xrefs == idx->alloc ) {
+		size_t alloc = idx->alloc ? idx->alloc * 2 : XREF_MIN_ALLOC;
+		Opdis_xref * xrefs = realloc( idx->xrefs,
+					      alloc * sizeof(Opdis_xref) );
+		if (! xrefs ) {
+			rb_raise( rb_eNoMemError, "Unable to allocate xref "
+				  "index" );
+		}
+		idx->xrefs = xrefs;
+		idx->alloc = alloc;
+	}
+
+	xref = &idx->xrefs[idx->num_xrefs++];
+	xref->from = from;
+	xref->to = to;
+	xref->type = (unsigned char) type;
+}
+
+/* The address referenced by a non-branch operand, or OPDIS_INVALID_ADDR.
+ * Only addresses which do not depend on register contents are returned;
+ * a PC-relative address is computed from the end of the instruction. */
+static opdis_vma_t op_data_addr( const opdis_insn_t * insn,
+				 const opdis_op_t * op,
+				 enum Opdis_xref_type * type ) {
+	const opdis_addr_expr_t * expr;
+
+	*type = ( op->flags & opdis_op_flag_w ) ? xref_write : xref_read;
+
+	switch ( op->category ) {
+		case opdis_op_cat_absolute:
+			return op->value.abs.offset;
+
+		case opdis_op_cat_expr:
+			expr = &op->value.expr;
+			if ( expr->elements & opdis_addr_expr_index ||
+			     ! (expr->elements & opdis_addr_expr_disp) ) {
+				break;
+			}
+			if (! (expr->elements & opdis_addr_expr_base) ) {
+				return ( expr->elements &
+					 opdis_addr_expr_disp_abs ) ?
+					expr->displacement.a.offset :
+					expr->displacement.u;
+			}
+			if ( expr->base.flags & opdis_reg_flag_pc ) {
+				return insn->vma + insn->size +
+				       expr->displacement.s;
+			}
+			break;
+
+		case opdis_op_cat_immediate:
+			if ( op->flags & opdis_op_flag_address ) {
+				*type = xref_addr;
+				return op->value.immediate.vma;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	return OPDIS_INVALID_ADDR;
+}
+
+static void xrefs_add_insn( Opdis_xref_index * idx, 
+			    const opdis_insn_t * insn, opdis_vma_t tgt ) {
+	const opdis_op_t * skip = NULL;
+	unsigned int i;
+
+	if ( opdis_insn_is_branch(insn) ) {
+		enum Opdis_xref_type type = xref_jump;
+
+		if ( insn->flags.cflow & (opdis_cflow_flag_call |
+					  opdis_cflow_flag_callcc) ) {
+			type = xref_call;
+		} else if ( insn->flags.cflow & opdis_cflow_flag_jmpcc ) {
+			type = xref_cond;
+		}
+
+		/* an unresolved target operand (e.g. a jump through a
+		 * pointer) is treated as a data reference */
+		if ( tgt != OPDIS_INVALID_ADDR ) {
+			xrefs_add( idx, insn->vma, tgt, type );
+			skip = insn->target;
+		}
+	}
+
+	for ( i = 0; i < insn->num_operands; i++ ) {
+		const opdis_op_t * op = insn->operands[i];
+		enum Opdis_xref_type type;
+		opdis_vma_t addr;
+
+		if ( op == skip ) {
+			continue;
+		}
+
+		addr = op_data_addr( insn, op, &type );
+		if ( addr != OPDIS_INVALID_ADDR ) {
+			xrefs_add( idx, insn->vma, addr, type );
+		}
+	}
+}
+
+static int cmp_xref_to( const void * a, const void * b ) {
+	const Opdis_xref_to * x = (const Opdis_xref_to *) a;
+	const Opdis_xref_to * y = (const Opdis_xref_to *) b;
+
+	if ( x->to != y->to ) {
+		return ( x->to < y->to ) ? -1 : 1;
+	}
+	/* xrefs are in source order, so this orders by source */
+	return ( x->xref < y->xref ) ? -1 : ( x->xref > y->xref );
+}
+
+static void xrefs_build( Opdis_xref_index * idx, OPDIS_RESOLVER resolver,
+			 void * resolver_arg ) {
+	size_t i, count = Opdis_disassemblyCount( idx->output );
+
+	idx->targets = Opdis_disassemblyAllocArray( count, sizeof(opdis_vma_t),
+						    "xref index" );
+	Opdis_disassemblyResolve( idx->output, idx->targets, resolver,
+				  resolver_arg );
+
+	for ( i = 0; i < count; i++ ) {
+		xrefs_add_insn( idx, Opdis_disassemblyInsnAt(idx->output, i),
+				idx->targets[i] );
+	}
+
+	free( idx->targets );
+	idx->targets = NULL;
+
+	idx->by_to = Opdis_disassemblyAllocArray( idx->num_xrefs,
+						  sizeof(Opdis_xref_to),
+						  "xref index" );
+	for ( i = 0; i < idx->num_xrefs; i++ ) {
+		idx->by_to[i].to = idx->xrefs[i].to;
+		idx->by_to[i].xref = i;
+	}
+	qsort( idx->by_to, idx->num_xrefs, sizeof(Opdis_xref_to),
+	       cmp_xref_to );
+}
+
+/* index of the first xref with a source at or after 'vma' */
+static size_t xrefs_lower_from( Opdis_xref_index * idx, opdis_vma_t vma ) {
+	size_t lo = 0, hi = idx->num_xrefs;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( idx->xrefs[mid].from < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* index in 'by_to' of the first xref with a target at or after 'vma' */
+static size_t xrefs_lower_to( Opdis_xref_index * idx, opdis_vma_t vma ) {
+	size_t lo = 0, hi = idx->num_xrefs;
+
+	while ( lo < hi ) {
+		size_t mid = lo + (hi - lo) / 2;
+		if ( idx->by_to[mid].to < vma ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* ---------------------------------------------------------------------- */
+/* XrefIndex Class */
+
+static Opdis_xref_index * xrefs_data( VALUE instance ) {
+	Opdis_xref_index * idx;
+	TypedData_Get_Struct(instance, Opdis_xref_index, &xrefs_data_type,
+			     idx);
+	if ( Qnil == idx->output ) {
+		rb_raise( rb_eRuntimeError, "XrefIndex not initialized" );
+	}
+	return idx;
+}
+
+static VALUE cls_xrefs_alloc( VALUE class ) {
+	Opdis_xref_index * idx;
+	VALUE instance = TypedData_Make_Struct(class, Opdis_xref_index,
+					       &xrefs_data_type, idx);
+	idx->output = Qnil;
+	return instance;
+}
+
+/* XrefIndex.new(disassembly) */
+static VALUE cls_xrefs_init( VALUE instance, VALUE output ) {
+	Opdis_xref_index * idx;
+
+	Opdis_disassemblyCheck( output );
+
+	TypedData_Get_Struct(instance, Opdis_xref_index, &xrefs_data_type,
+			     idx);
+	if ( Qnil != idx->output ) {
+		rb_raise( rb_eRuntimeError, "XrefIndex already built" );
+	}
+
+	idx->output = output;
+	xrefs_build( idx, opdis_default_resolver, NULL );
+
+	return instance;
+}
+
+static VALUE xref_value( Opdis_xref_index * idx, size_t i ) {
+	static const char * names[] = { XREF_TYPE_CALL, XREF_TYPE_JUMP,
+					XREF_TYPE_COND, XREF_TYPE_READ,
+					XREF_TYPE_WRITE, XREF_TYPE_ADDR };
+	Opdis_xref * xref = &idx->xrefs[i];
+
+	return rb_struct_new( clsXref, ULL2NUM(xref->from),
+			      ULL2NUM(xref->to),
+			      ID2SYM(rb_intern(names[xref->type])) );
+}
+
+/* Fill 'lo' and 'hi' (inclusive) from an Integer address or a Range of
+ * addresses. Returns 0 if the range is empty. */
+static int query_bounds( VALUE addr, opdis_vma_t * lo, opdis_vma_t * hi ) {
+	VALUE beg, end;
+	int excl;
+
+	if (! rb_range_values(addr, &beg, &end, &excl) ) {
+		*lo = *hi = (opdis_vma_t) NUM2ULL(addr);
+		return 1;
+	}
+
+	*lo = ( Qnil == beg ) ? 0 : (opdis_vma_t) NUM2ULL(beg);
+	*hi = ( Qnil == end ) ? OPDIS_INVALID_ADDR :
+				(opdis_vma_t) NUM2ULL(end);
+	if ( excl && Qnil != end ) {
+		if (! *hi ) {
+			return 0;
+		}
+		(*hi)--;
+	}
+
+	return *lo <= *hi;
+}
+
+static VALUE cls_xrefs_disassembly( VALUE instance ) {
+	return xrefs_data(instance)->output;
+}
+
+static VALUE cls_xrefs_length( VALUE instance ) {
+	return SIZET2NUM(xrefs_data(instance)->num_xrefs);
+}
+
+static VALUE cls_xrefs_each( VALUE instance ) {
+	Opdis_xref_index * idx;
+	size_t i;
+
+	RETURN_ENUMERATOR(instance, 0, 0);
+
+	idx = xrefs_data(instance);
+	for ( i = 0; i < idx->num_xrefs; i++ ) {
+		rb_yield( xref_value(idx, i) );
+	}
+
+	return instance;
+}
+
+static VALUE cls_xrefs_from( VALUE instance, VALUE addr ) {
+	Opdis_xref_index * idx = xrefs_data(instance);
+	VALUE ary = rb_ary_new();
+	opdis_vma_t lo, hi;
+	size_t i;
+
+	if (! query_bounds(addr, &lo, &hi) ) {
+		return ary;
+	}
+
+	for ( i = xrefs_lower_from(idx, lo);
+	      i < idx->num_xrefs && idx->xrefs[i].from <= hi; i++ ) {
+		rb_ary_push( ary, xref_value(idx, i) );
+	}
+
+	return ary;
+}
+
+static VALUE cls_xrefs_to( VALUE instance, VALUE addr ) {
+	Opdis_xref_index * idx = xrefs_data(instance);
+	VALUE ary = rb_ary_new();
+	opdis_vma_t lo, hi;
+	size_t i;
+
+	if (! query_bounds(addr, &lo, &hi) ) {
+		return ary;
+	}
+
+	for ( i = xrefs_lower_to(idx, lo);
+	      i < idx->num_xrefs && idx->by_to[i].to <= hi; i++ ) {
+		rb_ary_push( ary, xref_value(idx, idx->by_to[i].xref) );
+	}
+
+	return ary;
+}
+
+static void init_xrefs_class( VALUE modOpdis ) {
+	clsXrefs = rb_define_class_under(modOpdis, OPDIS_XREFS_CLASS_NAME,
+					 rb_cObject);
+	rb_define_alloc_func(clsXrefs, cls_xrefs_alloc);
+	rb_include_module(clsXrefs, rb_mEnumerable);
+
+	clsXref = rb_struct_define_under( clsXrefs, XREF_CLASS_NAME,
+					  XREF_MEMBER_FROM, XREF_MEMBER_TO,
+					  XREF_MEMBER_TYPE, NULL );
+
+	rb_define_method(clsXrefs, "initialize", cls_xrefs_init, 1);
+
+	rb_define_method(clsXrefs, XREF_ATTR_DISASM, cls_xrefs_disassembly, 0);
+
+	rb_define_method(clsXrefs, XREF_METHOD_LENGTH, cls_xrefs_length, 0);
+	rb_define_method(clsXrefs, XREF_METHOD_SIZE, cls_xrefs_length, 0);
+	rb_define_method(clsXrefs, XREF_METHOD_EACH, cls_xrefs_each, 0);
+	rb_define_method(clsXrefs, XREF_METHOD_TO, cls_xrefs_to, 1);
+	rb_define_method(clsXrefs, XREF_METHOD_FROM, cls_xrefs_from, 1);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public API */
+
+void Opdis_initXrefs( VALUE modOpdis ) {
+	init_xrefs_class(modOpdis);
+}
+
+VALUE Opdis_xrefsNew( VALUE output, OPDIS_RESOLVER resolver,
+		      void * resolver_arg ) {
+	VALUE instance = cls_xrefs_alloc(clsXrefs);
+	Opdis_xref_index * idx;
+
+	TypedData_Get_Struct(instance, Opdis_xref_index, &xrefs_data_type,
+			     idx);
+	idx->output = output;
+
+	xrefs_build( idx, resolver, resolver_arg );
+
+	return instance;
+}
@@ -0,0 +1,81 @@
+/* Xrefs.h
+ * Copyright 2010 Thoughtgang <http://www.thoughtgang.org>
+ * Written by TG Community Developers <community@thoughtgang.org>
+ * Released under the GNU Public License, version 3.
+ * See http://www.gnu.org/licenses/gpl.txt for details.
+ */
+
+#ifndef OPDIS_RB_XREFS_H
+#define OPDIS_RB_XREFS_H
+
+#include <opdis/opdis.h>
+#include <ruby.h>
+
+#define OPDIS_XREFS_CLASS_NAME "XrefIndex"
+#define XREF_CLASS_NAME "Xref"
+
+#define XREF_ATTR_DISASM "disassembly"
+#define XREF_METHOD_LENGTH "length"
+#define XREF_METHOD_SIZE "size"
+#define XREF_METHOD_EACH "each"
+#define XREF_METHOD_TO "xrefs_to"
+#define XREF_METHOD_FROM "xrefs_from"
+
+/* Xref members */
+#define XREF_MEMBER_FROM "from"
+#define XREF_MEMBER_TO "to"
+#define XREF_MEMBER_TYPE "type"
+
+/* Xref types */
+#define XREF_TYPE_CALL "call"
+#define XREF_TYPE_JUMP "jump"
+#define XREF_TYPE_COND "cond"
+#define XREF_TYPE_READ "read"
+#define XREF_TYPE_WRITE "write"
+#define XREF_TYPE_ADDR "addr"
+
+enum Opdis_xref_type {
+	xref_call,
+	xref_jump,
+	xref_cond,
+	xref_read,
+	xref_write,
+	xref_addr
+};
+
+/* A reference from the instruction at 'from' to the address 'to' */
+typedef struct {
+	opdis_vma_t from;
+	opdis_vma_t to;
+	unsigned char type;		/* Opdis_xref_type */
+} Opdis_xref;
+
+/* Entry in the index by target: 'xref' is an index into 'xrefs' */
+typedef struct {
+	opdis_vma_t to;
+	size_t xref;
+} Opdis_xref_to;
+
+/* 'xrefs' is sorted by source, in the order of the operands of each
+ * instruction; 'by_to' is sorted by target, then by source. */
+typedef struct {
+	Opdis_xref * xrefs;
+	Opdis_xref_to * by_to;
+	size_t num_xrefs;
+	size_t alloc;
+	VALUE output;			/* Disassembly the index was built from */
+
+	/* per-instruction branch targets, used while building */
+	opdis_vma_t * targets;
+} Opdis_xref_index;
+
+void Opdis_initXrefs( VALUE modOpdis );
+
+/* Build the cross-reference index of the instructions in 'output'. Branch
+ * targets are obtained from 'resolver'; data references are taken from
+ * memory operands with a fixed address and from immediate operands flagged
+ * as addresses. This reads the stored instructions and decodes nothing. */
+VALUE Opdis_xrefsNew( VALUE output, OPDIS_RESOLVER resolver,
+		      void * resolver_arg );
+
+#endif
@@ -13,6 +13,7 @@
 #   --with-opdis-lib=path_to_libopdis.so (/usr/local/lib)
 #   --with-opdis=path_to_opdis_source_tree
 #   --with-objdump=path_to_objdump_binary (objdump)
+#   --enable-reentrant-opcodes / --disable-reentrant-opcodes (detected)
 # See README for more info.
 
 require 'mkmf'
@@ -58,6 +59,22 @@ dir_config('opcodes')
 require_header('dis-asm.h')
 require_library('opcodes', 'init_disassemble_info')
 
+# Disassemblers in libopcodes before binutils 2.39 (e.g. i386) keep static
+# state, so they cannot be called by several threads at once. Without a
+# reentrant libopcodes, the extension decodes on one thread at a time.
+reentrant = enable_config('reentrant-opcodes') do
+  checking_for('reentrant libopcodes') do
+    try_compile(<<-SRC)
+#include <bfdver.h>
+#if BFD_VERSION < 239000000
+#error libopcodes is not reentrant
+#endif
+int main(void) { return 0; }
+    SRC
+  end
+end
+$CPPFLAGS += " -DOPDIS_REENTRANT_OPCODES" if reentrant
+
 # ----------------------------------------------------------------------
 # OPDIS
 
@@ -120,6 +137,27 @@ elsif RUBY_VERSION =~ /1.9/ then
         $CPPFLAGS += " -DRUBY_19"
 end
 
+# Disassemble without holding the GVL (ruby 2.0+)
+if have_header('ruby/thread.h') then
+  have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+  have_func('rb_thread_call_without_gvl2', 'ruby/thread.h')
+  have_func('rb_thread_call_with_gvl', 'ruby/thread.h')
+end
+
+# Parallel disassembly
+have_header('pthread.h') and have_library('pthread', 'pthread_create')
+
+# Memory-mapped File targets
+have_header('sys/mman.h') and have_func('mmap', 'sys/mman.h')
+
+# Nanosecond file timestamps for the cache
+have_struct_member('struct stat', 'st_mtim', 'sys/stat.h')
+
+# Zero-copy IO::Buffer targets (ruby 3.1+)
+if have_header('ruby/io/buffer.h') then
+  have_func('rb_io_buffer_get_bytes_for_reading', 'ruby/io/buffer.h')
+end
+
 # ----------------------------------------------------------------------
 # Makefile
 
@@ -35,13 +35,15 @@ method. Depending on the InstructionDecoder object, it may have been
 partially filled by a previous Decoder (e.g. the GenericDecoder and one of the
 X86Decoders).
 
-The <i>hash</i> argument contains the output of libopcodes and has the following
-members:
+The <i>ctx</i> argument is an Opdis::DecodeContext containing the output of 
+libopcodes. Its members are available as methods or, for compatibility with
+older decoders, through ctx[:member]:
 
 :vma:: The virtual memory address of the instruction.
 :offset:: The offset of the instruction into the target buffer.
 :size:: The size of the instruction in bytes.
-:buffer:: An array containing the bytes in the instruction.
+:buffer:: An Opdis::ByteView of the target buffer up to the end of the 
+instruction. The instruction bytes are at buffer[offset, size].
 :items:: An array of the instruction strings generated by libopcodes.
 :raw_insn:: The complete instruction string (ASCII_ as generated by libopcodes. 
 :branch_delay:: The number of instructions that will execute before the branch
@@ -56,18 +58,86 @@ This is not always set by libopcodes.
 :target2:: The second target address of a branch or dereference.
 This is not always set by libopcodes.
 
+The context is only valid while decode is running; use DecodeContext#to_h
+to keep a copy.
+
 InstructionDecoder#decode will invoke opdis_default_decoder to fill
 architecture-independent members such as Instruction#vma and Instruction#ascii.
 
 This method must return success or failure. Failure will result in an 
 error message being added to Disassembly.errors.
 =end
-    def decode( insn, hash )
+    def decode( insn, ctx )
       true
     end
 
   end
 
+# ----------------------------------------------------------------------
+=begin rdoc
+The arguments passed to InstructionDecoder#decode. 
+
+Members are computed when they are first requested, and the target buffer is
+not copied. A DecodeContext (and its ByteView) refers to memory owned by
+libopdis, and raises a RuntimeError if used after decode has returned.
+=end
+  class DecodeContext
+
+=begin rdoc
+Return the member named by the Symbol or String <i>key</i>, or nil.
+See InstructionDecoder#decode for the member names.
+=end
+    def [](key)
+    end
+
+=begin rdoc
+Return a Hash of all members. The buffer is copied into a String, so the
+Hash remains usable after decode has returned.
+=end
+    def to_h
+    end
+
+=begin rdoc
+Return true if the context can still be used.
+=end
+    def valid?
+    end
+
+  end
+
+# ----------------------------------------------------------------------
+=begin rdoc
+A read-only view of a target buffer. This includes Enumerable.
+=end
+  class ByteView
+
+=begin rdoc
+Return the byte at <i>idx</i> as an Integer, or a String containing
+<i>len</i> bytes starting at <i>idx</i>.
+=end
+    def [](idx, len=nil)
+    end
+
+=begin rdoc
+Return the number of bytes in the view.
+=end
+    def length
+    end
+
+=begin rdoc
+Yield each byte in the view as an Integer.
+=end
+    def each_byte
+    end
+
+=begin rdoc
+Return a copy of the bytes in the view as a String.
+=end
+    def to_s
+    end
+
+  end
+
 # ----------------------------------------------------------------------
 =begin rdoc
 A decoder for disassembled AT&T syntax x86 instructions.
@@ -78,7 +148,7 @@ A decoder for disassembled AT&T syntax x86 instructions.
 See InstructionDecoder#decode.
 This will invoke opdis default x86 decoder with AT&T syntax.
 =end
-    def decode( insn, hash )
+    def decode( insn, ctx )
       true
     end
 
@@ -94,7 +164,7 @@ A decoder for disassembled Intel syntax x86 instructions.
 See InstructionDecoder#decode.
 This will invoke opdis default x86 decoder with Intel syntax.
 =end
-    def decode( insn, hash )
+    def decode( insn, ctx )
       true
     end
 
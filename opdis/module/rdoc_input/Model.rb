@@ -40,6 +40,10 @@ and <i>target</i> members have been filled, though the Operand objects in
 <i>operands</i> will only have their <i>ascii</i> member filled. 
 DECODE_MNEMONIC_FLAGS and DECODE_OPERAND_FLAGS indicate that instruction
 and operand metadata have been filled.
+
+Instruction attributes are converted to Ruby objects the first time they
+are read; instructions which are never inspected cost no more than the
+underlying C structure.
 =end
   class Instruction
 
@@ -94,6 +94,21 @@ The <i>disassembler_options</i> field for libopcodes.
 =end
     attr_accessor :opcodes_options
 
+=begin rdoc
+Directory in which ext_disassemble caches its results, or nil (the default)
+to disable caching. The directory and its parents are created when needed.
+Each Disassembly is stored in a compact binary file
+named after a hash of the target contents, the section or symbol being
+disassembled, the architecture, syntax, decoder, strategy, VMA and length.
+A repeated ext_disassemble of the same target is served from this file,
+which is mapped into memory rather than read; instructions are only built
+from the mapping when they are accessed.
+
+Results are not cached when an insn_decoder, addr_tracker or resolver
+object is supplied, since the output then depends on Ruby code.
+=end
+    attr_accessor :cache_dir
+
 =begin rdoc
 Disassemble a single instruction at the specified VMA.
 =end
@@ -127,12 +142,22 @@ entry point (or <b>start_address</b>). Requires that the target be a
 Bfd::Target object.
 =end
     STRATEGY_ENTRY='bfd-entry'
+=begin rdoc
+Perform a control-flow disassembly from every known function start and
+divide the instructions into functions (see Disassembly#functions). For a
+Bfd::Target, the starts are its entry point and its function symbols; for a
+Bfd::Symbol, the symbol; for a buffer, <i>vma</i>. The VMAs in the
+<i>functions</i> argument are added to these, and the target of every call
+that is found also starts a function.
+=end
+    STRATEGY_FUNCTIONS='functions'
 
 =begin rdoc
 Available disassembler strategies.
 =end
     STRATEGIES = [ STRATEGY_SINGLE, STRATEGY_LINEAR, STRATEGY_CFLOW,
-                   STRATEGY_SYMBOL, STRATEGY_SECTION, STRATEGY_ENTRY ]
+                   STRATEGY_SYMBOL, STRATEGY_SECTION, STRATEGY_ENTRY,
+                   STRATEGY_FUNCTIONS ]
 
 =begin rdoc
 AT&T assembly language syntax (src, dest).
@@ -150,8 +175,20 @@ Intel assembly language syntax (dest, src).
 =begin rdoc
 Disassemble all bytes in a target.
 
-The target parameter can be a String of bytes, an Array of bytes, a 
-Bfd::Target, a Bfd::Section, or a Bfd::Symbol.
+The target parameter can be a String of bytes, an Array of bytes, an
+IO::Buffer, an IO, a Bfd::Target, a Bfd::Section, or a Bfd::Symbol.
+
+String and IO::Buffer targets are not copied: the disassembler reads their
+bytes directly. An IO::Buffer is locked for the duration of the call.
+
+Disassembly runs without holding the global interpreter lock, so several
+threads can disassemble different targets at the same time. This requires
+a reentrant libopcodes (binutils 2.39 or later); with an older libopcodes,
+disassemblies in different threads run one after another. Instructions
+are handed to the block in batches; resolver, addr_tracker and insn_decoder
+objects are still invoked once per instruction. An exception raised by the
+block or by one of these objects stops the disassembly and is re-raised
+by this method.
 
 The args parameter is a Hash which can contain any of the following members:
 
@@ -174,6 +211,9 @@ The args parameter is a Hash which can contain any of the following members:
 
   arch:: The architecture to disassemble for.
 
+  cache_dir:: Directory in which to cache disassembly results. See
+              <i>cache_dir</i>.
+
   strategy:: This disassembly algorithm to use. Default is STRATEGY_LINEAR.
 
   vma:: The VMA to start disassembly at. Default is 0.
@@ -183,10 +223,165 @@ The args parameter is a Hash which can contain any of the following members:
   buffer_vma:: The load address of the target. This is only needed when the
                target is a String or Array; BFD targets will provide their
                own VMAs. Default is 0.
+
+  threads:: Number of threads to use. For STRATEGY_LINEAR and
+            STRATEGY_SECTION the range is split into chunks that are
+            disassembled concurrently and stitched back together, so the
+            result is the same as a single-threaded sweep. For
+            the control flow strategies, branch
+            targets are shared out between the threads and each address is
+            decoded once; the instructions are yielded in VMA order. 
+            +true+ uses one thread per CPU. Ignored when an insn_decoder or
+            addr_tracker object (or, for control flow strategies, a
+            resolver) is supplied, or when the extension was built
+            against a libopcodes which is not reentrant (see README).
+            Default is 1.
+
+  functions:: An Array of VMAs of additional function starts for
+              STRATEGY_FUNCTIONS.
 =end
     def ext_disassemble(target, args) # :yields: instructions
     end
 
+=begin rdoc
+Disassemble a target, passing each instruction to the block as it is
+produced. Unlike ext_disassemble, no Disassembly is built: instructions are
+passed to the block in small batches and released once the block returns,
+so memory use stays constant regardless of the size of the target.
+
+The target and args parameters are the same as for ext_disassemble. The 
+threads argument is ignored.
+
+Returns the list of error messages encountered.
+=end
+    def ext_each_instruction(target, args) # :yields: instruction
+    end
+
+=begin rdoc
+Disassemble a list of targets or address ranges. The arguments are parsed,
+and the opdis_t configured, once for the whole list; a target is only 
+reloaded when it differs from the target of the previous item.
+
+Each element of <i>items</i> is one of:
+
+  target:: A target as accepted by ext_disassemble, disassembled using the
+           vma and length in <i>args</i>.
+
+  [target, vma, length]:: A target with its own vma and length. Either may
+                          be nil to use the value in <i>args</i>.
+
+  Range:: A range of addresses in args[:target].
+
+The args parameter accepts the members documented for ext_disassemble, and:
+
+  target:: The target for Range items.
+
+  combined:: If true, all instructions are stored in a single Disassembly.
+             Default is false. With STRATEGY_FUNCTIONS, its FunctionTable
+             holds the functions of every item.
+
+Returns an Array with one Disassembly per item, or the combined Disassembly.
+=end
+    def ext_disassemble_batch(items, args) # :yields: instruction
+    end
+
+=begin rdoc
+Update <i>output</i>, a Disassembly of <i>target</i>, after some of the
+bytes of <i>target</i> have been modified. Only the instructions affected
+by the modification are decoded again, so the cost depends on the size of
+the change rather than the size of the target.
+
+The changes parameter is an Array of the modified VMAs: each member is
+either a Range of VMAs or a single VMA.
+
+The args parameter must match the one used to produce <i>output</i>; see
+ext_disassemble. For STRATEGY_LINEAR and STRATEGY_SECTION, the sweep is
+restarted at each instruction that overlaps a change, and stops once it
+reaches an instruction which the original sweep also produced. For control
+flow strategies, the code is walked again from each changed instruction
+that is still reachable; the walk stops at instructions which are still
+valid, and instructions that can no longer be reached are removed. An
+addr_tracker is not consulted by control flow strategies, and the threads
+argument is ignored.
+
+The replacement instructions are passed to the block, if one is given, and
+their errors are appended to the errors of <i>output</i>. Returns
+<i>output</i>.
+=end
+    def ext_redisassemble(target, output, changes, args) # :yields: instruction
+    end
+
+=begin rdoc
+Disassemble a target and count its instructions, without creating any
+Instruction objects or a Disassembly. Each instruction is counted by the
+libopdis display callback and then discarded.
+
+The target and args parameters are the same as for ext_disassemble. The
+threads argument is ignored. To get the counts for one section of a file,
+pass the Bfd::Section as the target.
+
+Returns a Hash with the following members:
+
+  count:: The number of instructions.
+  bytes:: The total size of the instructions.
+  mnemonics:: A Hash of mnemonic => count, from most to least frequent.
+  categories:: A Hash of category (see Instruction#category) => count.
+               Instructions of unknown category are counted under nil.
+  isa:: A Hash of ISA subset (see Instruction#isa) => count. libopdis
+        reports SSE and AVX instructions alike as Instruction::ISA_SIMD.
+  errors:: The list of error messages encountered.
+
+Zero counts are omitted.
+=end
+    def ext_statistics(target, args)
+    end
+
+=begin rdoc
+Find the gadgets in a target: the instruction sequences which end in a
+return, or in a jump or call to a register or memory address.
+
+The code is scanned for the bytes which begin such an instruction (on x86
+this is an SSE2 scan for C2, C3, CA, CB and FF; other architectures try
+every offset), and each candidate is decoded to confirm it. The bytes
+before each terminator are then decoded at every offset; a gadget is a
+run of instructions, none of which is a branch, ending exactly at the
+terminator. Gadgets with identical bytes are reported once.
+
+For a Bfd::Target, every code section is searched; for a Bfd::Section or
+Bfd::Symbol, the section containing it. For other targets, the buffer is
+searched from the vma argument (default: the start of the buffer) to the
+end, or for length bytes. The args parameter may also contain:
+
+  depth:: The number of bytes searched before each terminator (default 16,
+          at most 64).
+  max_insns:: The maximum number of instructions in a gadget, including
+              the terminator (default 6, at most 32).
+  types:: An Array of the gadget types to find: 'ret', 'jmp' and 'call'
+          (default all).
+  threads:: The number of worker threads, or true for one per CPU. Each
+            worker decodes with its own copy of the Disassembler. Ignored
+            unless libopcodes is reentrant, as for ext_disassemble.
+
+The general args (arch, syntax, etc) are the same as for ext_disassemble.
+Decoder errors are expected and are not reported. A Ruby insn_decoder
+restricts the search to one thread.
+
+Returns an Array of Gadget objects, in order of VMA.
+=end
+    def ext_gadgets(target, args)
+    end
+
+=begin rdoc
+Prepare a Session for disassembling <i>target</i> repeatedly. The args
+parameter is the same as for ext_disassemble; it is parsed, and the target
+loaded, only once. The vma and length arguments become the defaults for
+each run of the Session.
+
+See Disassembler#prepare.
+=end
+    def ext_prepare(target, args)
+    end
+
 =begin rdoc
 Instantiate a new Disassembler object.
 
@@ -211,6 +406,9 @@ The args parameter is a Hash which can contain any of the following members:
             in dis-asm.h for details.
 
   arch:: The architecture to disassemble for.
+
+  cache_dir:: Directory in which to cache disassembly results. See
+              <i>cache_dir</i>.
 =end
     def initialize( args ) # :yields: disassembler
     end
@@ -229,14 +427,63 @@ object.
     def ext_usage( io )
     end
 
+=begin rdoc
+A target and disassembly configuration prepared by Disassembler#prepare.
+
+The arguments, strategy, syntax and callbacks are fixed when the Session is
+created; each run supplies only a vma and length. A Session may not be run
+by two threads at once. An IO::Buffer target is only locked during a run.
+=end
+  class Session
+
+=begin rdoc
+Disassemble <i>length</i> bytes at <i>vma</i> with the prepared strategy,
+returning an Opdis::Disassembly. A nil vma or length uses the value given
+to Disassembler#prepare. See Disassembler#ext_disassemble; with
+STRATEGY_FUNCTIONS, the function starts are collected anew for each run.
+=end
+    def ext_disassemble(vma, length) # :yields: instruction
+    end
+
+=begin rdoc
+Disassemble <i>length</i> bytes at <i>vma</i>, passing each instruction to
+the block without storing it. Returns the list of error messages 
+encountered. See Disassembler#ext_each_instruction.
+=end
+    def ext_each_instruction(vma, length) # :yields: instruction
+    end
+
+=begin rdoc
+Release the target. A closed Session cannot be run.
+=end
+    def close
+    end
+
+=begin rdoc
+Return true if the Session has been closed.
+=end
+    def closed?
+    end
+
+=begin rdoc
+The target passed to Disassembler#prepare.
+=end
+    def target
+    end
+
+  end
+
 =begin rdoc
 Disassembler output.
 
-This consists of a hash mapping VMA keys to Instruction objects. The Disassembly
-object also contains an internal array of error messages generated by the
-disassembler.
+This behaves like a Hash mapping VMA keys to Instruction objects. The 
+instructions are stored natively in an array sorted by VMA, and the Ruby
+Instruction objects are only created when they are accessed. Iteration is
+always in order of VMA. The Disassembly object also contains an internal array
+of error messages generated by the disassembler.
 =end
-  class Disassembly < Hash
+  class Disassembly
+    include Enumerable
 
 =begin rdoc
 An array of error messages encountered during disassembly.
@@ -244,10 +491,478 @@ An array of error messages encountered during disassembly.
     attr_reader :errors
 
 =begin rdoc
-Returns the Instruction object containing VMA.
+Returns the Instruction object containing VMA, or <i>false</i>. Only the
+nearest instruction at or before VMA is considered. This is a binary search
+of the instructions, which are kept sorted by VMA.
+=end
+    def containing(vma)
+    end
+
+=begin rdoc
+Returns an Array of the Instruction objects at VMAs from lo up to, but not
+including, hi, in order of VMA.
+=end
+    def range(lo, hi)
+    end
+
+=begin rdoc
+Yields each Instruction object at VMAs from lo up to, but not including, hi,
+in order of VMA. Returns an Enumerator if no block is given.
+=end
+    def each_between(lo, hi) # :yields: instruction
+    end
+
+=begin rdoc
+Returns the Instruction object at VMA, or <i>nil</i>.
+=end
+    def [](vma)
+    end
+
+=begin rdoc
+Store Instruction object at VMA.
+=end
+    def []=(vma, insn)
+    end
+
+=begin rdoc
+Remove the Instruction object at VMA. Returns the Instruction object or
+<i>nil</i>.
+=end
+    def delete(vma)
+    end
+
+=begin rdoc
+Yields [VMA, Instruction] pairs in order of VMA.
+=end
+    def each # :yields: vma, instruction
+    end
+
+=begin rdoc
+Yields each VMA in order.
+=end
+    def each_key # :yields: vma
+    end
+
+=begin rdoc
+Yields each Instruction object in order of VMA.
+=end
+    def each_value # :yields: instruction
+    end
+
+=begin rdoc
+Returns a sorted array of the VMAs of all instructions.
+=end
+    def keys
+    end
+
+=begin rdoc
+Returns an array of all Instruction objects in order of VMA.
+=end
+    def values
+    end
+
+=begin rdoc
+Returns the number of instructions in the Disassembly.
+=end
+    def length
+    end
+
+=begin rdoc
+Returns true if an instruction exists at VMA.
+=end
+    def key?(vma)
+    end
+
+=begin rdoc
+Returns a Hash of VMA => Instruction entries.
+=end
+    def to_h
+    end
+
+=begin rdoc
+Export the instructions as columns of packed binary Strings, one element
+per instruction in order of VMA. Integers are in native byte order. The
+columns are built from the native records without creating Instruction
+objects, so changes made to Instruction objects after they were stored are
+not reflected.
+
+Returns a Hash with the following members:
+
+  count:: The number of instructions.
+  vma:: u64 instruction addresses (String#unpack 'Q*').
+  size:: u8 instruction sizes (255 for larger instructions).
+  mnemonic:: u16 indexes into <i>mnemonics</i> ('S*').
+  mnemonics:: Array of the distinct mnemonics.
+  category:: u8 indexes into <i>categories</i> ('C*').
+  categories:: Array of category names; index 0 (unknown) is nil.
+  target:: u64 branch or reference targets, as returned by AddressResolver.
+           Instructions without a target have all bits set.
+
+If <i>names</i> is an Array of column names (e.g. [:vma, :target]), only
+those columns are built.
+=end
+    def columns(names=nil)
+    end
+
+=begin rdoc
+Returns the ControlFlowGraph of the instructions. Control flow strategies
+build the graph as part of disassembly, with the resolver used to follow
+branches; otherwise it is built from the instructions when first requested,
+using the default AddressResolver. Any change to the Disassembly discards
+the graph, and the next call builds a new one.
+=end
+    def cfg
+    end
+
+=begin rdoc
+Returns the XrefIndex of the instructions. It is built from the instructions
+when first requested, using the default AddressResolver to follow branches.
+Any change to the Disassembly discards the index, and the next call builds
+a new one.
+=end
+    def xrefs
+    end
+
+=begin rdoc
+Returns an Array of the Pattern::Match objects for the non-overlapping
+matches of <i>pattern</i>, which is a Pattern or a String to compile into
+one. See Pattern.
+=end
+    def scan(pattern)
+    end
+
+=begin rdoc
+Returns the FunctionTable built by STRATEGY_FUNCTIONS, or nil. The table is
+a snapshot: it is dropped, and this returns nil, once the Disassembly is
+modified.
+=end
+    def functions
+    end
+  end
+
+=begin rdoc
+The basic blocks of a Disassembly and the edges between them.
+
+A block is a run of adjacent instructions which is only entered at its first
+instruction and only left after its last. Blocks end at every branch,
+including calls, and at any instruction which is a branch target. Blocks are
+numbered in order of VMA.
+
+The graph is built natively from the stored instructions, and is stored as
+arrays of blocks and edges: Block and Edge objects are only created when
+requested. It is a snapshot; modifying the Disassembly does not update it
+(see Disassembly#cfg).
+
+  g = dis.disassemble( tgt, strategy: Opdis::Disassembler::STRATEGY_CFLOW ).cfg
+  g.each do |blk|
+    g.successors(blk.index).each { |e| puts "#{blk.start} #{e.type} #{e.target}" }
+  end
+=end
+  class ControlFlowGraph
+    include Enumerable
+
+=begin rdoc
+A basic block.
+
+  index:: The index of the block in the graph.
+  start:: The VMA of the first instruction.
+  end:: The VMA following the last instruction.
+  insns:: The Range of indexes of the block's instructions in the
+          Disassembly, in order of VMA.
+=end
+    Block = Struct.new(:index, :start, :end, :insns)
+
+=begin rdoc
+An edge from the last instruction of a block.
+
+  from:: The index of the source block.
+  to:: The index of the destination block, or nil if no block starts at
+       <i>target</i> (e.g. a call to code which was not disassembled).
+  target:: The VMA of the destination.
+  type:: :fallthrough, :jump, :cond (a conditional branch being taken) or
+         :call. A call which returns has a :fallthrough edge as well.
+=end
+    Edge = Struct.new(:from, :to, :target, :type)
+
+=begin rdoc
+Build the graph of the instructions in <i>disassembly</i>, using the default
+AddressResolver. If <i>entry</i> is given, a block starts at that VMA.
+=end
+    def initialize(disassembly, entry=nil)
+    end
+
+=begin rdoc
+The Disassembly the graph was built from.
+=end
+    attr_reader :disassembly
+
+=begin rdoc
+The VMA at which the control flow disassembly started, or nil.
+=end
+    attr_reader :entry
+
+=begin rdoc
+Returns the Block at <i>index</i>, or nil.
+=end
+    def [](index)
+    end
+
+=begin rdoc
+Returns the number of blocks.
+=end
+    def length
+    end
+
+=begin rdoc
+Yields each Block in order of VMA.
+=end
+    def each # :yields: block
+    end
+
+=begin rdoc
+Returns an Array of all blocks in order of VMA.
+=end
+    def blocks
+    end
+
+=begin rdoc
+Returns an Array of all edges, grouped by source block.
+=end
+    def edges
+    end
+
+=begin rdoc
+Returns the Block containing <i>vma</i>, or nil.
+=end
+    def block_at(vma)
+    end
+
+=begin rdoc
+Returns an Array of the edges leaving the block at <i>index</i>. A branch
+target comes before the fall-through.
+=end
+    def successors(index)
+    end
+
+=begin rdoc
+Returns an Array of the edges entering the block at <i>index</i>.
+=end
+    def predecessors(index)
+    end
+
+=begin rdoc
+Returns an Array of the Instruction objects in the block at <i>index</i>.
+=end
+    def instructions(index)
+    end
+  end
+
+=begin rdoc
+The functions found by STRATEGY_FUNCTIONS (see Disassembly#functions).
+
+A function is made up of the instructions reachable from its start without
+following calls and without entering another function; they need not be
+adjacent. Functions are claimed in order of start VMA, and each instruction
+belongs to at most one function.
+
+  fns = dis.disassemble( tgt, strategy: Opdis::Disassembler::STRATEGY_FUNCTIONS ).functions
+  fns.each { |f| puts "#{f.start} #{f.count} #{f.source}" }
+=end
+  class FunctionTable
+    include Enumerable
+
+=begin rdoc
+A function.
+
+  start:: The VMA of the function start.
+  end:: The VMA following the highest instruction in the function.
+  size:: The number of bytes of instructions in the function.
+  count:: The number of instructions in the function.
+  source:: How the start was found: :entry (the entry point), :symbol (a
+           function symbol), :given (the <i>functions</i> argument) or :call
+           (the target of a call).
+=end
+    Function = Struct.new(:start, :end, :size, :count, :source)
+
+=begin rdoc
+The Disassembly the table was built from.
+=end
+    attr_reader :disassembly
+
+=begin rdoc
+Returns the Function at <i>index</i>, or nil.
+=end
+    def [](index)
+    end
+
+=begin rdoc
+Returns the number of functions.
+=end
+    def length
+    end
+
+=begin rdoc
+Yields each Function in order of start VMA.
+=end
+    def each # :yields: function
+    end
+
+=begin rdoc
+Returns an Array of the start VMAs of all functions.
+=end
+    def starts
+    end
+
+=begin rdoc
+Returns the Function which the instruction at <i>vma</i> belongs to, or nil.
 =end
     def containing(vma)
     end
   end
 
+=begin rdoc
+The cross-references of a Disassembly: the addresses each instruction
+refers to, indexed by source and by target (see Disassembly#xrefs).
+
+Code references are the resolved targets of branches. Data references come
+from memory operands whose address does not depend on a register (an
+absolute address, or a displacement from the program counter), and from
+immediate operands which the decoder flags as addresses.
+
+The index is built natively from the stored instructions, and Xref objects
+are only created when requested.
+
+  x = dis.disassemble( tgt ).xrefs
+  x.xrefs_to( 0x8049f00 ).each { |r| puts "#{r.from} #{r.type}" }
+=end
+  class XrefIndex
+    include Enumerable
+
+=begin rdoc
+A reference.
+
+  from:: The VMA of the referring instruction.
+  to:: The referenced address.
+  type:: :call, :jump or :cond (a conditional branch) for code references;
+         :read or :write for memory operands; :addr for an immediate
+         address.
+=end
+    Xref = Struct.new(:from, :to, :type)
+
+=begin rdoc
+Build the index of the instructions in <i>disassembly</i>, using the default
+AddressResolver.
+=end
+    def initialize(disassembly)
+    end
+
+=begin rdoc
+The Disassembly the index was built from.
+=end
+    attr_reader :disassembly
+
+=begin rdoc
+Returns the number of references.
+=end
+    def length
+    end
+
+=begin rdoc
+Yields each Xref in order of source.
+=end
+    def each # :yields: xref
+    end
+
+=begin rdoc
+Returns an Array of the references to <i>addr</i>, which is an address or a
+Range of addresses, in order of target and then of source.
+=end
+    def xrefs_to(addr)
+    end
+
+=begin rdoc
+Returns an Array of the references made by the instruction at <i>addr</i>,
+which is an address or a Range of addresses, in order of source.
+=end
+    def xrefs_from(addr)
+    end
+  end
+
+=begin rdoc
+A pattern over a sequence of instructions, matched natively against the
+stored instructions of a Disassembly (see Disassembly#scan).
+
+A pattern is a list of instructions separated by ';'. Each instruction is
+a mnemonic, an optional list of operands separated by ',', and an optional
+repetition:
+
+  mnemonic:: A mnemonic (e.g. mov), a prefix ending in '*' (e.g. j*),
+             alternatives separated by '|' (e.g. jz|jnz), or '*' for any
+             instruction. Case is ignored. Without an operand list, the
+             operands are not examined.
+  operand:: One of:
+            * :: any operand.
+            ... :: any number of operands, including none.
+            reg :: any register.
+            eax, %eax :: the named register.
+            @name :: a register variable. Every use of the variable in a
+                     match refers to the same register.
+            imm :: any immediate.
+            16, 0x10, $0x10, -1 :: an immediate with the given value.
+            mem :: any memory operand.
+            [eax], [reg], [@name], [*] :: a memory operand with the given
+                                           base register.
+  repetition:: {n}, {n,m} or {n,} for n to m occurrences; '?' for {0,1};
+               '+' for {1,}. Open repetitions stop after 256 instructions.
+
+Operands are listed in the order of Instruction#operands, which follows
+the syntax of the Disassembler. Repetitions are greedy. A match only
+spans instructions which are adjacent in memory.
+
+  Opdis::Pattern.new( 'mov @r, imm; *{0,3}; call [@r]' )
+  Opdis::Pattern.new( 'xor* [@p], reg; inc @p; loop|jnz *' )
+  Opdis::Pattern.new( '* ..., 0x67452301, ...' )
+=end
+  class Pattern
+
+=begin rdoc
+A match.
+
+  start:: The VMA of the first instruction.
+  end:: The VMA following the last instruction.
+  insns:: The Range of indexes of the instructions in the Disassembly.
+  captures:: A Hash of variable name => register name.
+=end
+    Match = Struct.new(:start, :end, :insns, :captures)
+
+=begin rdoc
+Compile <i>source</i>. Raises ArgumentError if it is not a valid pattern.
+=end
+    def initialize(source)
+    end
+
+=begin rdoc
+The pattern source String.
+=end
+    attr_reader :source
+
+=begin rdoc
+Returns an Array of the matches in <i>disassembly</i>. See
+Disassembly#scan. Raises RuntimeError if a match attempt tests more than
+1,000,000 instructions, as nested repetitions can.
+=end
+    def scan(disassembly)
+    end
+  end
+
+=begin rdoc
+A gadget found by Disassembler#gadgets.
+
+  vma:: The lowest VMA at which the gadget occurs.
+  addresses:: An Array of every VMA at which the gadget occurs.
+  bytes:: The bytes of the gadget, as a String.
+  text:: The instructions of the gadget, separated by '; '.
+=end
+  Gadget = Struct.new(:vma, :addresses, :bytes, :text)
+
 end
@@ -14,6 +14,18 @@ VALUE Opdis_rb_hash_lookup2( VALUE hash, VALUE key, VALUE def ) {
 	return (v == Qnil) ? def : v;
 }
 
+int Opdis_rb_range_values( VALUE range, VALUE * beg, VALUE * end, 
+			   int * excl ) {
+	if (! rb_obj_is_kind_of(range, rb_cRange) ) {
+		return 0;
+	}
+
+	*beg = rb_funcall(range, rb_intern("begin"), 0);
+	*end = rb_funcall(range, rb_intern("end"), 0);
+	*excl = RTEST(rb_funcall(range, rb_intern("exclude_end?"), 0));
+	return 1;
+}
+
 #endif
 
 /* ---------------------------------------------------------------------- */
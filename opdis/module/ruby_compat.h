@@ -14,9 +14,14 @@
 #ifdef RUBY_18
 #include <stdarg.h>
 #define rb_str_new_cstr(arg) rb_str_new2(arg)
+#define rb_thread_check_ints() rb_thread_schedule()
+#define rb_set_errinfo(err) (ruby_errinfo = (err))
 
 VALUE Opdis_rb_hash_lookup2(VALUE, VALUE, VALUE);
 #define rb_hash_lookup2( a1, a2, a3 ) Opdis_rb_hash_lookup2(a1, a2, a3)
+
+int Opdis_rb_range_values(VALUE, VALUE *, VALUE *, int *);
+#define rb_range_values( a1, a2, a3, a4 ) Opdis_rb_range_values(a1, a2, a3, a4)
 #endif
 
 VALUE Opdis_path2class(const char * path);
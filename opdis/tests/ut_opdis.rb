@@ -5,6 +5,7 @@
 require 'test/unit'
 require 'rubygems'
 require 'Opdis'
+require 'tmpdir'
 
 class TC_OpdisModule < Test::Unit::TestCase
 
@@ -27,4 +28,487 @@ class TC_OpdisModule < Test::Unit::TestCase
       assert_equal( 'int3', ops[0].mnemonic )
     end
   end
+
+  def test_disassembly_hash_api
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 55 89 E5 C3 }) )
+      assert_equal( [0, 1, 3], ops.keys )
+      assert( ops.key?(1) )
+      assert_nil( ops[2] )
+      assert_equal( 'mov', ops.containing(2).mnemonic )
+      assert_equal( ops.keys, ops.collect { |vma, i| i.vma } )
+      assert_same( ops[3], ops.values.last )
+    end
+  end
+
+  def test_instruction_lazy_attrs
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      insn = dis.disassemble( hex_buf(%w{ E8 00 00 00 00 }) )[0]
+      assert( insn.branch? )
+      assert( insn.flags.include?(Opdis::Instruction::FLG_CALL) )
+      insn.mnemonic = 'nop'
+      assert_equal( 'nop', insn.mnemonic )
+      assert_same( insn.operands, insn.operands )
+      assert_equal( insn.operands[insn.tgt_idx], insn.target ) if insn.tgt_idx
+    end
+  end
+
+  def test_interned_strings
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 90 90 }) )
+      assert( ops[0].mnemonic.frozen? )
+      assert_same( ops[0].mnemonic, ops[1].mnemonic )
+      assert_same( ops[0].category, ops[1].category )
+    end
+  end
+
+  def test_buffer_targets
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 90 C3 })
+      assert_equal( 2, dis.disassemble( buf ).length )
+      assert_equal( 2, dis.disassemble( [0x90, 0xC3] ).length )
+      buf << 0xCC.chr
+      assert_equal( 3, dis.disassemble( buf ).length )
+      if defined? IO::Buffer
+        assert_equal( 2, dis.disassemble( IO::Buffer.for(buf[0,2]) ).length )
+      end
+    end
+  end
+
+  def test_file_target
+    require 'tempfile'
+    Tempfile.open('opdis') do |f|
+      f.write( hex_buf(%w{ CC 90 90 C3 }) )
+      f.flush
+      f.rewind
+      f.read(1)
+      Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+        ops = dis.disassemble( f )
+        assert_equal( 3, ops.length )
+        assert_equal( 'nop', ops[0].mnemonic )
+        assert( f.eof? )
+      end
+    end
+  end
+
+  def test_block_exception
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      count = 0
+      assert_raise( RuntimeError ) do
+        dis.disassemble( hex_buf(%w{ 90 90 90 }) ) { |i| count += 1; raise 'stop' }
+      end
+      assert_equal( 1, count )
+      assert_equal( 3, dis.disassemble( hex_buf(%w{ 90 90 90 }) ).length )
+    end
+  end
+
+  def test_parallel_linear
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf( %w{ 55 89 E5 B8 01 00 00 00 90 C3 } * 0x8000 )
+      serial = dis.disassemble( buf )
+      par = dis.disassemble( buf, :threads => 4 )
+      assert_equal( serial.keys, par.keys )
+      assert_equal( serial.values.last.mnemonic, par.values.last.mnemonic )
+    end
+  end
+
+  def test_parallel_cflow
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      # call +2; jmp +1; nop; nop; ret
+      buf = hex_buf( %w{ E8 02 00 00 00 EB 01 90 90 C3 } )
+      args = { :strategy => Opdis::Disassembler::STRATEGY_CFLOW }
+      serial = dis.disassemble( buf, args )
+      par = dis.disassemble( buf, args.merge(:threads => 4) )
+      assert_equal( serial.keys, par.keys )
+    end
+  end
+
+  def test_each_instruction
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 89 E5 C3 })
+      vmas = []
+      errors = dis.each_instruction( buf ) { |i| vmas << i.vma }
+      assert_equal( [0, 1, 3], vmas )
+      assert_equal( [], errors )
+      enum = dis.each_instruction( buf )
+      assert_equal( %w{ push mov ret }, enum.collect { |i| i.mnemonic } )
+    end
+  end
+
+  def test_gc_in_decoder
+    decoder = Class.new( Opdis::X86Decoder ) do
+      def decode( insn, ctx )
+        raise 'not a DecodeContext' if not ctx.kind_of? Opdis::DecodeContext
+        GC.start
+        super
+      end
+    end
+
+    Opdis::Disassembler.new( :arch => 'x86', 
+                             :insn_decoder => decoder.new ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 55 89 E5 C3 }) )
+      assert_equal( %w{ push mov ret }, ops.values.collect { |i| i.mnemonic } )
+    end
+  end
+
+  def test_decode_context
+    decoder = Class.new( Opdis::X86Decoder ) do
+      attr_reader :contexts, :bytes, :tails
+      def decode( insn, ctx )
+        (@contexts ||= []) << ctx
+        raise 'vma mismatch' if ctx[:vma] != ctx.vma or ctx['size'] != ctx.size
+        (@bytes ||= []) << ctx.buffer[ctx.offset]
+        (@tails ||= []) << ctx.buffer[ctx.offset, (1 << 63) - 1].length
+        super
+      end
+    end.new
+
+    Opdis::Disassembler.new( :arch => 'x86', 
+                             :insn_decoder => decoder ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 55 89 E5 C3 }) )
+      assert_equal( %w{ push mov ret }, ops.values.collect { |i| i.mnemonic } )
+    end
+    assert_equal( [0x55, 0x89, 0xC3], decoder.bytes )
+    assert_equal( [4, 3, 1], decoder.tails )
+    ctx = decoder.contexts.last
+    assert_equal( false, ctx.valid? )
+    assert_raise( RuntimeError ) { ctx.vma }
+  end
+
+  def test_prepare
+    buf = hex_buf(%w{ 55 89 E5 C3 90 C3 })
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      dis.prepare( buf, :strategy => Opdis::Disassembler::STRATEGY_CFLOW ) do |s|
+        ops = s.disassemble
+        assert_equal( %w{ push mov ret }, 
+                      ops.values.collect { |i| i.mnemonic } )
+        # a second run is not affected by addresses visited in the first
+        assert_equal( 3, s.disassemble(0).length )
+        assert_equal( [4, 5], s.each_instruction(4).collect { |i| i.vma } )
+      end
+
+      sess = dis.prepare( buf, :strategy => Opdis::Disassembler::STRATEGY_LINEAR,
+                          :length => 4 )
+      assert_equal( [0, 1, 3], sess.disassemble.keys )
+      assert_equal( [4, 5], sess.disassemble(4, 2).keys )
+      sess.close
+      assert( sess.closed? )
+      assert_raise( RuntimeError ) { sess.disassemble }
+
+      if defined? IO::Buffer
+        iobuf = IO::Buffer.for(buf)
+        sess = dis.prepare( iobuf )
+        assert( ! iobuf.locked? )
+        assert_equal( 2, sess.disassemble(4, 2).length )
+        assert( ! iobuf.locked? )
+        sess.close
+      end
+    end
+  end
+
+  def test_disassemble_batch
+    buf = hex_buf(%w{ 55 89 E5 C3 90 C3 })
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      outs = dis.disassemble_batch( [0...4, 4..5], :target => buf )
+      assert_equal( [[0, 1, 3], [4, 5]], outs.collect { |o| o.keys } )
+
+      other = hex_buf(%w{ 90 90 })
+      outs = dis.disassemble_batch( [ [buf, 4, 2], other ] )
+      assert_equal( [[4, 5], [0, 1]], outs.collect { |o| o.keys } )
+
+      ops = dis.disassemble_batch( [0...1, 4...5], :target => buf,
+                                   :combined => true )
+      assert_equal( %w{ push nop }, ops.values.collect { |i| i.mnemonic } )
+    end
+  end
+
+  def test_columns
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 55 89 E5 90 90 C3 }) )
+      cols = ops.columns
+      assert_equal( 5, cols[:count] )
+      assert_equal( [0, 1, 3, 4, 5], cols[:vma].unpack('Q*') )
+      assert_equal( [1, 2, 1, 1, 1], cols[:size].unpack('C*') )
+      assert_equal( %w{ push mov nop nop ret }, 
+                    cols[:mnemonic].unpack('S*').collect { |i| 
+                      cols[:mnemonics][i] } )
+      assert_equal( ops.values.collect { |i| i.category },
+                    cols[:category].unpack('C*').collect { |i| 
+                      cols[:categories][i] } )
+
+      cols = ops.columns( [:size] )
+      assert_equal( [:count, :size], cols.keys.sort_by { |k| k.to_s } )
+    end
+  end
+
+  def test_disassembly_ranges
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      ops = dis.disassemble( hex_buf(%w{ 55 89 E5 B8 01 00 00 00 C3 }) )
+      assert_equal( 3, ops.containing(5).vma )
+      assert_equal( 0, ops.containing(0).vma )
+      assert_equal( false, ops.containing(9) )
+      assert_equal( [1, 3], ops.range(1, 8).collect { |i| i.vma } )
+      assert_equal( [], ops.range(4, 8) )
+      assert_equal( %w{ mov ret }, 
+                    ops.each_between(2, 100).collect { |i| i.mnemonic } )
+    end
+  end
+
+  def test_builtin_callbacks
+    tracker = Opdis::VisitedAddressTracker.new
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 89 E5 C3 })
+      insn = dis.disassemble( buf )[0]
+      assert_equal( false, tracker.visited?(insn) )
+      assert_equal( true, tracker.visited?(insn) )
+
+      plain = Class.new( Opdis::X86Decoder )
+      ops = dis.disassemble( buf, :insn_decoder => plain.new,
+                             :resolver => Opdis::AddressResolver.new )
+      assert_equal( %w{ push mov ret }, ops.values.collect { |i| i.mnemonic } )
+
+      calls = 0
+      custom = Class.new( Opdis::X86Decoder ) do
+        define_method(:decode) { |i, h| calls += 1; super(i, h) }
+      end
+      dis.disassemble( buf, :insn_decoder => custom.new )
+      assert_equal( 3, calls )
+    end
+  end
+
+  def test_cache_dir
+    Dir.mktmpdir do |dir|
+      Opdis::Disassembler.new( :arch => 'x86', :cache_dir => dir ) do |dis|
+        assert_equal( dir, dis.cache_dir )
+        buf = hex_buf(%w{ 55 89 E5 B8 01 00 00 00 C3 })
+        first = dis.disassemble( buf )
+        assert_equal( 1, Dir.glob(File.join(dir, '*.opdc')).length )
+
+        yielded = []
+        second = dis.disassemble( buf ) { |i| yielded << i.vma }
+        assert_equal( first.keys, second.keys )
+        assert_equal( first.keys, yielded )
+        assert_equal( first.values.collect { |i| i.ascii },
+                      second.values.collect { |i| i.ascii } )
+        assert_equal( first.errors, second.errors )
+        assert_equal( 'mov', second[3].mnemonic )
+        assert_equal( first[3].operands.length, second[3].operands.length )
+
+        dis.disassemble( buf, :syntax => 'intel' )
+        assert_equal( 2, Dir.glob(File.join(dir, '*.opdc')).length )
+
+        dis.cache_dir = File.join(dir, 'a', 'b')
+        dis.disassemble( buf )
+        assert_equal( 1, Dir.glob(File.join(dir, 'a/b/*.opdc')).length )
+      end
+    end
+  end
+
+  def test_redisassemble
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 89 E5 90 90 90 C3 })
+      ops = dis.disassemble( buf )
+      buf[3, 2] = hex_buf(%w{ B0 01 })
+      added = []
+      assert_same( ops, dis.redisassemble( buf, ops, [3..4] ) { |i|
+                                            added << i.vma } )
+      assert_equal( [3], added )
+      assert_equal( dis.disassemble( buf ).keys, ops.keys )
+      assert_equal( %w{ push mov mov nop ret }, 
+                    ops.values.collect { |i| i.mnemonic } )
+
+      args = { :strategy => Opdis::Disassembler::STRATEGY_CFLOW }
+      buf = hex_buf(%w{ 55 89 E5 EB 01 90 C3 })
+      ops = dis.disassemble( buf, args )
+      assert_equal( [0, 1, 3, 6], ops.keys )
+      buf[4, 1] = hex_buf(%w{ 00 })
+      dis.redisassemble( buf, ops, [4], args )
+      assert_equal( [0, 1, 3, 5, 6], ops.keys )
+
+      assert_raise( TypeError ) { dis.redisassemble( buf, {}, [4] ) }
+    end
+  end
+
+  def test_cfg
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 74 02 EB 01 90 C3 })
+      ops = dis.disassemble( buf, 
+                             :strategy => Opdis::Disassembler::STRATEGY_CFLOW )
+      cfg = ops.cfg
+      assert_kind_of( Opdis::ControlFlowGraph, cfg )
+      assert_same( ops, cfg.disassembly )
+      assert_equal( 0, cfg.entry )
+      assert_equal( [0, 3, 5, 6], cfg.collect { |b| b.start } )
+      assert_equal( [3, 5, 6, 7], cfg.collect { |b| b.end } )
+      assert_equal( 0...2, cfg[0].insns )
+      assert_equal( [0, 1], cfg.instructions(0).collect { |i| i.vma } )
+      assert_equal( [[:cond, 2], [:fallthrough, 1]],
+                    cfg.successors(0).collect { |e| [e.type, e.to] } )
+      assert_equal( [[:jump, 3]],
+                    cfg.successors(1).collect { |e| [e.type, e.to] } )
+      assert_equal( [1, 2], cfg.predecessors(3).collect { |e| e.from }.sort )
+      assert_equal( 2, cfg.block_at(5).index )
+      assert_equal( 4, cfg.edges.length )
+
+      ops.delete(5)
+      assert_not_same( cfg, ops.cfg )
+      assert_equal( [0, 3, 6], ops.cfg.collect { |b| b.start } )
+      assert_nil( ops.cfg.successors(0).first.to )
+
+      # every run path attaches the graph of its start address
+      cflow = Opdis::Disassembler::STRATEGY_CFLOW
+      dis.prepare( buf, :strategy => cflow ) do |s|
+        assert_equal( 3, s.disassemble(3).cfg.entry )
+      end
+      outs = dis.disassemble_batch( [[buf, 3, nil]], :strategy => cflow )
+      assert_equal( 3, outs[0].cfg.entry )
+      ops = dis.disassemble_batch( [[buf, 3, nil], [buf, 0, nil]],
+                                   :strategy => cflow, :combined => true )
+      assert_equal( 3, ops.cfg.entry )
+    end
+
+    Dir.mktmpdir do |dir|
+      Opdis::Disassembler.new( :arch => 'x86', :cache_dir => dir ) do |dis|
+        buf = hex_buf(%w{ 55 74 02 EB 01 90 C3 })
+        args = { :strategy => Opdis::Disassembler::STRATEGY_CFLOW }
+        first = dis.disassemble( buf, args )
+        cached = dis.disassemble( buf, args )
+        assert_equal( 0, cached.cfg.entry )
+        assert_equal( first.cfg.collect { |b| b.start }, 
+                      cached.cfg.collect { |b| b.start } )
+      end
+    end
+  end
+
+  def test_functions
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 E8 02 00 00 00 C3 90 B0 01 C3 })
+      fns = dis.functions( buf )
+      assert_kind_of( Opdis::FunctionTable, fns )
+      assert_equal( [0, 8], fns.starts )
+      assert_equal( [:entry, :call], fns.collect { |f| f.source } )
+      assert_equal( [7, 7, 3], [fns[0].end, fns[0].size, fns[0].count] )
+      assert_equal( 8, fns.containing(10).start )
+      assert_nil( fns.containing(7) )
+
+      ops = dis.disasm_functions( buf, :functions => [7] )
+      assert_same( ops, ops.functions.disassembly )
+      assert_equal( [0, 7, 8], ops.functions.starts )
+      assert_equal( :given, ops.functions[1].source )
+      assert_equal( 1, ops.functions[1].count )
+      assert_nil( dis.disassemble( buf ).functions )
+      ops.delete(7)
+      assert_nil( ops.functions )
+
+      strat = Opdis::Disassembler::STRATEGY_FUNCTIONS
+      dis.prepare( buf, :strategy => strat ) do |s|
+        assert_equal( [0, 8], s.disassemble.functions.starts )
+      end
+      outs = dis.disassemble_batch( [buf], :strategy => strat )
+      assert_equal( [0, 8], outs[0].functions.starts )
+      ops = dis.disassemble_batch( [buf, [buf, 7, nil]], :strategy => strat,
+                                   :combined => true )
+      assert_equal( [0, 7, 8], ops.functions.starts )
+    end
+  end
+
+  def test_xrefs
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ E8 07 00 00 00 A1 00 20 00 00 74 F4 C3 })
+      ops = dis.disassemble( buf )
+      x = ops.xrefs
+      assert_kind_of( Opdis::XrefIndex, x )
+      assert_same( ops, x.disassembly )
+      assert_same( x, ops.xrefs )
+      assert_equal( [[0x0C, :call]], 
+                    x.xrefs_from(0).collect { |r| [r.to, r.type] } )
+      assert_equal( [[0x0A, :cond]], 
+                    x.xrefs_to(0).collect { |r| [r.from, r.type] } )
+      assert_equal( [5], x.xrefs_to(0x2000).collect { |r| r.from } )
+      assert_equal( [0x2000], x.xrefs_to(0x1000..0x3000).collect { |r| r.to } )
+      assert_equal( [], x.xrefs_from(0x0C) )
+
+      ops.delete(5)
+      assert_not_same( x, ops.xrefs )
+      assert_equal( [], ops.xrefs.xrefs_to(0x2000) )
+    end
+  end
+
+  def test_statistics
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 89 E5 90 90 C3 })
+      stats = dis.statistics( buf )
+      assert_equal( 5, stats[:count] )
+      assert_equal( 6, stats[:bytes] )
+      assert_equal( [], stats[:errors] )
+      assert_equal( 'nop', stats[:mnemonics].keys.first )
+
+      insns = dis.disassemble( buf ).values
+      mnems = Hash.new(0)
+      cats = Hash.new(0)
+      insns.each { |i| mnems[i.mnemonic] += 1; cats[i.category] += 1 }
+      assert_equal( mnems, stats[:mnemonics] )
+      assert_equal( cats, stats[:categories] )
+      assert_equal( 5, stats[:isa].values.inject(0) { |a, n| a + n } )
+
+      stats = dis.statistics( buf, :vma => 3, :length => 2 )
+      assert_equal( { 'nop' => 2 }, stats[:mnemonics] )
+    end
+  end
+
+  def test_pattern
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      buf = hex_buf(%w{ 55 89 E5 B8 01 00 00 00 FF D0 90 90 C3 })
+      ops = dis.disassemble( buf )
+
+      m = ops.scan( 'nop+' )
+      assert_equal( 1, m.length )
+      assert_equal( [10, 12, 5...7], [m[0].start, m[0].end, m[0].insns] )
+
+      assert_equal( [0], ops.scan( 'push reg; mov ...' ).collect { |x| 
+                                                             x.start } )
+      assert_equal( [3], ops.scan( 'mov ..., 1, ...' ).collect { |x| 
+                                                           x.start } )
+      assert_equal( { 'r' => 'ebp' }, ops.scan( 'push @r' )[0].captures )
+      assert_equal( [], ops.scan( 'push %esp' ) )
+      assert_equal( [0], ops.scan( 'push|pop *; *{2}; call' ).collect { |x| 
+                                                              x.start } )
+
+      pat = Opdis::Pattern.new( 'ret' )
+      assert_equal( 'ret', pat.source )
+      assert_equal( [12], pat.scan( ops ).collect { |x| x.start } )
+
+      assert_raise( ArgumentError ) { Opdis::Pattern.new( 'mov [eax' ) }
+      assert_raise( ArgumentError ) { ops.scan( 'nop?' ) }
+    end
+  end
+
+  def test_gadgets
+    Opdis::Disassembler.new( :arch => 'x86' ) do |dis|
+      # pop eax; pop ecx; ret; nop; pop eax; pop ecx; ret; jmp *eax
+      buf = hex_buf(%w{ 58 59 C3 90 58 59 C3 FF E0 })
+      gadgets = dis.gadgets( buf )
+
+      g = gadgets.find { |x| x.bytes == hex_buf(%w{ 58 59 C3 }) }
+      assert_not_nil( g )
+      assert_equal( 0, g.vma )
+      assert_equal( [0, 4], g.addresses )
+      assert_equal( 3, g.text.split('; ').length )
+
+      g = gadgets.find { |x| x.bytes == hex_buf(%w{ C3 }) }
+      assert_equal( [2, 6], g.addresses )
+      assert_equal( gadgets.collect { |x| x.vma }.sort, 
+                    gadgets.collect { |x| x.vma } )
+      assert( gadgets.any? { |x| x.bytes == hex_buf(%w{ FF E0 }) } )
+
+      rets = dis.gadgets( buf, :types => [:ret], :max_insns => 2 )
+      assert_equal( [1, 2], rets.collect { |x| x.vma } )
+      assert_equal( [1, 2], dis.gadgets( buf, :types => [:ret], 
+                                         :max_insns => 2, 
+                                         :threads => 2 ).collect { |x|
+                                                               x.vma } )
+
+      assert_raise( ArgumentError ) { dis.gadgets( buf, :types => [:int] ) }
+    end
+  end
 end